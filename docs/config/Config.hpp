@@ -4,6 +4,15 @@
 #include <string>
 #include <vector>
 
+// allow/deny entry: a CIDR ("10.0.0.0/8", "2001:db8::/32", "all") or a file
+// of them, one per line
+struct AccessRule {
+  bool allow;
+  bool fromFile;
+  std::string source;
+  AccessRule() : allow(false), fromFile(false) {}
+};
+
 struct RouteConfig {
   std::string path;                  // location path prefix
   std::string root;                  // filesystem root for this route
@@ -11,11 +20,56 @@ struct RouteConfig {
   std::string redirect;              // optional redirect target
   std::string index;                 // default file
   bool directoryListing;             // enable/disable autoindex
+  bool autoindexJson;                // JSON instead of HTML by default
+  bool autoindexStat;                // size/mtime columns
+  size_t autoindexLimit;             // entries per page; 0 = all
   bool uploadsEnabled;               // allow uploads
   std::string uploadPath;            // where to store uploads
+  unsigned long uploadMaxSize;       // PUT size cap; 0 = client_max_body_size
+  bool readahead;                    // advise sequential reads of files
+  unsigned long nocacheMinSize;      // transfers this large skip page cache
+  unsigned long uploadDirectMinSize;  // PUTs this large use O_DIRECT; 0 off
   std::string cgiExtension;          // e.g. .py
   std::string cgiInterpreter;        // e.g. /usr/bin/python3
-  RouteConfig() : directoryListing(false), uploadsEnabled(false) {}
+  std::string websocketBackend;      // Unix socket of a WebSocket app
+  bool embedded;                     // root names a compiled-in asset dir
+  bool stats;                        // serves the server's counters
+  bool coalesce;                     // share one CGI run among identical GETs
+  bool cache;                        // cache CGI responses (Cache-Control)
+  int cacheTtlSec;                   // TTL when the script sets no max-age
+  int cacheStaleSec;                 // default stale-while-revalidate window
+  std::vector<std::string> varyHeaders;  // split coalescing/cache keys
+  std::vector<AccessRule> access;        // client address allow/deny
+  std::string expires;       // static file lifetime ("30d", "max", "off")
+  std::string cacheControl;  // extra Cache-Control directives, comma list
+  bool immutableAssets;      // cache fingerprinted file names for a year
+  RouteConfig()
+      : directoryListing(false),
+        autoindexJson(false),
+        autoindexStat(true),
+        autoindexLimit(0),
+        uploadsEnabled(false),
+        uploadMaxSize(0),
+        readahead(false),
+        nocacheMinSize(0),
+        uploadDirectMinSize(0),
+        embedded(false),
+        stats(false),
+        coalesce(false),
+        cache(false),
+        cacheTtlSec(0),
+        cacheStaleSec(0),
+        immutableAssets(true) {}
+};
+
+// Server-level rewrite/return rule, evaluated before route matching.
+// Patterns: "=/exact", "/literal/prefix" (the rest of the path is $1) or
+// "^regex" (literals, ., [classes], (groups), |, *, +, ?, trailing $).
+struct RewriteRule {
+  std::string pattern;
+  std::string target;  // rewrite replacement, redirect URL or return body
+  int code;            // 0: internal rewrite; 3xx: redirect; else: return
+  RewriteRule() : code(0) {}
 };
 
 struct ServerConfig {
@@ -29,6 +83,26 @@ struct ServerConfig {
   int bodyTimeoutMs;    // time to receive full body
   int idleTimeoutMs;    // keep-alive idle timeout
   int cgiTimeoutMs;     // max CGI execution time
+  // TLS (listener speaks TLS when a certificate is configured)
+  std::string tlsCertificate;     // PEM chain
+  std::string tlsCertificateKey;  // PEM private key
+  bool tlsKtls;                   // try kernel TLS offload
+  size_t responseCacheSize;       // bytes of cached CGI responses
+  size_t zeroCopyMinSize;  // MSG_ZEROCOPY for shared sends this large; 0 off
+  std::string sharedCacheFile;  // shared static file cache segment; "" off
+  size_t sharedCacheSize;       // bytes, when the segment is created
+  std::string statsSegment;     // counters shared with other processes
+  bool perfCounters;            // sample hardware counters per request
+  std::string captureFile;      // JSON-lines request capture; "" off
+  size_t captureBodyLimit;      // request body bytes kept per record
+  // Per-virtual-host quotas; 0 = unlimited
+  size_t limitConnections;     // connections whose requests chose this host
+  size_t limitBuffered;        // bytes those connections hold in memory
+  size_t limitCgi;             // concurrent CGI processes
+  unsigned long limitRate;     // requests per second
+  unsigned long limitBurst;    // requests above the rate; 0 = limitRate
+  std::vector<RewriteRule> rewrites;  // in order; first match wins
+  std::vector<AccessRule> access;     // checked when a client connects
   std::vector<RouteConfig> routes;
   ServerConfig()
       : port(0),
@@ -36,7 +110,18 @@ struct ServerConfig {
         headerTimeoutMs(5000),
         bodyTimeoutMs(10000),
         idleTimeoutMs(15000),
-        cgiTimeoutMs(5000) {}
+        cgiTimeoutMs(5000),
+        tlsKtls(true),
+        responseCacheSize(16 * 1024 * 1024),
+        zeroCopyMinSize(0),
+        sharedCacheSize(64 * 1024 * 1024),
+        perfCounters(false),
+        captureBodyLimit(0),
+        limitConnections(0),
+        limitBuffered(0),
+        limitCgi(0),
+        limitRate(0),
+        limitBurst(0) {}
 };
 
 struct Config {
@@ -82,6 +82,109 @@ bool ConfigParser::ParseLine(const std::string &line, Config &out,
     if (!currentServer || tokens.size() < 2) return false;
     currentServer->cgiTimeoutMs = std::atoi(tokens[1].c_str());
     return true;
+  } else if (tokens[0] == "response_cache_size") {
+    if (!currentServer || tokens.size() < 2) return false;
+    currentServer->responseCacheSize = (size_t)std::atoi(tokens[1].c_str());
+    return true;
+  } else if (tokens[0] == "zerocopy_min_size") {
+    if (!currentServer || tokens.size() < 2) return false;
+    currentServer->zeroCopyMinSize = (size_t)std::atoi(tokens[1].c_str());
+    return true;
+  } else if (tokens[0] == "shared_cache") {
+    if (!currentServer || tokens.size() < 2) return false;
+    currentServer->sharedCacheFile = tokens[1];
+    if (tokens.size() > 2)
+      currentServer->sharedCacheSize =
+          (size_t)std::strtoul(tokens[2].c_str(), 0, 10);
+    return true;
+  } else if (tokens[0] == "capture") {
+    if (!currentServer || tokens.size() < 2) return false;
+    currentServer->captureFile = tokens[1];
+    if (tokens.size() > 2)
+      currentServer->captureBodyLimit =
+          (size_t)std::strtoul(tokens[2].c_str(), 0, 10);
+    return true;
+  } else if (tokens[0] == "limit_connections") {
+    if (!currentServer || tokens.size() < 2) return false;
+    currentServer->limitConnections = (size_t)std::atoi(tokens[1].c_str());
+    return true;
+  } else if (tokens[0] == "limit_buffered") {
+    if (!currentServer || tokens.size() < 2) return false;
+    currentServer->limitBuffered =
+        (size_t)std::strtoul(tokens[1].c_str(), 0, 10);
+    return true;
+  } else if (tokens[0] == "limit_cgi") {
+    if (!currentServer || tokens.size() < 2) return false;
+    currentServer->limitCgi = (size_t)std::atoi(tokens[1].c_str());
+    return true;
+  } else if (tokens[0] == "limit_rate") {
+    if (!currentServer || tokens.size() < 2) return false;
+    currentServer->limitRate = std::strtoul(tokens[1].c_str(), 0, 10);
+    if (tokens.size() > 2)
+      currentServer->limitBurst = std::strtoul(tokens[2].c_str(), 0, 10);
+    return true;
+  } else if (tokens[0] == "stats_segment") {
+    if (!currentServer || tokens.size() < 2) return false;
+    currentServer->statsSegment = tokens[1];
+    return true;
+  } else if (tokens[0] == "perf_counters") {
+    if (!currentServer || tokens.size() < 2) return false;
+    currentServer->perfCounters =
+        tokens[1] == "on" || tokens[1] == "1" || tokens[1] == "true";
+    return true;
+  } else if (tokens[0] == "tls_certificate") {
+    if (!currentServer || tokens.size() < 2) return false;
+    currentServer->tlsCertificate = tokens[1];
+    return true;
+  } else if (tokens[0] == "tls_certificate_key") {
+    if (!currentServer || tokens.size() < 2) return false;
+    currentServer->tlsCertificateKey = tokens[1];
+    return true;
+  } else if (tokens[0] == "tls_ktls") {
+    if (!currentServer || tokens.size() < 2) return false;
+    currentServer->tlsKtls =
+        tokens[1] == "on" || tokens[1] == "1" || tokens[1] == "true";
+    return true;
+  } else if (tokens[0] == "allow" || tokens[0] == "deny" ||
+             tokens[0] == "allow_file" || tokens[0] == "deny_file") {
+    if (!currentServer || tokens.size() < 2) return false;
+    for (size_t i = 1; i < tokens.size(); ++i) {
+      AccessRule rule;
+      rule.allow = tokens[0][0] == 'a';
+      rule.fromFile = tokens[0].find("_file") != std::string::npos;
+      rule.source = tokens[i];
+      currentServer->access.push_back(rule);
+    }
+    return true;
+  } else if (tokens[0] == "rewrite") {
+    // rewrite <pattern> <replacement> [last|break|redirect|permanent]
+    if (!currentServer || tokens.size() < 3) return false;
+    RewriteRule rule;
+    rule.pattern = tokens[1];
+    rule.target = tokens[2];
+    if (tokens.size() > 3) {
+      if (tokens[3] == "redirect")
+        rule.code = 302;
+      else if (tokens[3] == "permanent")
+        rule.code = 301;
+      else if (tokens[3] != "last" && tokens[3] != "break")
+        return false;
+    }
+    currentServer->rewrites.push_back(rule);
+    return true;
+  } else if (tokens[0] == "return") {
+    // return <pattern> <code> [URL for 3xx | body text]
+    if (!currentServer || tokens.size() < 3) return false;
+    RewriteRule rule;
+    rule.pattern = tokens[1];
+    rule.code = std::atoi(tokens[2].c_str());
+    if (rule.code < 200 || rule.code > 599) return false;
+    for (size_t i = 3; i < tokens.size(); ++i) {
+      if (i > 3) rule.target += ' ';
+      rule.target += tokens[i];
+    }
+    currentServer->rewrites.push_back(rule);
+    return true;
   } else if (tokens[0] == "route") {
     if (!currentServer || tokens.size() < 3) return false;
     RouteConfig rc;
@@ -109,15 +212,72 @@ bool ConfigParser::ParseLine(const std::string &line, Config &out,
           rc.uploadsEnabled = true;
       } else if (key == "upload_path") {
         rc.uploadPath = val;
+      } else if (key == "upload_max_size") {
+        rc.uploadMaxSize = std::strtoul(val.c_str(), 0, 10);
+      } else if (key == "readahead") {
+        if (val == "on" || val == "1" || val == "true") rc.readahead = true;
+      } else if (key == "nocache_min_size") {
+        rc.nocacheMinSize = std::strtoul(val.c_str(), 0, 10);
+      } else if (key == "upload_direct_min_size") {
+        rc.uploadDirectMinSize = std::strtoul(val.c_str(), 0, 10);
       } else if (key == "autoindex") {
         if (val == "on" || val == "1" || val == "true")
           rc.directoryListing = true;
+      } else if (key == "autoindex_format") {
+        rc.autoindexJson = val == "json";
+      } else if (key == "autoindex_stat") {
+        rc.autoindexStat = !(val == "off" || val == "0" || val == "false");
+      } else if (key == "autoindex_limit") {
+        rc.autoindexLimit = (size_t)std::atoi(val.c_str());
       } else if (key == "redirect") {
         rc.redirect = val;
       } else if (key == "cgi_ext") {
         rc.cgiExtension = val;
       } else if (key == "cgi_bin") {
         rc.cgiInterpreter = val;
+      } else if (key == "websocket") {
+        rc.websocketBackend = val;
+      } else if (key == "embedded") {
+        if (val == "on" || val == "1" || val == "true") rc.embedded = true;
+      } else if (key == "stats") {
+        if (val == "on" || val == "1" || val == "true") rc.stats = true;
+      } else if (key == "coalesce") {
+        if (val == "on" || val == "1" || val == "true") rc.coalesce = true;
+      } else if (key == "cache") {
+        if (val == "on" || val == "1" || val == "true") rc.cache = true;
+      } else if (key == "cache_ttl") {
+        rc.cacheTtlSec = std::atoi(val.c_str());
+      } else if (key == "cache_swr") {
+        rc.cacheStaleSec = std::atoi(val.c_str());
+      } else if (key == "expires") {
+        rc.expires = val;
+      } else if (key == "cache_control") {
+        rc.cacheControl = val;
+      } else if (key == "immutable") {
+        rc.immutableAssets = !(val == "off" || val == "0" || val == "false");
+      } else if (key == "allow" || key == "deny" || key == "allow_file" ||
+                 key == "deny_file") {
+        // comma separated
+        size_t start = 0;
+        while (start < val.size()) {
+          size_t comma = val.find(',', start);
+          if (comma == std::string::npos) comma = val.size();
+          AccessRule rule;
+          rule.allow = key[0] == 'a';
+          rule.fromFile = key.find("_file") != std::string::npos;
+          rule.source = val.substr(start, comma - start);
+          rc.access.push_back(rule);
+          start = comma + 1;
+        }
+      } else if (key == "vary") {
+        // comma separated header names
+        size_t start = 0;
+        while (start < val.size()) {
+          size_t comma = val.find(',', start);
+          if (comma == std::string::npos) comma = val.size();
+          rc.varyHeaders.push_back(val.substr(start, comma - start));
+          start = comma + 1;
+        }
       }
     }
     currentServer->routes.push_back(rc);
@@ -0,0 +1,452 @@
+#include "http/Hpack.hpp"
+
+namespace {
+
+struct StaticEntry {
+  const char *name;
+  const char *value;
+};
+
+// RFC 7541 Appendix A
+const StaticEntry kStaticTable[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+const size_t kStaticCount = sizeof(kStaticTable) / sizeof(kStaticTable[0]);
+
+struct HuffmanCode {
+  unsigned long code;
+  unsigned char bits;
+};
+
+// RFC 7541 Appendix B, indexed by symbol; entry 256 is EOS
+const HuffmanCode kHuffmanCodes[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+    {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+    {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+    {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+    {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+    {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+    {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+    {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+    {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+    {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+    {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+    {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+    {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+    {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+    {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+    {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+    {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+    {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+    {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+    {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+    {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+    {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+    {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+    {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+    {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+    {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+    {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+    {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+    {0x3fffffff, 30},
+};
+
+const size_t kEntryOverhead = 32;
+const size_t kDefaultTableSize = 4096;
+
+// Binary decoding tree built from kHuffmanCodes on first use. Leaves hold
+// symbol + 1 in the negative range so 0 can mean "no child yet".
+struct HuffmanNode {
+  int child[2];
+};
+
+const std::vector<HuffmanNode> &huffmanTree() {
+  static std::vector<HuffmanNode> tree;
+  if (!tree.empty()) return tree;
+  HuffmanNode root = {{0, 0}};
+  tree.push_back(root);
+  for (int sym = 0; sym < 257; ++sym) {
+    size_t node = 0;
+    for (int b = kHuffmanCodes[sym].bits - 1; b >= 0; --b) {
+      int bit = (int)((kHuffmanCodes[sym].code >> b) & 1);
+      if (b == 0) {
+        tree[node].child[bit] = -(sym + 1);
+      } else {
+        if (tree[node].child[bit] <= 0) {
+          HuffmanNode n = {{0, 0}};
+          tree.push_back(n);
+          tree[node].child[bit] = (int)(tree.size() - 1);
+        }
+        node = (size_t)tree[node].child[bit];
+      }
+    }
+  }
+  return tree;
+}
+
+bool huffmanDecode(const char *p, size_t len, std::string &out) {
+  const std::vector<HuffmanNode> &tree = huffmanTree();
+  size_t node = 0;
+  int pending = 0;       // bits consumed since the last emitted symbol
+  bool allOnes = true;   // padding must be a prefix of EOS (all ones)
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char c = (unsigned char)p[i];
+    for (int b = 7; b >= 0; --b) {
+      int bit = (c >> b) & 1;
+      int next = tree[node].child[bit];
+      ++pending;
+      if (!bit) allOnes = false;
+      if (next < 0) {
+        int sym = -next - 1;
+        if (sym == 256) return false;  // EOS inside a string is an error
+        out += (char)sym;
+        node = 0;
+        pending = 0;
+        allOnes = true;
+      } else if (next == 0) {
+        return false;
+      } else {
+        node = (size_t)next;
+      }
+    }
+  }
+  return pending <= 7 && allOnes;
+}
+
+size_t huffmanLength(const std::string &s) {
+  unsigned long bits = 0;
+  for (size_t i = 0; i < s.size(); ++i)
+    bits += kHuffmanCodes[(unsigned char)s[i]].bits;
+  return (size_t)((bits + 7) / 8);
+}
+
+void huffmanEncode(const std::string &s, std::string &out) {
+  unsigned long acc = 0;  // holds at most 7 + 30 bits
+  int accBits = 0;
+  for (size_t i = 0; i < s.size(); ++i) {
+    const HuffmanCode &hc = kHuffmanCodes[(unsigned char)s[i]];
+    acc = (acc << hc.bits) | hc.code;
+    accBits += hc.bits;
+    while (accBits >= 8) {
+      accBits -= 8;
+      out += (char)((acc >> accBits) & 0xff);
+    }
+    acc &= (1UL << accBits) - 1;
+  }
+  if (accBits > 0)
+    out += (char)(((acc << (8 - accBits)) | (0xff >> accBits)) & 0xff);
+}
+
+// Integer representation (RFC 7541 section 5.1)
+bool decodeInt(const std::string &in, size_t &pos, int prefixBits,
+               size_t &value) {
+  if (pos >= in.size()) return false;
+  size_t max = (1u << prefixBits) - 1;
+  value = (unsigned char)in[pos++] & max;
+  if (value < max) return true;
+  int shift = 0;
+  for (;;) {
+    if (pos >= in.size() || shift > 21) return false;  // cap at ~2^28
+    unsigned char b = (unsigned char)in[pos++];
+    value += (size_t)(b & 0x7f) << shift;
+    shift += 7;
+    if (!(b & 0x80)) return true;
+  }
+}
+
+void encodeInt(size_t value, int prefixBits, unsigned char firstByteFlags,
+               std::string &out) {
+  size_t max = (1u << prefixBits) - 1;
+  if (value < max) {
+    out += (char)(firstByteFlags | value);
+    return;
+  }
+  out += (char)(firstByteFlags | max);
+  value -= max;
+  while (value >= 128) {
+    out += (char)((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  out += (char)value;
+}
+
+bool decodeString(const std::string &in, size_t &pos, std::string &out) {
+  if (pos >= in.size()) return false;
+  bool huffman = ((unsigned char)in[pos] & 0x80) != 0;
+  size_t len;
+  if (!decodeInt(in, pos, 7, len)) return false;
+  if (len > in.size() - pos) return false;
+  out.clear();
+  if (huffman) {
+    if (!huffmanDecode(in.data() + pos, len, out)) return false;
+  } else {
+    out.assign(in, pos, len);
+  }
+  pos += len;
+  return true;
+}
+
+void encodeString(const std::string &s, std::string &out) {
+  size_t hlen = huffmanLength(s);
+  if (hlen < s.size()) {
+    encodeInt(hlen, 7, 0x80, out);
+    huffmanEncode(s, out);
+  } else {
+    encodeInt(s.size(), 7, 0x00, out);
+    out += s;
+  }
+}
+
+// Fields whose values rarely repeat, or must not be cached by intermediaries
+bool neverIndex(const std::string &name) {
+  return name == "authorization" || name == "set-cookie" ||
+         name == "cookie" || name == "content-length" || name == "date" ||
+         name == "etag" || name == "last-modified" || name == "location";
+}
+
+}  // namespace
+
+HpackTable::HpackTable() : m_size(0), m_maxSize(kDefaultTableSize) {}
+
+void HpackTable::SetMaxSize(size_t maxSize) {
+  m_maxSize = maxSize;
+  EvictTo(m_maxSize);
+}
+
+void HpackTable::Add(const std::string &name, const std::string &value) {
+  size_t entrySize = name.size() + value.size() + kEntryOverhead;
+  if (entrySize > m_maxSize) {
+    // An oversized entry empties the table (RFC 7541 section 4.4)
+    EvictTo(0);
+    return;
+  }
+  EvictTo(m_maxSize - entrySize);
+  HttpHeader h;
+  h.name = name;
+  h.value = value;
+  m_entries.push_front(h);
+  m_size += entrySize;
+}
+
+bool HpackTable::Lookup(size_t index, std::string &name,
+                        std::string &value) const {
+  if (index == 0) return false;
+  if (index <= kStaticCount) {
+    name = kStaticTable[index - 1].name;
+    value = kStaticTable[index - 1].value;
+    return true;
+  }
+  index -= kStaticCount + 1;
+  if (index >= m_entries.size()) return false;
+  name = m_entries[index].name;
+  value = m_entries[index].value;
+  return true;
+}
+
+size_t HpackTable::Find(const std::string &name, const std::string &value,
+                        bool &exact) const {
+  size_t nameMatch = 0;
+  exact = false;
+  for (size_t i = 0; i < kStaticCount; ++i) {
+    if (name != kStaticTable[i].name) continue;
+    if (value == kStaticTable[i].value) {
+      exact = true;
+      return i + 1;
+    }
+    if (!nameMatch) nameMatch = i + 1;
+  }
+  for (size_t i = 0; i < m_entries.size(); ++i) {
+    if (m_entries[i].name != name) continue;
+    if (m_entries[i].value == value) {
+      exact = true;
+      return kStaticCount + 1 + i;
+    }
+    if (!nameMatch) nameMatch = kStaticCount + 1 + i;
+  }
+  return nameMatch;
+}
+
+void HpackTable::EvictTo(size_t limit) {
+  while (m_size > limit && !m_entries.empty()) {
+    const HttpHeader &old = m_entries.back();
+    m_size -= old.name.size() + old.value.size() + kEntryOverhead;
+    m_entries.pop_back();
+  }
+}
+
+HpackDecoder::HpackDecoder() : m_settingsMax(kDefaultTableSize) {}
+
+void HpackDecoder::SetMaxTableSize(size_t maxSize) {
+  m_settingsMax = maxSize;
+  if (m_table.MaxSize() > maxSize) m_table.SetMaxSize(maxSize);
+}
+
+bool HpackDecoder::Decode(const std::string &block,
+                          std::vector<HttpHeader> &out) {
+  size_t pos = 0;
+  bool sawField = false;
+  while (pos < block.size()) {
+    unsigned char b = (unsigned char)block[pos];
+    HttpHeader h;
+    if (b & 0x80) {
+      // Indexed header field
+      size_t index;
+      if (!decodeInt(block, pos, 7, index)) return false;
+      if (!m_table.Lookup(index, h.name, h.value)) return false;
+    } else if ((b & 0xe0) == 0x20) {
+      // Dynamic table size update: only allowed before the first field
+      size_t size;
+      if (sawField || !decodeInt(block, pos, 5, size)) return false;
+      if (size > m_settingsMax) return false;
+      m_table.SetMaxSize(size);
+      continue;
+    } else {
+      // Literal: 01 = incremental indexing, 0000 = without, 0001 = never
+      bool incremental = (b & 0xc0) == 0x40;
+      size_t index;
+      if (!decodeInt(block, pos, incremental ? 6 : 4, index)) return false;
+      if (index) {
+        std::string ignored;
+        if (!m_table.Lookup(index, h.name, ignored)) return false;
+      } else if (!decodeString(block, pos, h.name)) {
+        return false;
+      }
+      if (!decodeString(block, pos, h.value)) return false;
+      if (incremental) m_table.Add(h.name, h.value);
+    }
+    sawField = true;
+    out.push_back(h);
+  }
+  return true;
+}
+
+HpackEncoder::HpackEncoder() : m_sizeUpdatePending(false) {}
+
+void HpackEncoder::SetMaxTableSize(size_t maxSize) {
+  // Never grow beyond the default; a smaller table only costs ratio
+  if (maxSize > kDefaultTableSize) maxSize = kDefaultTableSize;
+  if (maxSize == m_table.MaxSize()) return;
+  m_table.SetMaxSize(maxSize);
+  m_sizeUpdatePending = true;
+}
+
+void HpackEncoder::Encode(const std::vector<HttpHeader> &headers,
+                          std::string &out) {
+  if (m_sizeUpdatePending) {
+    encodeInt(m_table.MaxSize(), 5, 0x20, out);
+    m_sizeUpdatePending = false;
+  }
+  for (size_t i = 0; i < headers.size(); ++i) {
+    const HttpHeader &h = headers[i];
+    bool exact = false;
+    size_t index = m_table.Find(h.name, h.value, exact);
+    if (exact) {
+      encodeInt(index, 7, 0x80, out);
+      continue;
+    }
+    bool never = neverIndex(h.name);
+    if (never)
+      encodeInt(index, 4, 0x10, out);
+    else
+      encodeInt(index, 6, 0x40, out);
+    if (!index) encodeString(h.name, out);
+    encodeString(h.value, out);
+    if (!never) m_table.Add(h.name, h.value);
+  }
+}
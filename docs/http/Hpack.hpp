@@ -0,0 +1,61 @@
+// HPACK header compression for HTTP/2 (RFC 7541)
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "http/HttpRequest.hpp"
+
+// Dynamic table (RFC 7541 section 2.3.2). Entries are kept newest first, so
+// m_entries[0] is HPACK index 62. Lookup/Find cover the static table too.
+class HpackTable {
+ public:
+  HpackTable();
+
+  void SetMaxSize(size_t maxSize);
+  size_t MaxSize() const { return m_maxSize; }
+  void Add(const std::string &name, const std::string &value);
+
+  // Resolve a 1-based index spanning static + dynamic entries
+  bool Lookup(size_t index, std::string &name, std::string &value) const;
+  // Best match for a field: returns 0 if the name is unknown, sets exact when
+  // the value matched as well
+  size_t Find(const std::string &name, const std::string &value,
+              bool &exact) const;
+
+ private:
+  void EvictTo(size_t limit);
+
+  std::deque<HttpHeader> m_entries;
+  size_t m_size;  // RFC size: sum of name + value + 32 per entry
+  size_t m_maxSize;
+};
+
+class HpackDecoder {
+ public:
+  HpackDecoder();
+
+  // Ceiling for dynamic table size updates (our SETTINGS_HEADER_TABLE_SIZE)
+  void SetMaxTableSize(size_t maxSize);
+  // Decode a complete header block; false means COMPRESSION_ERROR
+  bool Decode(const std::string &block, std::vector<HttpHeader> &out);
+
+ private:
+  HpackTable m_table;
+  size_t m_settingsMax;
+};
+
+class HpackEncoder {
+ public:
+  HpackEncoder();
+
+  // Apply the peer's SETTINGS_HEADER_TABLE_SIZE; signalled in the next block
+  void SetMaxTableSize(size_t maxSize);
+  // Names must already be lowercase
+  void Encode(const std::vector<HttpHeader> &headers, std::string &out);
+
+ private:
+  HpackTable m_table;
+  bool m_sizeUpdatePending;
+};
@@ -0,0 +1,648 @@
+#include "http/Http2Session.hpp"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#include "http/Uri.hpp"
+
+namespace {
+
+const char kPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+const size_t kPrefaceLen = sizeof(kPreface) - 1;
+
+// Frame types (RFC 9113 section 6)
+enum {
+  kFrameData = 0x0,
+  kFrameHeaders = 0x1,
+  kFramePriority = 0x2,
+  kFrameRstStream = 0x3,
+  kFrameSettings = 0x4,
+  kFramePushPromise = 0x5,
+  kFramePing = 0x6,
+  kFrameGoAway = 0x7,
+  kFrameWindowUpdate = 0x8,
+  kFrameContinuation = 0x9
+};
+
+// Frame flags
+const unsigned char kFlagEndStream = 0x1;
+const unsigned char kFlagAck = 0x1;
+const unsigned char kFlagEndHeaders = 0x4;
+const unsigned char kFlagPadded = 0x8;
+const unsigned char kFlagPriority = 0x20;
+
+// Error codes (RFC 9113 section 7)
+enum {
+  kNoError = 0x0,
+  kProtocolError = 0x1,
+  kFlowControlError = 0x3,
+  kStreamClosed = 0x5,
+  kFrameSizeError = 0x6,
+  kRefusedStream = 0x7,
+  kCompressionError = 0x9
+};
+
+// SETTINGS identifiers
+enum {
+  kSettingsHeaderTableSize = 0x1,
+  kSettingsEnablePush = 0x2,
+  kSettingsMaxConcurrentStreams = 0x3,
+  kSettingsInitialWindowSize = 0x4,
+  kSettingsMaxFrameSize = 0x5
+};
+
+const size_t kFrameHeaderLen = 9;
+const size_t kOurMaxFrame = 16384;  // we never advertise a larger size
+const uint32_t kMaxConcurrentStreams = 100;
+const size_t kMaxHeaderBlock = 65536;
+const long kMaxWindow = 0x7fffffffL;
+
+uint32_t readU32(const std::string &s, size_t pos) {
+  return ((uint32_t)(unsigned char)s[pos] << 24) |
+         ((uint32_t)(unsigned char)s[pos + 1] << 16) |
+         ((uint32_t)(unsigned char)s[pos + 2] << 8) |
+         (uint32_t)(unsigned char)s[pos + 3];
+}
+
+void appendU32(std::string &out, uint32_t v) {
+  out += (char)((v >> 24) & 0xff);
+  out += (char)((v >> 16) & 0xff);
+  out += (char)((v >> 8) & 0xff);
+  out += (char)(v & 0xff);
+}
+
+// HTTP2-Settings carries a base64url SETTINGS payload without padding
+bool decodeBase64Url(const std::string &in, std::string &out) {
+  unsigned long acc = 0;
+  int bits = 0;
+  for (size_t i = 0; i < in.size(); ++i) {
+    char c = in[i];
+    int v;
+    if (c >= 'A' && c <= 'Z')
+      v = c - 'A';
+    else if (c >= 'a' && c <= 'z')
+      v = c - 'a' + 26;
+    else if (c >= '0' && c <= '9')
+      v = c - '0' + 52;
+    else if (c == '-' || c == '+')
+      v = 62;
+    else if (c == '_' || c == '/')
+      v = 63;
+    else if (c == '=')
+      break;
+    else
+      return false;
+    acc = (acc << 6) | (unsigned long)v;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      out += (char)((acc >> bits) & 0xff);
+    }
+  }
+  return true;
+}
+
+std::string toLower(const std::string &s) {
+  std::string r = s;
+  for (size_t i = 0; i < r.size(); ++i)
+    r[i] = (char)std::tolower((unsigned char)r[i]);
+  return r;
+}
+
+// Connection-specific fields are forbidden in HTTP/2 (RFC 9113 8.2.2)
+bool isConnectionHeader(const std::string &lowerName) {
+  return lowerName == "connection" || lowerName == "keep-alive" ||
+         lowerName == "proxy-connection" || lowerName == "transfer-encoding" ||
+         lowerName == "upgrade";
+}
+
+}  // namespace
+
+Http2Session::Http2Session(size_t maxBodySize)
+    : m_prefaceDone(false),
+      m_goAwaySent(false),
+      m_goAwayReceived(false),
+      m_lastStreamId(0),
+      m_continuationStream(0),
+      m_continuationEnd(false),
+      m_connSendWindow(65535),
+      m_peerInitialWindow(65535),
+      m_peerMaxFrame(16384),
+      m_maxBodySize(maxBodySize) {
+  // Server connection preface: our SETTINGS must be the first frame
+  std::string settings;
+  settings += (char)0;
+  settings += (char)kSettingsMaxConcurrentStreams;
+  appendU32(settings, kMaxConcurrentStreams);
+  WriteFrame(m_control, kFrameSettings, 0, 0, settings);
+}
+
+int Http2Session::MatchPreface(const std::string &buf) {
+  size_t n = buf.size() < kPrefaceLen ? buf.size() : kPrefaceLen;
+  if (buf.compare(0, n, kPreface, n) != 0) return -1;
+  return n == kPrefaceLen ? 1 : 0;
+}
+
+bool Http2Session::StartUpgrade(const std::string &settingsHeader,
+                                const HttpRequest &req) {
+  std::string payload;
+  if (!decodeBase64Url(settingsHeader, payload) || payload.size() % 6 != 0)
+    return false;
+  if (!ApplySettings(payload)) return false;
+  Http2Stream &s = m_streams[1];
+  s.m_id = 1;
+  s.m_request = req;
+  s.m_remoteClosed = true;
+  s.m_sendWindow = m_peerInitialWindow;
+  m_lastStreamId = 1;
+  m_ready.push_back(1);
+  return true;
+}
+
+bool Http2Session::Feed(std::string &in) {
+  if (m_goAwaySent && !m_control.empty()) return false;
+  if (!m_prefaceDone) {
+    int match = MatchPreface(in);
+    if (match < 0) return ConnectionError(kProtocolError);
+    if (match == 0) return true;
+    in.erase(0, kPrefaceLen);
+    m_prefaceDone = true;
+  }
+  size_t pos = 0;
+  bool ok = true;
+  while (ok && in.size() - pos >= kFrameHeaderLen) {
+    size_t len = ((size_t)(unsigned char)in[pos] << 16) |
+                 ((size_t)(unsigned char)in[pos + 1] << 8) |
+                 (size_t)(unsigned char)in[pos + 2];
+    if (len > kOurMaxFrame) {
+      ok = ConnectionError(kFrameSizeError);
+      break;
+    }
+    if (in.size() - pos - kFrameHeaderLen < len) break;  // need more
+    unsigned char type = (unsigned char)in[pos + 3];
+    unsigned char flags = (unsigned char)in[pos + 4];
+    uint32_t streamId = readU32(in, pos + 5) & 0x7fffffffu;
+    std::string payload = in.substr(pos + kFrameHeaderLen, len);
+    pos += kFrameHeaderLen + len;
+    ok = ProcessFrame(type, flags, streamId, payload);
+  }
+  in.erase(0, pos);
+  return ok;
+}
+
+bool Http2Session::PopRequest(uint32_t &streamId, HttpRequest &req) {
+  while (!m_ready.empty()) {
+    uint32_t id = m_ready.front();
+    m_ready.pop_front();
+    std::map<uint32_t, Http2Stream>::iterator it = m_streams.find(id);
+    if (it == m_streams.end()) continue;  // reset before dispatch
+    streamId = id;
+    req = it->second.m_request;
+    return true;
+  }
+  return false;
+}
+
+void Http2Session::SubmitResponse(uint32_t streamId, const std::string &http1,
+                                  bool headOnly) {
+  std::map<uint32_t, Http2Stream>::iterator it = m_streams.find(streamId);
+  if (it == m_streams.end() || it->second.m_responseQueued) return;
+  Http2Stream &s = it->second;
+  size_t hdrEnd = http1.find("\r\n\r\n");
+  if (hdrEnd == std::string::npos) hdrEnd = http1.size();
+  // Status line: "HTTP/1.1 200 OK"
+  size_t sp = http1.find(' ');
+  std::string status = "500";
+  if (sp != std::string::npos && sp + 4 <= hdrEnd)
+    status = http1.substr(sp + 1, 3);
+  HttpHeader st;
+  st.name = ":status";
+  st.value = status;
+  s.m_responseHeaders.push_back(st);
+  size_t pos = http1.find("\r\n");
+  while (pos != std::string::npos && pos < hdrEnd) {
+    pos += 2;
+    size_t eol = http1.find("\r\n", pos);
+    if (eol == std::string::npos || eol > hdrEnd) eol = hdrEnd;
+    std::string line = http1.substr(pos, eol - pos);
+    size_t colon = line.find(':');
+    if (colon != std::string::npos) {
+      HttpHeader h;
+      h.name = toLower(line.substr(0, colon));
+      size_t v = colon + 1;
+      while (v < line.size() && (line[v] == ' ' || line[v] == '\t')) ++v;
+      h.value = line.substr(v);
+      if (!isConnectionHeader(h.name)) s.m_responseHeaders.push_back(h);
+    }
+    pos = eol;
+    if (eol == hdrEnd) break;
+  }
+  if (!headOnly && hdrEnd + 4 <= http1.size())
+    s.m_responseBody = http1.substr(hdrEnd + 4);
+  s.m_responseQueued = true;
+}
+
+void Http2Session::Flush(std::string &out, size_t limit) {
+  out += m_control;
+  m_control.clear();
+  // After an h2c upgrade, responses wait for the client preface; clients
+  // that only buffer a little data past the 101 would drop them otherwise
+  if (!m_prefaceDone) return;
+
+  // HEADERS are not flow controlled: send every queued response head now
+  std::map<uint32_t, Http2Stream>::iterator it = m_streams.begin();
+  while (it != m_streams.end()) {
+    Http2Stream &s = it->second;
+    if (s.m_responseQueued && !s.m_headersSent) {
+      bool endStream = s.m_responseBody.empty();
+      WriteHeaders(out, s, endStream);
+      s.m_headersSent = true;
+      if (endStream) {
+        m_streams.erase(it++);
+        continue;
+      }
+    }
+    ++it;
+  }
+
+  // DATA: smooth weighted round-robin across streams with window and data
+  // left, one frame per pick, so heavier streams get proportionally more
+  // bandwidth without starving light ones
+  std::vector<Http2Stream *> candidates;
+  while (out.size() < limit && m_connSendWindow > 0) {
+    candidates.clear();
+    long totalWeight = 0;
+    for (it = m_streams.begin(); it != m_streams.end(); ++it) {
+      Http2Stream &s = it->second;
+      if (s.m_headersSent && s.m_bodyOffset < s.m_responseBody.size() &&
+          s.m_sendWindow > 0) {
+        candidates.push_back(&s);
+        totalWeight += s.m_weight;
+      }
+    }
+    if (candidates.empty()) break;
+    Http2Stream *pick = 0;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      candidates[i]->m_credit += candidates[i]->m_weight;
+      if (!pick || candidates[i]->m_credit > pick->m_credit)
+        pick = candidates[i];
+    }
+    pick->m_credit -= totalWeight;
+
+    size_t chunk = pick->m_responseBody.size() - pick->m_bodyOffset;
+    if (chunk > m_peerMaxFrame) chunk = m_peerMaxFrame;
+    if ((long)chunk > m_connSendWindow) chunk = (size_t)m_connSendWindow;
+    if ((long)chunk > pick->m_sendWindow) chunk = (size_t)pick->m_sendWindow;
+    bool last = pick->m_bodyOffset + chunk == pick->m_responseBody.size();
+    WriteFrame(out, kFrameData, last ? kFlagEndStream : 0, pick->m_id,
+               pick->m_responseBody.substr(pick->m_bodyOffset, chunk));
+    pick->m_bodyOffset += chunk;
+    pick->m_sendWindow -= (long)chunk;
+    m_connSendWindow -= (long)chunk;
+    if (last) m_streams.erase(pick->m_id);
+  }
+}
+
+bool Http2Session::WantsClose() const {
+  if (!m_control.empty()) return false;  // flush GOAWAY first
+  if (m_goAwaySent) return true;
+  return m_goAwayReceived && m_streams.empty();
+}
+
+bool Http2Session::ProcessFrame(unsigned char type, unsigned char flags,
+                                uint32_t streamId, const std::string &payload) {
+  // A header block must be contiguous (RFC 9113 section 6.10)
+  if (m_continuationStream &&
+      (type != kFrameContinuation || streamId != m_continuationStream))
+    return ConnectionError(kProtocolError);
+
+  switch (type) {
+    case kFrameHeaders:
+      return OnHeaders(flags, streamId, payload);
+    case kFrameContinuation:
+      return OnContinuation(flags, streamId, payload);
+    case kFrameData:
+      return OnData(flags, streamId, payload);
+    case kFrameSettings:
+      return OnSettings(flags, streamId, payload);
+    case kFrameWindowUpdate:
+      return OnWindowUpdate(streamId, payload);
+    case kFramePriority: {
+      if (!streamId) return ConnectionError(kProtocolError);
+      if (payload.size() != 5) {
+        StreamError(streamId, kFrameSizeError);
+        return true;
+      }
+      std::map<uint32_t, Http2Stream>::iterator it = m_streams.find(streamId);
+      if (it != m_streams.end())
+        it->second.m_weight = (unsigned char)payload[4] + 1;
+      return true;
+    }
+    case kFrameRstStream:
+      if (!streamId) return ConnectionError(kProtocolError);
+      if (payload.size() != 4) return ConnectionError(kFrameSizeError);
+      m_streams.erase(streamId);
+      return true;
+    case kFramePing:
+      if (streamId) return ConnectionError(kProtocolError);
+      if (payload.size() != 8) return ConnectionError(kFrameSizeError);
+      if (!(flags & kFlagAck))
+        WriteFrame(m_control, kFramePing, kFlagAck, 0, payload);
+      return true;
+    case kFrameGoAway:
+      if (streamId) return ConnectionError(kProtocolError);
+      m_goAwayReceived = true;
+      return true;
+    case kFramePushPromise:
+      return ConnectionError(kProtocolError);  // clients cannot push
+    default:
+      return true;  // unknown frame types are ignored
+  }
+}
+
+bool Http2Session::OnHeaders(unsigned char flags, uint32_t streamId,
+                             std::string payload) {
+  if (!streamId) return ConnectionError(kProtocolError);
+  if (!StripPadding(flags, payload)) return ConnectionError(kProtocolError);
+  int weight = 16;
+  if (flags & kFlagPriority) {
+    if (payload.size() < 5) return ConnectionError(kFrameSizeError);
+    weight = (unsigned char)payload[4] + 1;
+    payload.erase(0, 5);
+  }
+
+  std::map<uint32_t, Http2Stream>::iterator it = m_streams.find(streamId);
+  if (it != m_streams.end()) {
+    // Trailer section on an open stream
+    Http2Stream &s = it->second;
+    if (s.m_remoteClosed || !(flags & kFlagEndStream)) {
+      StreamError(streamId, kStreamClosed);
+      return true;
+    }
+    s.m_trailers = true;
+    s.m_headerBlock = payload;
+  } else {
+    if (!(streamId & 1) || streamId <= m_lastStreamId)
+      return ConnectionError(kProtocolError);
+    m_lastStreamId = streamId;
+    Http2Stream &s = m_streams[streamId];
+    s.m_id = streamId;
+    s.m_weight = weight;
+    s.m_sendWindow = m_peerInitialWindow;
+    s.m_headerBlock = payload;
+  }
+
+  if (!(flags & kFlagEndHeaders)) {
+    m_continuationStream = streamId;
+    m_continuationEnd = (flags & kFlagEndStream) != 0;
+    return true;
+  }
+  return FinishHeaders(m_streams[streamId], (flags & kFlagEndStream) != 0);
+}
+
+bool Http2Session::OnContinuation(unsigned char flags, uint32_t streamId,
+                                  const std::string &payload) {
+  if (!m_continuationStream || streamId != m_continuationStream)
+    return ConnectionError(kProtocolError);
+  Http2Stream &s = m_streams[streamId];
+  s.m_headerBlock += payload;
+  if (s.m_headerBlock.size() > kMaxHeaderBlock)
+    return ConnectionError(kProtocolError);
+  if (!(flags & kFlagEndHeaders)) return true;
+  m_continuationStream = 0;
+  return FinishHeaders(s, m_continuationEnd);
+}
+
+bool Http2Session::FinishHeaders(Http2Stream &stream, bool endStream) {
+  std::vector<HttpHeader> fields;
+  // Decode even for refused streams: the HPACK context is connection-wide
+  if (!m_decoder.Decode(stream.m_headerBlock, fields))
+    return ConnectionError(kCompressionError);
+  stream.m_headerBlock.clear();
+  uint32_t id = stream.m_id;
+
+  if (stream.m_trailers) {
+    stream.m_remoteClosed = true;
+    m_ready.push_back(id);
+    return true;
+  }
+  if (m_goAwaySent || m_streams.size() > kMaxConcurrentStreams) {
+    StreamError(id, kRefusedStream);
+    return true;
+  }
+
+  HttpRequest &req = stream.m_request;
+  req.version = "HTTP/2.0";
+  std::string authority;
+  for (size_t i = 0; i < fields.size(); ++i) {
+    const HttpHeader &f = fields[i];
+    if (f.name.empty()) {
+      StreamError(id, kProtocolError);
+      return true;
+    }
+    if (f.name[0] == ':') {
+      if (f.name == ":method")
+        req.method = f.value;
+      else if (f.name == ":path")
+        req.uri = f.value;
+      else if (f.name == ":authority")
+        authority = f.value;
+      continue;
+    }
+    if (isConnectionHeader(f.name) && f.name != "upgrade") {
+      StreamError(id, kProtocolError);
+      return true;
+    }
+    req.headers.push_back(f);
+  }
+  if (req.method.empty() || req.uri.empty() ||
+      !NormalizeRequestTarget(req.uri, req.path, req.query)) {
+    StreamError(id, kProtocolError);
+    return true;
+  }
+  // Virtual host selection keys off Host; :authority replaces it in HTTP/2
+  if (!authority.empty()) {
+    HttpHeader host;
+    host.name = "host";
+    host.value = authority;
+    req.headers.insert(req.headers.begin(), host);
+  }
+  if (endStream) {
+    stream.m_remoteClosed = true;
+    req.complete = true;
+    m_ready.push_back(id);
+  }
+  return true;
+}
+
+bool Http2Session::OnData(unsigned char flags, uint32_t streamId,
+                          std::string payload) {
+  if (!streamId) return ConnectionError(kProtocolError);
+  size_t frameLen = payload.size();
+  if (!StripPadding(flags, payload)) return ConnectionError(kProtocolError);
+  std::map<uint32_t, Http2Stream>::iterator it = m_streams.find(streamId);
+  if (it == m_streams.end() || it->second.m_remoteClosed) {
+    if (streamId > m_lastStreamId) return ConnectionError(kProtocolError);
+    CreditWindow(0, frameLen);
+    StreamError(streamId, kStreamClosed);
+    return true;
+  }
+  Http2Stream &s = it->second;
+  std::string &body = s.m_request.body;
+  if (body.size() <= m_maxBodySize) {
+    size_t room = m_maxBodySize + 1 - body.size();
+    body.append(payload, 0, payload.size() < room ? payload.size() : room);
+  }
+  CreditWindow(0, frameLen);
+  if (flags & kFlagEndStream) {
+    s.m_remoteClosed = true;
+    s.m_request.complete = true;
+    m_ready.push_back(streamId);
+  } else {
+    CreditWindow(streamId, frameLen);
+  }
+  return true;
+}
+
+bool Http2Session::OnSettings(unsigned char flags, uint32_t streamId,
+                              const std::string &payload) {
+  if (streamId) return ConnectionError(kProtocolError);
+  if (flags & kFlagAck) {
+    if (!payload.empty()) return ConnectionError(kFrameSizeError);
+    return true;
+  }
+  if (payload.size() % 6 != 0) return ConnectionError(kFrameSizeError);
+  if (!ApplySettings(payload)) return false;
+  WriteFrame(m_control, kFrameSettings, kFlagAck, 0, std::string());
+  return true;
+}
+
+bool Http2Session::ApplySettings(const std::string &payload) {
+  for (size_t pos = 0; pos + 6 <= payload.size(); pos += 6) {
+    unsigned id = ((unsigned)(unsigned char)payload[pos] << 8) |
+                  (unsigned char)payload[pos + 1];
+    uint32_t value = readU32(payload, pos + 2);
+    switch (id) {
+      case kSettingsHeaderTableSize:
+        m_encoder.SetMaxTableSize(value);
+        break;
+      case kSettingsEnablePush:
+        if (value > 1) return ConnectionError(kProtocolError);
+        break;
+      case kSettingsInitialWindowSize: {
+        if (value > (uint32_t)kMaxWindow)
+          return ConnectionError(kFlowControlError);
+        // Changes apply retroactively to every open stream (6.9.2)
+        long delta = (long)value - m_peerInitialWindow;
+        m_peerInitialWindow = (long)value;
+        for (std::map<uint32_t, Http2Stream>::iterator it = m_streams.begin();
+             it != m_streams.end(); ++it) {
+          it->second.m_sendWindow += delta;
+          if (it->second.m_sendWindow > kMaxWindow)
+            return ConnectionError(kFlowControlError);
+        }
+        break;
+      }
+      case kSettingsMaxFrameSize:
+        if (value < 16384 || value > 16777215)
+          return ConnectionError(kProtocolError);
+        m_peerMaxFrame = value;
+        break;
+      default:
+        break;  // MAX_CONCURRENT_STREAMS etc. do not constrain a server
+    }
+  }
+  return true;
+}
+
+bool Http2Session::OnWindowUpdate(uint32_t streamId,
+                                  const std::string &payload) {
+  if (payload.size() != 4) return ConnectionError(kFrameSizeError);
+  long increment = (long)(readU32(payload, 0) & 0x7fffffffu);
+  if (!streamId) {
+    if (!increment) return ConnectionError(kProtocolError);
+    m_connSendWindow += increment;
+    if (m_connSendWindow > kMaxWindow)
+      return ConnectionError(kFlowControlError);
+    return true;
+  }
+  std::map<uint32_t, Http2Stream>::iterator it = m_streams.find(streamId);
+  if (it == m_streams.end()) return true;  // may race with stream closure
+  if (!increment) {
+    StreamError(streamId, kProtocolError);
+    return true;
+  }
+  it->second.m_sendWindow += increment;
+  if (it->second.m_sendWindow > kMaxWindow)
+    StreamError(streamId, kFlowControlError);
+  return true;
+}
+
+bool Http2Session::StripPadding(unsigned char flags, std::string &payload) {
+  if (!(flags & kFlagPadded)) return true;
+  if (payload.empty()) return false;
+  size_t pad = (unsigned char)payload[0];
+  if (pad >= payload.size()) return false;
+  payload = payload.substr(1, payload.size() - 1 - pad);
+  return true;
+}
+
+bool Http2Session::ConnectionError(uint32_t code) {
+  if (m_goAwaySent) return false;
+  std::string payload;
+  appendU32(payload, m_lastStreamId);
+  appendU32(payload, code);
+  WriteFrame(m_control, kFrameGoAway, 0, 0, payload);
+  m_goAwaySent = true;
+  m_streams.clear();
+  m_ready.clear();
+  return false;
+}
+
+void Http2Session::StreamError(uint32_t streamId, uint32_t code) {
+  std::string payload;
+  appendU32(payload, code);
+  WriteFrame(m_control, kFrameRstStream, 0, streamId, payload);
+  m_streams.erase(streamId);
+}
+
+void Http2Session::WriteFrame(std::string &out, unsigned char type,
+                              unsigned char flags, uint32_t streamId,
+                              const std::string &payload) const {
+  size_t len = payload.size();
+  out += (char)((len >> 16) & 0xff);
+  out += (char)((len >> 8) & 0xff);
+  out += (char)(len & 0xff);
+  out += (char)type;
+  out += (char)flags;
+  appendU32(out, streamId & 0x7fffffffu);
+  out += payload;
+}
+
+void Http2Session::WriteHeaders(std::string &out, Http2Stream &stream,
+                                bool endStream) {
+  std::string block;
+  m_encoder.Encode(stream.m_responseHeaders, block);
+  size_t pos = 0;
+  bool first = true;
+  do {
+    size_t chunk = block.size() - pos;
+    if (chunk > m_peerMaxFrame) chunk = m_peerMaxFrame;
+    bool lastFragment = pos + chunk == block.size();
+    unsigned char flags = lastFragment ? kFlagEndHeaders : 0;
+    if (first && endStream) flags |= kFlagEndStream;
+    WriteFrame(out, first ? kFrameHeaders : kFrameContinuation, flags,
+               stream.m_id, block.substr(pos, chunk));
+    pos += chunk;
+    first = false;
+  } while (pos < block.size());
+}
+
+void Http2Session::CreditWindow(uint32_t streamId, size_t bytes) {
+  // Hand received bytes straight back; buffering is bounded by m_maxBodySize
+  if (!bytes) return;
+  std::string payload;
+  appendU32(payload, (uint32_t)bytes);
+  WriteFrame(m_control, kFrameWindowUpdate, 0, streamId, payload);
+}
@@ -0,0 +1,120 @@
+// HTTP/2 over cleartext (RFC 9113): framing, stream state, flow control
+#pragma once
+
+#include <stdint.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "http/Hpack.hpp"
+#include "http/HttpRequest.hpp"
+
+struct Http2Stream {
+  uint32_t m_id;
+  HttpRequest m_request;
+  std::string m_headerBlock;  // HEADERS + CONTINUATION fragments
+  bool m_remoteClosed;        // END_STREAM seen from the client
+  bool m_trailers;            // current header block is a trailer section
+
+  // Response side
+  bool m_responseQueued;
+  bool m_headersSent;
+  std::vector<HttpHeader> m_responseHeaders;
+  std::string m_responseBody;
+  size_t m_bodyOffset;
+
+  // Flow control and scheduling
+  long m_sendWindow;  // peer-granted window for our DATA
+  int m_weight;       // 1..256, from HEADERS priority or PRIORITY frames
+  long m_credit;      // smooth weighted round-robin accumulator
+
+  Http2Stream()
+      : m_id(0),
+        m_remoteClosed(false),
+        m_trailers(false),
+        m_responseQueued(false),
+        m_headersSent(false),
+        m_bodyOffset(0),
+        m_sendWindow(65535),
+        m_weight(16),
+        m_credit(0) {}
+};
+
+class Http2Session {
+ public:
+  // maxBodySize: request bodies are buffered up to this + 1 bytes so the
+  // regular 413 check still fires without holding unbounded data
+  explicit Http2Session(size_t maxBodySize);
+
+  // Prior-knowledge detection on the first bytes of a connection:
+  // 1 = client preface, 0 = need more bytes, -1 = not HTTP/2
+  static int MatchPreface(const std::string &buf);
+
+  // Take over after "101 Switching Protocols" for an Upgrade: h2c request;
+  // the request itself becomes stream 1. False if HTTP2-Settings is invalid.
+  bool StartUpgrade(const std::string &settingsHeader, const HttpRequest &req);
+
+  // Consume complete frames from the front of in. Returns false once a
+  // connection error has been raised (GOAWAY is queued for Flush).
+  bool Feed(std::string &in);
+
+  // Requests whose headers and body are complete, in arrival order
+  bool PopRequest(uint32_t &streamId, HttpRequest &req);
+
+  // Queue a response for a stream from a serialized HTTP/1.1 message.
+  // Ignored if the client has reset the stream meanwhile.
+  void SubmitResponse(uint32_t streamId, const std::string &http1,
+                      bool headOnly);
+
+  // Append control frames, response HEADERS and as much DATA as flow control
+  // allows to out, stopping once out reaches limit bytes
+  void Flush(std::string &out, size_t limit);
+
+  bool WantsClose() const;
+  size_t ActiveStreams() const { return m_streams.size(); }
+
+ private:
+  // Non-copyable
+  Http2Session(const Http2Session &);
+  Http2Session &operator=(const Http2Session &);
+
+  bool ProcessFrame(unsigned char type, unsigned char flags, uint32_t streamId,
+                    const std::string &payload);
+  bool OnHeaders(unsigned char flags, uint32_t streamId, std::string payload);
+  bool OnContinuation(unsigned char flags, uint32_t streamId,
+                      const std::string &payload);
+  bool OnData(unsigned char flags, uint32_t streamId, std::string payload);
+  bool OnSettings(unsigned char flags, uint32_t streamId,
+                  const std::string &payload);
+  bool OnWindowUpdate(uint32_t streamId, const std::string &payload);
+  bool ApplySettings(const std::string &payload);
+  bool FinishHeaders(Http2Stream &stream, bool endStream);
+  bool StripPadding(unsigned char flags, std::string &payload);
+
+  bool ConnectionError(uint32_t code);
+  void StreamError(uint32_t streamId, uint32_t code);
+  void WriteFrame(std::string &out, unsigned char type, unsigned char flags,
+                  uint32_t streamId, const std::string &payload) const;
+  void WriteHeaders(std::string &out, Http2Stream &stream, bool endStream);
+  void CreditWindow(uint32_t streamId, size_t bytes);
+
+  HpackDecoder m_decoder;
+  HpackEncoder m_encoder;
+  std::map<uint32_t, Http2Stream> m_streams;
+  std::deque<uint32_t> m_ready;  // stream ids with complete requests
+  std::string m_control;         // queued non-DATA frames
+
+  bool m_prefaceDone;
+  bool m_goAwaySent;
+  bool m_goAwayReceived;
+  uint32_t m_lastStreamId;        // highest client stream seen
+  uint32_t m_continuationStream;  // nonzero while a header block is open
+  bool m_continuationEnd;         // END_STREAM of the open header block
+
+  long m_connSendWindow;
+  long m_peerInitialWindow;
+  size_t m_peerMaxFrame;
+  size_t m_maxBodySize;
+};
@@ -4,6 +4,8 @@
 #include <cstdlib>
 #include <iostream>
 
+#include "http/Uri.hpp"
+
 HttpRequestParser::HttpRequestParser()
     : m_state(kStateRequestLine),
       m_contentLength(0),
@@ -72,6 +74,11 @@ bool HttpRequestParser::Parse(const std::string &data, HttpRequest &req) {
         req.method = line.substr(0, m1);
         req.uri = line.substr(m1 + 1, m2 - m1 - 1);
         req.version = line.substr(m2 + 1);
+        if (!NormalizeRequestTarget(req.uri, req.path, req.query)) {
+          m_state = kStateError;
+          m_consumed = eol;
+          return false;
+        }
       } else {
         size_t colon = line.find(':');
         if (colon != std::string::npos) {
@@ -80,7 +87,7 @@ bool HttpRequestParser::Parse(const std::string &data, HttpRequest &req) {
           h.value = trim(line.substr(colon + 1));
           req.headers.push_back(h);
           if (h.name == "Content-Length") {
-            m_contentLength = (size_t)std::atoi(h.value.c_str());
+            m_contentLength = (size_t)std::strtoul(h.value.c_str(), 0, 10);
           }
           if (h.name == "Transfer-Encoding" && h.value == "chunked") {
             m_chunked = true;
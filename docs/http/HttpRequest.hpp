@@ -10,13 +10,17 @@ struct HttpHeader {
 
 struct HttpRequest {
   std::string method;
-  std::string uri;
+  std::string uri;    // request target as received
+  std::string path;   // canonical: decoded, dot segments resolved
+  std::string query;  // after '?', still percent-encoded
   std::string version;
   std::vector<HttpHeader> headers;
   std::string body;
   bool complete;
+  bool rewritten;  // server rewrite rules already applied to path/query
+  bool admitted;   // counted against its virtual host's quotas
 
-  HttpRequest() : complete(false) {}
+  HttpRequest() : complete(false), rewritten(false), admitted(false) {}
 };
 
 class HttpRequestParser {
@@ -28,6 +32,20 @@ class HttpRequestParser {
   size_t Consumed() const { return m_consumed; }
   bool Error() const { return m_state == kStateError; }
 
+  // For bodies the server consumes itself (streamed PUT uploads): once the
+  // headers are in, the body starts at BodyOffset() of the data passed to
+  // Parse, and EndBody() marks the request done without it
+  bool HeadersDone() const {
+    return m_state == kStateBody || m_state == kStateDone;
+  }
+  size_t BodyOffset() const { return m_headerEndOffset; }
+  size_t ContentLength() const { return m_contentLength; }
+  bool Chunked() const { return m_chunked; }
+  void EndBody() {
+    m_state = kStateDone;
+    m_consumed = m_headerEndOffset;
+  }
+
  private:
   enum State {
     kStateRequestLine,
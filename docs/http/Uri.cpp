@@ -0,0 +1,120 @@
+#include "http/Uri.hpp"
+
+namespace {
+
+enum ByteClass {
+  kByteChar,      // copied to the path
+  kByteSlash,     // segment separator
+  kBytePercent,   // starts an escape
+  kByteQuery,     // '?': path ends, query follows
+  kByteFragment,  // '#': target ends
+  kByteInvalid    // control characters and space
+};
+
+const unsigned char kNotHex = 0xff;
+
+// Built once at static initialization; indexed by byte value
+struct UriTables {
+  unsigned char byteClass[256];
+  unsigned char hexValue[256];
+  UriTables() {
+    for (int c = 0; c < 256; ++c) {
+      byteClass[c] = (c <= 0x20 || c == 0x7f) ? kByteInvalid : kByteChar;
+      hexValue[c] = kNotHex;
+    }
+    byteClass['/'] = kByteSlash;
+    byteClass['%'] = kBytePercent;
+    byteClass['?'] = kByteQuery;
+    byteClass['#'] = kByteFragment;
+    for (int d = 0; d < 10; ++d) hexValue['0' + d] = (unsigned char)d;
+    for (int h = 0; h < 6; ++h) {
+      hexValue['a' + h] = (unsigned char)(10 + h);
+      hexValue['A' + h] = (unsigned char)(10 + h);
+    }
+  }
+};
+
+const UriTables kTables;
+
+// Resolves the segment just completed at the end of path (which starts with
+// '/'). A "." segment disappears; ".." also removes its parent. False when
+// ".." would climb above the root.
+bool closeSegment(std::string &path) {
+  size_t start = path.rfind('/') + 1;
+  size_t len = path.size() - start;
+  if (len == 1 && path[start] == '.') {
+    path.erase(start);
+  } else if (len == 2 && path[start] == '.' && path[start + 1] == '.') {
+    if (start == 1) return false;
+    path.erase(path.rfind('/', start - 2) + 1);
+  }
+  return true;
+}
+
+}  // namespace
+
+bool NormalizeRequestTarget(const std::string &target, std::string &path,
+                            std::string &query) {
+  path.clear();
+  query.clear();
+  if (target == "*") {
+    path = target;
+    return true;
+  }
+  size_t i = 0;
+  // absolute-form: skip scheme and authority, keep the path
+  if (target.compare(0, 7, "http://") == 0 ||
+      target.compare(0, 8, "https://") == 0) {
+    i = target.find('/', target.find("//") + 2);
+    if (i == std::string::npos) {
+      path = "/";
+      return true;
+    }
+  }
+  if (i >= target.size() || target[i] != '/') return false;
+
+  path.reserve(target.size() - i);
+  path += '/';
+  for (++i; i < target.size(); ++i) {
+    unsigned char c = (unsigned char)target[i];
+    switch (kTables.byteClass[c]) {
+      case kByteChar:
+        path += (char)c;
+        break;
+      case kBytePercent: {
+        if (i + 2 >= target.size()) return false;
+        unsigned char hi = kTables.hexValue[(unsigned char)target[i + 1]];
+        unsigned char lo = kTables.hexValue[(unsigned char)target[i + 2]];
+        if (hi == kNotHex || lo == kNotHex) return false;
+        c = (unsigned char)(hi << 4 | lo);
+        if (c == 0) return false;
+        i += 2;
+        if (c != '/') {
+          path += (char)c;
+          break;
+        }
+        // An escaped slash separates segments like a literal one
+      }
+      // fall through
+      case kByteSlash:
+        if (!closeSegment(path)) return false;
+        if (path[path.size() - 1] != '/') path += '/';
+        break;
+      case kByteQuery: {
+        size_t end = target.find('#', i + 1);
+        query.assign(target, i + 1,
+                     end == std::string::npos ? std::string::npos
+                                              : end - i - 1);
+        i = target.size();
+        break;
+      }
+      case kByteFragment:
+        i = target.size();
+        break;
+      default:
+        return false;
+    }
+  }
+  // A trailing "." or ".." names a directory: "/a/b/.." is "/a/"
+  return closeSegment(path);
+}
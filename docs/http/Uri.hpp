@@ -0,0 +1,16 @@
+// Request-target canonicalization (RFC 3986 sections 2.1, 5.2.4).
+#pragma once
+
+#include <string>
+
+// Splits an origin-form ("/a/b?x") or absolute-form ("http://h/a/b?x")
+// request target into a canonical path and the raw query string, in one
+// pass driven by byte-class lookup tables:
+//   - percent-escapes are decoded (so "%2e%2e" is a dot segment);
+//   - "." and ".." segments are resolved and repeated slashes collapsed;
+//   - the fragment, if any, is dropped; the query is left encoded.
+// Returns false for targets that must be answered with 400: no leading '/',
+// malformed escapes, control bytes, an escaped NUL, or ".." above the root.
+// The asterisk-form "*" yields the path "*".
+bool NormalizeRequestTarget(const std::string &target, std::string &path,
+                            std::string &query);
@@ -0,0 +1,238 @@
+#include "http/WebSocket.hpp"
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const char kAcceptGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+uint32_t rotl(uint32_t v, int n) { return (v << n) | (v >> (32 - n)); }
+
+// SHA-1 is only needed for the handshake digest (RFC 6455 section 4.2.2)
+void sha1(const std::string &msg, unsigned char out[20]) {
+  uint32_t h[5] = {0x67452301u, 0xEFCDAB89u, 0x98BADCFEu, 0x10325476u,
+                   0xC3D2E1F0u};
+  std::string data = msg;
+  uint32_t bitLenHi = (uint32_t)((msg.size() >> 29) & 0xffffffffu);
+  uint32_t bitLenLo = (uint32_t)((msg.size() << 3) & 0xffffffffu);
+  data += (char)0x80;
+  while (data.size() % 64 != 56) data += (char)0;
+  for (int i = 3; i >= 0; --i) data += (char)((bitLenHi >> (i * 8)) & 0xff);
+  for (int i = 3; i >= 0; --i) data += (char)((bitLenLo >> (i * 8)) & 0xff);
+
+  for (size_t chunk = 0; chunk < data.size(); chunk += 64) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i) {
+      const unsigned char *p =
+          (const unsigned char *)data.data() + chunk + i * 4;
+      w[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+             ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+    }
+    for (int i = 16; i < 80; ++i)
+      w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; ++i) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999u;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1u;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDCu;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6u;
+      }
+      uint32_t t = rotl(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rotl(b, 30);
+      b = a;
+      a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+  for (int i = 0; i < 5; ++i) {
+    out[i * 4] = (unsigned char)(h[i] >> 24);
+    out[i * 4 + 1] = (unsigned char)(h[i] >> 16);
+    out[i * 4 + 2] = (unsigned char)(h[i] >> 8);
+    out[i * 4 + 3] = (unsigned char)h[i];
+  }
+}
+
+std::string base64(const unsigned char *data, size_t len) {
+  static const char kAlphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < len; i += 3) {
+    uint32_t v = (uint32_t)data[i] << 16;
+    if (i + 1 < len) v |= (uint32_t)data[i + 1] << 8;
+    if (i + 2 < len) v |= data[i + 2];
+    out += kAlphabet[(v >> 18) & 63];
+    out += kAlphabet[(v >> 12) & 63];
+    out += i + 1 < len ? kAlphabet[(v >> 6) & 63] : '=';
+    out += i + 2 < len ? kAlphabet[v & 63] : '=';
+  }
+  return out;
+}
+
+void appendU32(std::string &out, uint32_t v) {
+  out += (char)((v >> 24) & 0xff);
+  out += (char)((v >> 16) & 0xff);
+  out += (char)((v >> 8) & 0xff);
+  out += (char)(v & 0xff);
+}
+
+uint32_t readU32(const std::string &s, size_t pos) {
+  return ((uint32_t)(unsigned char)s[pos] << 24) |
+         ((uint32_t)(unsigned char)s[pos + 1] << 16) |
+         ((uint32_t)(unsigned char)s[pos + 2] << 8) |
+         (uint32_t)(unsigned char)s[pos + 3];
+}
+
+}  // namespace
+
+WebSocketParser::WebSocketParser(size_t maxPayload)
+    : m_maxPayload(maxPayload), m_closeCode(0) {}
+
+WebSocketParser::Result WebSocketParser::Parse(std::string &in,
+                                               WsFrame &frame) {
+  if (in.size() < 2) return kWsNeedMore;
+  unsigned char b0 = (unsigned char)in[0];
+  unsigned char b1 = (unsigned char)in[1];
+  unsigned char opcode = b0 & 0x0f;
+  bool fin = (b0 & 0x80) != 0;
+  // No extensions are negotiated, so RSV bits must be clear; clients must
+  // mask every frame (RFC 6455 section 5.1)
+  if ((b0 & 0x70) || !(b1 & 0x80) ||
+      (opcode > kWsOpBinary && opcode < kWsOpClose) || opcode > kWsOpPong) {
+    m_closeCode = kWsCloseProtocolError;
+    return kWsError;
+  }
+  size_t headerLen = 2;
+  size_t len = b1 & 0x7f;
+  if (len == 126) {
+    if (in.size() < 4) return kWsNeedMore;
+    len = ((size_t)(unsigned char)in[2] << 8) | (unsigned char)in[3];
+    headerLen = 4;
+  } else if (len == 127) {
+    if (in.size() < 10) return kWsNeedMore;
+    if (readU32(in, 2) != 0) {  // anything >= 4 GiB exceeds any ceiling
+      m_closeCode = kWsCloseTooBig;
+      return kWsError;
+    }
+    len = readU32(in, 6);
+    headerLen = 10;
+  }
+  if (opcode >= kWsOpClose && (len > 125 || !fin)) {
+    m_closeCode = kWsCloseProtocolError;
+    return kWsError;
+  }
+  if (len > m_maxPayload) {
+    m_closeCode = kWsCloseTooBig;
+    return kWsError;
+  }
+  if (in.size() < headerLen + 4 + len) return kWsNeedMore;
+  unsigned char mask[4];
+  std::memcpy(mask, in.data() + headerLen, 4);
+  frame.fin = fin;
+  frame.opcode = opcode;
+  frame.payload.assign(in, headerLen + 4, len);
+  if (len) WebSocketUnmask(&frame.payload[0], len, mask, 0);
+  in.erase(0, headerLen + 4 + len);
+  return kWsFrame;
+}
+
+std::string WebSocketAcceptKey(const std::string &clientKey) {
+  unsigned char digest[20];
+  sha1(clientKey + kAcceptGuid, digest);
+  return base64(digest, sizeof(digest));
+}
+
+void WebSocketUnmask(char *data, size_t len, const unsigned char mask[4],
+                     size_t keyOffset) {
+  unsigned char key[4];
+  for (size_t k = 0; k < 4; ++k) key[k] = mask[(keyOffset + k) & 3];
+  size_t i = 0;
+#if defined(__SSE2__)
+  uint32_t keyWord;
+  std::memcpy(&keyWord, key, 4);
+  const __m128i wideKey = _mm_set1_epi32((int)keyWord);
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(data + i),
+                     _mm_xor_si128(v, wideKey));
+  }
+#endif
+  // Block sizes are multiples of 4, so the key phase stays aligned with i
+  unsigned char pattern[sizeof(unsigned long)];
+  for (size_t k = 0; k < sizeof(pattern); ++k) pattern[k] = key[k & 3];
+  unsigned long wordKey;
+  std::memcpy(&wordKey, pattern, sizeof(wordKey));
+  for (; i + sizeof(wordKey) <= len; i += sizeof(wordKey)) {
+    unsigned long v;
+    std::memcpy(&v, data + i, sizeof(v));
+    v ^= wordKey;
+    std::memcpy(data + i, &v, sizeof(v));
+  }
+  for (; i < len; ++i) data[i] = (char)(data[i] ^ key[i & 3]);
+}
+
+std::string WebSocketEncodeFrame(unsigned char opcode,
+                                 const std::string &payload) {
+  std::string out;
+  size_t len = payload.size();
+  out.reserve(len + 10);
+  out += (char)(0x80 | opcode);
+  if (len < 126) {
+    out += (char)len;
+  } else if (len <= 0xffff) {
+    out += (char)126;
+    out += (char)((len >> 8) & 0xff);
+    out += (char)(len & 0xff);
+  } else {
+    out += (char)127;
+    appendU32(out, 0);  // payloads never reach 4 GiB
+    appendU32(out, (uint32_t)len);
+  }
+  out += payload;
+  return out;
+}
+
+std::string WebSocketCloseFrame(int code) {
+  std::string payload;
+  payload += (char)((code >> 8) & 0xff);
+  payload += (char)(code & 0xff);
+  return WebSocketEncodeFrame(kWsOpClose, payload);
+}
+
+void AppendWsRecord(std::string &out, char type, uint32_t id,
+                    const std::string &payload) {
+  out += type;
+  appendU32(out, id);
+  appendU32(out, (uint32_t)payload.size());
+  out += payload;
+}
+
+bool ParseWsRecord(const std::string &in, size_t &pos, char &type,
+                   uint32_t &id, std::string &payload) {
+  if (in.size() - pos < kWsRecordHeaderLen) return false;
+  uint32_t len = readU32(in, pos + 5);
+  if (in.size() - pos - kWsRecordHeaderLen < len) return false;
+  type = in[pos];
+  id = readU32(in, pos + 1);
+  payload.assign(in, pos + kWsRecordHeaderLen, len);
+  pos += kWsRecordHeaderLen + len;
+  return true;
+}
@@ -0,0 +1,91 @@
+// WebSocket (RFC 6455) framing plus the record protocol spoken to
+// application backends over a Unix stream socket.
+#pragma once
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <string>
+
+#include "util/SharedBuffer.hpp"
+
+enum WsOpcode {
+  kWsOpContinuation = 0x0,
+  kWsOpText = 0x1,
+  kWsOpBinary = 0x2,
+  kWsOpClose = 0x8,
+  kWsOpPing = 0x9,
+  kWsOpPong = 0xA
+};
+
+// Close status codes used by the server
+enum WsCloseCode {
+  kWsCloseNormal = 1000,
+  kWsCloseProtocolError = 1002,
+  kWsClosePolicy = 1008,
+  kWsCloseTooBig = 1009,
+  kWsCloseInternalError = 1011
+};
+
+struct WsFrame {
+  bool fin;
+  unsigned char opcode;
+  std::string payload;  // already unmasked
+  WsFrame() : fin(false), opcode(0) {}
+};
+
+// Incremental parser for client-to-server frames. Enforces masking, control
+// frame rules and a payload ceiling; on kWsError, CloseCode() tells which
+// status to send before closing.
+class WebSocketParser {
+ public:
+  enum Result { kWsNeedMore, kWsFrame, kWsError };
+
+  explicit WebSocketParser(size_t maxPayload = 1 << 20);
+
+  // Consumes one frame from the front of in when complete
+  Result Parse(std::string &in, WsFrame &frame);
+  int CloseCode() const { return m_closeCode; }
+
+ private:
+  size_t m_maxPayload;
+  int m_closeCode;
+};
+
+// Sec-WebSocket-Accept for a client's Sec-WebSocket-Key
+std::string WebSocketAcceptKey(const std::string &clientKey);
+
+// XOR payload bytes with the 4-byte masking key, starting at key position
+// keyOffset (0..3). Uses SSE2 for 16-byte blocks when available, then
+// machine words, then single bytes.
+void WebSocketUnmask(char *data, size_t len, const unsigned char mask[4],
+                     size_t keyOffset);
+
+// Encode an unmasked server-to-client frame (FIN set)
+std::string WebSocketEncodeFrame(unsigned char opcode,
+                                 const std::string &payload);
+std::string WebSocketCloseFrame(int code);
+
+// Backend record protocol. Each record is:
+//   type (1 byte) | connection id (4 bytes, big endian) |
+//   payload length (4 bytes, big endian) | payload
+// selfserv -> backend: 'O' open (payload: request URI), 'T' text message,
+//                      'B' binary message, 'C' client gone
+// backend -> selfserv: 'T'/'B' message to one connection, 'C' close it,
+//                      't'/'b' broadcast to every connection on the backend
+enum WsRecordType {
+  kWsRecordOpen = 'O',
+  kWsRecordText = 'T',
+  kWsRecordBinary = 'B',
+  kWsRecordClose = 'C',
+  kWsRecordBroadcastText = 't',
+  kWsRecordBroadcastBinary = 'b'
+};
+
+const size_t kWsRecordHeaderLen = 9;
+
+void AppendWsRecord(std::string &out, char type, uint32_t id,
+                    const std::string &payload);
+// Parses one record at in[pos]; advances pos. False when incomplete.
+bool ParseWsRecord(const std::string &in, size_t &pos, char &type,
+                   uint32_t &id, std::string &payload);
@@ -0,0 +1,145 @@
+#include "server/CachePolicy.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+const char kImmutableHeader[] =
+    "Cache-Control: public, max-age=31536000, immutable\r\n";
+const long kMaxLifetimeSec = 315360000;  // "max": ten years, as nginx
+
+bool isHex(char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
+         (c >= 'A' && c <= 'F');
+}
+
+// "3600", "90s", "15m", "12h", "30d", "2w"
+bool parseLifetime(const std::string &s, long &seconds) {
+  size_t digits = 0;
+  seconds = 0;
+  while (digits < s.size() && s[digits] >= '0' && s[digits] <= '9') {
+    if (seconds > kMaxLifetimeSec) return false;
+    seconds = seconds * 10 + (s[digits] - '0');
+    ++digits;
+  }
+  if (digits == 0 || digits + 1 < s.size()) return false;
+  long unit = 1;
+  if (digits < s.size()) {
+    switch (s[digits]) {
+      case 's': unit = 1; break;
+      case 'm': unit = 60; break;
+      case 'h': unit = 3600; break;
+      case 'd': unit = 86400; break;
+      case 'w': unit = 7 * 86400; break;
+      default: return false;
+    }
+  }
+  if (seconds > kMaxLifetimeSec / unit) return false;
+  seconds *= unit;
+  return true;
+}
+
+}  // namespace
+
+bool IsFingerprinted(const std::string &path) {
+  size_t slash = path.rfind('/');
+  size_t begin = slash == std::string::npos ? 0 : slash + 1;
+  size_t ext = path.rfind('.');
+  if (ext == std::string::npos || ext < begin) return false;
+  // Components strictly between the stem's first one and the extension
+  size_t start = path.find_first_of(".-", begin);
+  while (start < ext) {
+    size_t end = path.find_first_of(".-", start + 1);
+    bool digit = false, letter = false, hex = true;
+    for (size_t i = start + 1; i < end && hex; ++i) {
+      hex = isHex(path[i]);
+      if (path[i] >= '0' && path[i] <= '9')
+        digit = true;
+      else
+        letter = true;
+    }
+    if (hex && digit && letter && end - start - 1 >= 6) return true;
+    start = end;
+  }
+  return false;
+}
+
+std::string HttpDate(time_t t) {
+  static const char kDays[][4] = {"Sun", "Mon", "Tue", "Wed",
+                                  "Thu", "Fri", "Sat"};
+  static const char kMonths[][4] = {"Jan", "Feb", "Mar", "Apr",
+                                    "May", "Jun", "Jul", "Aug",
+                                    "Sep", "Oct", "Nov", "Dec"};
+  struct tm tmv;
+  gmtime_r(&t, &tmv);
+  char buf[40];
+  std::sprintf(buf, "%s, %02d %s %04d %02d:%02d:%02d GMT",
+               kDays[tmv.tm_wday], tmv.tm_mday, kMonths[tmv.tm_mon],
+               tmv.tm_year + 1900, tmv.tm_hour, tmv.tm_min, tmv.tm_sec);
+  return buf;
+}
+
+CachePolicy::CachePolicy() : m_expiresSec(-1), m_immutable(true) {}
+
+bool CachePolicy::Compile(const RouteConfig &route, std::string &error) {
+  m_header.clear();
+  m_expiresSec = -1;
+  m_immutable = route.immutableAssets;
+
+  std::string directives;
+  bool hasMaxAge = false;
+  size_t start = 0;
+  while (start < route.cacheControl.size()) {
+    size_t comma = route.cacheControl.find(',', start);
+    if (comma == std::string::npos) comma = route.cacheControl.size();
+    std::string d = route.cacheControl.substr(start, comma - start);
+    start = comma + 1;
+    if (d.empty()) continue;
+    for (size_t i = 0; i < d.size(); ++i) {
+      if ((unsigned char)d[i] <= ' ' || (unsigned char)d[i] >= 127) {
+        error = "bad cache_control directive '" + d + "'";
+        return false;
+      }
+    }
+    if (d.compare(0, 8, "max-age=") == 0) hasMaxAge = true;
+    if (!directives.empty()) directives += ", ";
+    directives += d;
+  }
+
+  std::string expiresLine;
+  const std::string &expires = route.expires;
+  if (!expires.empty() && expires != "off") {
+    std::string age;
+    if (expires == "epoch") {
+      age = "no-cache";
+      expiresLine = "Expires: " + HttpDate(1) + "\r\n";
+    } else if (expires == "max") {
+      age = "max-age=315360000";
+      expiresLine = "Expires: Thu, 31 Dec 2037 23:55:55 GMT\r\n";
+    } else if (parseLifetime(expires, m_expiresSec)) {
+      char buf[32];
+      std::sprintf(buf, "max-age=%ld", m_expiresSec);
+      age = buf;
+    } else {
+      error = "bad expires '" + expires + "'";
+      return false;
+    }
+    if (hasMaxAge) {
+      error = "both expires and a cache_control max-age on route " +
+              route.path;
+      return false;
+    }
+    if (!directives.empty()) directives += ", ";
+    directives += age;
+  }
+  if (!directives.empty())
+    m_header = "Cache-Control: " + directives + "\r\n" + expiresLine;
+  return true;
+}
+
+std::string CachePolicy::Headers(const std::string &path, time_t now) const {
+  if (m_immutable && IsFingerprinted(path)) return kImmutableHeader;
+  if (m_expiresSec < 0) return m_header;
+  return m_header + "Expires: " + HttpDate(now + m_expiresSec) + "\r\n";
+}
@@ -0,0 +1,36 @@
+// Browser caching headers for static files.
+#pragma once
+
+#include <ctime>
+#include <string>
+
+#include "config/Config.hpp"
+
+// True for file names carrying a content hash, such as "app.3f9a2c.js" or
+// "main-1a2b3c4d.css": a '.'- or '-'-delimited run of at least six hex
+// digits, mixing digits and letters, between the stem and the extension.
+// The content behind such a URL never changes, so it may be cached for good.
+bool IsFingerprinted(const std::string &path);
+
+// RFC 9110 IMF-fixdate, "Sun, 06 Nov 1994 08:49:37 GMT"
+std::string HttpDate(time_t t);
+
+// A route's expires=/cache_control=/immutable= settings, compiled at startup
+// into the header lines appended to its static file responses
+class CachePolicy {
+ public:
+  CachePolicy();
+
+  // expires: "off", "epoch", "max" or a lifetime ("3600", "90s", "15m",
+  // "12h", "30d", "2w"), sent as max-age plus Expires. cache_control:
+  // comma-separated directives, sent as given.
+  bool Compile(const RouteConfig &route, std::string &error);
+  // Header lines (each ending in CRLF) for a 200 for path at time now; empty
+  // when the route sets nothing and path is not fingerprinted
+  std::string Headers(const std::string &path, time_t now) const;
+
+ private:
+  std::string m_header;  // prebuilt Cache-Control (and a fixed Expires)
+  long m_expiresSec;     // Expires is now + this; -1 for none or fixed
+  bool m_immutable;      // fingerprinted names are cached for a year
+};
@@ -0,0 +1,409 @@
+#include "server/DirListing.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+struct OrderLess {
+  const std::vector<DirEntry> *entries;
+  DirSortKey key;
+  bool descending;
+  bool operator()(size_t a, size_t b) const {
+    const DirEntry &x0 = (*entries)[a];
+    const DirEntry &y0 = (*entries)[b];
+    if (x0.isDir != y0.isDir) return x0.isDir;
+    const DirEntry &x = descending ? y0 : x0;
+    const DirEntry &y = descending ? x0 : y0;
+    if (key == kDirSortSize && x.size != y.size) return x.size < y.size;
+    if (key == kDirSortMtime && x.mtime != y.mtime) return x.mtime < y.mtime;
+    return x.name < y.name;
+  }
+};
+
+void appendHtmlEscaped(std::string &out, const std::string &s) {
+  for (size_t i = 0; i < s.size(); ++i) {
+    switch (s[i]) {
+      case '&':
+        out += "&amp;";
+        break;
+      case '<':
+        out += "&lt;";
+        break;
+      case '>':
+        out += "&gt;";
+        break;
+      case '"':
+        out += "&quot;";
+        break;
+      case '\'':
+        out += "&#39;";
+        break;
+      default:
+        out += s[i];
+    }
+  }
+}
+
+// Percent-encodes everything but RFC 3986 unreserved characters and '/'
+void appendUrlEncoded(std::string &out, const std::string &s) {
+  static const char kHex[] = "0123456789ABCDEF";
+  for (size_t i = 0; i < s.size(); ++i) {
+    unsigned char c = (unsigned char)s[i];
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+        (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_' ||
+        c == '~' || c == '/') {
+      out += (char)c;
+    } else {
+      out += '%';
+      out += kHex[c >> 4];
+      out += kHex[c & 15];
+    }
+  }
+}
+
+void appendJsonString(std::string &out, const std::string &s) {
+  out += '"';
+  for (size_t i = 0; i < s.size(); ++i) {
+    unsigned char c = (unsigned char)s[i];
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += (char)c;
+    } else if (c < 0x20) {
+      char esc[8];
+      std::sprintf(esc, "\\u%04x", c);
+      out += esc;
+    } else {
+      out += (char)c;
+    }
+  }
+  out += '"';
+}
+
+void appendUnsigned(std::string &out, unsigned long v) {
+  char buf[32];
+  std::sprintf(buf, "%lu", v);
+  out += buf;
+}
+
+void appendTime(std::string &out, time_t t) {
+  char buf[32];
+  struct tm tmv;
+  gmtime_r(&t, &tmv);
+  std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tmv);
+  out += buf;
+}
+
+// Directory contents read through the directory fd: d_type when stat info is
+// not wanted, fstatat relative to the fd otherwise (no path rebuilding)
+bool readDirectory(int dirFd, bool withStat, std::vector<DirEntry> &out) {
+  DIR *d = ::fdopendir(dirFd);
+  if (!d) return false;
+  struct dirent *ent;
+  while ((ent = ::readdir(d))) {
+    const char *name = ent->d_name;
+    if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0) continue;
+    DirEntry e;
+    e.name = name;
+    bool known = false;
+#ifdef DT_DIR
+    if (ent->d_type != DT_UNKNOWN && ent->d_type != DT_LNK) {
+      e.isDir = ent->d_type == DT_DIR;
+      known = true;
+    }
+#endif
+    if (withStat || !known) {
+      struct stat st;
+      if (::fstatat(::dirfd(d), name, &st, 0) == 0) {
+        e.isDir = S_ISDIR(st.st_mode);
+        e.size = st.st_size;
+        e.mtime = st.st_mtime;
+      }
+    }
+    out.push_back(e);
+  }
+  ::closedir(d);  // also closes dirFd
+  return true;
+}
+
+}  // namespace
+
+DirSnapshot::DirSnapshot(const DirSnapshot &other) : m_rep(other.m_rep) {
+  if (m_rep) ++m_rep->refs;
+}
+
+DirSnapshot &DirSnapshot::operator=(const DirSnapshot &other) {
+  if (m_rep != other.m_rep) {
+    Release();
+    m_rep = other.m_rep;
+    if (m_rep) ++m_rep->refs;
+  }
+  return *this;
+}
+
+DirSnapshot::~DirSnapshot() { Release(); }
+
+void DirSnapshot::Release() {
+  if (m_rep && --m_rep->refs == 0) delete m_rep;
+  m_rep = 0;
+}
+
+const std::vector<size_t> &DirSnapshot::Order(DirSortKey key,
+                                              bool descending) const {
+  int slot = (int)key * 2 + (descending ? 1 : 0);
+  std::map<int, std::vector<size_t> >::iterator it = m_rep->orders.find(slot);
+  if (it != m_rep->orders.end()) return it->second;
+  std::vector<size_t> &order = m_rep->orders[slot];
+  order.resize(m_rep->entries.size());
+  for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+  OrderLess less;
+  less.entries = &m_rep->entries;
+  less.key = key;
+  less.descending = descending;
+  std::sort(order.begin(), order.end(), less);
+  return order;
+}
+
+DirListingCache::DirListingCache(size_t maxEntries)
+    : m_maxEntries(maxEntries), m_entries(0), m_clock(0) {}
+
+bool DirListingCache::Get(const std::string &dirPath, bool withStat,
+                          DirSnapshot &out) {
+  int fd = ::open(dirPath.c_str(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    return false;
+  }
+  std::map<std::string, Slot>::iterator it = m_slots.find(dirPath);
+  if (it != m_slots.end()) {
+    const DirSnapshot &snap = it->second.snap;
+    if (snap.m_rep->mtimeSec == (long)st.st_mtim.tv_sec &&
+        snap.m_rep->mtimeNsec == (long)st.st_mtim.tv_nsec &&
+        (snap.HasStat() || !withStat)) {
+      ::close(fd);
+      it->second.lastUse = ++m_clock;
+      out = snap;
+      return true;
+    }
+    m_entries -= snap.Size();
+    m_slots.erase(it);
+  }
+  DirSnapshot snap;
+  snap.m_rep = new DirSnapshot::Rep;
+  snap.m_rep->refs = 1;
+  snap.m_rep->hasStat = withStat;
+  snap.m_rep->mtimeSec = (long)st.st_mtim.tv_sec;
+  snap.m_rep->mtimeNsec = (long)st.st_mtim.tv_nsec;
+  if (!readDirectory(fd, withStat, snap.m_rep->entries)) {
+    ::close(fd);
+    return false;
+  }
+  out = snap;
+  if (snap.Size() <= m_maxEntries) {
+    Evict(snap.Size());
+    Slot &slot = m_slots[dirPath];
+    slot.snap = snap;
+    slot.lastUse = ++m_clock;
+    m_entries += snap.Size();
+  }
+  return true;
+}
+
+void DirListingCache::Evict(size_t needed) {
+  while (!m_slots.empty() && m_entries + needed > m_maxEntries) {
+    std::map<std::string, Slot>::iterator victim = m_slots.begin();
+    for (std::map<std::string, Slot>::iterator it = m_slots.begin();
+         it != m_slots.end(); ++it)
+      if (it->second.lastUse < victim->second.lastUse) victim = it;
+    m_entries -= victim->second.snap.Size();
+    m_slots.erase(victim);
+  }
+}
+
+void ParseDirListingQuery(const std::string &query, DirListingOptions &opts) {
+  size_t start = 0;
+  while (start < query.size()) {
+    size_t amp = query.find('&', start);
+    if (amp == std::string::npos) amp = query.size();
+    std::string param = query.substr(start, amp - start);
+    start = amp + 1;
+    size_t eq = param.find('=');
+    if (eq == std::string::npos) continue;
+    std::string key = param.substr(0, eq);
+    std::string val = param.substr(eq + 1);
+    if (key == "sort") {
+      if (val == "name") opts.sort = kDirSortName;
+      if (val == "size") opts.sort = kDirSortSize;
+      if (val == "mtime") opts.sort = kDirSortMtime;
+    } else if (key == "order") {
+      opts.descending = val == "desc";
+    } else if (key == "format") {
+      opts.json = val == "json";
+    } else if (key == "page") {
+      long page = std::atol(val.c_str());
+      opts.page = page > 0 ? (size_t)page : 1;
+    } else if (key == "limit") {
+      long limit = std::atol(val.c_str());
+      if (limit >= 0) opts.limit = (size_t)limit;
+    }
+  }
+  if (!opts.withStat && opts.sort != kDirSortName) opts.withStat = true;
+}
+
+DirListingWriter::DirListingWriter(const DirSnapshot &snap,
+                                   const DirListingOptions &opts,
+                                   const std::string &uriPath, bool chunked)
+    : m_snap(snap),
+      m_opts(opts),
+      m_uriPath(uriPath),
+      m_chunked(chunked),
+      m_begin(0),
+      m_end(snap.Size()),
+      m_pos(0),
+      m_state(kStateHeader) {
+  if (m_uriPath.empty() || m_uriPath[m_uriPath.size() - 1] != '/')
+    m_uriPath += '/';
+  if (m_opts.limit) {
+    size_t skip = (m_opts.page - 1) * m_opts.limit;
+    if (m_opts.page - 1 > m_end / m_opts.limit) skip = m_end;  // overflow
+    m_begin = skip < m_end ? skip : m_end;
+    if (m_end - m_begin > m_opts.limit) m_end = m_begin + m_opts.limit;
+  }
+  m_pos = m_begin;
+}
+
+bool DirListingWriter::Next(std::string &out, size_t maxBytes) {
+  if (m_state == kStateDone) return false;
+  std::string slice;
+  if (m_state == kStateHeader) {
+    Header(slice);
+    m_state = kStateRows;
+  }
+  if (m_state == kStateRows) {
+    const std::vector<size_t> &order =
+        m_snap.Order(m_opts.sort, m_opts.descending);
+    while (m_pos < m_end && slice.size() < maxBytes) {
+      Row(slice, m_snap.At(order[m_pos]), m_pos == m_begin);
+      ++m_pos;
+    }
+    if (m_pos == m_end) m_state = kStateFooter;
+  }
+  if (m_state == kStateFooter && slice.size() < maxBytes) {
+    Footer(slice);
+    m_state = kStateDone;
+  }
+  if (m_chunked) {
+    char size[24];
+    std::sprintf(size, "%lx\r\n", (unsigned long)slice.size());
+    out += size;
+    out += slice;
+    out += "\r\n";
+    if (m_state == kStateDone) out += "0\r\n\r\n";
+  } else {
+    out += slice;
+  }
+  return m_state != kStateDone;
+}
+
+void DirListingWriter::Header(std::string &out) const {
+  if (m_opts.json) {
+    out += "{\"path\":";
+    appendJsonString(out, m_uriPath);
+    out += ",\"total\":";
+    appendUnsigned(out, m_snap.Size());
+    out += ",\"page\":";
+    appendUnsigned(out, m_opts.page);
+    out += ",\"limit\":";
+    appendUnsigned(out, m_opts.limit);
+    out += ",\"entries\":[";
+    return;
+  }
+  out +=
+      "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>Index "
+      "of ";
+  appendHtmlEscaped(out, m_uriPath);
+  out += "</title></head><body><h1>Index of ";
+  appendHtmlEscaped(out, m_uriPath);
+  out += "</h1><table>\n";
+  if (m_uriPath != "/") out += "<tr><td><a href=\"../\">../</a></td></tr>\n";
+}
+
+void DirListingWriter::Row(std::string &out, const DirEntry &e,
+                           bool first) const {
+  if (m_opts.json) {
+    if (!first) out += ',';
+    out += "{\"name\":";
+    appendJsonString(out, e.name);
+    out += e.isDir ? ",\"type\":\"dir\"" : ",\"type\":\"file\"";
+    if (m_snap.HasStat()) {
+      out += ",\"size\":";
+      appendUnsigned(out, (unsigned long)e.size);
+      out += ",\"mtime\":";
+      appendUnsigned(out, (unsigned long)e.mtime);
+    }
+    out += '}';
+    return;
+  }
+  out += "<tr><td><a href=\"";
+  std::string href;
+  appendUrlEncoded(href, m_uriPath);  // decoded canonical path
+  appendUrlEncoded(href, e.name);
+  if (e.isDir) href += '/';
+  appendHtmlEscaped(out, href);
+  out += "\">";
+  appendHtmlEscaped(out, e.name);
+  if (e.isDir) out += '/';
+  out += "</a></td>";
+  if (m_snap.HasStat()) {
+    out += "<td>";
+    if (e.isDir)
+      out += '-';
+    else
+      appendUnsigned(out, (unsigned long)e.size);
+    out += "</td><td>";
+    appendTime(out, e.mtime);
+    out += "</td>";
+  }
+  out += "</tr>\n";
+}
+
+void DirListingWriter::Footer(std::string &out) const {
+  if (m_opts.json) {
+    out += "]}\n";
+    return;
+  }
+  out += "</table>\n";
+  if (m_opts.limit) {
+    // Keep the sort and format of this page in the navigation links
+    std::string keep = "&amp;limit=";
+    appendUnsigned(keep, m_opts.limit);
+    keep += m_opts.sort == kDirSortSize    ? "&amp;sort=size"
+            : m_opts.sort == kDirSortMtime ? "&amp;sort=mtime"
+                                           : "";
+    if (m_opts.descending) keep += "&amp;order=desc";
+    out += "<p>";
+    if (m_opts.page > 1) {
+      out += "<a href=\"?page=";
+      appendUnsigned(out, m_opts.page - 1);
+      out += keep;
+      out += "\">previous</a> ";
+    }
+    if (m_opts.page * m_opts.limit < m_snap.Size()) {
+      out += "<a href=\"?page=";
+      appendUnsigned(out, m_opts.page + 1);
+      out += keep;
+      out += "\">next</a>";
+    }
+    out += "</p>\n";
+  }
+  out += "</body></html>\n";
+}
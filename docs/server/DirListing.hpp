@@ -0,0 +1,122 @@
+// Directory listings (autoindex): sorted snapshots cached by directory mtime
+// and HTML/JSON output rendered a bounded slice at a time.
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+struct DirEntry {
+  std::string name;
+  bool isDir;
+  off_t size;    // valid when the snapshot was taken with stat info
+  time_t mtime;  // likewise
+  DirEntry() : isDir(false), size(0), mtime(0) {}
+};
+
+enum DirSortKey { kDirSortName, kDirSortSize, kDirSortMtime };
+
+// Entries of one directory as of one mtime. Reference counted so a listing
+// still being streamed survives the cache replacing the snapshot; sort orders
+// are computed on first use and kept with it.
+class DirSnapshot {
+ public:
+  DirSnapshot() : m_rep(0) {}
+  DirSnapshot(const DirSnapshot &other);
+  DirSnapshot &operator=(const DirSnapshot &other);
+  ~DirSnapshot();
+
+  bool Valid() const { return m_rep != 0; }
+  size_t Size() const { return m_rep ? m_rep->entries.size() : 0; }
+  bool HasStat() const { return m_rep && m_rep->hasStat; }
+  const DirEntry &At(size_t i) const { return m_rep->entries[i]; }
+  // Indices into the entries: directories first, then by key
+  const std::vector<size_t> &Order(DirSortKey key, bool descending) const;
+
+ private:
+  friend class DirListingCache;
+  struct Rep {
+    std::vector<DirEntry> entries;
+    bool hasStat;
+    long mtimeSec;
+    long mtimeNsec;
+    std::map<int, std::vector<size_t> > orders;  // by key * 2 + descending
+    size_t refs;
+  };
+  void Release();
+
+  Rep *m_rep;
+};
+
+// Snapshots by path, re-read only when the directory's mtime changes; the
+// least recently used are dropped beyond maxEntries entries in total
+class DirListingCache {
+ public:
+  explicit DirListingCache(size_t maxEntries = 1 << 20);
+
+  // False when the directory cannot be opened or read
+  bool Get(const std::string &dirPath, bool withStat, DirSnapshot &out);
+
+ private:
+  struct Slot {
+    DirSnapshot snap;
+    unsigned long lastUse;
+  };
+  void Evict(size_t needed);
+
+  size_t m_maxEntries;
+  size_t m_entries;
+  unsigned long m_clock;
+  std::map<std::string, Slot> m_slots;
+};
+
+struct DirListingOptions {
+  DirSortKey sort;
+  bool descending;
+  bool json;
+  bool withStat;  // size and mtime columns (one fstatat per entry)
+  size_t page;    // 1-based
+  size_t limit;   // entries per page; 0 lists everything
+  DirListingOptions()
+      : sort(kDirSortName),
+        descending(false),
+        json(false),
+        withStat(true),
+        page(1),
+        limit(0) {}
+};
+
+// Applies sort=name|size|mtime, order=asc|desc, format=html|json, page=N
+// and limit=N from a query string (without the '?')
+void ParseDirListingQuery(const std::string &query, DirListingOptions &opts);
+
+// Produces a listing in slices so a huge directory never becomes one huge
+// string. With chunked set, every slice is framed as an HTTP/1.1 chunk and
+// the terminating chunk follows the last one. uriPath is the decoded request
+// path; links are percent-encoded from it.
+class DirListingWriter {
+ public:
+  DirListingWriter(const DirSnapshot &snap, const DirListingOptions &opts,
+                   const std::string &uriPath, bool chunked);
+
+  // Appends roughly maxBytes or less; false once the output is complete
+  bool Next(std::string &out, size_t maxBytes);
+
+ private:
+  void Header(std::string &out) const;
+  void Row(std::string &out, const DirEntry &e, bool first) const;
+  void Footer(std::string &out) const;
+
+  DirSnapshot m_snap;
+  DirListingOptions m_opts;
+  std::string m_uriPath;  // ends with '/'
+  bool m_chunked;
+  size_t m_begin;  // page bounds in sort order
+  size_t m_end;
+  size_t m_pos;
+  enum { kStateHeader, kStateRows, kStateFooter, kStateDone } m_state;
+};
@@ -0,0 +1,23 @@
+#include "server/EmbeddedAssets.hpp"
+
+#include <cstring>
+
+#ifndef SELFSERV_WITH_EMBEDDED_ASSETS
+// Without WITH_EMBED the generated table is absent; embedded routes 404
+const EmbeddedAsset kEmbeddedAssets[] = {{"", 0, 0, "", "", 0, 0}};
+const size_t kEmbeddedAssetCount = 0;
+#endif
+
+const EmbeddedAsset *FindEmbeddedAsset(const std::string &path) {
+  size_t lo = 0, hi = kEmbeddedAssetCount;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = std::strcmp(kEmbeddedAssets[mid].path, path.c_str());
+    if (cmp == 0) return &kEmbeddedAssets[mid];
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return 0;
+}
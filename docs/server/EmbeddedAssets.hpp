@@ -0,0 +1,25 @@
+// Static files compiled into the binary (make server WITH_EMBED=<dir>), served
+// from read-only memory with no filesystem access.
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// One file of the embedded tree. The table is generated at build time by
+// docs/tools/embed_assets.cpp and sorted by path; the content hash, MIME type
+// and gzip variant are precomputed so serving does no work per request.
+struct EmbeddedAsset {
+  const char *path;  // "/index.html"
+  const unsigned char *data;
+  size_t size;
+  const char *mime;
+  const char *etag;  // quoted strong validator
+  const unsigned char *gzipData;  // 0 when compression did not pay off
+  size_t gzipSize;
+};
+
+extern const EmbeddedAsset kEmbeddedAssets[];
+extern const size_t kEmbeddedAssetCount;
+
+// Binary search by exact path; 0 when absent
+const EmbeddedAsset *FindEmbeddedAsset(const std::string &path);
@@ -0,0 +1,174 @@
+#include "server/FileCopy.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "http/Uri.hpp"
+
+ssize_t CopyFileBytes(int in, off_t &inOffset, int out, off_t &outOffset,
+                      size_t len) {
+#ifdef __linux__
+  off64_t from = inOffset;
+  off64_t to = outOffset;
+  ssize_t n = ::copy_file_range(in, &from, out, &to, len, 0);
+  if (n >= 0) {
+    inOffset = from;
+    outOffset = to;
+    return n;
+  }
+  if (errno != ENOSYS && errno != EXDEV && errno != EINVAL &&
+      errno != EOPNOTSUPP)
+    return -1;
+#endif
+  char buf[64 * 1024];
+  ssize_t got = ::pread(in, buf, len < sizeof(buf) ? len : sizeof(buf),
+                        inOffset);
+  if (got <= 0) return got;
+  for (ssize_t done = 0; done < got;) {
+    ssize_t n = ::pwrite(out, buf + done, (size_t)(got - done), outOffset);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    done += n;
+    outOffset += n;
+  }
+  inOffset += got;
+  return got;
+}
+
+int RenameFile(const std::string &from, const std::string &to, bool replace) {
+  int rc;
+#ifdef RENAME_NOREPLACE
+  rc = ::renameat2(AT_FDCWD, from.c_str(), AT_FDCWD, to.c_str(),
+                   RENAME_NOREPLACE);
+  if (rc != 0 && (errno == EINVAL || errno == ENOSYS)) {
+    // Filesystem without RENAME_NOREPLACE: check, then rename
+    struct stat st;
+    if (::lstat(to.c_str(), &st) == 0) {
+      errno = EEXIST;
+    } else {
+      rc = std::rename(from.c_str(), to.c_str());
+    }
+  }
+#else
+  // link() fails atomically on an existing name; directories cannot be
+  // linked, so they are checked and renamed
+  struct stat st;
+  if (::lstat(from.c_str(), &st) == 0 && !S_ISDIR(st.st_mode)) {
+    rc = ::link(from.c_str(), to.c_str());
+    if (rc == 0) ::unlink(from.c_str());
+  } else if (::lstat(to.c_str(), &st) == 0) {
+    rc = -1;
+    errno = EEXIST;
+  } else {
+    rc = std::rename(from.c_str(), to.c_str());
+  }
+#endif
+  if (rc == 0) return 201;
+  if (errno == EXDEV) return 0;
+  if (errno == ENOENT || errno == ENOTDIR) return 409;  // no such directory
+  if (errno != EEXIST && errno != ENOTEMPTY) return 500;
+  if (!replace) return 412;
+  if (std::rename(from.c_str(), to.c_str()) == 0) return 204;
+  return errno == EXDEV ? 0 : 500;
+}
+
+bool ParseDestination(const std::string &destination, std::string &authority,
+                      std::string &path) {
+  authority.clear();
+  size_t start = 0;
+  if (destination.compare(0, 7, "http://") == 0)
+    start = 7;
+  else if (destination.compare(0, 8, "https://") == 0)
+    start = 8;
+  if (start) {
+    size_t slash = destination.find('/', start);
+    if (slash == std::string::npos || slash == start) return false;
+    authority = destination.substr(start, slash - start);
+    if (authority.find_first_of("?#") != std::string::npos) return false;
+    start = slash;
+  } else if (destination.empty() || destination[0] != '/') {
+    return false;
+  }
+  std::string query;
+  return NormalizeRequestTarget(destination.substr(start), path, query);
+}
+
+FileAssembly::FileAssembly()
+    : m_replace(true),
+      m_next(0),
+      m_inOffset(0),
+      m_inSize(0),
+      m_outOffset(0),
+      m_failed(false) {}
+
+int FileAssembly::Begin(const std::vector<std::string> &sources,
+                        const std::string &target, bool replace) {
+  m_sources = sources;
+  m_target = target;
+  m_replace = replace;
+  size_t slash = target.rfind('/');
+  size_t name = slash == std::string::npos ? 0 : slash + 1;
+  m_temp = target.substr(0, name) + "." + target.substr(name) + ".XXXXXX";
+  std::vector<char> tmpl(m_temp.begin(), m_temp.end());
+  tmpl.push_back('\0');
+  int fd = ::mkstemp(&tmpl[0]);
+  if (fd < 0) return errno == ENOENT || errno == ENOTDIR ? 409 : 500;
+  m_temp = &tmpl[0];
+  ::fchmod(fd, 0644);
+  m_out.Reset(fd);
+  return 0;
+}
+
+bool FileAssembly::OpenNextSource() {
+  if (m_next == m_sources.size()) return false;
+  int fd = ::open(m_sources[m_next++].c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || ::fstat(fd, &st) != 0) {
+    if (fd >= 0) ::close(fd);
+    m_failed = true;
+    return false;
+  }
+  m_in.Reset(fd);
+  m_inOffset = 0;
+  m_inSize = st.st_size;
+  return true;
+}
+
+bool FileAssembly::Step(size_t maxBytes) {
+  while (maxBytes > 0 && !m_failed) {
+    if (!m_in.Valid() && !OpenNextSource()) return false;
+    off_t left = m_inSize - m_inOffset;
+    if (left == 0) {
+      m_in.Reset(-1);
+      continue;
+    }
+    size_t want = (off_t)maxBytes < left ? maxBytes : (size_t)left;
+    ssize_t n = CopyFileBytes(m_in.Get(), m_inOffset, m_out.Get(),
+                              m_outOffset, want);
+    if (n <= 0) {
+      m_failed = true;  // a source shrank underneath us, or an I/O error
+      return false;
+    }
+    maxBytes -= (size_t)n;
+  }
+  return !m_failed && (m_in.Valid() || m_next < m_sources.size());
+}
+
+int FileAssembly::Finish() {
+  m_in.Reset(-1);
+  m_out.Reset(-1);
+  int status = m_failed ? 500 : RenameFile(m_temp, m_target, m_replace);
+  if (status != 201 && status != 204) {
+    ::unlink(m_temp.c_str());
+    return status ? status : 500;
+  }
+  for (size_t i = 0; i < m_removeAfter.size(); ++i)
+    std::remove(m_removeAfter[i].c_str());
+  return status;
+}
@@ -0,0 +1,72 @@
+// Server-side file copies and renames that keep the bytes in the kernel.
+#pragma once
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "server/FD.hpp"
+
+// Copies len bytes between regular files at the given offsets, advancing
+// both. Uses copy_file_range(2), so the data never passes through user
+// space and filesystems with shared extents (btrfs, XFS) may reflink it
+// instead of copying; falls back to pread/pwrite where that is not
+// available (other systems, older kernels, across filesystems).
+ssize_t CopyFileBytes(int in, off_t &inOffset, int out, off_t &outOffset,
+                      size_t len);
+
+// Renames from to to, atomically refusing to replace an existing to unless
+// replace is set (renameat2 RENAME_NOREPLACE, or link+unlink without it).
+// Returns 201 (to was created), 204 (replaced), 412 (exists, !replace),
+// 409 (to's directory is missing), 0 when from and to are on different
+// filesystems, or 500.
+int RenameFile(const std::string &from, const std::string &to, bool replace);
+
+// Splits the Destination header of a COPY or MOVE into its authority (empty
+// for an origin-form "/a/b") and canonical path. Accepts only origin-form
+// targets and http/https absolute URIs that have a path; false (400) for
+// anything else, "*" and "http://host" included.
+bool ParseDestination(const std::string &destination, std::string &authority,
+                      std::string &path);
+
+// Writes the concatenation of some files into a temporary file next to
+// the target, a bounded slice per Step() so the event loop keeps serving
+// other clients, then renames it into place. Used to join multi-part
+// uploads and for COPY (and MOVE across filesystems).
+class FileAssembly {
+ public:
+  FileAssembly();
+
+  // replace: whether an existing target may be overwritten. Returns 0,
+  // 409 (target's directory is missing) or 500.
+  int Begin(const std::vector<std::string> &sources, const std::string &target,
+            bool replace);
+  // Removed (files or empty directories, in order) once the result is in
+  // place
+  void RemoveOnSuccess(const std::string &path) {
+    m_removeAfter.push_back(path);
+  }
+  // Copies up to maxBytes; true while there is more to copy
+  bool Step(size_t maxBytes);
+  // After the last Step: RenameFile's status (201/204/412), or 500
+  int Finish();
+  off_t Size() const { return m_outOffset; }
+  size_t SourceCount() const { return m_sources.size(); }
+
+ private:
+  bool OpenNextSource();
+
+  std::vector<std::string> m_sources;
+  std::vector<std::string> m_removeAfter;
+  std::string m_target;
+  std::string m_temp;
+  bool m_replace;
+  size_t m_next;  // index of the next source to open
+  FD m_in;
+  FD m_out;
+  off_t m_inOffset;
+  off_t m_inSize;
+  off_t m_outOffset;
+  bool m_failed;
+};
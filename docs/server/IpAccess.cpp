@@ -0,0 +1,226 @@
+#include "server/IpAccess.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+void maskTo(IpAddress &a, int len) {
+  for (int w = 0; w < 4; ++w) {
+    int keep = len - w * 32;
+    if (keep >= 32) continue;
+    a.words[w] = keep <= 0 ? 0 : a.words[w] & ~(0xffffffffu >> keep);
+  }
+}
+
+// Number of leading bits a and b share, at most limit
+int commonBits(const IpAddress &a, const IpAddress &b, int limit) {
+  int n = 0;
+  for (int w = 0; w < 4 && n < limit; ++w) {
+    uint32_t diff = a.words[w] ^ b.words[w];
+    if (diff == 0) {
+      n += 32;
+      continue;
+    }
+    while (!(diff & 0x80000000u)) {
+      diff <<= 1;
+      ++n;
+    }
+    break;
+  }
+  return n < limit ? n : limit;
+}
+
+bool readCidrFile(const std::string &path, bool allow, IpAccessList &list,
+                  std::string &error) {
+  std::ifstream in(path.c_str());
+  if (!in) {
+    error = "cannot read " + path;
+    return false;
+  }
+  std::string line;
+  int lineNo = 0;
+  while (std::getline(in, line)) {
+    ++lineNo;
+    size_t hash = line.find('#');
+    if (hash != std::string::npos) line.erase(hash);
+    size_t b = line.find_first_not_of(" \t\r");
+    if (b == std::string::npos) continue;
+    size_t e = line.find_last_not_of(" \t\r");
+    IpAddress addr;
+    int len;
+    if (!ParseCidr(line.substr(b, e - b + 1), addr, len)) {
+      char num[16];
+      std::sprintf(num, "%d", lineNo);
+      error = path + ":" + num + ": bad address '" + line + "'";
+      return false;
+    }
+    list.Insert(addr, len, allow);
+  }
+  return true;
+}
+
+}  // namespace
+
+bool IpAddressFromSockaddr(const struct sockaddr *sa, IpAddress &out) {
+  out = IpAddress();
+  if (sa->sa_family == AF_INET) {
+    const struct sockaddr_in *in4 = (const struct sockaddr_in *)sa;
+    out.words[2] = 0xffffu;
+    out.words[3] = ntohl(in4->sin_addr.s_addr);
+    return true;
+  }
+  if (sa->sa_family == AF_INET6) {
+    const unsigned char *b =
+        ((const struct sockaddr_in6 *)sa)->sin6_addr.s6_addr;
+    for (int w = 0; w < 4; ++w)
+      out.words[w] = ((uint32_t)b[w * 4] << 24) |
+                     ((uint32_t)b[w * 4 + 1] << 16) |
+                     ((uint32_t)b[w * 4 + 2] << 8) | b[w * 4 + 3];
+    return true;
+  }
+  return false;
+}
+
+bool ParseCidr(const std::string &text, IpAddress &addr, int &prefixLen) {
+  addr = IpAddress();
+  if (text == "all") {
+    prefixLen = 0;
+    return true;
+  }
+  size_t slash = text.find('/');
+  std::string host = text.substr(0, slash);
+  int bits = -1;
+  if (slash != std::string::npos) {
+    const char *p = text.c_str() + slash + 1;
+    char *end = 0;
+    long v = std::strtol(p, &end, 10);
+    if (end == p || *end || v < 0 || v > 128) return false;
+    bits = (int)v;
+  }
+  struct in_addr v4;
+  struct in6_addr v6;
+  if (inet_pton(AF_INET, host.c_str(), &v4) == 1) {
+    if (bits > 32) return false;
+    addr.words[2] = 0xffffu;
+    addr.words[3] = ntohl(v4.s_addr);
+    prefixLen = 96 + (bits < 0 ? 32 : bits);
+  } else if (inet_pton(AF_INET6, host.c_str(), &v6) == 1) {
+    const unsigned char *b = v6.s6_addr;
+    for (int w = 0; w < 4; ++w)
+      addr.words[w] = ((uint32_t)b[w * 4] << 24) |
+                      ((uint32_t)b[w * 4 + 1] << 16) |
+                      ((uint32_t)b[w * 4 + 2] << 8) | b[w * 4 + 3];
+    prefixLen = bits < 0 ? 128 : bits;
+  } else {
+    return false;
+  }
+  maskTo(addr, prefixLen);
+  return true;
+}
+
+std::string FormatIpAddress(const IpAddress &addr) {
+  char buf[INET6_ADDRSTRLEN];
+  if (addr.words[0] == 0 && addr.words[1] == 0 && addr.words[2] == 0xffffu) {
+    struct in_addr v4;
+    v4.s_addr = htonl(addr.words[3]);
+    inet_ntop(AF_INET, &v4, buf, sizeof(buf));
+  } else {
+    struct in6_addr v6;
+    for (int i = 0; i < 16; ++i)
+      v6.s6_addr[i] =
+          (unsigned char)(addr.words[i / 4] >> (24 - (i % 4) * 8));
+    inet_ntop(AF_INET6, &v6, buf, sizeof(buf));
+  }
+  return buf;
+}
+
+IpAccessList::IpAccessList() : m_prefixCount(0) { NewNode(IpAddress(), 0); }
+
+int IpAccessList::NewNode(const IpAddress &key, int len) {
+  Node n;
+  n.key = key;
+  n.len = len;
+  n.child[0] = n.child[1] = -1;
+  n.verdict = -1;
+  m_nodes.push_back(n);
+  return (int)m_nodes.size() - 1;
+}
+
+bool IpAccessList::Build(const std::vector<AccessRule> &rules,
+                         std::string &error) {
+  for (size_t i = 0; i < rules.size(); ++i) {
+    const AccessRule &rule = rules[i];
+    if (rule.fromFile) {
+      if (!readCidrFile(rule.source, rule.allow, *this, error)) return false;
+      continue;
+    }
+    IpAddress addr;
+    int len;
+    if (!ParseCidr(rule.source, addr, len)) {
+      error = "bad address '" + rule.source + "'";
+      return false;
+    }
+    Insert(addr, len, rule.allow);
+  }
+  return true;
+}
+
+// Every node's key is a prefix of the keys below it. Inserting descends
+// while the node's prefix covers the new one; where an edge diverges from
+// the new prefix, a node for their common bits is spliced in.
+void IpAccessList::Insert(const IpAddress &prefix, int len, bool allow) {
+  int n = 0;
+  int leaf = -1;
+  for (;;) {
+    if (m_nodes[n].len == len) {
+      leaf = n;
+      break;
+    }
+    int side = prefix.Bit(m_nodes[n].len);
+    int c = m_nodes[n].child[side];
+    if (c < 0) {
+      leaf = NewNode(prefix, len);
+      m_nodes[n].child[side] = leaf;
+      break;
+    }
+    int limit = m_nodes[c].len < len ? m_nodes[c].len : len;
+    int common = commonBits(m_nodes[c].key, prefix, limit);
+    if (common == m_nodes[c].len) {
+      n = c;
+      continue;
+    }
+    IpAddress splitKey = prefix;
+    maskTo(splitKey, common);
+    int mid = NewNode(splitKey, common);
+    m_nodes[mid].child[m_nodes[c].key.Bit(common)] = c;
+    m_nodes[n].child[side] = mid;
+    if (common == len) {
+      leaf = mid;
+    } else {
+      leaf = NewNode(prefix, len);
+      m_nodes[mid].child[prefix.Bit(common)] = leaf;
+    }
+    break;
+  }
+  if (m_nodes[leaf].verdict < 0) ++m_prefixCount;
+  m_nodes[leaf].verdict = allow ? 1 : 0;
+}
+
+bool IpAccessList::Allows(const IpAddress &addr) const {
+  int verdict = -1;
+  int n = 0;
+  while (n >= 0) {
+    const Node &node = m_nodes[n];
+    if (commonBits(node.key, addr, node.len) < node.len) break;
+    if (node.verdict >= 0) verdict = node.verdict;
+    if (node.len == 128) break;
+    n = node.child[addr.Bit(node.len)];
+  }
+  return verdict != 0;
+}
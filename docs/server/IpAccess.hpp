@@ -0,0 +1,53 @@
+// CIDR allow/deny lists for clients.
+#pragma once
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <vector>
+
+#include "config/Config.hpp"
+
+// 128-bit address; IPv4 is stored IPv4-mapped (::ffff:a.b.c.d) so both
+// families share one key space
+struct IpAddress {
+  uint32_t words[4];  // most significant first
+  IpAddress() { words[0] = words[1] = words[2] = words[3] = 0; }
+  bool Bit(int i) const { return (words[i >> 5] >> (31 - (i & 31))) & 1; }
+};
+
+bool IpAddressFromSockaddr(const struct sockaddr *sa, IpAddress &out);
+// "10.0.0.0/8", "192.0.2.7", "2001:db8::/32", "all"; prefixLen is 0..128
+bool ParseCidr(const std::string &text, IpAddress &addr, int &prefixLen);
+std::string FormatIpAddress(const IpAddress &addr);
+
+// Path-compressed binary trie of prefixes, each marked allow or deny. A
+// lookup walks at most 128 bits whatever the number of prefixes and returns
+// the verdict of the most specific matching prefix; addresses no prefix
+// covers are allowed (list "deny all" to change that).
+class IpAccessList {
+ public:
+  IpAccessList();
+
+  // Compiles the rules in order; a later duplicate prefix replaces an
+  // earlier one. Rules naming a file read one CIDR per line ('#' comments).
+  bool Build(const std::vector<AccessRule> &rules, std::string &error);
+  bool Empty() const { return m_prefixCount == 0; }
+  size_t PrefixCount() const { return m_prefixCount; }
+
+  void Insert(const IpAddress &prefix, int len, bool allow);
+  bool Allows(const IpAddress &addr) const;
+
+ private:
+  struct Node {
+    IpAddress key;  // bits beyond len are zero
+    int len;
+    int child[2];  // by bit len of the address; -1 when absent
+    signed char verdict;  // -1: no prefix ends here; 0: deny; 1: allow
+  };
+  int NewNode(const IpAddress &key, int len);
+
+  std::vector<Node> m_nodes;  // m_nodes[0] is the root (length 0)
+  size_t m_prefixCount;
+};
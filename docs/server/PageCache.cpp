@@ -0,0 +1,73 @@
+#include "server/PageCache.hpp"
+
+#include <fcntl.h>
+
+namespace {
+
+// Starts writeback of [offset, offset + len); with wait, also waits for
+// writeback already under way and for this one to finish
+void writeBack(int fd, off_t offset, off_t len, bool wait) {
+#ifdef SYNC_FILE_RANGE_WRITE
+  unsigned int flags = SYNC_FILE_RANGE_WRITE;
+  if (wait) flags |= SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WAIT_AFTER;
+  ::sync_file_range(fd, offset, len, flags);
+#else
+  if (wait) ::fdatasync(fd);
+  (void)offset;
+  (void)len;
+#endif
+}
+
+}  // namespace
+
+void AdviseSequentialRead(int fd, off_t size) {
+#ifdef POSIX_FADV_SEQUENTIAL
+  ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  ::posix_fadvise(fd, 0, size, POSIX_FADV_WILLNEED);
+#else
+  (void)fd;
+  (void)size;
+#endif
+}
+
+void DropCachedPages(int fd, off_t offset, off_t len) {
+#ifdef POSIX_FADV_DONTNEED
+  ::posix_fadvise(fd, offset, len, POSIX_FADV_DONTNEED);
+#else
+  (void)fd;
+  (void)offset;
+  (void)len;
+#endif
+}
+
+void WriteBehind::Start(off_t offset) {
+  m_first = offset;
+  m_next = offset - offset % kWriteBehindBytes;
+  m_active = true;
+}
+
+void WriteBehind::Advance(int fd, off_t cursor) {
+  if (!m_active) return;
+  while (cursor - m_next >= kWriteBehindBytes) {
+    writeBack(fd, m_next, kWriteBehindBytes, false);
+    off_t previous = m_next - kWriteBehindBytes;
+    if (previous >= m_first - m_first % kWriteBehindBytes) {
+      writeBack(fd, previous, kWriteBehindBytes, true);
+      DropCachedPages(fd, previous, kWriteBehindBytes);
+    }
+    m_next += kWriteBehindBytes;
+  }
+}
+
+void WriteBehind::Finish(int fd, off_t end) {
+  if (!m_active) return;
+  // Windows before the last submitted one are already written and dropped
+  off_t from = m_next - kWriteBehindBytes;
+  if (from < m_first - m_first % kWriteBehindBytes)
+    from = m_first - m_first % kWriteBehindBytes;
+  if (end > from) {
+    writeBack(fd, from, end - from, true);
+    DropCachedPages(fd, from, end - from);
+  }
+  m_active = false;
+}
@@ -0,0 +1,39 @@
+// Page-cache hints for bulk transfers, so one-off large files do not push
+// small hot ones out of memory. The hints are best effort and do nothing
+// where the system lacks them.
+#pragma once
+
+#include <sys/types.h>
+
+// Span of file written back and dropped at a time behind an upload's cursor
+const off_t kWriteBehindBytes = 8 * 1024 * 1024;
+
+// A file about to be read front to back: doubles readahead and starts
+// reading it in the background (POSIX_FADV_SEQUENTIAL, POSIX_FADV_WILLNEED)
+void AdviseSequentialRead(int fd, off_t size);
+// Drops the clean cached pages of [offset, offset + len); len 0 is to EOF
+void DropCachedPages(int fd, off_t offset, off_t len);
+
+// Keeps a large write from filling the page cache with dirty pages: each
+// full window behind the cursor is submitted for writeback
+// (sync_file_range), and the window before it, whose writeback has had a
+// window's worth of time to complete, is waited for and dropped. The wait
+// is usually already over, so the writer is not slowed to disk speed in
+// bursts the way a full dirty-page flush would.
+class WriteBehind {
+ public:
+  WriteBehind() : m_first(0), m_next(0), m_active(false) {}
+
+  // Writing starts at offset
+  void Start(off_t offset);
+  bool Active() const { return m_active; }
+  // Bytes before cursor have been written
+  void Advance(int fd, off_t cursor);
+  // After the last write: writes back and drops everything up to end
+  void Finish(int fd, off_t end);
+
+ private:
+  off_t m_first;  // where writing started
+  off_t m_next;   // start of the first window not yet submitted
+  bool m_active;
+};
@@ -0,0 +1,75 @@
+#include "server/PerfCounters.hpp"
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+const uint64_t kEvents[kStatHardwareEventCount] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+int perfEventOpen(struct perf_event_attr &attr, int groupFd) {
+  // This thread, on any CPU
+  return (int)::syscall(SYS_perf_event_open, &attr, 0, -1, groupFd,
+                        PERF_FLAG_FD_CLOEXEC);
+}
+
+}  // namespace
+
+PerfCounters::PerfCounters() : m_kernel(false) {
+  for (int i = 0; i < kStatHardwareEventCount; ++i) m_fds[i] = -1;
+}
+
+PerfCounters::~PerfCounters() { Close(); }
+
+bool PerfCounters::Open(std::string &error) {
+  int err = 0;
+  if (OpenGroup(true, err)) return true;
+  // perf_event_paranoid 2 (a common default) allows user space only
+  if ((err == EACCES || err == EPERM) && OpenGroup(false, err)) return true;
+  error = std::string("perf_event_open: ") + std::strerror(err);
+  return false;
+}
+
+bool PerfCounters::OpenGroup(bool kernel, int &err) {
+  for (int i = 0; i < kStatHardwareEventCount; ++i) {
+    struct perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = kEvents[i];
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = kernel ? 0 : 1;
+    attr.exclude_hv = 1;
+    m_fds[i] = perfEventOpen(attr, i == 0 ? -1 : m_fds[0]);
+    if (m_fds[i] < 0) {
+      err = errno;
+      Close();
+      return false;
+    }
+  }
+  m_kernel = kernel;
+  return true;
+}
+
+void PerfCounters::Close() {
+  for (int i = kStatHardwareEventCount - 1; i >= 0; --i) {
+    if (m_fds[i] >= 0) ::close(m_fds[i]);
+    m_fds[i] = -1;
+  }
+}
+
+bool PerfCounters::Read(uint64_t values[kStatHardwareEventCount]) const {
+  // PERF_FORMAT_GROUP: the number of events, then their values
+  uint64_t buf[1 + kStatHardwareEventCount];
+  if (m_fds[0] < 0 || ::read(m_fds[0], buf, sizeof(buf)) != sizeof(buf) ||
+      buf[0] != kStatHardwareEventCount)
+    return false;
+  std::memcpy(values, buf + 1, sizeof(uint64_t) * kStatHardwareEventCount);
+  return true;
+}
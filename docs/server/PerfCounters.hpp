@@ -0,0 +1,39 @@
+// Hardware performance counters of the calling thread, read through
+// perf_event_open(2).
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+#include "server/Stats.hpp"
+
+// Cycles, instructions, cache misses and branch misses, counted as one group
+// so a single read() returns all four, in StatHardwareEvent order. Kernel
+// time is included when perf_event_paranoid allows it, user space only
+// otherwise. Each Read() is a system call; the server only samples when
+// configured to.
+class PerfCounters {
+ public:
+  PerfCounters();
+  ~PerfCounters();
+
+  // False with error set when the kernel or CPU refuses (no PMU, as in many
+  // virtual machines, or a paranoid setting that forbids even user space)
+  bool Open(std::string &error);
+  bool Active() const { return m_fds[0] >= 0; }
+  bool KernelIncluded() const { return m_kernel; }
+  // Running totals since Open()
+  bool Read(uint64_t values[kStatHardwareEventCount]) const;
+
+ private:
+  // Non-copyable
+  PerfCounters(const PerfCounters &);
+  PerfCounters &operator=(const PerfCounters &);
+
+  bool OpenGroup(bool kernel, int &err);
+  void Close();
+
+  int m_fds[kStatHardwareEventCount];  // [0] leads the group
+  bool m_kernel;
+};
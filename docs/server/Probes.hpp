@@ -0,0 +1,37 @@
+// USDT probes (provider "selfserv") across the request lifecycle, for
+// bpftrace, perf and SystemTap. Built only when SELFSERV_WITH_USDT is defined
+// (make server WITH_USDT=1, needs <sys/sdt.h>); otherwise the macros expand
+// to nothing and their arguments are not evaluated.
+//
+//   accept          fd, listening fd
+//   header_parsed   fd, method, uri, head bytes
+//   route_selected  fd, server index, route path, uri
+//   handler_start   fd, method, uri
+//   handler_end     fd, phase, status (0 if no response yet), queued bytes
+//   cgi_start       fd, pid, script path
+//   cgi_exit        fd, pid, wait status
+//   response_queued fd, status, queued bytes, uri
+//   bytes_sent      fd, bytes, bytes still queued
+//   timeout         fd, phase, status sent (408, or 0 for an idle close)
+//   close           fd, phase, whether the client closed first
+//
+// Strings are NUL-terminated and valid only while the probe fires; fd is
+// negative for HTTP/2 streams. Phases are ClientConnection::Phase values.
+#pragma once
+
+#ifdef SELFSERV_WITH_USDT
+
+#include <sys/sdt.h>
+
+#define SELFSERV_PROBE2(name, a, b) STAP_PROBE2(selfserv, name, a, b)
+#define SELFSERV_PROBE3(name, a, b, c) STAP_PROBE3(selfserv, name, a, b, c)
+#define SELFSERV_PROBE4(name, a, b, c, d) \
+  STAP_PROBE4(selfserv, name, a, b, c, d)
+
+#else
+
+#define SELFSERV_PROBE2(name, a, b) ((void)0)
+#define SELFSERV_PROBE3(name, a, b, c) ((void)0)
+#define SELFSERV_PROBE4(name, a, b, c, d) ((void)0)
+
+#endif
@@ -0,0 +1,219 @@
+#include "server/PutUpload.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// O_DIRECT offsets, lengths and buffer addresses are multiples of this
+const size_t kDirectAlign = 4096;
+// Bytes staged per direct write
+const size_t kDirectChunk = 1024 * 1024;
+
+// Decimal digits into a non-negative off_t; false on overflow or no digits
+bool parseOffset(const std::string &s, size_t &pos, off_t &out) {
+  const off_t limit = (off_t)(((unsigned long)-1) >> 1);
+  size_t start = pos;
+  out = 0;
+  while (pos < s.size() && s[pos] >= '0' && s[pos] <= '9') {
+    int d = s[pos] - '0';
+    if (out > (limit - d) / 10) return false;
+    out = out * 10 + d;
+    ++pos;
+  }
+  return pos > start;
+}
+
+}  // namespace
+
+bool ParseContentRange(const std::string &value, ContentRange &out) {
+  size_t pos = 0;
+  while (pos < value.size() && value[pos] == ' ') ++pos;
+  if (value.compare(pos, 6, "bytes ") != 0) return false;
+  pos += 6;
+  while (pos < value.size() && value[pos] == ' ') ++pos;
+  if (!parseOffset(value, pos, out.first) || pos >= value.size() ||
+      value[pos++] != '-' || !parseOffset(value, pos, out.last) ||
+      pos >= value.size() || value[pos++] != '/')
+    return false;
+  if (value.compare(pos, std::string::npos, "*") == 0) {
+    out.total = -1;
+    pos = value.size();
+  } else if (!parseOffset(value, pos, out.total)) {
+    return false;
+  }
+  if (pos != value.size() || out.last < out.first) return false;
+  return out.total < 0 || out.last < out.total;
+}
+
+std::string UploadPartPath(const std::string &target) {
+  size_t slash = target.rfind('/');
+  size_t name = slash == std::string::npos ? 0 : slash + 1;
+  return target.substr(0, name) + "." + target.substr(name) + ".part";
+}
+
+bool UploadPersisted(const std::string &target, off_t &bytes) {
+  struct stat st;
+  if (::stat(UploadPartPath(target).c_str(), &st) != 0) return false;
+  bytes = st.st_size;
+  return true;
+}
+
+PutUpload::PutUpload()
+    : m_staged(0),
+      m_dropCacheMin(0),
+      m_directMin(0),
+      m_offset(0),
+      m_end(0),
+      m_total(-1),
+      m_persisted(0) {}
+
+int PutUpload::Begin(const std::string &target,
+                     const std::string &contentRange, off_t length,
+                     off_t maxSize) {
+  ContentRange range;
+  if (contentRange.empty()) {
+    range.first = 0;
+    range.last = length - 1;
+    range.total = length;
+  } else if (!ParseContentRange(contentRange, range) ||
+             range.last - range.first + 1 != length) {
+    return 400;
+  }
+  off_t declared = range.total >= 0 ? range.total : range.last + 1;
+  if (maxSize > 0 && declared > maxSize) return 413;
+  struct stat st;
+  if (::stat(target.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) return 409;
+  m_target = target;
+  m_part = UploadPartPath(target);
+  int flags = O_WRONLY | O_CREAT | (contentRange.empty() ? O_TRUNC : 0);
+  int fd = ::open(m_part.c_str(), flags, 0644);
+  if (fd < 0) return errno == ENOENT || errno == ENOTDIR ? 409 : 500;
+  m_fd.Reset(fd);
+  if (::fstat(fd, &st) != 0) {
+    m_fd.Reset(-1);
+    return 500;
+  }
+  m_persisted = st.st_size;
+  if (range.first > m_persisted) {
+    m_fd.Reset(-1);
+    return 409;
+  }
+  m_offset = range.first;
+  m_end = range.first + length;
+  m_total = range.total;
+  m_staged = 0;
+#ifdef O_DIRECT
+  if (m_directMin > 0 && declared >= m_directMin) {
+    // Filesystems without O_DIRECT (tmpfs on older kernels) refuse it;
+    // the upload then goes through the cache as usual
+    int direct = ::open(m_part.c_str(), O_WRONLY | O_DIRECT);
+    if (direct >= 0) {
+      m_directFd.Reset(direct);
+      m_stage.resize(kDirectChunk + kDirectAlign);
+    }
+  }
+#endif
+  if (!m_directFd.Valid() && m_dropCacheMin > 0 && declared >= m_dropCacheMin)
+    m_writeBehind.Start(m_offset);
+  return 0;
+}
+
+char *PutUpload::Stage() {
+  char *base = &m_stage[0];
+  return base + (kDirectAlign - (size_t)base % kDirectAlign) % kDirectAlign;
+}
+
+bool PutUpload::WriteAt(int fd, const char *data, size_t len) {
+  off_t at = m_offset - (off_t)m_staged;
+  while (len > 0) {
+    ssize_t n = ::pwrite(fd, data, len, at);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    data += n;
+    len -= (size_t)n;
+    at += n;
+    if (at > m_persisted) m_persisted = at;
+  }
+  return true;
+}
+
+// Writes the staged bytes: the block-aligned part directly, and with all
+// set the rest (a segment's tail) through the cache
+bool PutUpload::FlushStaged(bool all) {
+  size_t aligned = m_staged - m_staged % kDirectAlign;
+  size_t rest = all ? m_staged - aligned : 0;
+  if (aligned > 0 && !WriteAt(m_directFd.Get(), Stage(), aligned)) return false;
+  m_staged -= aligned;
+  if (rest > 0) {
+    std::memmove(Stage(), Stage() + aligned, rest);
+    if (!WriteAt(m_fd.Get(), Stage(), rest)) return false;
+    m_staged = 0;
+  }
+  return true;
+}
+
+bool PutUpload::Write(const char *data, size_t len) {
+  if (len > (size_t)Remaining()) len = (size_t)Remaining();
+  while (len > 0) {
+    size_t n = len;
+    if (m_directFd.Valid() &&
+        (m_staged > 0 || (size_t)m_offset % kDirectAlign == 0)) {
+      if (n > kDirectChunk - m_staged) n = kDirectChunk - m_staged;
+      std::memcpy(Stage() + m_staged, data, n);
+      m_staged += n;
+      m_offset += n;
+      if (m_staged == kDirectChunk && !FlushStaged(false)) return false;
+    } else {
+      // Cached write; with O_DIRECT only up to the next block boundary
+      if (m_directFd.Valid() &&
+          n > kDirectAlign - (size_t)m_offset % kDirectAlign)
+        n = kDirectAlign - (size_t)m_offset % kDirectAlign;
+      if (!WriteAt(m_fd.Get(), data, n)) return false;
+      m_offset += n;
+    }
+    data += n;
+    len -= n;
+  }
+  m_writeBehind.Advance(m_fd.Get(), m_offset);
+  return true;
+}
+
+void PutUpload::Abort() {
+  if (m_directFd.Valid()) FlushStaged(true);
+  m_writeBehind.Finish(m_fd.Get(), m_offset);
+  m_directFd.Reset(-1);
+  std::vector<char>().swap(m_stage);
+  m_fd.Reset(-1);
+}
+
+int PutUpload::Finish() {
+  bool flushed = !m_directFd.Valid() || FlushStaged(true);
+  m_writeBehind.Finish(m_fd.Get(), m_offset);
+  m_directFd.Reset(-1);
+  std::vector<char>().swap(m_stage);
+  if (!flushed) {
+    m_fd.Reset(-1);
+    return 500;
+  }
+  if (m_total < 0 || m_persisted < m_total) {
+    m_fd.Reset(-1);
+    return 202;
+  }
+  // A stale part file may be longer than this upload
+  if (m_persisted > m_total && ::ftruncate(m_fd.Get(), m_total) != 0) {
+    m_fd.Reset(-1);
+    return 500;
+  }
+  m_persisted = m_total;
+  m_fd.Reset(-1);
+  struct stat st;
+  bool existed = ::stat(m_target.c_str(), &st) == 0;
+  if (std::rename(m_part.c_str(), m_target.c_str()) != 0) return 500;
+  return existed ? 204 : 201;
+}
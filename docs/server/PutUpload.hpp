@@ -0,0 +1,90 @@
+// Resumable PUT uploads written straight to disk.
+#pragma once
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "server/FD.hpp"
+#include "server/PageCache.hpp"
+
+// "bytes first-last/total"; total is -1 for "*"
+struct ContentRange {
+  off_t first;
+  off_t last;
+  off_t total;
+  ContentRange() : first(0), last(0), total(-1) {}
+};
+
+bool ParseContentRange(const std::string &value, ContentRange &out);
+
+// Hidden file next to the target ("dir/.name.part") that collects the bytes
+std::string UploadPartPath(const std::string &target);
+// Bytes persisted so far for target; false when no upload is in progress
+bool UploadPersisted(const std::string &target, off_t &bytes);
+
+// A body is written into the part file with pwrite() at the offset its
+// Content-Range names (0 without one) as it arrives, so an interrupted
+// upload keeps every byte received. Segments may overlap what is already
+// on disk but never start past its end, which keeps the persisted bytes a
+// contiguous prefix whose length is simply the part file's size. Once that
+// prefix reaches the declared total the part file is renamed over the
+// target, so readers see the old file or the complete new one.
+//
+// Large uploads can be kept out of the page cache, where they would evict
+// hot static files: written pages are flushed and dropped behind the
+// cursor, or the body bypasses the cache with O_DIRECT. Direct writes must
+// be block-aligned, so the body is staged in an aligned buffer and only
+// the unaligned head and tail of a segment go through the cache.
+class PutUpload {
+ public:
+  PutUpload();
+  ~PutUpload() { Abort(); }
+
+  // For the next Begin: uploads totalling at least dropCacheMin bytes are
+  // written behind, at least directMin bytes with O_DIRECT (0: never)
+  void SetCachePolicy(off_t dropCacheMin, off_t directMin) {
+    m_dropCacheMin = dropCacheMin;
+    m_directMin = directMin;
+  }
+
+  // Opens the part file for a body of length bytes. contentRange may be
+  // empty: the upload then restarts from byte 0 with total = length.
+  // Returns 0, or the status to answer with: 400 (bad range), 409
+  // (segment starts past the persisted bytes, or no parent directory), 413
+  // (total above maxSize) or 500.
+  int Begin(const std::string &target, const std::string &contentRange,
+            off_t length, off_t maxSize);
+  bool Active() const { return m_fd.Valid(); }
+  off_t Remaining() const { return m_end - m_offset; }
+  bool Write(const char *data, size_t len);
+  // After the whole body: 201 (created) or 204 (replaced) once the target
+  // is complete, 202 while bytes are missing, 500 on error. Closes the
+  // part file either way.
+  int Finish();
+  // Closes the part file, which stays for a resume, with every byte
+  // received so far written
+  void Abort();
+  off_t Persisted() const { return m_persisted; }
+  bool Direct() const { return m_directFd.Valid(); }
+
+ private:
+  bool WriteAt(int fd, const char *data, size_t len);
+  bool FlushStaged(bool all);
+  char *Stage();
+
+  std::string m_target;
+  std::string m_part;
+  FD m_fd;
+  FD m_directFd;  // the part file again, opened O_DIRECT
+  std::vector<char> m_stage;  // holds an aligned block for direct writes
+  size_t m_staged;            // body bytes in it, ending at m_offset
+  WriteBehind m_writeBehind;
+  off_t m_dropCacheMin;
+  off_t m_directMin;
+  off_t m_offset;     // next byte of the body goes here
+  off_t m_end;        // one past the body's last byte
+  off_t m_total;      // declared size; -1 when unknown
+  off_t m_persisted;  // contiguous bytes on disk
+};
@@ -0,0 +1,75 @@
+#include "server/ResponseCache.hpp"
+
+ResponseCache::ResponseCache(size_t maxBytes)
+    : m_maxBytes(maxBytes), m_bytes(0), m_clock(0) {}
+
+void ResponseCache::SetCapacity(size_t maxBytes) {
+  m_maxBytes = maxBytes;
+  Evict(0);
+}
+
+size_t ResponseCache::Cost(const std::string &key, const Entry &e) {
+  return key.size() + e.head.size() + e.body.Size();
+}
+
+bool ResponseCache::Lookup(const std::string &key, unsigned long nowMs,
+                           Hit &hit) {
+  EntryMap::iterator it = m_entries.find(key);
+  if (it == m_entries.end()) return false;
+  Entry &e = it->second;
+  if (nowMs >= e.staleUntilMs) {
+    EraseEntry(it);
+    return false;
+  }
+  m_lru.erase(e.lastUse);
+  e.lastUse = ++m_clock;
+  m_lru[e.lastUse] = key;
+  hit.head = e.head;
+  hit.body = e.body;
+  hit.ageSec = (nowMs - e.storedMs) / 1000;
+  hit.stale = nowMs >= e.freshUntilMs;
+  hit.refresh = hit.stale && !e.refreshing;
+  if (hit.refresh) e.refreshing = true;
+  return true;
+}
+
+void ResponseCache::Store(const std::string &key, const std::string &head,
+                          const std::string &body, unsigned long nowMs,
+                          unsigned long ttlMs, unsigned long staleMs) {
+  Erase(key);
+  Entry e;
+  e.head = head;
+  e.body = SharedBuffer(body);
+  size_t cost = Cost(key, e);
+  if (ttlMs == 0 || cost > m_maxBytes / 2) return;  // never crowd out the rest
+  Evict(cost);
+  e.storedMs = nowMs;
+  e.freshUntilMs = nowMs + ttlMs;
+  e.staleUntilMs = e.freshUntilMs + staleMs;
+  e.lastUse = ++m_clock;
+  m_entries[key] = e;
+  m_lru[e.lastUse] = key;
+  m_bytes += cost;
+}
+
+void ResponseCache::Erase(const std::string &key) {
+  EntryMap::iterator it = m_entries.find(key);
+  if (it != m_entries.end()) EraseEntry(it);
+}
+
+void ResponseCache::EraseEntry(EntryMap::iterator it) {
+  m_bytes -= Cost(it->first, it->second);
+  m_lru.erase(it->second.lastUse);
+  m_entries.erase(it);
+}
+
+void ResponseCache::Evict(size_t needed) {
+  while (!m_lru.empty() && m_bytes + needed > m_maxBytes) {
+    EntryMap::iterator it = m_entries.find(m_lru.begin()->second);
+    if (it == m_entries.end()) {  // cannot happen; keep the index consistent
+      m_lru.erase(m_lru.begin());
+      continue;
+    }
+    EraseEntry(it);
+  }
+}
@@ -0,0 +1,64 @@
+// In-memory cache of complete CGI responses, one per virtual host.
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <string>
+
+#include "util/SharedBuffer.hpp"
+
+// Entries hold the response head (status line and headers, without
+// Connection or the blank line) and a shared body, so a hit is assembled from
+// memory with no copy of the body. Past its TTL an entry may still be served
+// for a stale-while-revalidate window while one refresh runs; least recently
+// used entries are evicted to stay under the byte cap.
+class ResponseCache {
+ public:
+  struct Hit {
+    std::string head;
+    SharedBuffer body;
+    unsigned long ageSec;
+    bool stale;
+    bool refresh;  // this caller should start the background refresh
+    Hit() : ageSec(0), stale(false), refresh(false) {}
+  };
+
+  explicit ResponseCache(size_t maxBytes = 16 * 1024 * 1024);
+
+  void SetCapacity(size_t maxBytes);
+  // False on a miss or once the stale window has passed
+  bool Lookup(const std::string &key, unsigned long nowMs, Hit &hit);
+  void Store(const std::string &key, const std::string &head,
+             const std::string &body, unsigned long nowMs,
+             unsigned long ttlMs, unsigned long staleMs);
+  void Erase(const std::string &key);
+  size_t Bytes() const { return m_bytes; }
+
+ private:
+  struct Entry {
+    std::string head;
+    SharedBuffer body;
+    unsigned long storedMs;
+    unsigned long freshUntilMs;
+    unsigned long staleUntilMs;
+    unsigned long lastUse;  // key into m_lru
+    bool refreshing;
+    Entry()
+        : storedMs(0),
+          freshUntilMs(0),
+          staleUntilMs(0),
+          lastUse(0),
+          refreshing(false) {}
+  };
+  typedef std::map<std::string, Entry> EntryMap;
+
+  static size_t Cost(const std::string &key, const Entry &e);
+  void EraseEntry(EntryMap::iterator it);
+  void Evict(size_t needed);
+
+  size_t m_maxBytes;
+  size_t m_bytes;
+  unsigned long m_clock;  // use counter; lower means less recently used
+  EntryMap m_entries;
+  std::map<unsigned long, std::string> m_lru;  // lastUse -> key
+};
@@ -0,0 +1,595 @@
+#include "server/Rewrite.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+namespace {
+
+// Program opcodes; each instruction is three ints: op, x, y
+enum Op {
+  kOpByte,   // x: byte set; consumes one byte in the set
+  kOpSplit,  // try x, then y
+  kOpJmp,    // continue at x
+  kOpSave,   // record the position in capture slot x
+  kOpMatch   // rule x matched
+};
+
+const size_t kMaxStates = 8192;
+const int kMaxGroups = 10;  // $0 (whole match) .. $9
+const int kCaptureSlots = kMaxGroups * 2;
+
+// Pattern syntax tree, built before emitting code so alternatives and
+// repetitions can be laid out with known jump targets
+struct Node {
+  enum Type { kSet, kCat, kAlt, kStar, kPlus, kQuest, kGroup, kEmpty } type;
+  int a, b;  // children (kCat, kAlt) or child (others)
+  int value;  // kSet: byte set; kGroup: group number
+  Node(Type t, int x, int y, int v) : type(t), a(x), b(y), value(v) {}
+};
+
+class PatternParser {
+ public:
+  PatternParser(const std::string &src, size_t pos,
+                std::vector<std::vector<bool> > &sets,
+                std::vector<Node> &nodes)
+      : m_src(src), m_pos(pos), m_sets(sets), m_nodes(nodes), m_groups(1) {}
+
+  // Parses up to end (exclusive); -1 on error with Error() set
+  int Parse(size_t end) {
+    m_end = end;
+    int root = ParseAlt();
+    if (root >= 0 && m_pos != m_end) return Fail("unbalanced ')'");
+    return root;
+  }
+  const std::string &Error() const { return m_error; }
+  int Literal(unsigned char c) {
+    return Add(Node::kSet, -1, -1, AddSet(c, c, false));
+  }
+  int AnyByte() { return Add(Node::kSet, -1, -1, AddSet(0, 255, false)); }
+  int Add(Node::Type t, int a, int b, int v) {
+    m_nodes.push_back(Node(t, a, b, v));
+    return (int)m_nodes.size() - 1;
+  }
+  int NextGroup() { return m_groups++; }
+
+ private:
+  int Fail(const char *msg) {
+    if (m_error.empty()) m_error = msg;
+    return -1;
+  }
+
+  int AddSet(unsigned char lo, unsigned char hi, bool negate) {
+    std::vector<bool> set(256, negate);
+    for (int c = lo; c <= hi; ++c) set[c] = !negate;
+    m_sets.push_back(set);
+    return (int)m_sets.size() - 1;
+  }
+
+  int ParseAlt() {
+    int left = ParseCat();
+    while (left >= 0 && m_pos < m_end && m_src[m_pos] == '|') {
+      ++m_pos;
+      int right = ParseCat();
+      if (right < 0) return -1;
+      left = Add(Node::kAlt, left, right, 0);
+    }
+    return left;
+  }
+
+  int ParseCat() {
+    int left = Add(Node::kEmpty, -1, -1, 0);
+    while (m_pos < m_end && m_src[m_pos] != '|' && m_src[m_pos] != ')') {
+      int atom = ParseRepeat();
+      if (atom < 0) return -1;
+      left = Add(Node::kCat, left, atom, 0);
+    }
+    return left;
+  }
+
+  int ParseRepeat() {
+    int atom = ParseAtom();
+    while (atom >= 0 && m_pos < m_end) {
+      char c = m_src[m_pos];
+      if (c == '*')
+        atom = Add(Node::kStar, atom, -1, 0);
+      else if (c == '+')
+        atom = Add(Node::kPlus, atom, -1, 0);
+      else if (c == '?')
+        atom = Add(Node::kQuest, atom, -1, 0);
+      else
+        break;
+      ++m_pos;
+    }
+    return atom;
+  }
+
+  int ParseAtom() {
+    char c = m_src[m_pos++];
+    switch (c) {
+      case '.':
+        return AnyByte();
+      case '[':
+        return ParseClass();
+      case '(': {
+        if (m_groups >= kMaxGroups) return Fail("more than 9 groups");
+        int group = m_groups++;
+        int inner = ParseAlt();
+        if (inner < 0) return -1;
+        if (m_pos >= m_end || m_src[m_pos] != ')') return Fail("missing ')'");
+        ++m_pos;
+        return Add(Node::kGroup, inner, -1, group);
+      }
+      case '*':
+      case '+':
+      case '?':
+        return Fail("quantifier without operand");
+      case '$':
+        return Fail("'$' is only allowed at the end");
+      case '\\':
+        if (m_pos >= m_end) return Fail("trailing '\\'");
+        return Literal((unsigned char)m_src[m_pos++]);
+      default:
+        return Literal((unsigned char)c);
+    }
+  }
+
+  // [abc], [a-z0-9_], [^/]; ']' first is a literal
+  int ParseClass() {
+    bool negate = m_pos < m_end && m_src[m_pos] == '^';
+    if (negate) ++m_pos;
+    std::vector<bool> set(256, false);
+    bool first = true;
+    while (m_pos < m_end && (first || m_src[m_pos] != ']')) {
+      first = false;
+      unsigned char lo = (unsigned char)m_src[m_pos++];
+      if (lo == '\\' && m_pos < m_end) lo = (unsigned char)m_src[m_pos++];
+      unsigned char hi = lo;
+      if (m_pos + 1 < m_end && m_src[m_pos] == '-' &&
+          m_src[m_pos + 1] != ']') {
+        hi = (unsigned char)m_src[m_pos + 1];
+        m_pos += 2;
+        if (hi < lo) return Fail("bad range in []");
+      }
+      for (int b = lo; b <= hi; ++b) set[b] = true;
+    }
+    if (m_pos >= m_end) return Fail("missing ']'");
+    ++m_pos;
+    if (negate) set.flip();
+    m_sets.push_back(set);
+    return Add(Node::kSet, -1, -1, (int)m_sets.size() - 1);
+  }
+
+  const std::string &m_src;
+  size_t m_pos;
+  size_t m_end;
+  std::vector<std::vector<bool> > &m_sets;
+  std::vector<Node> &m_nodes;
+  int m_groups;
+  std::string m_error;
+};
+
+int emit(std::vector<int> &prog, int op, int x, int y) {
+  prog.push_back(op);
+  prog.push_back(x);
+  prog.push_back(y);
+  return (int)prog.size() / 3 - 1;
+}
+
+int nextPc(const std::vector<int> &prog) { return (int)prog.size() / 3; }
+
+void emitNode(std::vector<int> &prog, const std::vector<Node> &nodes,
+              int n) {
+  const Node &node = nodes[n];
+  switch (node.type) {
+    case Node::kEmpty:
+      break;
+    case Node::kSet:
+      emit(prog, kOpByte, node.value, 0);
+      break;
+    case Node::kCat:
+      emitNode(prog, nodes, node.a);
+      emitNode(prog, nodes, node.b);
+      break;
+    case Node::kAlt: {
+      int split = emit(prog, kOpSplit, 0, 0);
+      emitNode(prog, nodes, node.a);
+      int jmp = emit(prog, kOpJmp, 0, 0);
+      prog[split * 3 + 1] = split + 1;
+      prog[split * 3 + 2] = nextPc(prog);
+      emitNode(prog, nodes, node.b);
+      prog[jmp * 3 + 1] = nextPc(prog);
+      break;
+    }
+    case Node::kStar: {
+      int split = emit(prog, kOpSplit, 0, 0);
+      emitNode(prog, nodes, node.a);
+      emit(prog, kOpJmp, split, 0);
+      prog[split * 3 + 1] = split + 1;
+      prog[split * 3 + 2] = nextPc(prog);
+      break;
+    }
+    case Node::kPlus: {
+      int start = nextPc(prog);
+      emitNode(prog, nodes, node.a);
+      emit(prog, kOpSplit, start, nextPc(prog) + 1);
+      break;
+    }
+    case Node::kQuest: {
+      int split = emit(prog, kOpSplit, 0, 0);
+      emitNode(prog, nodes, node.a);
+      prog[split * 3 + 1] = split + 1;
+      prog[split * 3 + 2] = nextPc(prog);
+      break;
+    }
+    case Node::kGroup:
+      emit(prog, kOpSave, node.value * 2, 0);
+      emitNode(prog, nodes, node.a);
+      emit(prog, kOpSave, node.value * 2 + 1, 0);
+      break;
+  }
+}
+
+const char *reasonFor(int code) {
+  switch (code) {
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 303: return "See Other";
+    case 307: return "Temporary Redirect";
+    case 308: return "Permanent Redirect";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 410: return "Gone";
+    case 429: return "Too Many Requests";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+    default: return code < 400 ? "OK" : "Error";
+  }
+}
+
+bool isRedirect(int code) {
+  return code == 301 || code == 302 || code == 303 || code == 307 ||
+         code == 308;
+}
+
+// Captures come from the decoded path; re-escape what would change meaning
+// in a target or a Location header
+void appendEscaped(std::string &out, const std::string &s) {
+  static const char kHex[] = "0123456789ABCDEF";
+  for (size_t i = 0; i < s.size(); ++i) {
+    unsigned char c = (unsigned char)s[i];
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+        (c >= '0' && c <= '9') || (c && std::strchr("-._~/!$&'()*+,;=:@", c))) {
+      out += (char)c;
+    } else {
+      out += '%';
+      out += kHex[c >> 4];
+      out += kHex[c & 15];
+    }
+  }
+}
+
+struct Thread {
+  int pc;
+  int caps[kCaptureSlots];
+};
+
+// Pike VM thread list insertion: follows epsilon edges in priority order,
+// so earlier threads are preferred (leftmost alternative, greedy repeats)
+// mark is indexed from the rule's first instruction (base)
+void addThread(const std::vector<int> &prog, std::vector<Thread> &list,
+               std::vector<int> &mark, int base, int gen, int pc,
+               const int *caps, int pos) {
+  if (mark[pc - base] == gen) return;
+  mark[pc - base] = gen;
+  int op = prog[pc * 3], x = prog[pc * 3 + 1], y = prog[pc * 3 + 2];
+  if (op == kOpJmp) {
+    addThread(prog, list, mark, base, gen, x, caps, pos);
+  } else if (op == kOpSplit) {
+    addThread(prog, list, mark, base, gen, x, caps, pos);
+    addThread(prog, list, mark, base, gen, y, caps, pos);
+  } else if (op == kOpSave) {
+    int saved[kCaptureSlots];
+    std::copy(caps, caps + kCaptureSlots, saved);
+    saved[x] = pos;
+    addThread(prog, list, mark, base, gen, pc + 1, saved, pos);
+  } else {
+    Thread t;
+    t.pc = pc;
+    std::copy(caps, caps + kCaptureSlots, t.caps);
+    list.push_back(t);
+  }
+}
+
+}  // namespace
+
+RewriteEngine::RewriteEngine() : m_classCount(0) {
+  std::fill(m_byteClass, m_byteClass + 256, 0);
+}
+
+bool RewriteEngine::Compile(const std::vector<RewriteRule> &rules,
+                            std::string &error) {
+  m_rules.clear();
+  m_prog.clear();
+  m_sets.clear();
+  for (size_t r = 0; r < rules.size(); ++r) {
+    const std::string &pat = rules[r].pattern;
+    if (pat.empty() || (pat[0] != '/' && pat[0] != '=' && pat[0] != '^')) {
+      error = "rewrite pattern '" + pat + "' must start with '/', '=' or '^'";
+      return false;
+    }
+    bool regex = pat[0] == '^';
+    size_t end = pat.size();
+    // Must the pattern consume the whole path? Regexes only with a final '$'
+    bool anchored = !regex || (end > 1 && pat[end - 1] == '$' &&
+                               (end < 3 || pat[end - 2] != '\\'));
+    std::vector<Node> nodes;
+    PatternParser parser(pat, regex ? 1 : 0, m_sets, nodes);
+    int root;
+    if (regex) {
+      root = parser.Parse(anchored ? end - 1 : end);
+    } else {
+      // "=/exact" or a literal prefix whose remainder is group 1
+      bool exact = !pat.empty() && pat[0] == '=';
+      root = parser.Add(Node::kEmpty, -1, -1, 0);
+      for (size_t i = exact ? 1 : 0; i < pat.size(); ++i)
+        root = parser.Add(Node::kCat, root,
+                          parser.Literal((unsigned char)pat[i]), 0);
+      if (!exact) {
+        int rest = parser.Add(Node::kStar, parser.AnyByte(), -1, 0);
+        root = parser.Add(Node::kCat, root,
+                          parser.Add(Node::kGroup, rest, -1,
+                                     parser.NextGroup()),
+                          0);
+      }
+    }
+    if (root < 0) {
+      error = "rewrite pattern '" + pat + "': " + parser.Error();
+      return false;
+    }
+
+    Rule rule;
+    rule.config = rules[r];
+    rule.start = emit(m_prog, kOpSave, 0, 0);
+    emitNode(m_prog, nodes, root);
+    emit(m_prog, kOpSave, 1, 0);
+    if (!anchored) {
+      // Unanchored end: anything may follow the match
+      int any = (int)m_sets.size();
+      m_sets.push_back(std::vector<bool>(256, true));
+      int split = emit(m_prog, kOpSplit, 0, 0);
+      emit(m_prog, kOpByte, any, 0);
+      emit(m_prog, kOpJmp, split, 0);
+      m_prog[split * 3 + 1] = split + 1;
+      m_prog[split * 3 + 2] = nextPc(m_prog);
+    }
+    emit(m_prog, kOpMatch, (int)r, 0);
+    rule.end = nextPc(m_prog);
+
+    const std::string &t = rule.config.target;
+    rule.usesCaptures = false;
+    for (size_t i = 0; i + 1 < t.size(); ++i)
+      if (t[i] == '$' && t[i + 1] >= '0' && t[i + 1] <= '9')
+        rule.usesCaptures = true;
+    rule.appendsQuery =
+        (rule.config.code == 0 || isRedirect(rule.config.code)) &&
+        t.find('?') == std::string::npos;
+    std::vector<int> noCaps(kCaptureSlots, -1);
+    Expand(rule, "", "", noCaps, rule.fixed);
+    m_rules.push_back(rule);
+  }
+  BuildByteClasses();
+  return BuildDfa(error);
+}
+
+// Bytes that every set treats alike share a class, so the transition table
+// has one column per class instead of 256
+void RewriteEngine::BuildByteClasses() {
+  std::map<std::vector<bool>, int> classes;
+  m_classRep.clear();
+  for (int c = 0; c < 256; ++c) {
+    std::vector<bool> signature(m_sets.size());
+    for (size_t s = 0; s < m_sets.size(); ++s) signature[s] = m_sets[s][c];
+    std::map<std::vector<bool>, int>::iterator it = classes.find(signature);
+    if (it == classes.end()) {
+      it = classes.insert(std::make_pair(signature, (int)m_classRep.size()))
+               .first;
+      m_classRep.push_back((unsigned char)c);
+    }
+    m_byteClass[c] = (unsigned char)it->second;
+  }
+  m_classCount = (int)m_classRep.size();
+}
+
+void RewriteEngine::Closure(int pc, std::vector<char> &seen,
+                            std::vector<int> &out) const {
+  std::vector<int> stack(1, pc);
+  while (!stack.empty()) {
+    int p = stack.back();
+    stack.pop_back();
+    if (seen[p]) continue;
+    seen[p] = 1;
+    int op = m_prog[p * 3];
+    if (op == kOpSplit) {
+      stack.push_back(m_prog[p * 3 + 2]);
+      stack.push_back(m_prog[p * 3 + 1]);
+    } else if (op == kOpJmp) {
+      stack.push_back(m_prog[p * 3 + 1]);
+    } else if (op == kOpSave) {
+      stack.push_back(p + 1);
+    } else {
+      out.push_back(p);
+    }
+  }
+}
+
+// Subset construction over every rule's program at once. A DFA state is the
+// sorted set of byte/match instructions the NFA could be at.
+bool RewriteEngine::BuildDfa(std::string &error) {
+  m_trans.clear();
+  m_accept.clear();
+  if (m_rules.empty()) return true;
+  size_t progLen = m_prog.size() / 3;
+  std::map<std::vector<int>, int> ids;
+  std::vector<std::vector<int> > states;
+
+  std::vector<char> seen(progLen, 0);
+  std::vector<int> start;
+  for (size_t r = 0; r < m_rules.size(); ++r)
+    Closure(m_rules[r].start, seen, start);
+  std::sort(start.begin(), start.end());
+  ids[start] = 0;
+  states.push_back(start);
+
+  for (size_t s = 0; s < states.size(); ++s) {
+    int accept = -1;
+    for (size_t i = 0; i < states[s].size(); ++i) {
+      int pc = states[s][i];
+      if (m_prog[pc * 3] == kOpMatch &&
+          (accept < 0 || m_prog[pc * 3 + 1] < accept))
+        accept = m_prog[pc * 3 + 1];
+    }
+    m_accept.push_back(accept);
+    for (int c = 0; c < m_classCount; ++c) {
+      unsigned char rep = m_classRep[c];
+      std::vector<int> next;
+      std::fill(seen.begin(), seen.end(), 0);
+      for (size_t i = 0; i < states[s].size(); ++i) {
+        int pc = states[s][i];
+        if (m_prog[pc * 3] == kOpByte && m_sets[m_prog[pc * 3 + 1]][rep])
+          Closure(pc + 1, seen, next);
+      }
+      if (next.empty()) {
+        m_trans.push_back(-1);
+        continue;
+      }
+      std::sort(next.begin(), next.end());
+      std::map<std::vector<int>, int>::iterator it = ids.find(next);
+      if (it == ids.end()) {
+        if (states.size() >= kMaxStates) {
+          error = "rewrite rules need too many automaton states";
+          return false;
+        }
+        it = ids.insert(std::make_pair(next, (int)states.size())).first;
+        states.push_back(next);
+      }
+      m_trans.push_back(it->second);
+    }
+  }
+  return true;
+}
+
+bool RewriteEngine::Match(const std::string &path, const std::string &query,
+                          RewriteResult &out) const {
+  if (m_rules.empty()) return false;
+  int state = 0;
+  for (size_t i = 0; i < path.size(); ++i) {
+    state = m_trans[state * m_classCount +
+                    m_byteClass[(unsigned char)path[i]]];
+    if (state < 0) return false;
+  }
+  if (m_accept[state] < 0) return false;
+  const Rule &rule = m_rules[m_accept[state]];
+  if (!rule.usesCaptures && (!rule.appendsQuery || query.empty())) {
+    out = rule.fixed;
+    return true;
+  }
+  std::vector<int> caps(kCaptureSlots, -1);
+  if (rule.usesCaptures && !Captures(rule, path, caps)) return false;
+  Expand(rule, path, query, caps, out);
+  return true;
+}
+
+bool RewriteEngine::Captures(const Rule &rule, const std::string &path,
+                             std::vector<int> &caps) const {
+  std::vector<int> mark(rule.end - rule.start, -1);
+  std::vector<Thread> clist, nlist;
+  int gen = 0;
+  addThread(m_prog, clist, mark, rule.start, gen++, rule.start, &caps[0], 0);
+  bool matched = false;
+  for (size_t pos = 0; pos <= path.size() && !clist.empty(); ++pos) {
+    nlist.clear();
+    for (size_t i = 0; i < clist.size(); ++i) {
+      const Thread &t = clist[i];
+      int op = m_prog[t.pc * 3];
+      if (op == kOpMatch) {
+        if (pos == path.size()) {
+          // Highest-priority full match; lower threads are cut off
+          caps.assign(t.caps, t.caps + kCaptureSlots);
+          matched = true;
+          break;
+        }
+      } else if (op == kOpByte && pos < path.size() &&
+                 m_sets[m_prog[t.pc * 3 + 1]][(unsigned char)path[pos]]) {
+        addThread(m_prog, nlist, mark, rule.start, gen, t.pc + 1, t.caps,
+                  (int)pos + 1);
+      }
+    }
+    ++gen;
+    clist.swap(nlist);
+  }
+  return matched;
+}
+
+void RewriteEngine::Expand(const Rule &rule, const std::string &path,
+                           const std::string &query,
+                           const std::vector<int> &caps,
+                           RewriteResult &out) const {
+  const std::string &t = rule.config.target;
+  int code = rule.config.code;
+  std::string target;
+  for (size_t i = 0; i < t.size(); ++i) {
+    if (t[i] == '$' && i + 1 < t.size() && t[i + 1] >= '0' &&
+        t[i + 1] <= '9') {
+      int g = t[++i] - '0';
+      if (caps[g * 2] >= 0 && caps[g * 2 + 1] >= caps[g * 2])
+        appendEscaped(target,
+                      path.substr(caps[g * 2], caps[g * 2 + 1] - caps[g * 2]));
+    } else {
+      target += t[i];
+    }
+  }
+  if (code == 0 || isRedirect(code)) {
+    // As in nginx: the request's query string follows the new target unless
+    // the target has its own; a trailing '?' drops it
+    if (rule.appendsQuery) {
+      if (!query.empty()) target += "?" + query;
+    } else if (target[target.size() - 1] == '?') {
+      target.erase(target.size() - 1);
+    } else if (!query.empty()) {
+      target += "&" + query;
+    }
+  }
+
+  out = RewriteResult();
+  out.code = code;
+  out.target = target;
+  if (code == 0) {
+    out.action = RewriteResult::kRewriteInternal;
+    return;
+  }
+  out.action = RewriteResult::kRewriteRespond;
+  const char *ctype = "text/plain";
+  if (isRedirect(code)) {
+    ctype = "text/html";
+    out.body = std::string("<html><body><h1>") + reasonFor(code) +
+               "</h1><a href='" + target + "'>" + target +
+               "</a></body></html>";
+  } else {
+    out.body = target;
+  }
+  char status[64];
+  std::sprintf(status, "HTTP/1.1 %d %s\r\n", code, reasonFor(code));
+  out.head = status;
+  if (isRedirect(code)) out.head += "Location: " + target + "\r\n";
+  char len[64];
+  std::sprintf(len, "Content-Length: %lu\r\n", (unsigned long)out.body.size());
+  out.head += len;
+  out.head += "Content-Type: ";
+  out.head += ctype;
+  out.head += "\r\n";
+}
@@ -0,0 +1,76 @@
+// Per-virtual-host rewrite/return rules compiled into one DFA.
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "config/Config.hpp"
+
+// Outcome of matching a request path against a server's rules
+struct RewriteResult {
+  enum Action {
+    kRewriteNone,      // no rule matched
+    kRewriteInternal,  // serve target (path and query) instead
+    kRewriteRespond    // send response as is
+  };
+  Action action;
+  int code;
+  std::string target;  // internal: new request target; 3xx: Location
+  // For kRewriteRespond: status line and headers without Connection or the
+  // blank line, then the body separately
+  std::string head;
+  std::string body;
+  RewriteResult() : action(kRewriteNone), code(0) {}
+};
+
+// All rules of a server block are compiled at startup into a Thompson
+// program and then, by subset construction, into a single DFA over byte
+// equivalence classes. Matching a path is one table lookup per byte and
+// names the first rule (in configuration order) that matches. Only when
+// that rule's target refers to captures ($0..$9) is the rule's own program
+// run again, as a Pike VM, to extract them; both passes are linear in the
+// path length whatever the number of rules. Responses of rules whose
+// targets use no captures are serialized once at compile time.
+class RewriteEngine {
+ public:
+  RewriteEngine();
+
+  // False with a message for a malformed pattern or an automaton too large
+  // to build
+  bool Compile(const std::vector<RewriteRule> &rules, std::string &error);
+  bool Empty() const { return m_rules.empty(); }
+  size_t StateCount() const { return m_accept.size(); }
+
+  bool Match(const std::string &path, const std::string &query,
+             RewriteResult &out) const;
+
+ private:
+  struct Rule {
+    RewriteRule config;
+    int start;            // first instruction in m_prog
+    int end;              // one past its last instruction
+    bool usesCaptures;    // target mentions $0..$9
+    bool appendsQuery;    // request query is carried over to the target
+    RewriteResult fixed;  // the result when neither applies
+  };
+
+  void BuildByteClasses();
+  bool BuildDfa(std::string &error);
+  void Closure(int pc, std::vector<char> &seen, std::vector<int> &out) const;
+  bool Captures(const Rule &rule, const std::string &path,
+                std::vector<int> &caps) const;
+  void Expand(const Rule &rule, const std::string &path,
+              const std::string &query, const std::vector<int> &caps,
+              RewriteResult &out) const;
+
+  std::vector<Rule> m_rules;
+  // Three ints per instruction: opcode, x, y (see Rewrite.cpp)
+  std::vector<int> m_prog;
+  std::vector<std::vector<bool> > m_sets;  // 256 flags per byte set
+  std::vector<unsigned char> m_classRep;   // a member byte of each class
+  unsigned char m_byteClass[256];
+  int m_classCount;
+  std::vector<int> m_trans;   // state * m_classCount + class -> state or -1
+  std::vector<int> m_accept;  // state -> first matching rule or -1
+};
@@ -8,9 +8,11 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cctype>
 #include <cerrno>
 #include <cstdio>
@@ -20,27 +22,218 @@
 #include <fstream>
 #include <iostream>
 
+#include "http/Uri.hpp"
+#include "server/Probes.hpp"
+
+extern char **environ;  // replaced in CGI children before exec
+
 namespace {
+// Bytes of directory listing rendered per write-readiness event
+const size_t kDirListingSliceBytes = 16 * 1024;
+// Streamed PUT bodies are written once this much is buffered (or the socket
+// has no more to read), so pwrite() is not called per recv()
+const size_t kPutWriteBytes = 64 * 1024;
+// Bytes of a multi-part upload joined per event-loop pass
+const size_t kAssemblySliceBytes = 64 * 1024 * 1024;
+// How long buffers of a closed connection's unfinished zero-copy sends are
+// kept; covers the kernel flushing what was queued before the close
+const unsigned long kZeroCopyLingerMs = 120 * 1000;
+// Window over which the longest event-loop pass is reported, and how often
+// the resident set size is refreshed
+const unsigned long kLoopWindowUs = 1000000;
+
 static bool setNonBlocking(int fd) {
   int flags = fcntl(fd, F_GETFL, 0);
   if (flags < 0) return false;
   if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return false;
   return true;
 }
+
+// Resident set size from /proc/self/statm; 0 where it is not available
+int64_t residentBytes() {
+  int fd = ::open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return 0;
+  char buf[128];
+  ssize_t n = ::read(fd, buf, sizeof(buf) - 1);
+  ::close(fd);
+  if (n <= 0) return 0;
+  buf[n] = '\0';
+  unsigned long size = 0, resident = 0;
+  if (std::sscanf(buf, "%lu %lu", &size, &resident) != 2) return 0;
+  return (int64_t)resident * ::sysconf(_SC_PAGESIZE);
+}
 }  // namespace
 
 // forward declaration for static helper used in timeout sweep
 static std::string buildResponse(int code, const std::string &reason,
                                  const std::string &body, const char *ctype,
-                                 bool keepAlive, bool headOnly);
+                                 bool keepAlive, bool headOnly,
+                                 const std::string &extraHeaders = "");
 static std::string buildRedirect(int code, const std::string &reason,
                                  const std::string &location, bool keepAlive);
 static std::string loadErrorPageBody(const ServerConfig &sc, int code,
                                      const std::string &fallback);
 
-Server::Server(const Config &cfg) : m_config(cfg) {}
+Server::Server(const Config &cfg)
+    : m_config(cfg),
+      m_perfSampling(false),
+      m_loopWindowUs(0),
+      m_loopMaxUs(0),
+      m_nextCaptureId(0),
+      m_nextStreamKey(-2),
+      m_nextWsId(1) {}
+
+bool Server::Init() {
+  m_quotas.assign(m_config.servers.size(), VhostQuota());
+  for (size_t i = 0; i < m_config.servers.size(); ++i) {
+    const ServerConfig &sc = m_config.servers[i];
+    m_quotas[i].Configure(sc.limitConnections, sc.limitBuffered, sc.limitCgi,
+                          sc.limitRate, sc.limitBurst);
+  }
+  OpenPerfCounters();
+  return OpenStats() && CompileRewrites() && CompileAccessLists() &&
+         CompileCachePolicies() && OpenSharedCaches() && OpenCaptures() &&
+         OpenListeningSockets();
+}
+
+// Counters are process-wide: the first server block naming a segment
+// decides where they are shared; without one they stay private
+bool Server::OpenStats() {
+  std::string path;
+  for (size_t i = 0; i < m_config.servers.size() && path.empty(); ++i)
+    path = m_config.servers[i].statsSegment;
+  std::string error;
+  if (!m_stats.Open(path, error)) {
+    std::cerr << "[stats] " << error << "\n";
+    return false;
+  }
+  return true;
+}
+
+// Instrumentation only: without a PMU the server runs unmeasured
+void Server::OpenPerfCounters() {
+  bool wanted = false;
+  for (size_t i = 0; i < m_config.servers.size(); ++i)
+    wanted = wanted || m_config.servers[i].perfCounters;
+  if (!wanted) return;
+  std::string error;
+  if (!m_perf.Open(error))
+    std::cerr << "[perf] " << error << "; hardware counters off\n";
+  else if (!m_perf.KernelIncluded())
+    std::cerr << "[perf] counting user space only (perf_event_paranoid)\n";
+}
+
+bool Server::CompileRewrites() {
+  m_rewrites.assign(m_config.servers.size(), RewriteEngine());
+  for (size_t i = 0; i < m_config.servers.size(); ++i) {
+    const ServerConfig &sc = m_config.servers[i];
+    std::string error;
+    if (!m_rewrites[i].Compile(sc.rewrites, error)) {
+      std::cerr << "[rewrite] " << sc.host << ":" << sc.port << ": " << error
+                << "\n";
+      return false;
+    }
+    if (!sc.rewrites.empty())
+      std::cerr << "[rewrite] " << sc.host << ":" << sc.port << " "
+                << sc.rewrites.size() << " rules, "
+                << m_rewrites[i].StateCount() << " states\n";
+  }
+  return true;
+}
+
+bool Server::CompileAccessLists() {
+  m_serverAccess.assign(m_config.servers.size(), IpAccessList());
+  m_routeAccess.assign(m_config.servers.size(),
+                       std::vector<IpAccessList>());
+  for (size_t i = 0; i < m_config.servers.size(); ++i) {
+    const ServerConfig &sc = m_config.servers[i];
+    std::string error;
+    bool ok = m_serverAccess[i].Build(sc.access, error);
+    m_routeAccess[i].assign(sc.routes.size(), IpAccessList());
+    for (size_t r = 0; ok && r < sc.routes.size(); ++r)
+      ok = m_routeAccess[i][r].Build(sc.routes[r].access, error);
+    if (!ok) {
+      std::cerr << "[access] " << sc.host << ":" << sc.port << ": " << error
+                << "\n";
+      return false;
+    }
+    if (!m_serverAccess[i].Empty())
+      std::cerr << "[access] " << sc.host << ":" << sc.port << " "
+                << m_serverAccess[i].PrefixCount() << " prefixes\n";
+  }
+  return true;
+}
+
+bool Server::CompileCachePolicies() {
+  m_cachePolicies.assign(m_config.servers.size(), std::vector<CachePolicy>());
+  for (size_t i = 0; i < m_config.servers.size(); ++i) {
+    const ServerConfig &sc = m_config.servers[i];
+    m_cachePolicies[i].assign(sc.routes.size(), CachePolicy());
+    for (size_t r = 0; r < sc.routes.size(); ++r) {
+      std::string error;
+      if (!m_cachePolicies[i][r].Compile(sc.routes[r], error)) {
+        std::cerr << "[cache-policy] " << sc.host << ":" << sc.port << ": "
+                  << error << "\n";
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool Server::OpenSharedCaches() {
+  m_staticCaches.assign(m_config.servers.size(), (SharedFileCache *)0);
+  for (size_t i = 0; i < m_config.servers.size(); ++i) {
+    const ServerConfig &sc = m_config.servers[i];
+    if (sc.sharedCacheFile.empty()) continue;
+    SharedFileCache *&cache = m_sharedCaches[sc.sharedCacheFile];
+    if (!cache) {
+      cache = new SharedFileCache;
+      std::string error;
+      if (!cache->Open(sc.sharedCacheFile, sc.sharedCacheSize, error)) {
+        std::cerr << "[shared-cache] " << sc.host << ":" << sc.port << ": "
+                  << error << "\n";
+        return false;
+      }
+      std::cerr << "[shared-cache] " << sc.sharedCacheFile << " "
+                << cache->Entries() << " entries\n";
+    }
+    m_staticCaches[i] = cache;
+  }
+  return true;
+}
+
+bool Server::OpenCaptures() {
+  m_captures.assign(m_config.servers.size(), (TrafficCapture *)0);
+  for (size_t i = 0; i < m_config.servers.size(); ++i) {
+    const ServerConfig &sc = m_config.servers[i];
+    if (sc.captureFile.empty()) continue;
+    TrafficCapture *&capture = m_captureFiles[sc.captureFile];
+    if (!capture) {
+      capture = new TrafficCapture;
+      std::string error;
+      if (!capture->Open(sc.captureFile, error)) {
+        std::cerr << "[capture] " << sc.host << ":" << sc.port << ": "
+                  << error << "\n";
+        return false;
+      }
+      std::cerr << "[capture] " << sc.host << ":" << sc.port << " -> "
+                << sc.captureFile << "\n";
+    }
+    m_captures[i] = capture;
+  }
+  return true;
+}
 
-bool Server::Init() { return OpenListeningSockets(); }
+void Server::CacheRouteAccess(ClientConnection &conn, int serverIndex) {
+  const std::vector<IpAccessList> &lists = m_routeAccess[serverIndex];
+  conn.m_routeAllowed.assign(lists.size(), 1);
+  for (size_t r = 0; r < lists.size(); ++r) {
+    if (!lists[r].Empty())
+      conn.m_routeAllowed[r] = lists[r].Allows(conn.m_peer);
+  }
+  conn.m_accessServer = serverIndex;
+}
 
 bool Server::OpenListeningSockets() {
   for (size_t i = 0; i < m_config.servers.size(); ++i) {
@@ -75,6 +268,18 @@ bool Server::OpenListeningSockets() {
     }
     m_listenSockets.push_back(FD(fd));
   }
+  // FD copies dup(), so descriptors only settle once the vector is complete;
+  // m_listenSockets[i] belongs to m_config.servers[i]
+  for (size_t i = 0; i < m_config.servers.size(); ++i) {
+    const ServerConfig &sc = m_config.servers[i];
+    if (sc.tlsCertificate.empty()) continue;
+    TlsContext *tls = new TlsContext();
+    if (!tls->Init(sc)) {
+      delete tls;
+      return false;
+    }
+    m_tlsContexts[m_listenSockets[i].Get()] = tls;
+  }
   return true;
 }
 
@@ -98,6 +303,7 @@ int Server::ComputePollTimeout() const {
   for (std::map<int, ClientConnection>::const_iterator it = m_clients.begin();
        it != m_clients.end(); ++it) {
     const ClientConnection &c = it->second;
+    if (c.m_assembly && it->first < 0) return 0;  // HTTP/2 stream: no POLLOUT
     unsigned long deadline = 0;
     if (!c.m_headersComplete) {
       // Can't know virtual host yet; use first server's header timeout
@@ -111,7 +317,7 @@ int Server::ComputePollTimeout() const {
               : m_config.servers[0];
       if (!c.m_bodyComplete)
         deadline = c.m_lastActivityMs + (unsigned long)scRef.bodyTimeoutMs;
-      else if (c.m_keepAlive)
+      else if (c.m_keepAlive && !c.m_ws)  // WebSockets are long-lived
         deadline = c.m_lastActivityMs + (unsigned long)scRef.idleTimeoutMs;
     }
     if (deadline) {
@@ -124,12 +330,25 @@ int Server::ComputePollTimeout() const {
 }
 
 void Server::ProcessEvents() {
+  unsigned long passStartUs = MonotonicMicros();
   // Sweep for timeouts before handling events
   unsigned long nowMs = (unsigned long)std::time(0) * 1000UL;
+  while (!m_zeroCopyOrphans.empty() &&
+         nowMs - m_zeroCopyOrphans.front().first > kZeroCopyLingerMs)
+    m_zeroCopyOrphans.pop_front();
+  // Quota accounting rides on the sweep: what each virtual host's
+  // connections (and HTTP/2 streams) hold in memory right now
+  std::vector<size_t> buffered(m_quotas.size(), 0);
+  size_t bufferedTotal = 0;
   std::map<int, ClientConnection>::iterator itSweep = m_clients.begin();
   while (itSweep != m_clients.end()) {
     ClientConnection &c = itSweep->second;
     bool closeIt = false;
+    int quota = c.m_h2Key != 0 ? c.m_serverIndex : c.m_quotaServer;
+    size_t held = c.m_readBuf.size() + c.m_writeBuf.size() +
+                  c.m_sharedOutBytes + c.m_cgiBuffer.size();
+    bufferedTotal += held;
+    if (quota >= 0) buffered[quota] += held;
     // CGI timeout check
     if (c.m_cgiActive && c.m_serverIndex >= 0 &&
         (size_t)c.m_serverIndex < m_config.servers.size()) {
@@ -166,7 +385,7 @@ void Server::ProcessEvents() {
         if (scRef.bodyTimeoutMs > 0 &&
             nowMs - c.m_lastActivityMs > (unsigned long)scRef.bodyTimeoutMs)
           closeIt = true;
-      } else if (c.m_keepAlive && scRef.idleTimeoutMs > 0 &&
+      } else if (c.m_keepAlive && !c.m_ws && scRef.idleTimeoutMs > 0 &&
                  nowMs - c.m_lastActivityMs >
                      (unsigned long)scRef.idleTimeoutMs) {
         closeIt = true;
@@ -176,6 +395,7 @@ void Server::ProcessEvents() {
       int fd = itSweep->first;
       if (!c.m_headersComplete || !c.m_bodyComplete) {
         std::cerr << "[timeout] fd=" << fd << " sending 408\n";
+        SELFSERV_PROBE3(timeout, fd, (int)c.m_phase, 408);
         if (c.m_writeBuf.empty()) {
           c.m_writeBuf =
               buildResponse(408, "Request Timeout", "408 Request Timeout\n",
@@ -184,6 +404,7 @@ void Server::ProcessEvents() {
         }
       } else {
         std::cerr << "[idle-timeout] fd=" << fd << " closing keep-alive\n";
+        SELFSERV_PROBE3(timeout, fd, (int)c.m_phase, 0);
       }
       c.m_keepAlive = false;
       c.m_phase = ClientConnection::kPhaseClosing;
@@ -192,6 +413,13 @@ void Server::ProcessEvents() {
       ++itSweep;
     }
   }
+  for (size_t i = 0; i < m_quotas.size(); ++i)
+    m_quotas[i].SetBuffered(buffered[i]);
+  m_stats.Set(kStatBufferedBytes, (int64_t)bufferedTotal);
+  for (std::map<std::string, TrafficCapture *>::iterator it =
+           m_captureFiles.begin();
+       it != m_captureFiles.end(); ++it)
+    it->second->Flush();
   for (size_t i = 0; i < m_pfds.size(); ++i) {
     struct pollfd &p = m_pfds[i];
     if (!p.revents) continue;
@@ -208,32 +436,73 @@ void Server::ProcessEvents() {
         HandleCgiEvent(p.fd, p.revents);
         continue;
       }
+      if (m_wsBackends.find(p.fd) != m_wsBackends.end()) {
+        HandleWsBackendEvent(p.fd, p.revents);
+        continue;
+      }
     }
     if (isListen && (p.revents & POLLIN)) {
       AcceptNew(p.fd);
     } else {
       std::map<int, ClientConnection>::iterator it = m_clients.find(p.fd);
       if (it != m_clients.end()) {
-        if (p.revents & POLLIN) HandleReadable(it->second);
-        if (p.revents & POLLOUT) HandleWritable(it->second);
-        if (p.revents & (POLLHUP | POLLERR)) CloseConnection(p.fd);
+        short revents = p.revents;
+        // Zero-copy completions arrive on the error queue, raising POLLERR
+        if ((revents & POLLERR) && it->second.m_zeroCopy.Pending() &&
+            it->second.m_zeroCopy.Reap(p.fd))
+          revents &= ~POLLERR;
+        BeginPerfSample();
+        if (revents & POLLIN) HandleReadable(it->second);
+        if (revents & POLLOUT) HandleWritable(it->second);
+        EndPerfSample(p.fd);
+        if (revents & (POLLHUP | POLLERR)) CloseConnection(p.fd);
       }
     }
   }
+  FinishCoalesced();
+  CollectHttp2Responses();
+  RecordLoopPass(passStartUs);
+}
+
+// Loop lag: while one pass runs, every other ready connection waits, so the
+// longest pass bounds the extra latency the loop adds. The stats route sees
+// the worst pass of the last full window; RSS is refreshed with it.
+void Server::RecordLoopPass(unsigned long startUs) {
+  unsigned long now = MonotonicMicros();
+  m_loopMaxUs = std::max(m_loopMaxUs, now - startUs);
+  if (now - m_loopWindowUs < kLoopWindowUs) return;
+  m_stats.Set(kStatLoopLagMicros, (int64_t)m_loopMaxUs);
+  m_stats.Set(kStatResidentBytes, residentBytes());
+  m_loopWindowUs = now;
+  m_loopMaxUs = 0;
 }
 
 void Server::AcceptNew(int listenFd) {
   for (;;) {
-    int cfd = ::accept(listenFd, 0, 0);
+    struct sockaddr_storage peer;
+    socklen_t peerLen = sizeof(peer);
+    int cfd = ::accept(listenFd, (struct sockaddr *)&peer, &peerLen);
     if (cfd < 0) {
       break;  // non-blocking accept finished
     }
+    ClientConnection conn;
+    IpAddressFromSockaddr((struct sockaddr *)&peer, conn.m_peer);
+    // m_listenSockets[i] belongs to m_config.servers[i]
+    size_t serverIdx = 0;
+    while (serverIdx + 1 < m_listenSockets.size() &&
+           m_listenSockets[serverIdx].Get() != listenFd)
+      ++serverIdx;
+    if (!m_serverAccess[serverIdx].Allows(conn.m_peer)) {
+      // Before any allocation, TLS or parsing work
+      std::cerr << "[deny] " << FormatIpAddress(conn.m_peer) << "\n";
+      ::close(cfd);
+      continue;
+    }
     if (!setNonBlocking(cfd)) {
       ::close(cfd);
       continue;
     }
-    ClientConnection conn;
-    conn.m_fd.Reset(cfd);
+    CacheRouteAccess(conn, (int)serverIdx);
     conn.m_wantWrite = false;
     unsigned long nowMs = (unsigned long)(std::time(0)) * 1000UL;  // coarse
     conn.m_createdAtMs = nowMs;
@@ -242,14 +511,28 @@ void Server::AcceptNew(int listenFd) {
     conn.m_bodyComplete = false;
     conn.m_phase = ClientConnection::kPhaseAccepted;
     m_clients[cfd] = conn;
+    // FD copies dup() the descriptor, so the entry takes cfd only once it
+    // is in the map
+    m_clients[cfd].m_fd.Reset(cfd);
+    std::map<int, TlsContext *>::iterator tls = m_tlsContexts.find(listenFd);
+    if (tls != m_tlsContexts.end() &&
+        !m_clients[cfd].m_tls.Start(*tls->second, m_clients[cfd].m_fd.Get())) {
+      std::cerr << "[tls] cannot create session fd=" << cfd << "\n";
+      m_clients.erase(cfd);
+      continue;
+    }
+    m_stats.Add(kStatAccepted);
+    SELFSERV_PROBE2(accept, cfd, listenFd);
+    m_stats.Adjust(kStatActiveConnections, 1);
     std::cerr << "[accept] fd=" << cfd << " total_clients=" << m_clients.size()
-              << "\n";
+              << (tls != m_tlsContexts.end() ? " tls" : "") << "\n";
   }
 }
 
 static std::string buildResponse(int code, const std::string &reason,
                                  const std::string &body, const char *ctype,
-                                 bool keepAlive, bool headOnly) {
+                                 bool keepAlive, bool headOnly,
+                                 const std::string &extraHeaders) {
   std::string resp = "HTTP/1.1 ";
   char codeBuf[8];
   std::sprintf(codeBuf, "%d", code);
@@ -257,14 +540,17 @@ static std::string buildResponse(int code, const std::string &reason,
   resp += ' ';
   resp += reason;
   resp += "\r\n";
-  char len[32];
-  std::sprintf(len, "%lu", (unsigned long)body.size());
-  resp += "Content-Length: ";
-  resp += len;
-  resp += "\r\n";
+  if (code != 204) {
+    char len[32];
+    std::sprintf(len, "%lu", (unsigned long)body.size());
+    resp += "Content-Length: ";
+    resp += len;
+    resp += "\r\n";
+  }
   resp += "Content-Type: ";
   resp += ctype;
   resp += "\r\n";
+  resp += extraHeaders;
   resp += "Connection: ";
   resp += keepAlive ? "keep-alive" : "close";
   resp += "\r\n\r\n";
@@ -321,48 +607,123 @@ static std::string loadErrorPageBody(const ServerConfig &sc, int code,
   return fallback;
 }
 
-static bool readFile(const std::string &path, std::string &out) {
-  std::ifstream ifs(path.c_str(), std::ios::in | std::ios::binary);
-  if (!ifs) return false;
+// Reasons for the statuses of file-writing methods (PUT, COPY, MOVE)
+static const char *writeStatusReason(int code) {
+  switch (code) {
+    case 201: return "Created";
+    case 202: return "Accepted";
+    case 204: return "No Content";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 409: return "Conflict";
+    case 412: return "Precondition Failed";
+    case 413: return "Payload Too Large";
+    case 429: return "Too Many Requests";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    default: return "Internal Server Error";
+  }
+}
+
+// PUT upload outcomes; Upload-Offset tells the client where to resume
+static std::string buildUploadResponse(const ServerConfig &sc, int code,
+                                       off_t persisted, bool keepAlive,
+                                       bool headOnly) {
+  const char *reason = writeStatusReason(code);
+  char line[64];
+  std::sprintf(line, "%d %s\n", code, reason);
+  std::string body;
+  if (code >= 400)
+    body = loadErrorPageBody(sc, code, line);
+  else if (code != 204)
+    body = line;
+  // A 204 carries no Content-Length at all (RFC 9110 section 8.6)
+  char length[48] = "";
+  if (code != 204)
+    std::sprintf(length, "Content-Length: %lu\r\n",
+                 (unsigned long)body.size());
+  char head[256];
+  std::sprintf(head,
+               "HTTP/1.1 %d %s\r\nUpload-Offset: %lu\r\n"
+               "%sContent-Type: text/plain\r\nConnection: %s\r\n\r\n",
+               code, reason, (unsigned long)persisted, length,
+               keepAlive ? "keep-alive" : "close");
+  std::string resp = head;
+  if (!headOnly) resp += body;
+  return resp;
+}
+
+// Value of name in a query string ("a=1&b"); a bare name yields ""
+static bool queryParam(const std::string &query, const char *name,
+                       std::string &value) {
+  size_t len = std::strlen(name);
+  size_t start = 0;
+  while (start <= query.size()) {
+    size_t amp = query.find('&', start);
+    if (amp == std::string::npos) amp = query.size();
+    if (query.compare(start, len, name) == 0 &&
+        (start + len == amp || query[start + len] == '=')) {
+      value = start + len == amp ? ""
+                                 : query.substr(start + len + 1,
+                                                amp - start - len - 1);
+      return true;
+    }
+    start = amp + 1;
+  }
+  return false;
+}
+
+// The file a PUT or HEAD on an upload route writes or reports: the request
+// path itself, or with ?upload=<id>&part=<n> that part of a multi-part
+// session. False when the session does not exist.
+static bool uploadTarget(const HttpRequest &req, const std::string &filePath,
+                         std::string &target) {
+  std::string id, part;
+  if (!queryParam(req.query, "upload", id)) {
+    target = filePath;
+    return true;
+  }
+  return queryParam(req.query, "part", part) &&
+         UploadSessionPart(filePath, id, std::atoi(part.c_str()), target);
+}
+
+// Whole file into out, and its attributes into st. With readahead the
+// kernel is told it is read front to back; files of at least dropCacheMin
+// bytes (0: never) leave the page cache once read, so a one-off large
+// download does not evict hot files.
+static bool readFile(const std::string &path, std::string &out,
+                     struct stat &st, bool readahead, off_t dropCacheMin) {
+  FD file(::open(path.c_str(), O_RDONLY));
+  if (!file.Valid() || ::fstat(file.Get(), &st) != 0) return false;
+  if (readahead) AdviseSequentialRead(file.Get(), st.st_size);
   std::string data;
-  char buf[4096];
-  while (ifs.good()) {
-    ifs.read(buf, sizeof(buf));
-    std::streamsize n = ifs.gcount();
-    if (n > 0) data.append(buf, (size_t)n);
+  data.reserve((size_t)st.st_size);
+  char buf[64 * 1024];
+  for (;;) {
+    ssize_t n = ::read(file.Get(), buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    data.append(buf, (size_t)n);
   }
+  if (dropCacheMin > 0 && st.st_size >= dropCacheMin)
+    DropCachedPages(file.Get(), 0, 0);
   out.swap(data);
   return true;
 }
 
+// Status code of an HTTP/1.x response head at the start of buf, or 0
+static int responseStatus(const std::string &buf) {
+  if (buf.size() < 12 || buf.compare(0, 5, "HTTP/") != 0) return 0;
+  return std::atoi(buf.c_str() + 9);
+}
+
 static bool isDir(const std::string &path) {
   struct stat st;
   if (::stat(path.c_str(), &st) == 0) return S_ISDIR(st.st_mode);
   return false;
 }
 
-static bool listDir(const std::string &path, std::string &out) {
-  DIR *d = ::opendir(path.c_str());
-  if (!d) return false;
-  std::string body = "<html><body><h1>Index of ";
-  body += path;
-  body += "</h1><ul>";
-  struct dirent *ent;
-  while ((ent = ::readdir(d))) {
-    const char *name = ent->d_name;
-    if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0) continue;
-    body += "<li><a href=\"";
-    body += name;
-    body += "\">";
-    body += name;
-    body += "</a></li>";
-  }
-  ::closedir(d);
-  body += "</ul></body></html>";
-  out.swap(body);
-  return true;
-}
-
 static const RouteConfig *matchRoute(const ServerConfig &sc,
                                      const std::string &uri) {
   size_t bestLen = 0;
@@ -590,13 +951,91 @@ static bool hasHeader(const HttpRequest &req, const char *name,
   return false;
 }
 
+// m_clients key: the socket for real connections, the negative pseudo key for
+// HTTP/2 streams and background cache refreshes
+static int clientKey(const ClientConnection &conn) {
+  return conn.m_h2Key ? conn.m_h2Key : conn.m_fd.Get();
+}
+
+// Socket I/O through TLS when the connection has it. Both return > 0 for
+// bytes moved and <= 0 when the caller should stop (would block, closed or
+// failed), like recv/send. A TLS read that needs to write flags POLLOUT.
+static ssize_t connRecv(ClientConnection &conn, char *buf, size_t len) {
+  if (!conn.m_tls.Active()) return ::recv(conn.m_fd.Get(), buf, len, 0);
+  size_t n = 0;
+  TlsConnection::Status st = conn.m_tls.Read(buf, len, n);
+  if (st == TlsConnection::kTlsDone) return (ssize_t)n;
+  if (st == TlsConnection::kTlsWantWrite) conn.m_wantWrite = true;
+  return st == TlsConnection::kTlsClosed ? 0 : -1;
+}
+
+static ssize_t connSend(ClientConnection &conn, const char *buf, size_t len) {
+  if (!conn.m_tls.Active()) return ::send(conn.m_fd.Get(), buf, len, 0);
+  size_t n = 0;
+  if (conn.m_tls.Write(buf, len, n) == TlsConnection::kTlsDone)
+    return (ssize_t)n;
+  return -1;
+}
+
+bool Server::DriveTlsHandshake(ClientConnection &conn) {
+  TlsConnection::Status st = conn.m_tls.Handshake();
+  if (st == TlsConnection::kTlsWantRead) {
+    conn.m_wantWrite = false;
+    return false;
+  }
+  if (st == TlsConnection::kTlsWantWrite) {
+    conn.m_wantWrite = true;
+    return false;
+  }
+  if (st != TlsConnection::kTlsDone) {
+    // Let HandleWritable close it; closing here would invalidate conn
+    std::cerr << "[tls] handshake failed fd=" << conn.m_fd.Get() << "\n";
+    conn.m_keepAlive = false;
+    conn.m_phase = ClientConnection::kPhaseClosing;
+    conn.m_wantWrite = true;
+    return false;
+  }
+  conn.m_wantWrite = !conn.m_writeBuf.empty();
+  bool h2 = conn.m_tls.NegotiatedH2();
+  std::cerr << "[tls] fd=" << conn.m_fd.Get() << " " << conn.m_tls.Describe()
+            << " alpn=" << (h2 ? "h2" : "http/1.1")
+            << (conn.m_tls.Resumed() ? " resumed" : "")
+            << (conn.m_tls.KtlsSend() ? " ktls" : "") << "\n";
+  if (h2) StartHttp2(conn);  // ALPN h2: the client preface follows directly
+  return true;
+}
+
 void Server::HandleReadable(ClientConnection &conn) {
+  if (conn.m_tls.Active() && !conn.m_tls.Established()) {
+    if (conn.m_phase == ClientConnection::kPhaseClosing) return;
+    if (!DriveTlsHandshake(conn)) return;
+    // Application data may already sit in OpenSSL's buffer; read it now
+  }
   char buf[4096];
   for (;;) {
-    ssize_t n = ::recv(conn.m_fd.Get(), buf, sizeof(buf), 0);
-    if (n <= 0) break;  // EAGAIN or closed
+    ssize_t n = connRecv(conn, buf, sizeof(buf));
+    if (n == 0) {
+      // The client is done: answer what it sent, then close. Until then the
+      // socket is not polled for input, which would report EOF every pass.
+      conn.m_peerClosed = true;
+      if (conn.m_phase != ClientConnection::kPhaseHandle)
+        conn.m_wantWrite = true;
+      break;
+    }
+    if (n < 0) break;  // EAGAIN
     conn.m_readBuf.append(buf, n);
+    m_stats.Add(kStatBytesIn, (uint64_t)n);
+    if (!conn.m_requestStartUs) conn.m_requestStartUs = MonotonicMicros();
     conn.m_lastActivityMs = (unsigned long)std::time(0) * 1000UL;
+    if (conn.m_ws) {
+      DriveWebSocket(conn);
+      continue;
+    }
+    if (conn.m_upload.Active()) {
+      if (conn.m_readBuf.size() - conn.m_parser.BodyOffset() >= kPutWriteBytes)
+        DrivePutUpload(conn);
+      continue;
+    }
     if (conn.m_readBuf.size() < 2048) {
       // lightweight debug
       if (conn.m_readBuf.find("POST /upload") != std::string::npos) {
@@ -608,398 +1047,1079 @@ void Server::HandleReadable(ClientConnection &conn) {
                   << "'\n";
       }
     }
-    if (conn.m_parser.Parse(conn.m_readBuf, conn.m_request) ||
-        conn.m_parser.Error()) {
-      // Future: if request requires CGI, transition to PH_HANDLE then spawn CGI
-      // before PH_RESPOND
-      if (conn.m_parser.Error()) {
-        conn.m_keepAlive = false;
-        const ServerConfig &scTmp = m_config.servers[0];
-        std::string bodyErr =
-            loadErrorPageBody(scTmp, 400, "400 Bad Request\n");
-        conn.m_writeBuf = buildResponse(400, "Bad Request", bodyErr,
-                                        "text/plain", false, false);
+    if (!conn.m_h2 && conn.m_phase == ClientConnection::kPhaseAccepted) {
+      // Prior-knowledge HTTP/2 starts with a preface the HTTP/1 parser would
+      // happily accept as "PRI *", so it must be recognized first
+      int preface = Http2Session::MatchPreface(conn.m_readBuf);
+      if (preface == 0) continue;
+      if (preface > 0) StartHttp2(conn);
+    }
+    if (conn.m_h2) {
+      DriveHttp2(conn);
+      continue;
+    }
+    if (ParseBuffered(conn)) break;
+  }
+  if (conn.m_upload.Active()) DrivePutUpload(conn);  // whatever is left
+}
+
+// Runs the HTTP/1 parser over the read buffer and dispatches a complete
+// request. True once the connection has something to answer and should stop
+// reading for now.
+bool Server::ParseBuffered(ClientConnection &conn) {
+  bool complete = conn.m_parser.Parse(conn.m_readBuf, conn.m_request);
+  if ((complete || conn.m_parser.HeadersDone()) && !conn.m_parser.Error() &&
+      conn.m_phase != ClientConnection::kPhaseBody)
+    SELFSERV_PROBE4(header_parsed, conn.m_fd.Get(),
+                    conn.m_request.method.c_str(), conn.m_request.path.c_str(),
+                    conn.m_parser.BodyOffset());
+  if (complete || conn.m_parser.Error()) {
+    // Future: if request requires CGI, transition to PH_HANDLE then spawn CGI
+    // before PH_RESPOND
+    if (conn.m_parser.Error()) {
+      conn.m_keepAlive = false;
+      const ServerConfig &scTmp = m_config.servers[0];
+      std::string bodyErr = loadErrorPageBody(scTmp, 400, "400 Bad Request\n");
+      conn.m_writeBuf = buildResponse(400, "Bad Request", bodyErr,
+                                      "text/plain", false, false);
+      conn.m_phase = ClientConnection::kPhaseRespond;
+      std::cerr << "[400] malformed request bytes=" << conn.m_readBuf.size()
+                << "\n";
+      conn.m_wantWrite = true;
+      return true;
+    }
+    conn.m_headersComplete = true;  // we have at least parsed headers (parser
+                                    // only flips after full body though)
+    if (MaybeUpgradeHttp2(conn)) return false;
+    HandleRequest(conn);
+    return true;
+  }
+  if (conn.m_parser.HeadersDone() &&
+      conn.m_phase != ClientConnection::kPhaseBody) {
+    // Headers are in and the body is not: decided once per request
+    conn.m_phase = ClientConnection::kPhaseBody;
+    if (BeginStreamingPut(conn) && !conn.m_upload.Active()) return true;
+  }
+  return false;
+}
+
+// A PUT to an upload route with a Content-Length is not buffered: its body
+// goes to disk as it arrives. Anything that needs the whole body first (a
+// rewrite, CGI) or ends in an error response takes the buffered path so
+// HandleRequest answers it as usual.
+bool Server::BeginStreamingPut(ClientConnection &conn) {
+  const HttpRequest &req = conn.m_request;
+  if (req.method != "PUT" || conn.m_parser.Chunked() ||
+      conn.m_parser.ContentLength() == 0)
+    return false;
+  size_t serverIdx = 0;
+  const ServerConfig &sc = selectServer(m_config, req, serverIdx);
+  RewriteResult rewrite;
+  if (m_rewrites[serverIdx].Match(req.path, req.query, rewrite)) return false;
+  const RouteConfig *route = matchRoute(sc, req.path);
+  if (!route || !route->uploadsEnabled || !route->redirect.empty() ||
+      route->embedded || !route->websocketBackend.empty())
+    return false;
+  bool methodOk = route->methods.empty();
+  for (size_t i = 0; i < route->methods.size(); ++i)
+    if (route->methods[i] == "PUT") methodOk = true;
+  if (!methodOk) return false;
+  conn.m_serverIndex = (int)serverIdx;
+  if (conn.m_accessServer != conn.m_serverIndex)
+    CacheRouteAccess(conn, conn.m_serverIndex);
+  if (!conn.m_routeAllowed[route - &sc.routes[0]]) return false;
+  std::string rel = req.path.substr(route->path.size());
+  std::string filePath = route->root + rel;
+  if (("/" + rel + "/").find("/../") != std::string::npos) return false;
+  const std::string &ext = route->cgiExtension;
+  if (!ext.empty() && filePath.size() >= ext.size() &&
+      filePath.compare(filePath.size() - ext.size(), ext.size(), ext) == 0)
+    return false;
+  std::string target;
+  conn.m_headersComplete = true;
+  if (!AdmitRequest(conn)) return true;
+  if (!uploadTarget(req, filePath, target)) {
+    conn.m_keepAlive = false;
+    conn.m_writeBuf = buildUploadResponse(sc, 404, 0, false, false);
+    conn.m_phase = ClientConnection::kPhaseRespond;
+    conn.m_wantWrite = true;
+    std::cerr << "[404] no upload session uri=" << req.path << "?"
+              << req.query << "\n";
+    return true;
+  }
+  if (!StartPutUpload(conn, sc, *route, target,
+                      (off_t)conn.m_parser.ContentLength()))
+    return true;
+  std::string expect;
+  if (hasHeader(req, "Expect", expect) &&
+      strcasecmp(expect.c_str(), "100-continue") == 0) {
+    conn.m_writeBuf = "HTTP/1.1 100 Continue\r\n\r\n";
+    conn.m_wantWrite = true;
+  }
+  std::cerr << "[PUT] streaming uri=" << req.path
+            << " bytes=" << conn.m_parser.ContentLength() << "\n";
+  return true;
+}
+
+bool Server::StartPutUpload(ClientConnection &conn, const ServerConfig &sc,
+                            const RouteConfig &route,
+                            const std::string &filePath, off_t length) {
+  conn.m_requestClass = kStatClassUpload;
+  const std::string &path = conn.m_request.path;
+  std::string range;
+  hasHeader(conn.m_request, "Content-Range", range);
+  int status = 409;  // a directory cannot be PUT
+  if (path.size() > route.path.size() && path[path.size() - 1] != '/') {
+    off_t maxSize = route.uploadMaxSize ? (off_t)route.uploadMaxSize
+                                        : (off_t)sc.clientMaxBodySize;
+    conn.m_upload.SetCachePolicy((off_t)route.nocacheMinSize,
+                                 (off_t)route.uploadDirectMinSize);
+    status = conn.m_upload.Begin(filePath, range, length, maxSize);
+  }
+  if (status == 0) return true;
+  off_t persisted = 0;
+  UploadPersisted(filePath, persisted);
+  // The body may still be on its way; the connection cannot be reused
+  conn.m_keepAlive = false;
+  conn.m_writeBuf = buildUploadResponse(sc, status, persisted, false, false);
+  conn.m_phase = ClientConnection::kPhaseRespond;
+  conn.m_wantWrite = true;
+  std::cerr << "[" << status << "] PUT uri=" << path << " range='" << range
+            << "' persisted=" << (unsigned long)persisted << "\n";
+  return false;
+}
+
+void Server::DrivePutUpload(ClientConnection &conn) {
+  size_t offset = conn.m_parser.BodyOffset();
+  size_t take = conn.m_readBuf.size() - offset;
+  if ((off_t)take > conn.m_upload.Remaining())
+    take = (size_t)conn.m_upload.Remaining();
+  if (!conn.m_upload.Write(conn.m_readBuf.data() + offset, take)) {
+    std::cerr << "[500] PUT write failed uri=" << conn.m_request.path << ": "
+              << std::strerror(errno) << "\n";
+    conn.m_upload.Abort();
+    conn.m_parser.EndBody();
+    conn.m_keepAlive = false;
+    conn.m_writeBuf = buildUploadResponse(
+        m_config.servers[conn.m_serverIndex], 500, 0, false, false);
+    conn.m_phase = ClientConnection::kPhaseRespond;
+    conn.m_wantWrite = true;
+    return;
+  }
+  // Headers stay at the front of m_readBuf until the response is out
+  conn.m_readBuf.erase(offset, take);
+  if (conn.m_upload.Remaining() > 0) return;
+  conn.m_parser.EndBody();
+  FinishPutUpload(conn);
+}
+
+// Multi-part sessions on an upload route:
+//   POST   <path>?uploads      start one; the id is in Upload-Id
+//   PUT    <path>?upload=<id>&part=<n>   (streamed and resumable like PUT)
+//   POST   <path>?upload=<id>  join parts 1..N into <path>
+//   DELETE <path>?upload=<id>  abandon it
+void Server::HandleUploadSession(ClientConnection &conn,
+                                 const ServerConfig &sc,
+                                 const std::string &filePath) {
+  conn.m_requestClass = kStatClassUpload;
+  const HttpRequest &req = conn.m_request;
+  std::string keep, id;
+  conn.m_keepAlive = req.version == "HTTP/1.1";
+  if (hasHeader(req, "Connection", keep))
+    conn.m_keepAlive = keep == "keep-alive" || keep == "Keep-Alive";
+  conn.m_phase = ClientConnection::kPhaseRespond;
+  conn.m_bodyComplete = true;
+  const std::string &path = req.path;
+  if (path.empty() || path[path.size() - 1] == '/') {
+    conn.m_keepAlive = false;
+    conn.m_writeBuf = buildUploadResponse(sc, 409, 0, false, false);
+    return;
+  }
+  if (req.method == "POST" && queryParam(req.query, "uploads", id)) {
+    int status = CreateUploadSession(filePath, id);
+    if (status != 0) {
+      conn.m_keepAlive = false;
+      conn.m_writeBuf = buildUploadResponse(sc, status, 0, false, false);
+      return;
+    }
+    char head[160];
+    std::sprintf(head,
+                 "HTTP/1.1 201 Created\r\nUpload-Id: %s\r\n"
+                 "Content-Length: %lu\r\nContent-Type: text/plain\r\n"
+                 "Connection: %s\r\n\r\n",
+                 id.c_str(), (unsigned long)id.size() + 1,
+                 conn.m_keepAlive ? "keep-alive" : "close");
+    conn.m_writeBuf = head + id + "\n";
+    std::cerr << "[201] upload session " << id << " uri=" << path << "\n";
+    return;
+  }
+  queryParam(req.query, "upload", id);
+  if (req.method == "DELETE") {
+    bool removed = RemoveUploadSession(filePath, id);
+    if (!removed) conn.m_keepAlive = false;
+    conn.m_writeBuf = buildUploadResponse(sc, removed ? 204 : 404, 0,
+                                          conn.m_keepAlive, false);
+    std::cerr << "[" << (removed ? 204 : 404) << "] upload session " << id
+              << " abandoned uri=" << path << "\n";
+    return;
+  }
+  FileAssembly *assembly = new FileAssembly();
+  int status = BeginSessionAssembly(filePath, id, *assembly);
+  if (status != 0) {
+    delete assembly;
+    conn.m_keepAlive = false;
+    conn.m_writeBuf = buildUploadResponse(sc, status, 0, false, false);
+    std::cerr << "[" << status << "] upload session " << id
+              << " cannot complete uri=" << path << "\n";
+    return;
+  }
+  std::cerr << "[upload] joining " << assembly->SourceCount()
+            << " parts of session " << id << " uri=" << path << "\n";
+  conn.m_assembly = assembly;
+}
+
+void Server::DriveAssembly(ClientConnection &conn) {
+  conn.m_lastActivityMs = (unsigned long)std::time(0) * 1000UL;
+  if (conn.m_assembly->Step(kAssemblySliceBytes)) return;
+  int status = conn.m_assembly->Finish();
+  off_t size = conn.m_assembly->Size();
+  delete conn.m_assembly;
+  conn.m_assembly = 0;
+  if (status >= 500) conn.m_keepAlive = false;
+  const ServerConfig &sc = m_config.servers[conn.m_serverIndex];
+  if (conn.m_request.method == "POST") {
+    conn.m_writeBuf =
+        buildUploadResponse(sc, status, size, conn.m_keepAlive, false);
+  } else {  // COPY, or MOVE across filesystems
+    char line[64];
+    std::sprintf(line, "%d %s\n", status, writeStatusReason(status));
+    conn.m_writeBuf =
+        buildResponse(status, writeStatusReason(status),
+                      status == 204 ? "" : loadErrorPageBody(sc, status, line),
+                      "text/plain", conn.m_keepAlive, false);
+  }
+  std::cerr << "[" << status << "] " << conn.m_request.method
+            << " assembled uri=" << conn.m_request.path
+            << " bytes=" << (unsigned long)size << "\n";
+}
+
+// WebDAV-style COPY and MOVE of a file to the Destination header's path on
+// the same virtual host. The destination route must accept uploads, and so
+// must the source route for MOVE. Bytes stay on the server: MOVE is a
+// rename (a kernel copy only across filesystems) and COPY runs sliced
+// copy_file_range like a multi-part join. Overwrite: F refuses to replace
+// an existing destination, atomically (RENAME_NOREPLACE).
+void Server::HandleCopyMove(ClientConnection &conn, const ServerConfig &sc,
+                            const RouteConfig &route,
+                            const std::string &filePath) {
+  const HttpRequest &req = conn.m_request;
+  bool move = req.method == "MOVE";
+  std::string keep, destination, overwrite, host;
+  conn.m_keepAlive = req.version == "HTTP/1.1";
+  if (hasHeader(req, "Connection", keep))
+    conn.m_keepAlive = keep == "keep-alive" || keep == "Keep-Alive";
+  bool replace = !hasHeader(req, "Overwrite", overwrite) ||
+                 (overwrite != "F" && overwrite != "f");
+  std::string destPath, authority, destFile;
+  const RouteConfig *destRoute = 0;
+  struct stat st;
+  int status = 0;
+  if (!hasHeader(req, "Destination", destination) ||
+      !ParseDestination(destination, authority, destPath)) {
+    status = 400;
+  } else if (!authority.empty()) {
+    // Absolute URI: only this virtual host
+    hasHeader(req, "Host", host);
+    if (strcasecmp(authority.c_str(), host.c_str()) != 0) status = 502;
+  }
+  if (status == 0) {
+    destRoute = matchRoute(sc, destPath);
+    if (!destRoute || !destRoute->uploadsEnabled || destRoute->embedded ||
+        !destRoute->redirect.empty() || !destRoute->websocketBackend.empty() ||
+        !conn.m_routeAllowed[destRoute - &sc.routes[0]] ||
+        (move && !route.uploadsEnabled))
+      status = 403;
+  }
+  if (status == 0) {
+    std::string destRel = destPath.substr(destRoute->path.size());
+    destFile = destRoute->root + destRel;
+    if (::lstat(filePath.c_str(), &st) != 0)
+      status = 404;
+    else if (!S_ISREG(st.st_mode) && !(move && S_ISDIR(st.st_mode)))
+      status = 403;  // COPY of a directory is not supported
+    else if (destPath[destPath.size() - 1] == '/' ||
+             destPath.size() <= destRoute->path.size())
+      status = 409;
+    else if (("/" + destRel + "/").find("/../") != std::string::npos ||
+             destFile == filePath)
+      status = 403;
+  }
+  if (status == 0 && move) {
+    status = RenameFile(filePath, destFile, replace);
+    if (status == 0 && !S_ISREG(st.st_mode)) status = 502;
+  }
+  if (status == 0) {
+    // COPY, or MOVE of a file to another filesystem: copied in the kernel
+    // while the event loop runs, then renamed into place
+    struct stat destSt;
+    if (!replace && ::lstat(destFile.c_str(), &destSt) == 0) {
+      status = 412;  // rechecked atomically once the copy is done
+    } else {
+      FileAssembly *copy = new FileAssembly();
+      status = copy->Begin(std::vector<std::string>(1, filePath), destFile,
+                           replace);
+      if (status == 0) {
+        if (move) copy->RemoveOnSuccess(filePath);
+        conn.m_assembly = copy;
         conn.m_phase = ClientConnection::kPhaseRespond;
-        std::cerr << "[400] malformed request bytes=" << conn.m_readBuf.size()
-                  << "\n";
-        conn.m_wantWrite = true;
-        break;
+        conn.m_bodyComplete = true;
+        std::cerr << "[" << req.method << "] copying uri=" << req.path
+                  << " -> " << destPath << "\n";
+        return;
       }
-      conn.m_headersComplete = true;  // we have at least parsed headers (parser
-                                      // only flips after full body though)
-      if (conn.m_phase == ClientConnection::kPhaseAccepted)
-        conn.m_phase = ClientConnection::kPhaseHeaders;
-      size_t serverIdx = 0;
-      const ServerConfig &sc =
-          selectServer(m_config, conn.m_request, serverIdx);
-      conn.m_serverIndex = (int)serverIdx;
-      if (conn.m_request.body.size() > sc.clientMaxBodySize) {
+      delete copy;
+    }
+  }
+  if (status >= 400) conn.m_keepAlive = false;
+  char line[64];
+  std::sprintf(line, "%d %s\n", status, writeStatusReason(status));
+  conn.m_writeBuf =
+      buildResponse(status, writeStatusReason(status),
+                    status == 204 ? "" : loadErrorPageBody(sc, status, line),
+                    "text/plain", conn.m_keepAlive, false);
+  conn.m_phase = ClientConnection::kPhaseRespond;
+  conn.m_bodyComplete = true;
+  std::cerr << "[" << status << "] " << req.method << " uri=" << req.path
+            << " -> " << destPath << "\n";
+}
+
+void Server::FinishPutUpload(ClientConnection &conn) {
+  const ServerConfig &sc = m_config.servers[conn.m_serverIndex];
+  int status = conn.m_upload.Finish();
+  std::string keep;
+  conn.m_keepAlive = conn.m_request.version == "HTTP/1.1";
+  if (hasHeader(conn.m_request, "Connection", keep))
+    conn.m_keepAlive = keep == "keep-alive" || keep == "Keep-Alive";
+  if (status >= 500) conn.m_keepAlive = false;
+  conn.m_writeBuf = buildUploadResponse(sc, status, conn.m_upload.Persisted(),
+                                        conn.m_keepAlive, false);
+  conn.m_bodyComplete = true;
+  conn.m_phase = ClientConnection::kPhaseRespond;
+  conn.m_wantWrite = true;
+  std::cerr << "[" << status << "] PUT uri=" << conn.m_request.path
+            << " persisted=" << (unsigned long)conn.m_upload.Persisted()
+            << "\n";
+}
+
+void Server::HandleRequest(ClientConnection &conn) {
+  SELFSERV_PROBE3(handler_start, conn.m_fd.Get(),
+                  conn.m_request.method.c_str(), conn.m_request.path.c_str());
+  DispatchRequest(conn);
+  SELFSERV_PROBE4(handler_end, conn.m_fd.Get(), (int)conn.m_phase,
+                  responseStatus(conn.m_writeBuf),
+                  conn.m_writeBuf.size() + conn.m_sharedOutBytes);
+}
+
+void Server::DispatchRequest(ClientConnection &conn) {
+  if (conn.m_phase == ClientConnection::kPhaseAccepted)
+    conn.m_phase = ClientConnection::kPhaseHeaders;
+  size_t serverIdx = 0;
+  const ServerConfig &sc = selectServer(m_config, conn.m_request, serverIdx);
+  conn.m_serverIndex = (int)serverIdx;
+  conn.m_cacheKey.clear();  // set again below if this request may be cached
+  if (!AdmitRequest(conn)) return;
+  if (conn.m_request.body.size() > sc.clientMaxBodySize) {
+    conn.m_keepAlive = false;
+    std::string body413 = loadErrorPageBody(sc, 413, "413 Payload Too Large\n");
+    conn.m_writeBuf = buildResponse(413, "Payload Too Large", body413,
+                                    "text/plain", false, false);
+    conn.m_phase = ClientConnection::kPhaseRespond;
+    std::cerr << "[413] body_size=" << conn.m_request.body.size()
+              << " limit=" << sc.clientMaxBodySize << "\n";
+    conn.m_wantWrite = true;
+    return;
+  }
+  if (!conn.m_request.rewritten && ApplyRewrite(conn)) return;
+  const RouteConfig *route = matchRoute(sc, conn.m_request.path);
+  if (route)
+    SELFSERV_PROBE4(route_selected, conn.m_fd.Get(), (int)serverIdx,
+                    route->path.c_str(), conn.m_request.path.c_str());
+  if (!route) {
+    conn.m_keepAlive = false;
+    std::string body404 = loadErrorPageBody(sc, 404, "404 Not Found\n");
+    conn.m_writeBuf =
+        buildResponse(404, "Not Found", body404, "text/plain",
+                      conn.m_keepAlive, conn.m_request.method == "HEAD");
+    conn.m_phase = ClientConnection::kPhaseRespond;
+    std::cerr << "[404] uri=" << conn.m_request.path << "\n";
+  } else {
+    if (conn.m_accessServer != conn.m_serverIndex)
+      CacheRouteAccess(conn, conn.m_serverIndex);  // Host chose another vhost
+    if (!conn.m_routeAllowed[route - &sc.routes[0]]) {
+      conn.m_keepAlive = false;
+      std::string body403 = loadErrorPageBody(sc, 403, "403 Forbidden\n");
+      conn.m_writeBuf =
+          buildResponse(403, "Forbidden", body403, "text/plain",
+                        conn.m_keepAlive, conn.m_request.method == "HEAD");
+      conn.m_phase = ClientConnection::kPhaseRespond;
+      conn.m_wantWrite = true;
+      std::cerr << "[403] denied " << FormatIpAddress(conn.m_peer)
+                << " uri=" << conn.m_request.path << "\n";
+      return;
+    }
+    if (!route->methods.empty()) {
+      bool ok = false;
+      for (size_t i = 0; i < route->methods.size(); ++i)
+        if (route->methods[i] == conn.m_request.method) {
+          ok = true;
+          break;
+        }
+      if (!ok) {
         conn.m_keepAlive = false;
-        std::string body413 =
-            loadErrorPageBody(sc, 413, "413 Payload Too Large\n");
-        conn.m_writeBuf = buildResponse(413, "Payload Too Large", body413,
-                                        "text/plain", false, false);
+        conn.m_writeBuf = buildResponse(405, "Method Not Allowed",
+                                        "405 Method Not Allowed\n",
+                                        "text/plain", conn.m_keepAlive,
+                                        conn.m_request.method == "HEAD");
+        std::cerr << "[405] method=" << conn.m_request.method
+                  << " uri=" << conn.m_request.path << "\n";
         conn.m_phase = ClientConnection::kPhaseRespond;
-        std::cerr << "[413] body_size=" << conn.m_request.body.size()
-                  << " limit=" << sc.clientMaxBodySize << "\n";
         conn.m_wantWrite = true;
-        break;
+        return;
+      }
+    }
+    if (!route->websocketBackend.empty()) {
+      StartWebSocket(conn, sc, *route);
+      return;
+    }
+    std::string rel = conn.m_request.path.substr(route->path.size());
+    if (rel.empty() || rel == "/") {
+      if (!route->index.empty()) rel = "/" + route->index;
+    }
+    // Redirect handling
+    if (!route->redirect.empty()) {
+      conn.m_keepAlive = false;  // simpler; could keep-alive later
+      std::cerr << "[302] redirect uri=" << conn.m_request.path << " -> "
+                << route->redirect << "\n";
+      conn.m_writeBuf =
+          buildRedirect(302, "Found", route->redirect, conn.m_keepAlive);
+      conn.m_phase = ClientConnection::kPhaseRespond;
+      conn.m_bodyComplete = true;
+      conn.m_wantWrite = true;
+      return;
+    }
+    if (route->embedded) {
+      ServeEmbedded(conn, sc, *route, rel);
+      return;
+    }
+    if (route->stats) {
+      ServeStats(conn);
+      return;
+    }
+    // The parser already resolved dot segments; this only guards against a
+    // ".." that slipped through some other way
+    if (("/" + rel + "/").find("/../") != std::string::npos) {
+      conn.m_keepAlive = false;
+      std::string body403 = loadErrorPageBody(sc, 403, "403 Forbidden\n");
+      conn.m_writeBuf =
+          buildResponse(403, "Forbidden", body403, "text/plain",
+                        conn.m_keepAlive, conn.m_request.method == "HEAD");
+      conn.m_phase = ClientConnection::kPhaseRespond;
+      std::cerr << "[403] traversal attempt uri=" << conn.m_request.path
+                << "\n";
+    } else {
+      std::string filePath = route->root + rel;
+      // Decide if CGI based on extension match
+      bool wantsCgi = false;
+      if (!route->cgiExtension.empty() &&
+          filePath.size() >= route->cgiExtension.size()) {
+        if (filePath.compare(filePath.size() - route->cgiExtension.size(),
+                             route->cgiExtension.size(),
+                             route->cgiExtension) == 0)
+          wantsCgi = true;
       }
-      const RouteConfig *route = matchRoute(sc, conn.m_request.uri);
-      if (!route) {
+      std::string body;
+      struct stat fileSt;
+      off_t persisted = 0;
+      std::string uploadTo;  // PUT/HEAD target; session id for POST/DELETE
+      if (wantsCgi) {
+        if (route->cache && ServeFromCache(conn, *route, filePath)) {
+          conn.m_phase = ClientConnection::kPhaseRespond;
+        } else if (route->coalesce && JoinCoalesced(conn, *route)) {
+          std::cerr << "[coalesce] waiting uri=" << conn.m_request.path << "\n";
+        } else if (!m_quotas[conn.m_serverIndex].CgiAvailable()) {
+          conn.m_coalesceKey.clear();
+          RefuseOverQuota(conn, 503, "CGI processes");
+        } else if (MaybeStartCgi(conn, *route, filePath)) {
+          conn.m_requestClass = kStatClassCgi;
+          m_quotas[conn.m_serverIndex].StartCgi();
+          conn.m_cgiQuotaServer = conn.m_serverIndex;
+          conn.m_cgiStartMs = (unsigned long)std::time(0) * 1000UL;
+          conn.m_phase = ClientConnection::kPhaseHandle;
+          conn.m_wantWrite = false;
+          std::cerr << "[CGI] started pid=" << conn.m_cgiPid
+                    << " script=" << filePath << "\n";
+          if (!conn.m_coalesceKey.empty())
+            m_inFlight[conn.m_coalesceKey].leader = clientKey(conn);
+        } else {
+          conn.m_coalesceKey.clear();
+          conn.m_keepAlive = false;
+          std::string body500 =
+              loadErrorPageBody(sc, 500, "500 Internal Server Error\n");
+          conn.m_writeBuf =
+              buildResponse(500, "Internal Server Error", body500,
+                            "text/plain", false, false);
+          conn.m_phase = ClientConnection::kPhaseRespond;
+          conn.m_wantWrite = true;
+        }
+      } else if (conn.m_request.method == "COPY" ||
+                 conn.m_request.method == "MOVE") {
+        HandleCopyMove(conn, sc, *route, filePath);
+      } else if (route->uploadsEnabled &&
+                 (conn.m_request.method == "POST" ||
+                  conn.m_request.method == "DELETE") &&
+                 (queryParam(conn.m_request.query, "uploads", uploadTo) ||
+                  queryParam(conn.m_request.query, "upload", uploadTo))) {
+        HandleUploadSession(conn, sc, filePath);
+      } else if (route->uploadsEnabled &&
+                 (conn.m_request.method == "PUT" ||
+                  conn.m_request.method == "HEAD") &&
+                 !uploadTarget(conn.m_request, filePath, uploadTo)) {
         conn.m_keepAlive = false;
-        std::string body404 = loadErrorPageBody(sc, 404, "404 Not Found\n");
-        conn.m_writeBuf =
-            buildResponse(404, "Not Found", body404, "text/plain",
-                          conn.m_keepAlive, conn.m_request.method == "HEAD");
+        conn.m_writeBuf = buildUploadResponse(
+            sc, 404, 0, false, conn.m_request.method == "HEAD");
         conn.m_phase = ClientConnection::kPhaseRespond;
-        std::cerr << "[404] uri=" << conn.m_request.uri << "\n";
-      } else {
-        if (!route->methods.empty()) {
-          bool ok = false;
-          for (size_t i = 0; i < route->methods.size(); ++i)
-            if (route->methods[i] == conn.m_request.method) {
-              ok = true;
-              break;
-            }
-          if (!ok) {
+        std::cerr << "[404] no upload session uri=" << conn.m_request.path
+                  << "?" << conn.m_request.query << "\n";
+      } else if (conn.m_request.method == "PUT" && route->uploadsEnabled) {
+        const std::string &putBody = conn.m_request.body;
+        if (StartPutUpload(conn, sc, *route, uploadTo,
+                           (off_t)putBody.size())) {
+          if (conn.m_upload.Write(putBody.data(), putBody.size())) {
+            FinishPutUpload(conn);
+          } else {
+            conn.m_upload.Abort();
             conn.m_keepAlive = false;
-            conn.m_writeBuf = buildResponse(405, "Method Not Allowed",
-                                            "405 Method Not Allowed\n",
-                                            "text/plain", conn.m_keepAlive,
-                                            conn.m_request.method == "HEAD");
-            std::cerr << "[405] method=" << conn.m_request.method
-                      << " uri=" << conn.m_request.uri << "\n";
+            conn.m_writeBuf = buildUploadResponse(sc, 500, 0, false, false);
             conn.m_phase = ClientConnection::kPhaseRespond;
-            conn.m_wantWrite = true;
-            break;
           }
         }
-        std::string rel = conn.m_request.uri.substr(route->path.size());
-        if (rel.empty() || rel == "/") {
-          if (!route->index.empty()) rel = "/" + route->index;
+      } else if (conn.m_request.method == "HEAD" && route->uploadsEnabled &&
+                 (UploadPersisted(uploadTo, persisted) ||
+                  uploadTo != filePath)) {
+        // Finished parts of a session report their size
+        struct stat partSt;
+        if (uploadTo != filePath && ::stat(uploadTo.c_str(), &partSt) == 0)
+          persisted = partSt.st_size;
+        std::string keep;
+        conn.m_keepAlive = conn.m_request.version == "HTTP/1.1";
+        if (hasHeader(conn.m_request, "Connection", keep))
+          conn.m_keepAlive = keep == "keep-alive" || keep == "Keep-Alive";
+        conn.m_writeBuf =
+            buildUploadResponse(sc, 204, persisted, conn.m_keepAlive, true);
+        conn.m_bodyComplete = true;
+        conn.m_phase = ClientConnection::kPhaseRespond;
+      } else if (conn.m_request.method == "POST" && route->uploadsEnabled) {
+        std::string keep;
+        conn.m_keepAlive = false;
+        if (hasHeader(conn.m_request, "Connection", keep)) {
+          if (keep == "keep-alive" || keep == "Keep-Alive")
+            conn.m_keepAlive = true;
+          if (keep == "close" || keep == "Close") conn.m_keepAlive = false;
+        } else if (conn.m_request.version == "HTTP/1.1") {
+          conn.m_keepAlive = true;
         }
-        // Redirect handling
-        if (!route->redirect.empty()) {
-          conn.m_keepAlive = false;  // simpler; could keep-alive later
-          std::cerr << "[302] redirect uri=" << conn.m_request.uri << " -> "
-                    << route->redirect << "\n";
-          conn.m_writeBuf =
-              buildRedirect(302, "Found", route->redirect, conn.m_keepAlive);
-          conn.m_phase = ClientConnection::kPhaseRespond;
-          conn.m_bodyComplete = true;
-          conn.m_wantWrite = true;
-          break;
-        }
-        // Basic traversal guard
-        if (rel.find("..") != std::string::npos) {
-          conn.m_keepAlive = false;
-          std::string body403 = loadErrorPageBody(sc, 403, "403 Forbidden\n");
-          conn.m_writeBuf =
-              buildResponse(403, "Forbidden", body403, "text/plain",
-                            conn.m_keepAlive, conn.m_request.method == "HEAD");
-          conn.m_phase = ClientConnection::kPhaseRespond;
-          std::cerr << "[403] traversal attempt uri=" << conn.m_request.uri
-                    << "\n";
-        } else {
-          std::string filePath = route->root + rel;
-          // Decide if CGI based on extension match
-          bool wantsCgi = false;
-          if (!route->cgiExtension.empty() &&
-              filePath.size() >= route->cgiExtension.size()) {
-            if (filePath.compare(filePath.size() - route->cgiExtension.size(),
-                                 route->cgiExtension.size(),
-                                 route->cgiExtension) == 0)
-              wantsCgi = true;
-          }
-          std::string body;
-          if (wantsCgi) {
-            if (MaybeStartCgi(conn, *route, filePath)) {
-              conn.m_cgiStartMs = (unsigned long)std::time(0) * 1000UL;
-              conn.m_phase = ClientConnection::kPhaseHandle;
-              conn.m_wantWrite = false;
-              std::cerr << "[CGI] started pid=" << conn.m_cgiPid
-                        << " script=" << filePath << "\n";
-            } else {
-              conn.m_keepAlive = false;
-              std::string body500 =
-                  loadErrorPageBody(sc, 500, "500 Internal Server Error\n");
-              conn.m_writeBuf =
-                  buildResponse(500, "Internal Server Error", body500,
-                                "text/plain", false, false);
-              conn.m_phase = ClientConnection::kPhaseRespond;
-              conn.m_wantWrite = true;
-            }
-          } else if (conn.m_request.method == "POST" && route->uploadsEnabled) {
-            std::string keep;
-            conn.m_keepAlive = false;
-            if (hasHeader(conn.m_request, "Connection", keep)) {
-              if (keep == "keep-alive" || keep == "Keep-Alive")
-                conn.m_keepAlive = true;
-              if (keep == "close" || keep == "Close") conn.m_keepAlive = false;
-            } else if (conn.m_request.version == "HTTP/1.1") {
-              conn.m_keepAlive = true;
-            }
-            std::string ctype;
-            hasHeader(conn.m_request, "Content-Type", ctype);
-            std::cerr << "[POST] uri=" << conn.m_request.uri << " ctype='"
-                      << ctype << "' body_size=" << conn.m_request.body.size()
-                      << "\n";
-            std::string destDir =
-                route->uploadPath.empty() ? route->root : route->uploadPath;
-            ensureDir(destDir);
-            std::string respBody = "Received POST (";
-            char num[64];
-            std::sprintf(num, "%lu", (unsigned long)conn.m_request.body.size());
-            respBody += num;
-            respBody += " bytes)\n";
-            if (ctype.find("multipart/form-data") != std::string::npos) {
-              std::string boundary;
-              size_t bpos = ctype.find("boundary=");
-              if (bpos != std::string::npos) {
-                boundary = ctype.substr(bpos + 9);
-                if (!boundary.empty() && boundary[0] == '"') {
-                  size_t endq = boundary.find('"', 1);
-                  if (endq != std::string::npos)
-                    boundary = boundary.substr(1, endq - 1);
-                }
-              }
-              if (!boundary.empty()) {
-                std::vector<MultipartSavedFile> saved;
-                if (parseMultipartFormData(conn.m_request.body, boundary,
-                                           destDir, saved)) {
-                  if (saved.empty())
-                    respBody += "No file parts saved\n";
-                  else {
-                    for (size_t i = 0; i < saved.size(); ++i) {
-                      respBody += "Saved field='";
-                      respBody += saved[i].field;
-                      respBody += "' -> ";
-                      respBody += saved[i].filename;
-                      respBody += " (";
-                      char sz[32];
-                      std::sprintf(sz, "%lu", (unsigned long)saved[i].size);
-                      respBody += sz;
-                      respBody += ")\n";
-                    }
-                  }
-                } else {
-                  respBody += "Multipart parse error\n";
-                }
-              } else {
-                respBody += "Missing boundary parameter\n";
-              }
-            } else {
-              static unsigned long uploadCounter = 0;
-              ++uploadCounter;
-              char fname[64];
-              std::sprintf(fname, "upload_%lu.bin", uploadCounter);
-              std::string full = destDir;
-              if (full[full.size() - 1] != '/') full += '/';
-              full += fname;
-              FILE *wf = std::fopen(full.c_str(), "wb");
-              if (wf) {
-                if (!conn.m_request.body.empty())
-                  std::fwrite(conn.m_request.body.data(), 1,
-                              conn.m_request.body.size(), wf);
-                std::fclose(wf);
-                respBody += "Stored raw body as ";
-                respBody += full;
-                respBody += "\n";
-              }
+        std::string ctype;
+        hasHeader(conn.m_request, "Content-Type", ctype);
+        std::cerr << "[POST] uri=" << conn.m_request.path << " ctype='"
+                  << ctype << "' body_size=" << conn.m_request.body.size()
+                  << "\n";
+        std::string destDir =
+            route->uploadPath.empty() ? route->root : route->uploadPath;
+        ensureDir(destDir);
+        conn.m_requestClass = kStatClassUpload;
+        std::string respBody = "Received POST (";
+        char num[64];
+        std::sprintf(num, "%lu", (unsigned long)conn.m_request.body.size());
+        respBody += num;
+        respBody += " bytes)\n";
+        if (ctype.find("multipart/form-data") != std::string::npos) {
+          std::string boundary;
+          size_t bpos = ctype.find("boundary=");
+          if (bpos != std::string::npos) {
+            boundary = ctype.substr(bpos + 9);
+            if (!boundary.empty() && boundary[0] == '"') {
+              size_t endq = boundary.find('"', 1);
+              if (endq != std::string::npos)
+                boundary = boundary.substr(1, endq - 1);
             }
-            conn.m_writeBuf = buildResponse(200, "OK", respBody, "text/plain",
-                                            conn.m_keepAlive, false);
-            conn.m_bodyComplete = true;
-            conn.m_phase = ClientConnection::kPhaseRespond;
-          } else if (isDir(filePath)) {
-            if (route->directoryListing) {
-              if (listDir(filePath, body)) {
-                std::string keep;
-                conn.m_keepAlive = false;
-                if (hasHeader(conn.m_request, "Connection", keep)) {
-                  if (keep == "keep-alive" || keep == "Keep-Alive")
-                    conn.m_keepAlive = true;
-                  if (keep == "close" || keep == "Close")
-                    conn.m_keepAlive = false;
-                } else if (conn.m_request.version == "HTTP/1.1") {
-                  conn.m_keepAlive = true;
+          }
+          if (!boundary.empty()) {
+            std::vector<MultipartSavedFile> saved;
+            if (parseMultipartFormData(conn.m_request.body, boundary,
+                                       destDir, saved)) {
+              if (saved.empty())
+                respBody += "No file parts saved\n";
+              else {
+                for (size_t i = 0; i < saved.size(); ++i) {
+                  respBody += "Saved field='";
+                  respBody += saved[i].field;
+                  respBody += "' -> ";
+                  respBody += saved[i].filename;
+                  respBody += " (";
+                  char sz[32];
+                  std::sprintf(sz, "%lu", (unsigned long)saved[i].size);
+                  respBody += sz;
+                  respBody += ")\n";
                 }
-                conn.m_writeBuf = buildResponse(
-                    200, "OK", body, "text/html", conn.m_keepAlive,
-                    conn.m_request.method == "HEAD");
-                conn.m_phase = ClientConnection::kPhaseRespond;
-                std::cerr << "[200] dir listing uri=" << conn.m_request.uri
-                          << (conn.m_keepAlive ? " keep-alive" : " close")
-                          << "\n";
-              } else {
-                conn.m_keepAlive = false;
-                std::string body500 =
-                    loadErrorPageBody(sc, 500, "500 Internal Server Error\n");
-                conn.m_writeBuf = buildResponse(
-                    500, "Internal Server Error", body500, "text/plain", false,
-                    conn.m_request.method == "HEAD");
-                conn.m_phase = ClientConnection::kPhaseRespond;
               }
             } else {
-              conn.m_keepAlive = false;
-              std::string body403 =
-                  loadErrorPageBody(sc, 403, "403 Forbidden\n");
-              conn.m_writeBuf =
-                  buildResponse(403, "Forbidden", body403, "text/plain", false,
-                                conn.m_request.method == "HEAD");
-              conn.m_phase = ClientConnection::kPhaseRespond;
+              respBody += "Multipart parse error\n";
             }
-          } else if (conn.m_request.method == "DELETE") {
-            // Handle deletion of file
-            struct stat st;
-            if (::stat(filePath.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
-              if (::unlink(filePath.c_str()) == 0) {
-                std::string keep;
-                conn.m_keepAlive = false;
-                if (hasHeader(conn.m_request, "Connection", keep)) {
-                  if (keep == "keep-alive" || keep == "Keep-Alive")
-                    conn.m_keepAlive = true;
-                  if (keep == "close" || keep == "Close")
-                    conn.m_keepAlive = false;
-                } else if (conn.m_request.version == "HTTP/1.1") {
-                  conn.m_keepAlive = true;
-                }
-                conn.m_writeBuf =
-                    buildResponse(204, "No Content", "", "text/plain",
-                                  conn.m_keepAlive, false);
-                conn.m_phase = ClientConnection::kPhaseRespond;
-                std::cerr << "[204] deleted uri=" << conn.m_request.uri << "\n";
-              } else {
-                conn.m_keepAlive = false;
-                std::string body500 =
-                    loadErrorPageBody(sc, 500, "500 Internal Server Error\n");
-                conn.m_writeBuf =
-                    buildResponse(500, "Internal Server Error", body500,
-                                  "text/plain", false, false);
-                conn.m_phase = ClientConnection::kPhaseRespond;
-                std::cerr << "[500] delete failed uri=" << conn.m_request.uri
-                          << " errno=" << errno << "\n";
-              }
-            } else if (isDir(filePath)) {
-              conn.m_keepAlive = false;
-              std::string body403 =
-                  loadErrorPageBody(sc, 403, "403 Forbidden\n");
-              conn.m_writeBuf = buildResponse(403, "Forbidden", body403,
-                                              "text/plain", false, false);
-              conn.m_phase = ClientConnection::kPhaseRespond;
-            } else {
-              conn.m_keepAlive = false;
-              std::string body404f =
-                  loadErrorPageBody(sc, 404, "404 Not Found\n");
-              conn.m_writeBuf = buildResponse(404, "Not Found", body404f,
-                                              "text/plain", false, false);
-              conn.m_phase = ClientConnection::kPhaseRespond;
+          } else {
+            respBody += "Missing boundary parameter\n";
+          }
+        } else {
+          static unsigned long uploadCounter = 0;
+          ++uploadCounter;
+          char fname[64];
+          std::sprintf(fname, "upload_%lu.bin", uploadCounter);
+          std::string full = destDir;
+          if (full[full.size() - 1] != '/') full += '/';
+          full += fname;
+          FILE *wf = std::fopen(full.c_str(), "wb");
+          if (wf) {
+            if (!conn.m_request.body.empty())
+              std::fwrite(conn.m_request.body.data(), 1,
+                          conn.m_request.body.size(), wf);
+            std::fclose(wf);
+            respBody += "Stored raw body as ";
+            respBody += full;
+            respBody += "\n";
+          }
+        }
+        conn.m_writeBuf = buildResponse(200, "OK", respBody, "text/plain",
+                                        conn.m_keepAlive, false);
+        conn.m_bodyComplete = true;
+        conn.m_phase = ClientConnection::kPhaseRespond;
+      } else if (isDir(filePath)) {
+        DirListingOptions opts;
+        DirSnapshot snap;
+        if (route->directoryListing) {
+          opts.json = route->autoindexJson;
+          opts.withStat = route->autoindexStat;
+          opts.limit = route->autoindexLimit;
+          ParseDirListingQuery(conn.m_request.query, opts);
+        }
+        if (route->directoryListing &&
+            m_dirCache.Get(filePath, opts.withStat, snap)) {
+          std::string keep;
+          conn.m_keepAlive = false;
+          if (hasHeader(conn.m_request, "Connection", keep)) {
+            if (keep == "keep-alive" || keep == "Keep-Alive")
+              conn.m_keepAlive = true;
+            if (keep == "close" || keep == "Close") conn.m_keepAlive = false;
+          } else if (conn.m_request.version == "HTTP/1.1") {
+            conn.m_keepAlive = true;
+          }
+          const std::string &uriPath = conn.m_request.path;
+          DirListingWriter writer(snap, opts, uriPath, false);
+          const char *ctype =
+              opts.json ? "application/json" : "text/html; charset=utf-8";
+          if (conn.m_h2Key != 0 || conn.m_request.version != "HTTP/1.1") {
+            // HTTP/2 re-frames a complete response; HTTP/1.0 cannot chunk
+            while (writer.Next(body, 64 * 1024)) {
             }
-          } else if (readFile(filePath, body)) {
+            conn.m_writeBuf =
+                buildResponse(200, "OK", body, ctype, conn.m_keepAlive,
+                              conn.m_request.method == "HEAD");
+          } else {
+            // Slices are rendered as the socket drains (HandleWritable)
+            conn.m_writeBuf = "HTTP/1.1 200 OK\r\nContent-Type: ";
+            conn.m_writeBuf += ctype;
+            conn.m_writeBuf += "\r\nTransfer-Encoding: chunked\r\nConnection: ";
+            conn.m_writeBuf += conn.m_keepAlive ? "keep-alive" : "close";
+            conn.m_writeBuf += "\r\n\r\n";
+            if (conn.m_request.method != "HEAD")
+              conn.m_dirWriter =
+                  new DirListingWriter(snap, opts, uriPath, true);
+          }
+          conn.m_phase = ClientConnection::kPhaseRespond;
+          std::cerr << "[200] dir listing uri=" << conn.m_request.path
+                    << " entries=" << snap.Size()
+                    << (conn.m_keepAlive ? " keep-alive" : " close") << "\n";
+        } else if (route->directoryListing) {
+          conn.m_keepAlive = false;
+          std::string body500 =
+              loadErrorPageBody(sc, 500, "500 Internal Server Error\n");
+          conn.m_writeBuf = buildResponse(500, "Internal Server Error",
+                                          body500, "text/plain", false,
+                                          conn.m_request.method == "HEAD");
+          conn.m_phase = ClientConnection::kPhaseRespond;
+        } else {
+          conn.m_keepAlive = false;
+          std::string body403 =
+              loadErrorPageBody(sc, 403, "403 Forbidden\n");
+          conn.m_writeBuf =
+              buildResponse(403, "Forbidden", body403, "text/plain", false,
+                            conn.m_request.method == "HEAD");
+          conn.m_phase = ClientConnection::kPhaseRespond;
+        }
+      } else if (conn.m_request.method == "DELETE") {
+        // Handle deletion of file
+        struct stat st;
+        if (::stat(filePath.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+          if (::unlink(filePath.c_str()) == 0) {
             std::string keep;
             conn.m_keepAlive = false;
             if (hasHeader(conn.m_request, "Connection", keep)) {
               if (keep == "keep-alive" || keep == "Keep-Alive")
                 conn.m_keepAlive = true;
-              if (keep == "close" || keep == "Close") conn.m_keepAlive = false;
+              if (keep == "close" || keep == "Close")
+                conn.m_keepAlive = false;
             } else if (conn.m_request.version == "HTTP/1.1") {
-              conn.m_keepAlive =
-                  true;  // default for 1.1 unless close specified
-            }
-            if (conn.m_request.method == "GET" ||
-                conn.m_request.method == "HEAD") {
-              conn.m_writeBuf = buildResponse(
-                  200, "OK", body, guessType(filePath), conn.m_keepAlive,
-                  conn.m_request.method == "HEAD");
-              std::cerr << "[200] uri=" << conn.m_request.uri
-                        << " size=" << body.size()
-                        << (conn.m_keepAlive ? " keep-alive" : " close")
-                        << "\n";
-              conn.m_bodyComplete = true;
-              conn.m_phase = ClientConnection::kPhaseRespond;
-            } else if (conn.m_request.method == "POST") {
-              std::string respBody = "Received POST (";
-              char num[64];
-              std::sprintf(num, "%lu",
-                           (unsigned long)conn.m_request.body.size());
-              respBody += num;
-              respBody += " bytes)\n";
-              if (route->uploadsEnabled && !route->uploadPath.empty()) {
-                // naive unique name
-                std::string base = route->uploadPath;
-                if (!base.empty() && base[base.size() - 1] != '/') base += "/";
-                static unsigned long uploadCounter = 0;  // primitive counter
-                ++uploadCounter;
-                char fname[128];
-                std::sprintf(fname, "upload_%lu.dat", uploadCounter);
-                std::string full = base + fname;
-                FILE *wf = std::fopen(full.c_str(), "wb");
-                if (wf) {
-                  if (!conn.m_request.body.empty())
-                    std::fwrite(conn.m_request.body.data(), 1,
-                                conn.m_request.body.size(), wf);
-                  std::fclose(wf);
-                  respBody += "Stored as ";
-                  respBody += fname;
-                  respBody += "\n";
-                  std::cerr << "[UPLOAD] saved " << full
-                            << " size=" << conn.m_request.body.size() << "\n";
-                } else {
-                  respBody += "Upload save failed errno=";
-                  respBody += std::strerror(errno);
-                  respBody += "\n";
-                  std::cerr << "[UPLOAD-ERR] path=" << full
-                            << " errno=" << errno << "\n";
-                }
-              }
-              conn.m_writeBuf = buildResponse(200, "OK", respBody, "text/plain",
-                                              conn.m_keepAlive, false);
-              conn.m_phase = ClientConnection::kPhaseRespond;
-            } else if (conn.m_request.method == "DELETE") {
-              // Not implemented deletion semantics yet
-              conn.m_keepAlive = false;
-              std::string body501 =
-                  loadErrorPageBody(sc, 501, "501 Not Implemented\n");
-              conn.m_writeBuf = buildResponse(501, "Not Implemented", body501,
-                                              "text/plain", false, false);
-              conn.m_phase = ClientConnection::kPhaseRespond;
-            } else {
-              conn.m_keepAlive = false;
-              std::string body405 =
-                  loadErrorPageBody(sc, 405, "405 Method Not Allowed\n");
-              conn.m_writeBuf =
-                  buildResponse(405, "Method Not Allowed", body405,
-                                "text/plain", false, false);
-              conn.m_phase = ClientConnection::kPhaseRespond;
+              conn.m_keepAlive = true;
             }
+            conn.m_writeBuf =
+                buildResponse(204, "No Content", "", "text/plain",
+                              conn.m_keepAlive, false);
+            conn.m_phase = ClientConnection::kPhaseRespond;
+            std::cerr << "[204] deleted uri=" << conn.m_request.path << "\n";
           } else {
             conn.m_keepAlive = false;
-            std::string body404g =
-                loadErrorPageBody(sc, 404, "404 Not Found\n");
-            conn.m_writeBuf = buildResponse(404, "Not Found", body404g,
-                                            "text/plain", conn.m_keepAlive,
-                                            conn.m_request.method == "HEAD");
-            std::cerr << "[404] file=" << filePath << "\n";
+            std::string body500 =
+                loadErrorPageBody(sc, 500, "500 Internal Server Error\n");
+            conn.m_writeBuf =
+                buildResponse(500, "Internal Server Error", body500,
+                              "text/plain", false, false);
             conn.m_phase = ClientConnection::kPhaseRespond;
+            std::cerr << "[500] delete failed uri=" << conn.m_request.path
+                      << " errno=" << errno << "\n";
+          }
+        } else if (isDir(filePath)) {
+          conn.m_keepAlive = false;
+          std::string body403 =
+              loadErrorPageBody(sc, 403, "403 Forbidden\n");
+          conn.m_writeBuf = buildResponse(403, "Forbidden", body403,
+                                          "text/plain", false, false);
+          conn.m_phase = ClientConnection::kPhaseRespond;
+        } else {
+          conn.m_keepAlive = false;
+          std::string body404f =
+              loadErrorPageBody(sc, 404, "404 Not Found\n");
+          conn.m_writeBuf = buildResponse(404, "Not Found", body404f,
+                                          "text/plain", false, false);
+          conn.m_phase = ClientConnection::kPhaseRespond;
+        }
+      } else if ((conn.m_request.method == "GET" ||
+                  conn.m_request.method == "HEAD") &&
+                 ServeFromSharedCache(conn, sc, *route, filePath)) {
+        conn.m_bodyComplete = true;
+        conn.m_requestClass = kStatClassStaticHit;
+      } else if (readFile(filePath, body, fileSt, route->readahead,
+                          (off_t)route->nocacheMinSize)) {
+        conn.m_requestClass = kStatClassStaticMiss;
+        std::string keep;
+        conn.m_keepAlive = false;
+        if (hasHeader(conn.m_request, "Connection", keep)) {
+          if (keep == "keep-alive" || keep == "Keep-Alive")
+            conn.m_keepAlive = true;
+          if (keep == "close" || keep == "Close") conn.m_keepAlive = false;
+        } else if (conn.m_request.version == "HTTP/1.1") {
+          conn.m_keepAlive =
+              true;  // default for 1.1 unless close specified
+        }
+        if (conn.m_request.method == "GET" ||
+            conn.m_request.method == "HEAD") {
+          const CachePolicy &policy =
+              m_cachePolicies[conn.m_serverIndex][route - &sc.routes[0]];
+          conn.m_writeBuf = buildResponse(
+              200, "OK", body, guessType(filePath), conn.m_keepAlive,
+              conn.m_request.method == "HEAD",
+              policy.Headers(filePath, std::time(0)));
+          // Files the route keeps out of the page cache stay out of this
+          // one too
+          SharedFileCache *shared = m_staticCaches[conn.m_serverIndex];
+          if (shared && S_ISREG(fileSt.st_mode) &&
+              (off_t)body.size() == fileSt.st_size &&
+              body.size() <= shared->MaxBodySize() &&
+              (route->nocacheMinSize == 0 ||
+               body.size() < route->nocacheMinSize))
+            shared->Insert(filePath, fileSt, body);
+          std::cerr << "[200] uri=" << conn.m_request.path
+                    << " size=" << body.size()
+                    << (conn.m_keepAlive ? " keep-alive" : " close")
+                    << "\n";
+          conn.m_bodyComplete = true;
+          conn.m_phase = ClientConnection::kPhaseRespond;
+        } else if (conn.m_request.method == "POST") {
+          std::string respBody = "Received POST (";
+          char num[64];
+          std::sprintf(num, "%lu",
+                       (unsigned long)conn.m_request.body.size());
+          respBody += num;
+          respBody += " bytes)\n";
+          if (route->uploadsEnabled && !route->uploadPath.empty()) {
+            // naive unique name
+            std::string base = route->uploadPath;
+            if (!base.empty() && base[base.size() - 1] != '/') base += "/";
+            static unsigned long uploadCounter = 0;  // primitive counter
+            ++uploadCounter;
+            char fname[128];
+            std::sprintf(fname, "upload_%lu.dat", uploadCounter);
+            std::string full = base + fname;
+            FILE *wf = std::fopen(full.c_str(), "wb");
+            if (wf) {
+              if (!conn.m_request.body.empty())
+                std::fwrite(conn.m_request.body.data(), 1,
+                            conn.m_request.body.size(), wf);
+              std::fclose(wf);
+              respBody += "Stored as ";
+              respBody += fname;
+              respBody += "\n";
+              std::cerr << "[UPLOAD] saved " << full
+                        << " size=" << conn.m_request.body.size() << "\n";
+            } else {
+              respBody += "Upload save failed errno=";
+              respBody += std::strerror(errno);
+              respBody += "\n";
+              std::cerr << "[UPLOAD-ERR] path=" << full
+                        << " errno=" << errno << "\n";
+            }
           }
+          conn.m_writeBuf = buildResponse(200, "OK", respBody, "text/plain",
+                                          conn.m_keepAlive, false);
+          conn.m_phase = ClientConnection::kPhaseRespond;
+        } else if (conn.m_request.method == "DELETE") {
+          // Not implemented deletion semantics yet
+          conn.m_keepAlive = false;
+          std::string body501 =
+              loadErrorPageBody(sc, 501, "501 Not Implemented\n");
+          conn.m_writeBuf = buildResponse(501, "Not Implemented", body501,
+                                          "text/plain", false, false);
+          conn.m_phase = ClientConnection::kPhaseRespond;
+        } else {
+          conn.m_keepAlive = false;
+          std::string body405 =
+              loadErrorPageBody(sc, 405, "405 Method Not Allowed\n");
+          conn.m_writeBuf =
+              buildResponse(405, "Method Not Allowed", body405,
+                            "text/plain", false, false);
+          conn.m_phase = ClientConnection::kPhaseRespond;
         }
+      } else {
+        conn.m_keepAlive = false;
+        std::string body404g =
+            loadErrorPageBody(sc, 404, "404 Not Found\n");
+        conn.m_writeBuf = buildResponse(404, "Not Found", body404g,
+                                        "text/plain", conn.m_keepAlive,
+                                        conn.m_request.method == "HEAD");
+        std::cerr << "[404] file=" << filePath << "\n";
+        conn.m_phase = ClientConnection::kPhaseRespond;
       }
-      conn.m_wantWrite = true;
-      break;
     }
   }
+  // CGI leaders and coalesced waiters are answered later, by DriveCgiIO and
+  // FinishCoalesced; polling them for POLLOUT would close them right away
+  conn.m_wantWrite = conn.m_phase != ClientConnection::kPhaseHandle;
+}
+
+// Checks a request against its virtual host's quotas once the Host header
+// has selected it, before any routing, file or CGI work. A connection
+// counts against the host its latest request chose; HTTP/2 streams count
+// against their connection's.
+bool Server::AdmitRequest(ClientConnection &conn) {
+  if (conn.m_request.admitted) return true;  // coalescing re-dispatched it
+  conn.m_request.admitted = true;
+  int server = conn.m_serverIndex;
+  if (m_captures[server] && conn.m_h2Key == 0) CaptureRequest(conn);
+  bool attach = conn.m_h2Key == 0 && conn.m_quotaServer != server;
+  const char *why = "";
+  int code = m_quotas[server].Admit(attach, MonotonicMicros(), why);
+  if (code) {
+    RefuseOverQuota(conn, code, why);
+    return false;
+  }
+  if (attach) {
+    if (conn.m_quotaServer >= 0) m_quotas[conn.m_quotaServer].Detach();
+    conn.m_quotaServer = server;
+  }
+  return true;
+}
+
+void Server::RefuseOverQuota(ClientConnection &conn, int code,
+                             const char *why) {
+  const ServerConfig &sc = m_config.servers[conn.m_serverIndex];
+  conn.m_keepAlive = false;
+  const char *reason = writeStatusReason(code);
+  std::string body = loadErrorPageBody(
+      sc, code, std::string(code == 429 ? "429 " : "503 ") + reason + "\n");
+  conn.m_writeBuf = buildResponse(code, reason, body, "text/plain", false,
+                                  conn.m_request.method == "HEAD",
+                                  "Retry-After: 1\r\n");
+  conn.m_phase = ClientConnection::kPhaseRespond;
+  conn.m_wantWrite = true;
+  m_stats.Add(kStatQuotaRejections);
+  std::cerr << "[" << code << "] quota " << why << " host=" << sc.host << ":"
+            << sc.port << " uri=" << conn.m_request.path << "\n";
+}
+
+// Records the request's bytes as received: the head, and the body so far up
+// to the server block's limit. A streamed PUT is captured when its headers
+// are in, so its body is mostly still to come.
+void Server::CaptureRequest(ClientConnection &conn) {
+  size_t headLength = conn.m_parser.BodyOffset();
+  if (headLength == 0 || headLength > conn.m_readBuf.size()) return;
+  if (!conn.m_captureId) conn.m_captureId = ++m_nextCaptureId;
+  size_t limit = m_config.servers[conn.m_serverIndex].captureBodyLimit;
+  CapturedRequest rec;
+  rec.connection = conn.m_captureId;
+  rec.arrivalUs = conn.m_requestStartUs;
+  rec.pipelined = conn.m_pipelined;
+  rec.head = conn.m_readBuf.data();
+  rec.headLength = headLength;
+  rec.body = rec.head + headLength;
+  size_t consumed = conn.m_parser.Consumed();
+  rec.bodyTotal = consumed > headLength ? consumed - headLength
+                                        : conn.m_parser.ContentLength();
+  rec.bodyLength = conn.m_readBuf.size() - headLength;
+  if (rec.bodyLength > rec.bodyTotal) rec.bodyLength = rec.bodyTotal;
+  if (rec.bodyLength > limit) rec.bodyLength = limit;
+  m_captures[conn.m_serverIndex]->Record(rec);
+}
+
+// Server-level rewrite/return rules run once per request, before route
+// matching. An internal rewrite replaces the canonical path and query;
+// redirects and returns are answered from the prepared response.
+bool Server::ApplyRewrite(ClientConnection &conn) {
+  HttpRequest &req = conn.m_request;
+  req.rewritten = true;
+  RewriteResult res;
+  if (!m_rewrites[conn.m_serverIndex].Match(req.path, req.query, res))
+    return false;
+  if (res.action == RewriteResult::kRewriteInternal) {
+    std::cerr << "[rewrite] " << req.path << " -> " << res.target << "\n";
+    std::string path, query;
+    if (NormalizeRequestTarget(res.target, path, query)) {
+      req.path = path;
+      req.query = query;
+      return false;
+    }
+    res = RewriteResult();
+    res.code = 400;
+    res.body = "400 Bad Request\n";
+    res.head =
+        "HTTP/1.1 400 Bad Request\r\nContent-Length: 16\r\n"
+        "Content-Type: text/plain\r\n";
+  }
+  std::string keep;
+  conn.m_keepAlive = req.version == "HTTP/1.1";
+  if (hasHeader(req, "Connection", keep))
+    conn.m_keepAlive = keep == "keep-alive" || keep == "Keep-Alive";
+  conn.m_writeBuf = res.head;
+  conn.m_writeBuf += conn.m_keepAlive ? "Connection: keep-alive\r\n\r\n"
+                                      : "Connection: close\r\n\r\n";
+  if (req.method != "HEAD") conn.m_writeBuf += res.body;
+  conn.m_phase = ClientConnection::kPhaseRespond;
+  conn.m_bodyComplete = true;
+  conn.m_wantWrite = true;
+  std::cerr << "[" << res.code << "] rewrite uri=" << req.path
+            << (res.target.empty() ? "" : " -> ") << res.target << "\n";
+  return true;
 }
 
 void Server::HandleWritable(ClientConnection &conn) {
-  while (!conn.m_writeBuf.empty()) {
-    ssize_t n = ::send(conn.m_fd.Get(), conn.m_writeBuf.data(),
-                       conn.m_writeBuf.size(), 0);
-    if (n <= 0) break;
-    conn.m_writeBuf.erase(0, n);
+  if (conn.m_tls.Active() && !conn.m_tls.Established() &&
+      conn.m_phase != ClientConnection::kPhaseClosing) {
+    if (!DriveTlsHandshake(conn)) return;
+    HandleReadable(conn);  // request bytes may have arrived with the Finished
+    return;
+  }
+  if (conn.m_assembly) {
+    // Writability paces the copy: one slice per pass, then the response
+    DriveAssembly(conn);
+    if (conn.m_assembly) return;
+  }
+  // The final status of a response is known once its head is queued; an
+  // interim 100 Continue is not one. HTTP/2 streams are counted as they are
+  // collected.
+  if (!conn.m_responseStatus && !conn.m_h2) {
+    int status = responseStatus(conn.m_writeBuf);
+    if (status >= 200 || status == 101) {
+      conn.m_responseStatus = status;
+      SELFSERV_PROBE4(response_queued, conn.m_fd.Get(), status,
+                      conn.m_writeBuf.size() + conn.m_sharedOutBytes,
+                      conn.m_request.path.c_str());
+    }
+  }
+  for (;;) {
+    while (!conn.m_writeBuf.empty()) {
+      ssize_t n =
+          connSend(conn, conn.m_writeBuf.data(), conn.m_writeBuf.size());
+      if (n <= 0) break;
+      conn.m_writeBuf.erase(0, n);
+      m_stats.Add(kStatBytesOut, (uint64_t)n);
+      SELFSERV_PROBE3(bytes_sent, conn.m_fd.Get(), n,
+                      conn.m_writeBuf.size() + conn.m_sharedOutBytes);
+    }
+    // Shared buffers go out straight from their storage, never copied into
+    // m_writeBuf; whatever m_writeBuf holds (headers, the 101) precedes them
+    while (conn.m_writeBuf.empty() && !conn.m_sharedOut.empty()) {
+      const SharedBuffer &front = conn.m_sharedOut.front();
+      size_t left = front.Size() - conn.m_sharedOutOffset;
+      ssize_t n =
+          WantZeroCopy(conn, left)
+              ? conn.m_zeroCopy.Send(conn.m_fd.Get(), front,
+                                     conn.m_sharedOutOffset, left)
+              : connSend(conn, front.Data() + conn.m_sharedOutOffset, left);
+      if (n <= 0) break;
+      m_stats.Add(kStatBytesOut, (uint64_t)n);
+      conn.m_sharedOutOffset += (size_t)n;
+      conn.m_sharedOutBytes -= (size_t)n;
+      SELFSERV_PROBE3(bytes_sent, conn.m_fd.Get(), n, conn.m_sharedOutBytes);
+      if (conn.m_sharedOutOffset == front.Size()) {
+        conn.m_sharedOut.pop_front();
+        conn.m_sharedOutOffset = 0;
+      }
+    }
+    // A directory listing renders its next slice only once the previous one
+    // has left, so memory stays bounded however large the directory
+    if (!conn.m_dirWriter || !conn.m_writeBuf.empty() ||
+        !conn.m_sharedOut.empty())
+      break;
+    if (!conn.m_dirWriter->Next(conn.m_writeBuf, kDirListingSliceBytes)) {
+      delete conn.m_dirWriter;
+      conn.m_dirWriter = 0;
+    }
+  }
+  if (conn.m_h2) {
+    // Streams share the socket: refill from the session instead of resetting
+    // per-request state
+    if (conn.m_writeBuf.empty() &&
+        (conn.m_h2->WantsClose() || conn.m_peerClosed)) {
+      CloseConnection(conn.m_fd.Get());
+      return;
+    }
+    FlushHttp2(conn);
+    return;
+  }
+  if (conn.m_upload.Active()) {
+    // Only a 100 Continue went out; the request body is still arriving
+    if (conn.m_writeBuf.empty()) conn.m_wantWrite = false;
+    return;
+  }
+  if (conn.m_ws) {
+    if (conn.m_writeBuf.empty() && conn.m_sharedOut.empty()) {
+      if (conn.m_wsCloseSent || conn.m_peerClosed) {
+        CloseConnection(conn.m_fd.Get());
+        return;
+      }
+      conn.m_wantWrite = false;
+    }
+    return;
   }
-  if (conn.m_writeBuf.empty()) {
-    if (!conn.m_keepAlive || conn.m_phase == ClientConnection::kPhaseClosing) {
+  if (conn.m_writeBuf.empty() && conn.m_sharedOut.empty()) {
+    if (!conn.m_keepAlive || conn.m_peerClosed ||
+        conn.m_phase == ClientConnection::kPhaseClosing) {
       CloseConnection(conn.m_fd.Get());
       return;
     }
@@ -1010,17 +2130,130 @@ void Server::HandleWritable(ClientConnection &conn) {
     } else {
       conn.m_readBuf.clear();
     }
+    conn.m_pipelined = !conn.m_readBuf.empty();
+    FinishRequestStats(conn);
     conn.m_wantWrite = false;
     conn.m_request = HttpRequest();
     conn.m_parser.Reset();
     conn.m_keepAlive = false;  // will be set by next response
     conn.m_phase = ClientConnection::kPhaseIdle;
+    // A pipelined request may be buffered in full already, with nothing more
+    // to arrive and get it parsed
+    if (!conn.m_readBuf.empty()) {
+      ParseBuffered(conn);
+      if (conn.m_upload.Active()) DrivePutUpload(conn);
+    }
+  }
+}
+
+// Large shared bodies on plaintext sockets go out with MSG_ZEROCOPY when the
+// server block sets zerocopy_min_size
+bool Server::WantZeroCopy(ClientConnection &conn, size_t len) {
+  size_t minSize = m_config.servers[conn.m_serverIndex].zeroCopyMinSize;
+  if (minSize == 0 || len < minSize || conn.m_tls.Active()) return false;
+  return conn.m_zeroCopy.Enable(conn.m_fd.Get());
+}
+
+// Counts the response just sent (or cut short) on a socket connection. A
+// pipelined request already buffered starts now.
+void Server::FinishRequestStats(ClientConnection &conn) {
+  if (m_perfSampling) ChargePerfSample(conn);
+  if (conn.m_responseStatus) {
+    m_stats.RecordResponse(conn.m_responseStatus,
+                           MonotonicMicros() - conn.m_requestStartUs);
+    if (m_perf.Active()) {
+      int status = conn.m_responseStatus;
+      StatRequestClass cls = conn.m_requestClass;
+      if (status == 404)
+        cls = kStatClassNotFound;
+      else if (status >= 300 && status < 400 && status != 304)
+        cls = kStatClassRedirect;
+      m_stats.RecordHardware(cls, conn.m_hardware);
+    }
+    conn.m_responseStatus = 0;
+  }
+  std::fill(conn.m_hardware, conn.m_hardware + kStatHardwareEventCount, 0);
+  conn.m_requestClass = kStatClassOther;
+  conn.m_requestStartUs = conn.m_readBuf.empty() ? 0 : MonotonicMicros();
+}
+
+void Server::BeginPerfSample() {
+  m_perfSampling = m_perf.Active() && m_perf.Read(m_perfMark);
+}
+
+void Server::EndPerfSample(int fd) {
+  if (!m_perfSampling) return;
+  std::map<int, ClientConnection>::iterator it = m_clients.find(fd);
+  if (it != m_clients.end()) ChargePerfSample(it->second);
+  m_perfSampling = false;
+}
+
+// Adds what the counters moved since the mark to the connection's request,
+// and moves the mark: a request finishing midway through the handlers is
+// charged up to that point, and the next one from there
+void Server::ChargePerfSample(ClientConnection &conn) {
+  uint64_t now[kStatHardwareEventCount];
+  if (!m_perf.Read(now)) return;
+  for (int e = 0; e < kStatHardwareEventCount; ++e) {
+    conn.m_hardware[e] += now[e] - m_perfMark[e];
+    m_perfMark[e] = now[e];
   }
 }
 
 void Server::CloseConnection(int fd) {
   std::map<int, ClientConnection>::iterator it = m_clients.find(fd);
   if (it != m_clients.end()) {
+    SELFSERV_PROBE3(close, fd, (int)it->second.m_phase,
+                    (int)it->second.m_peerClosed);
+    if (fd >= 0) {
+      FinishRequestStats(it->second);
+      m_stats.Adjust(kStatActiveConnections, -1);
+    }
+    if (it->second.m_quotaServer >= 0)
+      m_quotas[it->second.m_quotaServer].Detach();
+    if (it->second.m_cgiQuotaServer >= 0)
+      m_quotas[it->second.m_cgiQuotaServer].EndCgi();
+    if (it->second.m_h2) {
+      // Drop streams still waiting on CGI; negative keys sort first
+      std::map<int, ClientConnection>::iterator s = m_clients.begin();
+      while (s != m_clients.end() && s->first < 0) {
+        if (s->second.m_h2ParentFd != fd) {
+          ++s;
+          continue;
+        }
+        if (s->second.m_cgiPid > 0 && s->second.m_cgiActive)
+          ::kill(s->second.m_cgiPid, SIGKILL);
+        ReapCgi(s->second);
+        delete s->second.m_assembly;
+        m_clients.erase(s++);
+      }
+      delete it->second.m_h2;
+      it->second.m_h2 = 0;
+    }
+    delete it->second.m_dirWriter;
+    delete it->second.m_assembly;
+    ClientConnection &c = it->second;
+    if (c.m_ws && c.m_wsBackendFd >= 0) {
+      std::map<int, WsBackend>::iterator b =
+          m_wsBackends.find(c.m_wsBackendFd);
+      if (b != m_wsBackends.end()) {
+        b->second.clients.erase(c.m_wsId);
+        AppendWsRecord(b->second.out, kWsRecordClose, c.m_wsId, "");
+        FlushWsBackend(b->first, b->second);
+      }
+    }
+    if (c.m_zeroCopy.Pending()) {
+      c.m_zeroCopy.Reap(fd);
+      std::vector<SharedBuffer> held;
+      c.m_zeroCopy.TakePending(held);
+      unsigned long nowMs = (unsigned long)std::time(0) * 1000UL;
+      for (size_t i = 0; i < held.size(); ++i) {
+        m_zeroCopyOrphans.push_back(
+            std::pair<unsigned long, SharedBuffer>(nowMs, SharedBuffer()));
+        m_zeroCopyOrphans.back().second = held[i];
+      }
+    }
+    it->second.m_tls.Free();
     m_clients.erase(it);
   }
 }
@@ -1036,12 +2269,14 @@ void Server::BuildPollFds(std::vector<struct pollfd> &pfds) {
   }
   std::map<int, ClientConnection>::iterator it = m_clients.begin();
   for (; it != m_clients.end(); ++it) {
-    struct pollfd p;
-    p.fd = it->first;
-    p.events = POLLIN;
-    if (it->second.m_wantWrite) p.events |= POLLOUT;
-    p.revents = 0;
-    pfds.push_back(p);
+    if (it->first >= 0) {  // HTTP/2 stream pseudo connections have no socket
+      struct pollfd p;
+      p.fd = it->first;
+      p.events = it->second.m_peerClosed ? 0 : POLLIN;
+      if (it->second.m_wantWrite) p.events |= POLLOUT;
+      p.revents = 0;
+      pfds.push_back(p);
+    }
     if (it->second.m_cgiActive) {
       if (it->second.m_cgiInFd >= 0) {
         struct pollfd pc;
@@ -1059,10 +2294,49 @@ void Server::BuildPollFds(std::vector<struct pollfd> &pfds) {
       }
     }
   }
+  for (std::map<int, WsBackend>::iterator b = m_wsBackends.begin();
+       b != m_wsBackends.end(); ++b) {
+    struct pollfd pw;
+    pw.fd = b->first;
+    pw.events = POLLIN;
+    if (!b->second.out.empty()) pw.events |= POLLOUT;
+    pw.revents = 0;
+    pfds.push_back(pw);
+  }
 }
 
 void Server::Shutdown() {
+  for (std::map<int, WsBackend>::iterator it = m_wsBackends.begin();
+       it != m_wsBackends.end(); ++it)
+    ::close(it->first);
+  m_wsBackends.clear();
+  for (std::map<int, ClientConnection>::iterator it = m_clients.begin();
+       it != m_clients.end(); ++it) {
+    delete it->second.m_h2;
+    it->second.m_h2 = 0;
+    delete it->second.m_dirWriter;
+    it->second.m_tls.Free();
+  }
   m_clients.clear();
+  // Handles into the shared caches unpin through their mapping, so every
+  // one is gone before the caches are unmapped
+  m_zeroCopyOrphans.clear();
+  for (std::map<std::string, SharedFileCache *>::iterator it =
+           m_sharedCaches.begin();
+       it != m_sharedCaches.end(); ++it)
+    delete it->second;
+  m_sharedCaches.clear();
+  m_staticCaches.clear();
+  for (std::map<std::string, TrafficCapture *>::iterator it =
+           m_captureFiles.begin();
+       it != m_captureFiles.end(); ++it)
+    delete it->second;
+  m_captureFiles.clear();
+  m_captures.clear();
+  for (std::map<int, TlsContext *>::iterator it = m_tlsContexts.begin();
+       it != m_tlsContexts.end(); ++it)
+    delete it->second;
+  m_tlsContexts.clear();
   m_listenSockets.clear();
 }
 
@@ -1084,6 +2358,10 @@ bool Server::MaybeStartCgi(ClientConnection &conn, const RouteConfig &route,
     ::close(outPipe[1]);
     return false;
   }
+  if (pid > 0) {
+    m_stats.Add(kStatCgiRuns);
+    SELFSERV_PROBE3(cgi_start, conn.m_fd.Get(), (int)pid, filePath.c_str());
+  }
   if (pid == 0) {
     // child
     ::dup2(inPipe[0], 0);   // stdin
@@ -1099,17 +2377,6 @@ bool Server::MaybeStartCgi(ClientConnection &conn, const RouteConfig &route,
       scriptDir.erase(slash);
       if (!scriptDir.empty()) ::chdir(scriptDir.c_str());
     }
-    // Derive PATH_INFO and QUERY_STRING from original URI
-    std::string uri = conn.m_request.uri;
-    std::string query;
-    size_t qpos = uri.find('?');
-    if (qpos != std::string::npos) {
-      query = uri.substr(qpos + 1);
-      uri = uri.substr(0, qpos);
-    }
-    // For PATH_INFO we supply the script path itself; more advanced splitting
-    // could map script vs extra path
-    std::string pathInfo = uri;
     // Content-Length & Type
     char lenBuf[32];
     std::sprintf(lenBuf, "%lu", (unsigned long)conn.m_request.body.size());
@@ -1127,13 +2394,18 @@ bool Server::MaybeStartCgi(ClientConnection &conn, const RouteConfig &route,
     envStrs.push_back("REQUEST_METHOD=" + conn.m_request.method);
     envStrs.push_back("SCRIPT_FILENAME=" + filePath);
     envStrs.push_back("SCRIPT_NAME=" + filePath);
-    envStrs.push_back("PATH_INFO=" + pathInfo);
-    envStrs.push_back("QUERY_STRING=" + query);
+    // For PATH_INFO we supply the script path itself; more advanced splitting
+    // could map script vs extra path
+    envStrs.push_back("PATH_INFO=" + conn.m_request.path);
+    envStrs.push_back("QUERY_STRING=" + conn.m_request.query);
     envStrs.push_back(std::string("CONTENT_LENGTH=") + lenBuf);
     if (!contentType.empty()) envStrs.push_back("CONTENT_TYPE=" + contentType);
     envStrs.push_back("GATEWAY_INTERFACE=CGI/1.1");
     envStrs.push_back("SERVER_PROTOCOL=HTTP/1.1");
     envStrs.push_back("REDIRECT_STATUS=200");  // for PHP
+    // Only PATH is inherited, so interpreters can still be found by name
+    const char *searchPath = std::getenv("PATH");
+    if (searchPath) envStrs.push_back(std::string("PATH=") + searchPath);
     // SERVER_NAME / PORT (best-effort)
     // SERVER_NAME / PORT from selected server config (best-effort)
     std::string serverName = "localhost";
@@ -1176,12 +2448,9 @@ bool Server::MaybeStartCgi(ClientConnection &conn, const RouteConfig &route,
       argv.push_back(const_cast<char *>(interpreter.c_str()));
     argv.push_back(const_cast<char *>(filePath.c_str()));
     argv.push_back(0);
-    if (!interpreter.empty()) {
-      ::execlp(interpreter.c_str(), interpreter.c_str(), filePath.c_str(),
-               (char *)0);
-    } else {
-      ::execlp(filePath.c_str(), filePath.c_str(), (char *)0);
-    }
+    // The script sees the CGI variables above, not the server's environment
+    environ = &envp[0];
+    ::execvp(argv[0], &argv[0]);
     _exit(1);
   }
   // parent
@@ -1193,8 +2462,14 @@ bool Server::MaybeStartCgi(ClientConnection &conn, const RouteConfig &route,
   conn.m_cgiOutFd = outPipe[0];
   conn.m_cgiPid = pid;
   conn.m_cgiActive = true;
-  m_cgiFdToClient[conn.m_cgiInFd] = conn.m_fd.Get();
-  m_cgiFdToClient[conn.m_cgiOutFd] = conn.m_fd.Get();
+  // Keep-alive connections may run several scripts
+  conn.m_cgiBuffer.clear();
+  conn.m_cgiHeadersDone = false;
+  conn.m_cgiEof = false;
+  conn.m_cgiBodyStart = 0;
+  conn.m_cgiWriteOffset = 0;
+  m_cgiFdToClient[conn.m_cgiInFd] = clientKey(conn);
+  m_cgiFdToClient[conn.m_cgiOutFd] = clientKey(conn);
   return true;
 }
 
@@ -1214,28 +2489,36 @@ bool Server::DriveCgiIO(ClientConnection &conn) {
       conn.m_cgiInFd = -1;
     }
   }
-  // read CGI stdout
+  // check if child exited; reaped before reading, so everything it wrote
+  // is already in the pipe
+  if (conn.m_cgiPid > 0) {
+    int status = 0;
+    pid_t r = ::waitpid(conn.m_cgiPid, &status, WNOHANG);
+    if (r == conn.m_cgiPid) {
+      SELFSERV_PROBE3(cgi_exit, conn.m_fd.Get(), (int)r, status);
+      conn.m_cgiPid = -1;
+    }
+  }
+  // read CGI stdout. A process the script left behind may still hold the
+  // pipe; then EOF comes with a later event, or the CGI timeout fires.
   if (conn.m_cgiOutFd >= 0) {
     for (;;) {
       char buf[4096];
       ssize_t n = ::read(conn.m_cgiOutFd, buf, sizeof(buf));
       if (n > 0) conn.m_cgiBuffer.append(buf, n);
+      if (n == 0) {  // EOF: the script's output is complete
+        ::close(conn.m_cgiOutFd);
+        m_cgiFdToClient.erase(conn.m_cgiOutFd);
+        conn.m_cgiOutFd = -1;
+        conn.m_cgiEof = true;
+      }
       if (n <= 0) break;
     }
   }
-  // check if child exited
-  int status = 0;
-  pid_t r = ::waitpid(conn.m_cgiPid, &status, WNOHANG);
-  if (r == conn.m_cgiPid) {
-    if (conn.m_cgiOutFd >= 0) {
-      ::close(conn.m_cgiOutFd);
-      m_cgiFdToClient.erase(conn.m_cgiOutFd);
-      conn.m_cgiOutFd = -1;
-    }
-    conn.m_cgiActive = false;
-  }
-  // If output available and not yet built response, parse headers
-  if (!conn.m_cgiBuffer.empty() && !conn.m_cgiHeadersDone) {
+  if (conn.m_cgiPid < 0 && conn.m_cgiEof) conn.m_cgiActive = false;
+  // Only complete output is parsed, and so cached or shared with coalesced
+  // waiters: a body cut short must never be replayed to other clients
+  if (!conn.m_cgiBuffer.empty() && !conn.m_cgiHeadersDone && conn.m_cgiEof) {
     size_t pos = conn.m_cgiBuffer.find("\r\n\r\n");
     if (pos != std::string::npos) {
       conn.m_cgiHeadersDone = true;
@@ -1288,15 +2571,16 @@ bool Server::DriveCgiIO(ClientConnection &conn) {
           start = end + 2;
       }
       std::string body = conn.m_cgiBuffer.substr(conn.m_cgiBodyStart);
-      // Determine keep-alive
-      if (connectionHdr.empty()) {
-        // Derive from HTTP/1.1 default
-        conn.m_keepAlive = true;
-      } else {
+      // Determine keep-alive: the client's choice, unless the script closes
+      conn.m_keepAlive = conn.m_request.version == "HTTP/1.1";
+      std::string keep;
+      if (hasHeader(conn.m_request, "Connection", keep))
+        conn.m_keepAlive = keep == "keep-alive" || keep == "Keep-Alive";
+      if (!connectionHdr.empty()) {
         std::string lower = connectionHdr;
         for (size_t i = 0; i < lower.size(); ++i)
           lower[i] = (char)std::tolower(lower[i]);
-        conn.m_keepAlive = (lower == "keep-alive");
+        if (lower != "keep-alive") conn.m_keepAlive = false;
       }
       // Build full response manually (not using buildResponse to allow header
       // passthrough)
@@ -1340,6 +2624,8 @@ bool Server::DriveCgiIO(ClientConnection &conn) {
       }
       if (!haveCT && !contentType.empty())
         resp += "Content-Type: " + contentType + "\r\n";
+      if (!conn.m_cacheKey.empty())
+        StoreCachedResponse(conn, code, passHeaders, resp, body);
       resp += "Connection: ";
       resp += conn.m_keepAlive ? "keep-alive" : "close";
       resp += "\r\n\r\n";
@@ -1376,9 +2662,14 @@ void Server::ReapCgi(ClientConnection &conn) {
   }
   if (conn.m_cgiPid > 0) {
     int st;
-    ::waitpid(conn.m_cgiPid, &st, WNOHANG);
+    if (::waitpid(conn.m_cgiPid, &st, WNOHANG) == conn.m_cgiPid)
+      SELFSERV_PROBE3(cgi_exit, conn.m_fd.Get(), (int)conn.m_cgiPid, st);
   }
   conn.m_cgiActive = false;
+  if (conn.m_cgiQuotaServer >= 0) {
+    m_quotas[conn.m_cgiQuotaServer].EndCgi();
+    conn.m_cgiQuotaServer = -1;
+  }
 }
 
 bool Server::HandleCgiEvent(int fd, short revents) {
@@ -1393,21 +2684,866 @@ bool Server::HandleCgiEvent(int fd, short revents) {
   }
   ClientConnection &conn = cit->second;
   if (!conn.m_cgiActive) return true;
-  if (revents & (POLLHUP | POLLERR)) {
-    // mark child likely done; drive IO then close
-    DriveCgiIO(conn);
-    if (conn.m_cgiOutFd == fd) {
-      ::close(conn.m_cgiOutFd);
-      m_cgiFdToClient.erase(fd);
-      conn.m_cgiOutFd = -1;
-    }
-    if (conn.m_cgiInFd == fd) {
-      ::close(conn.m_cgiInFd);
-      m_cgiFdToClient.erase(fd);
-      conn.m_cgiInFd = -1;
-    }
-    conn.m_cgiActive = false;
+  if ((revents & (POLLHUP | POLLERR)) && conn.m_cgiInFd == fd) {
+    // The script stopped reading its stdin; the rest of the body is dropped
+    ::close(conn.m_cgiInFd);
+    m_cgiFdToClient.erase(fd);
+    conn.m_cgiInFd = -1;
   }
+  // On stdout, a hang-up still leaves buffered output to read up to EOF
   if (!DriveCgiIO(conn)) return false;
   return true;
 }
+
+// Coalescing and cache key: method, virtual host, canonical path, the query
+// string verbatim and the route's vary= headers
+static std::string coalesceKey(const ClientConnection &conn,
+                               const RouteConfig &route) {
+  char idx[16];
+  std::sprintf(idx, "%d", conn.m_serverIndex);
+  std::string key = conn.m_request.method + " " + idx + " " +
+                    conn.m_request.path + "?" + conn.m_request.query;
+  for (size_t i = 0; i < route.varyHeaders.size(); ++i) {
+    std::string value;
+    hasHeader(conn.m_request, route.varyHeaders[i].c_str(), value);
+    key += '\n';
+    key += value;
+  }
+  return key;
+}
+
+bool Server::JoinCoalesced(ClientConnection &conn, const RouteConfig &route) {
+  // Only requests without side effects may share a response
+  if ((conn.m_request.method != "GET" && conn.m_request.method != "HEAD") ||
+      !conn.m_request.body.empty())
+    return false;
+  conn.m_coalesceKey = coalesceKey(conn, route);
+  std::map<std::string, CoalescedRequest>::iterator it =
+      m_inFlight.find(conn.m_coalesceKey);
+  if (it == m_inFlight.end()) return false;  // caller becomes the leader
+  it->second.waiters.push_back(clientKey(conn));
+  conn.m_phase = ClientConnection::kPhaseHandle;
+  return true;
+}
+
+void Server::FinishCoalesced() {
+  std::map<std::string, CoalescedRequest>::iterator it = m_inFlight.begin();
+  while (it != m_inFlight.end()) {
+    const std::string key = it->first;
+    // Keys are fds and may be reused, so membership is confirmed by key
+    std::map<int, ClientConnection>::iterator lead =
+        m_clients.find(it->second.leader);
+    bool leaderGone =
+        lead == m_clients.end() || lead->second.m_coalesceKey != key;
+    if (!leaderGone &&
+        lead->second.m_phase != ClientConnection::kPhaseRespond) {
+      ++it;
+      continue;
+    }
+    std::vector<int> waiters = it->second.waiters;
+    m_inFlight.erase(it++);
+    if (leaderGone) {
+      // The leader disconnected and its CGI was killed: the waiters start
+      // over, the first one becoming the new leader
+      for (size_t i = 0; i < waiters.size(); ++i) {
+        std::map<int, ClientConnection>::iterator w =
+            m_clients.find(waiters[i]);
+        if (w == m_clients.end() || w->second.m_coalesceKey != key) continue;
+        w->second.m_coalesceKey.clear();
+        HandleRequest(w->second);
+      }
+      continue;
+    }
+    ClientConnection &leader = lead->second;
+    leader.m_coalesceKey.clear();
+    if (waiters.empty()) continue;
+    // Headers are copied per connection; the body is stored once and queued
+    // on every HTTP/1.1 connection (HTTP/2 streams need their own copy to
+    // re-frame)
+    std::string response = leader.m_writeBuf;
+    size_t headEnd = response.find("\r\n\r\n");
+    headEnd = headEnd == std::string::npos ? response.size() : headEnd + 4;
+    std::string head = response.substr(0, headEnd);
+    SharedBuffer body(response.substr(headEnd));
+    if (leader.m_h2Key == 0) {
+      leader.m_writeBuf = head;
+      leader.m_sharedOut.push_back(body);
+      leader.m_sharedOutBytes += body.Size();
+    }
+    size_t served = 0;
+    for (size_t i = 0; i < waiters.size(); ++i) {
+      std::map<int, ClientConnection>::iterator w = m_clients.find(waiters[i]);
+      if (w == m_clients.end() || w->second.m_coalesceKey != key) continue;
+      ClientConnection &c = w->second;
+      c.m_coalesceKey.clear();
+      c.m_keepAlive = leader.m_keepAlive;
+      c.m_phase = ClientConnection::kPhaseRespond;
+      if (c.m_h2Key != 0) {
+        c.m_writeBuf = response;
+      } else {
+        c.m_writeBuf = head;
+        c.m_sharedOut.push_back(body);
+        c.m_sharedOutBytes += body.Size();
+        c.m_wantWrite = true;
+      }
+      ++served;
+    }
+    std::cerr << "[coalesce] " << served
+              << " waiters served from one CGI run\n";
+  }
+}
+
+ResponseCache &Server::CacheFor(int serverIndex) {
+  std::map<int, ResponseCache>::iterator it =
+      m_responseCaches.find(serverIndex);
+  if (it == m_responseCaches.end())
+    it = m_responseCaches
+             .insert(std::make_pair(
+                 serverIndex,
+                 ResponseCache(
+                     m_config.servers[serverIndex].responseCacheSize)))
+             .first;
+  return it->second;
+}
+
+bool Server::ServeFromCache(ClientConnection &conn, const RouteConfig &route,
+                            const std::string &filePath) {
+  std::string auth;
+  if ((conn.m_request.method != "GET" && conn.m_request.method != "HEAD") ||
+      !conn.m_request.body.empty() ||
+      hasHeader(conn.m_request, "Authorization", auth))
+    return false;
+  conn.m_cacheKey = coalesceKey(conn, route);
+  ResponseCache::Hit hit;
+  unsigned long nowMs = (unsigned long)std::time(0) * 1000UL;
+  if (!CacheFor(conn.m_serverIndex).Lookup(conn.m_cacheKey, nowMs, hit))
+    return false;  // miss: the CGI response will be stored under the key
+  std::cerr << "[cache] " << (hit.stale ? "stale" : "hit")
+            << " uri=" << conn.m_request.path << "\n";
+  if (hit.refresh) StartCacheRefresh(conn, route, filePath);
+  conn.m_cacheKey.clear();
+
+  std::string keep;
+  conn.m_keepAlive = conn.m_request.version == "HTTP/1.1";
+  if (hasHeader(conn.m_request, "Connection", keep))
+    conn.m_keepAlive = keep == "keep-alive" || keep == "Keep-Alive";
+  char age[32];
+  std::sprintf(age, "Age: %lu\r\n", hit.ageSec);
+  conn.m_writeBuf = hit.head;
+  conn.m_writeBuf += age;
+  conn.m_writeBuf += conn.m_keepAlive ? "Connection: keep-alive\r\n\r\n"
+                                      : "Connection: close\r\n\r\n";
+  if (conn.m_h2Key != 0) {
+    // HTTP/2 re-frames the whole HTTP/1.1-shaped response
+    conn.m_writeBuf.append(hit.body.Data(), hit.body.Size());
+  } else if (hit.body.Size()) {
+    conn.m_sharedOut.push_back(hit.body);
+    conn.m_sharedOutBytes += hit.body.Size();
+  }
+  return true;
+}
+
+void Server::StartCacheRefresh(const ClientConnection &conn,
+                               const RouteConfig &route,
+                               const std::string &filePath) {
+  // A client-less pseudo connection in the HTTP/2 stream key space: its CGI
+  // pipes are polled as usual, DriveCgiIO stores the result and
+  // CollectHttp2Responses discards it
+  int key = m_nextStreamKey--;
+  if (m_nextStreamKey >= -1) m_nextStreamKey = -2;  // wrapped
+  ClientConnection &refresh = m_clients[key];
+  refresh.m_request = conn.m_request;
+  refresh.m_serverIndex = conn.m_serverIndex;
+  refresh.m_createdAtMs = conn.m_lastActivityMs;
+  refresh.m_lastActivityMs = conn.m_lastActivityMs;
+  refresh.m_headersComplete = true;
+  refresh.m_bodyComplete = true;
+  refresh.m_h2Key = key;
+  refresh.m_cacheKey = conn.m_cacheKey;
+  if (!MaybeStartCgi(refresh, route, filePath)) {
+    // Drop the stale entry so the next request runs the script itself
+    CacheFor(conn.m_serverIndex).Erase(conn.m_cacheKey);
+    m_clients.erase(key);
+    return;
+  }
+  refresh.m_cgiStartMs = (unsigned long)std::time(0) * 1000UL;
+  refresh.m_phase = ClientConnection::kPhaseHandle;
+  std::cerr << "[cache] refresh pid=" << refresh.m_cgiPid
+            << " uri=" << conn.m_request.path << "\n";
+}
+
+void Server::StoreCachedResponse(
+    const ClientConnection &conn, int code,
+    const std::vector<std::pair<std::string, std::string> > &headers,
+    const std::string &head, const std::string &body) {
+  const ServerConfig &sc = m_config.servers[conn.m_serverIndex];
+  const RouteConfig *route = matchRoute(sc, conn.m_request.path);
+  ResponseCache &cache = CacheFor(conn.m_serverIndex);
+  if (!route || code != 200) {
+    cache.Erase(conn.m_cacheKey);
+    return;
+  }
+  long ttl = route->cacheTtlSec;
+  long stale = route->cacheStaleSec;
+  long sharedMaxAge = -1;
+  bool noStore = false;
+  for (size_t i = 0; i < headers.size(); ++i) {
+    std::string name = headers[i].first;
+    for (size_t j = 0; j < name.size(); ++j)
+      name[j] = (char)std::tolower((unsigned char)name[j]);
+    if (name == "set-cookie") noStore = true;  // per-user; never shared
+    if (name != "cache-control") continue;
+    std::string value = headers[i].second;
+    for (size_t j = 0; j < value.size(); ++j)
+      value[j] = (char)std::tolower((unsigned char)value[j]);
+    size_t start = 0;
+    while (start < value.size()) {
+      size_t comma = value.find(',', start);
+      if (comma == std::string::npos) comma = value.size();
+      std::string d = value.substr(start, comma - start);
+      start = comma + 1;
+      size_t b = d.find_first_not_of(" \t");
+      if (b == std::string::npos) continue;
+      d = d.substr(b, d.find_last_not_of(" \t") + 1 - b);
+      if (d == "no-store" || d == "private" || d == "no-cache") {
+        noStore = true;
+      } else if (d.compare(0, 8, "max-age=") == 0) {
+        ttl = std::atol(d.c_str() + 8);
+      } else if (d.compare(0, 9, "s-maxage=") == 0) {
+        sharedMaxAge = std::atol(d.c_str() + 9);
+      } else if (d.compare(0, 23, "stale-while-revalidate=") == 0) {
+        stale = std::atol(d.c_str() + 23);
+      }
+    }
+  }
+  if (sharedMaxAge >= 0) ttl = sharedMaxAge;  // this is a shared cache
+  if (noStore || ttl <= 0) {
+    cache.Erase(conn.m_cacheKey);
+    return;
+  }
+  if (stale < 0) stale = 0;
+  unsigned long nowMs = (unsigned long)std::time(0) * 1000UL;
+  cache.Store(conn.m_cacheKey, head, body, nowMs, (unsigned long)ttl * 1000UL,
+              (unsigned long)stale * 1000UL);
+}
+
+// Accept-Encoding lists gzip (or *) without q=0
+static bool acceptsGzip(const HttpRequest &req) {
+  std::string ae;
+  if (!hasHeader(req, "Accept-Encoding", ae)) return false;
+  size_t start = 0;
+  while (start < ae.size()) {
+    size_t comma = ae.find(',', start);
+    if (comma == std::string::npos) comma = ae.size();
+    std::string item = ae.substr(start, comma - start);
+    start = comma + 1;
+    size_t b = item.find_first_not_of(" \t");
+    if (b == std::string::npos) continue;
+    size_t semi = item.find(';', b);
+    std::string coding = item.substr(b, semi == std::string::npos
+                                            ? std::string::npos
+                                            : semi - b);
+    coding.erase(coding.find_last_not_of(" \t") + 1);
+    if (strcasecmp(coding.c_str(), "gzip") != 0 && coding != "*") continue;
+    if (semi == std::string::npos) return true;
+    size_t q = item.find("q=", semi);
+    return q == std::string::npos || std::atof(item.c_str() + q + 2) > 0;
+  }
+  return false;
+}
+
+void Server::ServeEmbedded(ClientConnection &conn, const ServerConfig &sc,
+                           const RouteConfig &route, const std::string &rel) {
+  conn.m_requestClass = kStatClassStaticHit;  // compiled into the binary
+  bool headOnly = conn.m_request.method == "HEAD";
+  std::string keep;
+  conn.m_keepAlive = conn.m_request.version == "HTTP/1.1";
+  if (hasHeader(conn.m_request, "Connection", keep))
+    conn.m_keepAlive = keep == "keep-alive" || keep == "Keep-Alive";
+  conn.m_phase = ClientConnection::kPhaseRespond;
+  conn.m_wantWrite = true;
+
+  // The route root selects a subtree of the embedded table ("/" for all)
+  std::string path = route.root;
+  if (!path.empty() && path[path.size() - 1] == '/')
+    path.erase(path.size() - 1);
+  // Prefix routes written with a trailing '/' leave rel without a leading one
+  if (rel.empty() || rel[0] != '/') path += '/';
+  path += rel;
+  const EmbeddedAsset *asset = FindEmbeddedAsset(path);
+  if (!asset && !route.index.empty() && path[path.size() - 1] == '/')
+    asset = FindEmbeddedAsset(path + route.index);
+  if (!asset || (conn.m_request.method != "GET" && !headOnly)) {
+    int code = asset ? 405 : 404;
+    std::string body =
+        loadErrorPageBody(sc, code, asset ? "405 Method Not Allowed\n"
+                                          : "404 Not Found\n");
+    conn.m_writeBuf =
+        buildResponse(code, asset ? "Method Not Allowed" : "Not Found", body,
+                      "text/plain", conn.m_keepAlive, headOnly);
+    std::cerr << "[" << code << "] embedded uri=" << conn.m_request.path
+              << "\n";
+    return;
+  }
+
+  // Each representation has its own validator; If-None-Match uses the weak
+  // comparison, so either one revalidates
+  bool gzip = asset->gzipData && acceptsGzip(conn.m_request);
+  std::string etag = asset->etag;
+  if (gzip) etag.insert(etag.size() - 1, "-gz");
+  std::string inm;
+  bool notModified = false;
+  if (hasHeader(conn.m_request, "If-None-Match", inm)) {
+    std::string hash(asset->etag + 1, std::strlen(asset->etag) - 2);
+    notModified = inm.find('*') != std::string::npos ||
+                  inm.find(hash) != std::string::npos;
+  }
+
+  const char *data = (const char *)(gzip ? asset->gzipData : asset->data);
+  size_t size = gzip ? asset->gzipSize : asset->size;
+  char len[32];
+  std::sprintf(len, "%lu", (unsigned long)size);
+  conn.m_writeBuf = notModified ? "HTTP/1.1 304 Not Modified\r\n"
+                                : "HTTP/1.1 200 OK\r\n";
+  if (!notModified) {
+    conn.m_writeBuf += "Content-Length: ";
+    conn.m_writeBuf += len;
+    conn.m_writeBuf += "\r\nContent-Type: ";
+    conn.m_writeBuf += asset->mime;
+    conn.m_writeBuf += "\r\n";
+    if (gzip) conn.m_writeBuf += "Content-Encoding: gzip\r\n";
+  }
+  conn.m_writeBuf += "ETag: " + etag + "\r\n";
+  // Assets change only with a rebuild. HTML entry points revalidate (cheap
+  // 304s) so a new build is picked up; everything else is immutable.
+  conn.m_writeBuf +=
+      std::strncmp(asset->mime, "text/html", 9) == 0
+          ? "Cache-Control: no-cache\r\n"
+          : "Cache-Control: public, max-age=31536000, immutable\r\n";
+  if (asset->gzipData) conn.m_writeBuf += "Vary: Accept-Encoding\r\n";
+  conn.m_writeBuf += conn.m_keepAlive ? "Connection: keep-alive\r\n\r\n"
+                                      : "Connection: close\r\n\r\n";
+  if (!notModified && !headOnly && size) {
+    if (conn.m_h2Key != 0) {
+      // HTTP/2 re-frames the whole HTTP/1.1-shaped response
+      conn.m_writeBuf.append(data, size);
+    } else {
+      // Sent straight from the read-only table, never copied
+      conn.m_sharedOut.push_back(SharedBuffer::Borrow(data, size));
+      conn.m_sharedOutBytes += size;
+    }
+  }
+  std::cerr << "[" << (notModified ? 304 : 200) << "] embedded uri="
+            << conn.m_request.path << (gzip ? " gzip" : "") << "\n";
+}
+
+// Counters of every process sharing the stats segment, plus the shared
+// caches this process has mapped, as Prometheus text
+void Server::ServeStats(ClientConnection &conn) {
+  bool headOnly = conn.m_request.method == "HEAD";
+  std::string keep;
+  conn.m_keepAlive = conn.m_request.version == "HTTP/1.1";
+  if (hasHeader(conn.m_request, "Connection", keep))
+    conn.m_keepAlive = keep == "keep-alive" || keep == "Keep-Alive";
+  conn.m_phase = ClientConnection::kPhaseRespond;
+  conn.m_wantWrite = true;
+  if (conn.m_request.method != "GET" && !headOnly) {
+    conn.m_writeBuf = buildResponse(405, "Method Not Allowed",
+                                    "405 Method Not Allowed\n", "text/plain",
+                                    conn.m_keepAlive, false);
+    return;
+  }
+  std::string body = m_stats.Render();
+  if (!m_sharedCaches.empty()) {
+    static const char *const kNames[] = {
+        "selfserv_shared_cache_entries", "selfserv_shared_cache_hits_total",
+        "selfserv_shared_cache_misses_total",
+        "selfserv_shared_cache_evictions_total"};
+    static const char *const kTypes[] = {"gauge", "counter", "counter",
+                                         "counter"};
+    for (int m = 0; m < 4; ++m) {
+      body += std::string("# TYPE ") + kNames[m] + " " + kTypes[m] + "\n";
+      for (std::map<std::string, SharedFileCache *>::const_iterator it =
+               m_sharedCaches.begin();
+           it != m_sharedCaches.end(); ++it) {
+        const SharedFileCache &cache = *it->second;
+        unsigned long values[] = {cache.Entries(), cache.Hits(),
+                                  cache.Misses(), cache.Evictions()};
+        char num[32];
+        std::sprintf(num, "%lu", values[m]);
+        body += std::string(kNames[m]) + "{segment=\"" + it->first + "\"} " +
+                num + "\n";
+      }
+    }
+  }
+  conn.m_writeBuf =
+      buildResponse(200, "OK", body, "text/plain; version=0.0.4",
+                    conn.m_keepAlive, headOnly, "Cache-Control: no-store\r\n");
+  std::cerr << "[200] stats uri=" << conn.m_request.path << "\n";
+}
+
+// GET/HEAD of a static file held in the server's shared cache: the stat
+// decides whether the entry is current, and the body is sent from the
+// shared mapping without being read or copied. False (nothing sent) on a
+// miss, including for anything that is not a regular file.
+bool Server::ServeFromSharedCache(ClientConnection &conn,
+                                  const ServerConfig &sc,
+                                  const RouteConfig &route,
+                                  const std::string &filePath) {
+  SharedFileCache *shared = m_staticCaches[conn.m_serverIndex];
+  struct stat st;
+  SharedBuffer body;
+  if (!shared || ::stat(filePath.c_str(), &st) != 0 || !S_ISREG(st.st_mode) ||
+      !shared->Lookup(filePath, st, body))
+    return false;
+  bool headOnly = conn.m_request.method == "HEAD";
+  std::string keep;
+  conn.m_keepAlive = conn.m_request.version == "HTTP/1.1";
+  if (hasHeader(conn.m_request, "Connection", keep))
+    conn.m_keepAlive = keep == "keep-alive" || keep == "Keep-Alive";
+  const CachePolicy &policy =
+      m_cachePolicies[conn.m_serverIndex][&route - &sc.routes[0]];
+  char len[32];
+  std::sprintf(len, "%lu", (unsigned long)body.Size());
+  conn.m_writeBuf = "HTTP/1.1 200 OK\r\nContent-Length: ";
+  conn.m_writeBuf += len;
+  conn.m_writeBuf += "\r\nContent-Type: ";
+  conn.m_writeBuf += guessType(filePath);
+  conn.m_writeBuf += "\r\n";
+  conn.m_writeBuf += policy.Headers(filePath, std::time(0));
+  conn.m_writeBuf += conn.m_keepAlive ? "Connection: keep-alive\r\n\r\n"
+                                      : "Connection: close\r\n\r\n";
+  if (!headOnly && body.Size()) {
+    if (conn.m_h2Key != 0) {
+      conn.m_writeBuf.append(body.Data(), body.Size());
+    } else {
+      conn.m_sharedOut.push_back(body);
+      conn.m_sharedOutBytes += body.Size();
+    }
+  }
+  conn.m_phase = ClientConnection::kPhaseRespond;
+  conn.m_wantWrite = true;
+  std::cerr << "[200] shared-cache uri=" << conn.m_request.path
+            << " size=" << body.Size()
+            << (conn.m_keepAlive ? " keep-alive" : " close") << "\n";
+  return true;
+}
+
+namespace {
+// Bytes of HTTP/2 frames staged in a connection's write buffer at a time;
+// bounds memory while letting the scheduler interleave streams
+const size_t kHttp2FlushBytes = 256 * 1024;
+
+bool headerHasToken(const std::string &value, const char *token) {
+  std::string lower = value;
+  for (size_t i = 0; i < lower.size(); ++i)
+    lower[i] = (char)std::tolower((unsigned char)lower[i]);
+  size_t len = std::strlen(token);
+  size_t pos = 0;
+  while ((pos = lower.find(token, pos)) != std::string::npos) {
+    bool startOk = pos == 0 || lower[pos - 1] == ',' || lower[pos - 1] == ' ';
+    size_t end = pos + len;
+    bool endOk = end == lower.size() || lower[end] == ',' || lower[end] == ' ';
+    if (startOk && endOk) return true;
+    pos = end;
+  }
+  return false;
+}
+}  // namespace
+
+bool Server::MaybeUpgradeHttp2(ClientConnection &conn) {
+  std::string upgrade, connection, settings;
+  if (conn.m_tls.Active()) return false;  // h2c is cleartext; TLS uses ALPN
+  if (!hasHeader(conn.m_request, "Upgrade", upgrade) ||
+      !headerHasToken(upgrade, "h2c") ||
+      !hasHeader(conn.m_request, "Connection", connection) ||
+      !headerHasToken(connection, "upgrade") ||
+      !hasHeader(conn.m_request, "HTTP2-Settings", settings))
+    return false;
+  StartHttp2(conn);
+  if (!conn.m_h2->StartUpgrade(settings, conn.m_request)) {
+    // Malformed HTTP2-Settings: ignore the upgrade and answer over HTTP/1.1
+    delete conn.m_h2;
+    conn.m_h2 = 0;
+    return false;
+  }
+  std::cerr << "[h2c] upgrade fd=" << conn.m_fd.Get() << "\n";
+  size_t consumed = conn.m_parser.Consumed();
+  if (consumed && consumed <= conn.m_readBuf.size())
+    conn.m_readBuf.erase(0, consumed);
+  else
+    conn.m_readBuf.clear();
+  conn.m_parser.Reset();
+  conn.m_request = HttpRequest();
+  conn.m_writeBuf +=
+      "HTTP/1.1 101 Switching Protocols\r\n"
+      "Connection: Upgrade\r\n"
+      "Upgrade: h2c\r\n\r\n";
+  DriveHttp2(conn);
+  return true;
+}
+
+void Server::StartHttp2(ClientConnection &conn) {
+  // The virtual host is chosen per stream, so buffer up to the largest limit
+  // and let HandleRequest apply the per-server 413 check
+  size_t maxBody = 0;
+  for (size_t i = 0; i < m_config.servers.size(); ++i)
+    if (m_config.servers[i].clientMaxBodySize > maxBody)
+      maxBody = m_config.servers[i].clientMaxBodySize;
+  conn.m_h2 = new Http2Session(maxBody);
+  conn.m_headersComplete = true;
+  conn.m_bodyComplete = true;
+  conn.m_keepAlive = true;  // idle timeout applies between streams
+  conn.m_phase = ClientConnection::kPhaseIdle;
+  if (Http2Session::MatchPreface(conn.m_readBuf) > 0)
+    std::cerr << "[h2c] prior knowledge fd=" << conn.m_fd.Get() << "\n";
+}
+
+void Server::DriveHttp2(ClientConnection &conn) {
+  if (!conn.m_h2->Feed(conn.m_readBuf)) {
+    std::cerr << "[h2c] connection error fd=" << conn.m_fd.Get() << "\n";
+    conn.m_readBuf.clear();  // GOAWAY queued; ignore anything further
+  }
+  uint32_t streamId = 0;
+  HttpRequest req;
+  while (conn.m_h2->PopRequest(streamId, req))
+    DispatchHttp2Stream(conn, streamId, req);
+  FlushHttp2(conn);
+}
+
+void Server::DispatchHttp2Stream(ClientConnection &conn, uint32_t streamId,
+                                 const HttpRequest &req) {
+  int key = m_nextStreamKey--;
+  if (m_nextStreamKey >= -1) m_nextStreamKey = -2;  // wrapped
+  ClientConnection &stream = m_clients[key];
+  stream.m_request = req;
+  stream.m_peer = conn.m_peer;
+  stream.m_accessServer = conn.m_accessServer;
+  stream.m_routeAllowed = conn.m_routeAllowed;
+  stream.m_createdAtMs = conn.m_lastActivityMs;
+  stream.m_lastActivityMs = conn.m_lastActivityMs;
+  stream.m_headersComplete = true;
+  stream.m_bodyComplete = true;
+  stream.m_h2ParentFd = conn.m_fd.Get();
+  stream.m_h2StreamId = streamId;
+  stream.m_h2Key = key;
+  stream.m_requestStartUs = MonotonicMicros();
+  std::cerr << "[h2c] stream=" << streamId << " " << req.method << " "
+            << req.path << "\n";
+  HandleRequest(stream);
+  // Static responses are ready now; CGI streams finish through
+  // CollectHttp2Responses once DriveCgiIO has built their reply
+}
+
+void Server::FlushHttp2(ClientConnection &conn) {
+  if (conn.m_writeBuf.size() < kHttp2FlushBytes)
+    conn.m_h2->Flush(conn.m_writeBuf, kHttp2FlushBytes);
+  conn.m_wantWrite = !conn.m_writeBuf.empty() || conn.m_h2->WantsClose();
+}
+
+void Server::CollectHttp2Responses() {
+  // Submit every finished stream before flushing so the scheduler can
+  // interleave them rather than draining whichever was collected first
+  std::vector<int> parents;
+  std::map<int, ClientConnection>::iterator it = m_clients.begin();
+  while (it != m_clients.end() && it->first < 0) {
+    ClientConnection &stream = it->second;
+    if (stream.m_assembly) DriveAssembly(stream);  // streams are not polled
+    if (stream.m_phase != ClientConnection::kPhaseRespond ||
+        stream.m_writeBuf.empty()) {
+      ++it;
+      continue;
+    }
+    // Background cache refreshes have no parent and are simply dropped
+    std::map<int, ClientConnection>::iterator parent =
+        m_clients.find(stream.m_h2ParentFd);
+    if (parent != m_clients.end() && parent->second.m_h2) {
+      m_stats.RecordResponse(responseStatus(stream.m_writeBuf),
+                             MonotonicMicros() - stream.m_requestStartUs);
+      parent->second.m_h2->SubmitResponse(stream.m_h2StreamId,
+                                          stream.m_writeBuf,
+                                          stream.m_request.method == "HEAD");
+      parents.push_back(parent->first);
+    }
+    ReapCgi(stream);
+    m_clients.erase(it++);
+  }
+  unsigned long nowMs = (unsigned long)std::time(0) * 1000UL;
+  for (size_t i = 0; i < parents.size(); ++i) {
+    ClientConnection &conn = m_clients[parents[i]];
+    conn.m_lastActivityMs = nowMs;
+    FlushHttp2(conn);
+  }
+}
+
+namespace {
+// Frames queued for one WebSocket client beyond this are a slow reader; the
+// connection is closed with 1008 rather than buffering without bound
+const size_t kWsMaxQueuedBytes = 4 * 1024 * 1024;
+}  // namespace
+
+void Server::StartWebSocket(ClientConnection &conn, const ServerConfig &sc,
+                            const RouteConfig &route) {
+  std::string upgrade, connection, key, version;
+  if (conn.m_h2Key != 0 || !hasHeader(conn.m_request, "Upgrade", upgrade) ||
+      !headerHasToken(upgrade, "websocket")) {
+    // No extended CONNECT (RFC 8441) over HTTP/2; HTTP/1.1 clients must ask
+    conn.m_keepAlive = false;
+    conn.m_writeBuf = buildResponse(426, "Upgrade Required",
+                                    "426 Upgrade Required\n", "text/plain",
+                                    false, conn.m_request.method == "HEAD");
+    conn.m_phase = ClientConnection::kPhaseRespond;
+    conn.m_wantWrite = true;
+    return;
+  }
+  if (conn.m_request.method != "GET" ||
+      !hasHeader(conn.m_request, "Connection", connection) ||
+      !headerHasToken(connection, "upgrade") ||
+      !hasHeader(conn.m_request, "Sec-WebSocket-Key", key) || key.empty() ||
+      !hasHeader(conn.m_request, "Sec-WebSocket-Version", version) ||
+      version != "13") {
+    conn.m_keepAlive = false;
+    std::string body400 = loadErrorPageBody(sc, 400, "400 Bad Request\n");
+    conn.m_writeBuf = buildResponse(400, "Bad Request", body400, "text/plain",
+                                    false, false);
+    conn.m_phase = ClientConnection::kPhaseRespond;
+    std::cerr << "[ws] bad handshake uri=" << conn.m_request.path << "\n";
+    conn.m_wantWrite = true;
+    return;
+  }
+  int backendFd = -1;
+  std::map<int, WsBackend>::iterator it = m_wsBackends.begin();
+  for (; it != m_wsBackends.end(); ++it)
+    if (it->second.path == route.websocketBackend) {
+      backendFd = it->first;
+      break;
+    }
+  if (backendFd < 0) {
+    backendFd = ConnectWsBackend(route.websocketBackend);
+    if (backendFd < 0) {
+      conn.m_keepAlive = false;
+      std::string body502 = loadErrorPageBody(sc, 502, "502 Bad Gateway\n");
+      conn.m_writeBuf = buildResponse(502, "Bad Gateway", body502,
+                                      "text/plain", false, false);
+      conn.m_phase = ClientConnection::kPhaseRespond;
+      conn.m_wantWrite = true;
+      return;
+    }
+  }
+  WsBackend &backend = m_wsBackends[backendFd];
+  uint32_t id = m_nextWsId++;
+  if (m_nextWsId == 0) m_nextWsId = 1;  // wrapped
+  backend.clients[id] = conn.m_fd.Get();
+
+  size_t consumed = conn.m_parser.Consumed();
+  if (consumed && consumed <= conn.m_readBuf.size())
+    conn.m_readBuf.erase(0, consumed);
+  else
+    conn.m_readBuf.clear();
+  conn.m_parser.Reset();
+  conn.m_ws = true;
+  conn.m_wsId = id;
+  conn.m_wsBackendFd = backendFd;
+  conn.m_wsParser = WebSocketParser(sc.clientMaxBodySize);
+  conn.m_keepAlive = true;
+  conn.m_phase = ClientConnection::kPhaseIdle;
+  conn.m_writeBuf =
+      "HTTP/1.1 101 Switching Protocols\r\n"
+      "Upgrade: websocket\r\n"
+      "Connection: Upgrade\r\n"
+      "Sec-WebSocket-Accept: " +
+      WebSocketAcceptKey(key) + "\r\n\r\n";
+  conn.m_wantWrite = true;
+  std::cerr << "[ws] open id=" << id << " fd=" << conn.m_fd.Get()
+            << " backend=" << route.websocketBackend << "\n";
+
+  AppendWsRecord(backend.out, kWsRecordOpen, id, conn.m_request.uri);
+  FlushWsBackend(backendFd, backend);
+  if (!conn.m_readBuf.empty()) DriveWebSocket(conn);
+}
+
+void Server::DriveWebSocket(ClientConnection &conn) {
+  if (conn.m_wsCloseSent) {
+    conn.m_readBuf.clear();  // closing handshake: the rest is ignored
+    return;
+  }
+  WsFrame frame;
+  for (;;) {
+    WebSocketParser::Result r = conn.m_wsParser.Parse(conn.m_readBuf, frame);
+    if (r == WebSocketParser::kWsNeedMore) return;
+    if (r == WebSocketParser::kWsError) {
+      FailWebSocket(conn, conn.m_wsParser.CloseCode());
+      return;
+    }
+    if (frame.opcode == kWsOpPing) {
+      SharedBuffer pong(WebSocketEncodeFrame(kWsOpPong, frame.payload));
+      QueueWsFrame(conn, pong);
+      continue;
+    }
+    if (frame.opcode == kWsOpPong) continue;
+    if (frame.opcode == kWsOpClose) {
+      int code = kWsCloseNormal;
+      if (frame.payload.size() >= 2)
+        code = ((unsigned char)frame.payload[0] << 8) |
+               (unsigned char)frame.payload[1];
+      FailWebSocket(conn, code);
+      return;
+    }
+    // Data frames: a continuation needs an open message and vice versa
+    if ((frame.opcode == kWsOpContinuation) != (conn.m_wsMessageOpcode != 0)) {
+      FailWebSocket(conn, kWsCloseProtocolError);
+      return;
+    }
+    if (frame.opcode != kWsOpContinuation)
+      conn.m_wsMessageOpcode = frame.opcode;
+    if (conn.m_wsMessage.size() + frame.payload.size() >
+        m_config.servers[conn.m_serverIndex].clientMaxBodySize) {
+      FailWebSocket(conn, kWsCloseTooBig);
+      return;
+    }
+    conn.m_wsMessage += frame.payload;
+    if (!frame.fin) continue;
+    std::map<int, WsBackend>::iterator b =
+        m_wsBackends.find(conn.m_wsBackendFd);
+    if (b != m_wsBackends.end()) {
+      char type = conn.m_wsMessageOpcode == kWsOpText ? (char)kWsRecordText
+                                                       : (char)kWsRecordBinary;
+      AppendWsRecord(b->second.out, type, conn.m_wsId, conn.m_wsMessage);
+      FlushWsBackend(b->first, b->second);
+    }
+    conn.m_wsMessage.clear();
+    conn.m_wsMessageOpcode = 0;
+  }
+}
+
+void Server::QueueWsFrame(ClientConnection &conn, const SharedBuffer &frame) {
+  if (conn.m_wsCloseSent) return;
+  if (conn.m_sharedOutBytes + frame.Size() > kWsMaxQueuedBytes) {
+    // Keep a partly written frame so the stream stays well formed, drop the
+    // rest and close
+    while (conn.m_sharedOut.size() > (conn.m_sharedOutOffset ? 1u : 0u)) {
+      conn.m_sharedOutBytes -= conn.m_sharedOut.back().Size();
+      conn.m_sharedOut.pop_back();
+    }
+    std::cerr << "[ws] slow reader id=" << conn.m_wsId << "\n";
+    FailWebSocket(conn, kWsClosePolicy);
+    return;
+  }
+  conn.m_sharedOut.push_back(frame);
+  conn.m_sharedOutBytes += frame.Size();
+  conn.m_wantWrite = true;
+}
+
+void Server::FailWebSocket(ClientConnection &conn, int closeCode) {
+  if (conn.m_wsCloseSent) return;
+  SharedBuffer frame(WebSocketCloseFrame(closeCode));
+  conn.m_sharedOut.push_back(frame);
+  conn.m_sharedOutBytes += frame.Size();
+  conn.m_wsCloseSent = true;
+  conn.m_readBuf.clear();
+  conn.m_wantWrite = true;
+  std::cerr << "[ws] close id=" << conn.m_wsId << " code=" << closeCode
+            << "\n";
+}
+
+int Server::ConnectWsBackend(const std::string &path) {
+  struct sockaddr_un addr;
+  if (path.size() >= sizeof(addr.sun_path)) return -1;
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, path.c_str(), path.size());
+  // A local stream connect completes or fails at once, so it is done
+  // blocking before the socket joins the event loop
+  if (::connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      !setNonBlocking(fd)) {
+    std::cerr << "[ws] backend unavailable: " << path << "\n";
+    ::close(fd);
+    return -1;
+  }
+  m_wsBackends[fd].path = path;
+  std::cerr << "[ws] backend connected fd=" << fd << " path=" << path << "\n";
+  return fd;
+}
+
+void Server::HandleWsBackendEvent(int fd, short revents) {
+  WsBackend &backend = m_wsBackends[fd];
+  if (revents & POLLIN) {
+    char buf[16384];
+    for (;;) {
+      ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+      if (n > 0) {
+        backend.in.append(buf, n);
+        continue;
+      }
+      if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        CloseWsBackend(fd);
+        return;
+      }
+      break;
+    }
+    size_t pos = 0;
+    char type = 0;
+    uint32_t id = 0;
+    std::string payload;
+    while (ParseWsRecord(backend.in, pos, type, id, payload)) {
+      unsigned char opcode =
+          (type == kWsRecordText || type == kWsRecordBroadcastText)
+              ? (unsigned char)kWsOpText
+              : (unsigned char)kWsOpBinary;
+      if (type == kWsRecordBroadcastText ||
+          type == kWsRecordBroadcastBinary) {
+        // Encoded once; every subscriber queues the same buffer
+        SharedBuffer frame(WebSocketEncodeFrame(opcode, payload));
+        for (std::map<uint32_t, int>::iterator c = backend.clients.begin();
+             c != backend.clients.end(); ++c) {
+          std::map<int, ClientConnection>::iterator conn =
+              m_clients.find(c->second);
+          if (conn != m_clients.end()) QueueWsFrame(conn->second, frame);
+        }
+        continue;
+      }
+      std::map<uint32_t, int>::iterator c = backend.clients.find(id);
+      if (c == backend.clients.end()) continue;  // client already gone
+      std::map<int, ClientConnection>::iterator conn =
+          m_clients.find(c->second);
+      if (conn == m_clients.end()) continue;
+      if (type == kWsRecordClose)
+        FailWebSocket(conn->second, kWsCloseNormal);
+      else if (type == kWsRecordText || type == kWsRecordBinary)
+        QueueWsFrame(conn->second,
+                     SharedBuffer(WebSocketEncodeFrame(opcode, payload)));
+    }
+    backend.in.erase(0, pos);
+  }
+  if (revents & POLLOUT) FlushWsBackend(fd, backend);
+  if ((revents & (POLLHUP | POLLERR)) && !(revents & POLLIN))
+    CloseWsBackend(fd);
+}
+
+void Server::FlushWsBackend(int fd, WsBackend &backend) {
+  // Errors surface as POLLHUP/POLLERR and are handled there
+  while (!backend.out.empty()) {
+    ssize_t n = ::send(fd, backend.out.data(), backend.out.size(),
+                       MSG_NOSIGNAL);
+    if (n <= 0) break;
+    backend.out.erase(0, n);
+  }
+}
+
+void Server::CloseWsBackend(int fd) {
+  std::map<int, WsBackend>::iterator it = m_wsBackends.find(fd);
+  if (it == m_wsBackends.end()) return;
+  std::cerr << "[ws] backend closed fd=" << fd << " path=" << it->second.path
+            << "\n";
+  for (std::map<uint32_t, int>::iterator c = it->second.clients.begin();
+       c != it->second.clients.end(); ++c) {
+    std::map<int, ClientConnection>::iterator conn = m_clients.find(c->second);
+    if (conn == m_clients.end()) continue;
+    conn->second.m_wsBackendFd = -1;
+    FailWebSocket(conn->second, kWsCloseInternalError);
+  }
+  ::close(fd);
+  m_wsBackends.erase(it);
+}
@@ -2,19 +2,48 @@
 
 #include <poll.h>
 
+#include <deque>
 #include <map>
 #include <string>
 #include <vector>
 
 #include "config/Config.hpp"
+#include "http/Http2Session.hpp"
 #include "http/HttpRequest.hpp"
+#include "http/WebSocket.hpp"
+#include "server/CachePolicy.hpp"
+#include "server/DirListing.hpp"
+#include "server/EmbeddedAssets.hpp"
 #include "server/FD.hpp"
+#include "server/IpAccess.hpp"
+#include "server/PageCache.hpp"
+#include "server/PerfCounters.hpp"
+#include "server/PutUpload.hpp"
+#include "server/ResponseCache.hpp"
+#include "server/Rewrite.hpp"
+#include "server/SharedFileCache.hpp"
+#include "server/Stats.hpp"
+#include "server/Tls.hpp"
+#include "server/TrafficCapture.hpp"
+#include "server/UploadSession.hpp"
+#include "server/VhostQuota.hpp"
+#include "server/ZeroCopy.hpp"
 
 struct ClientConnection {
   // Connection state
   FD m_fd;
+  TlsConnection m_tls;  // inactive for plaintext listeners
   std::string m_readBuf;
   std::string m_writeBuf;
+  // Reference-counted buffers sent after m_writeBuf: WebSocket frames and
+  // coalesced response bodies that several connections share
+  std::deque<SharedBuffer> m_sharedOut;
+  size_t m_sharedOutOffset;  // bytes of m_sharedOut.front() sent
+  size_t m_sharedOutBytes;   // queued bytes, for the slow-reader cap
+  ZeroCopySender m_zeroCopy;  // holds shared buffers the kernel still reads
+  DirListingWriter *m_dirWriter;  // owned; streams an autoindex listing
+  PutUpload m_upload;  // PUT body being written to disk as it arrives
+  FileAssembly *m_assembly;  // owned; multi-part join or COPY in progress
   bool m_wantWrite;
   HttpRequest m_request;
   HttpRequestParser m_parser;
@@ -23,11 +52,20 @@ struct ClientConnection {
   // Timing
   unsigned long m_createdAtMs;
   unsigned long m_lastActivityMs;
+  unsigned long m_requestStartUs;  // first byte of the current request, or 0
+  int m_responseStatus;            // final status being sent, or 0
+  unsigned long m_captureId;       // connection number in captures; 0 unset
+  bool m_pipelined;  // the current request came before the last response ended
+  // Hardware counters spent on the current request, and what it turned out
+  // to be; 404s and redirects are classed by their status
+  uint64_t m_hardware[kStatHardwareEventCount];
+  StatRequestClass m_requestClass;
 
   // Protocol state
   bool m_headersComplete;
   bool m_bodyComplete;
   bool m_timedOut;
+  bool m_peerClosed;  // EOF read: no more requests; close once answered
 
   // Connection phase (for debugging and state management)
   enum Phase {
@@ -46,30 +84,98 @@ struct ClientConnection {
   pid_t m_cgiPid;              // child PID
   bool m_cgiActive;            // CGI process active
   bool m_cgiHeadersDone;       // parsed CGI headers
+  bool m_cgiEof;               // CGI stdout read to end of file
   std::string m_cgiBuffer;     // raw CGI output buffer
   size_t m_cgiBodyStart;       // offset where body starts after headers
   size_t m_cgiWriteOffset;     // how many bytes of request body written to CGI
   unsigned long m_cgiStartMs;  // when CGI launched
   int m_serverIndex;           // index of selected server config
+  int m_quotaServer;           // server whose connection quota counts it
+  int m_cgiQuotaServer;        // server whose CGI quota counts its script
+  // Client address and its allow/deny verdict for each route of server
+  // m_accessServer, computed once (at accept for the listener's server)
+  IpAddress m_peer;
+  int m_accessServer;
+  std::vector<char> m_routeAllowed;
+  std::string m_coalesceKey;   // in-flight CGI request led or waited on
+  std::string m_cacheKey;      // store the CGI response under this key
+
+  // HTTP/2: the socket-owning connection holds the session; each stream is
+  // served by a pseudo connection stored under a negative key in m_clients
+  // (poll skips it) that points back at the owner
+  Http2Session *m_h2;     // owned; deleted in CloseConnection
+  int m_h2ParentFd;       // owning socket for stream pseudo connections
+  uint32_t m_h2StreamId;  // stream served by this pseudo connection
+  int m_h2Key;            // this pseudo connection's key in m_clients
+
+  // WebSocket, after a 101 on a route with websocket=
+  bool m_ws;
+  uint32_t m_wsId;    // connection id in backend records
+  int m_wsBackendFd;  // -1 once the backend has gone away
+  WebSocketParser m_wsParser;
+  std::string m_wsMessage;          // fragments of the current message
+  unsigned char m_wsMessageOpcode;  // 0 when no message is in progress
+  bool m_wsCloseSent;
 
   ClientConnection()
-      : m_wantWrite(false),
+      : m_sharedOutOffset(0),
+        m_sharedOutBytes(0),
+        m_dirWriter(0),
+        m_assembly(0),
+        m_wantWrite(false),
         m_keepAlive(false),
         m_createdAtMs(0),
         m_lastActivityMs(0),
+        m_requestStartUs(0),
+        m_responseStatus(0),
+        m_captureId(0),
+        m_pipelined(false),
+        m_hardware(),
+        m_requestClass(kStatClassOther),
         m_headersComplete(false),
         m_bodyComplete(false),
         m_timedOut(false),
+        m_peerClosed(false),
         m_phase(kPhaseAccepted),
         m_cgiInFd(-1),
         m_cgiOutFd(-1),
         m_cgiPid(-1),
         m_cgiActive(false),
         m_cgiHeadersDone(false),
+        m_cgiEof(false),
         m_cgiBodyStart(0),
         m_cgiWriteOffset(0),
         m_cgiStartMs(0),
-        m_serverIndex(0) {}
+        m_serverIndex(0),
+        m_quotaServer(-1),
+        m_cgiQuotaServer(-1),
+        m_accessServer(-1),
+        m_h2(0),
+        m_h2ParentFd(-1),
+        m_h2StreamId(0),
+        m_h2Key(0),
+        m_ws(false),
+        m_wsId(0),
+        m_wsBackendFd(-1),
+        m_wsMessageOpcode(0),
+        m_wsCloseSent(false) {}
+};
+
+// Unix-socket connection to a WebSocket application, shared by every client
+// on routes naming the same socket path
+struct WsBackend {
+  std::string path;
+  std::string in;                   // partial records from the backend
+  std::string out;                  // records not yet written
+  std::map<uint32_t, int> clients;  // connection id -> client fd
+};
+
+// Identical CGI requests share one execution: the first becomes the leader,
+// later ones park as waiters until its response is ready
+struct CoalescedRequest {
+  int leader;                // m_clients key
+  std::vector<int> waiters;  // m_clients keys
+  CoalescedRequest() : leader(0) {}
 };
 
 class Server {
@@ -89,12 +195,45 @@ class Server {
   Server &operator=(const Server &);
 
   // Connection management
+  bool OpenStats();
+  bool CompileRewrites();
+  bool CompileAccessLists();
+  bool CompileCachePolicies();
+  bool OpenSharedCaches();
+  bool OpenCaptures();
+  void OpenPerfCounters();
+  void CacheRouteAccess(ClientConnection &conn, int serverIndex);
   bool OpenListeningSockets();
   void AcceptNew(int listenFd);
   void HandleReadable(ClientConnection &conn);
+  bool ParseBuffered(ClientConnection &conn);  // true if it has an answer
+  void HandleRequest(ClientConnection &conn);
+  void DispatchRequest(ClientConnection &conn);  // HandleRequest's body
+  bool AdmitRequest(ClientConnection &conn);  // false once it answered
+  void RefuseOverQuota(ClientConnection &conn, int code, const char *why);
+  void CaptureRequest(ClientConnection &conn);
+  bool ApplyRewrite(ClientConnection &conn);  // true if it answered
+  bool BeginStreamingPut(ClientConnection &conn);  // true if it took over
+  bool StartPutUpload(ClientConnection &conn, const ServerConfig &sc,
+                      const RouteConfig &route, const std::string &filePath,
+                      off_t length);  // false once it answered an error
+  void DrivePutUpload(ClientConnection &conn);
+  void FinishPutUpload(ClientConnection &conn);
+  void HandleUploadSession(ClientConnection &conn, const ServerConfig &sc,
+                           const std::string &filePath);
+  void DriveAssembly(ClientConnection &conn);
+  void HandleCopyMove(ClientConnection &conn, const ServerConfig &sc,
+                      const RouteConfig &route, const std::string &filePath);
   void HandleWritable(ClientConnection &conn);
+  bool WantZeroCopy(ClientConnection &conn, size_t len);
+  void FinishRequestStats(ClientConnection &conn);
+  void BeginPerfSample();
+  void EndPerfSample(int fd);  // the connection may have closed meanwhile
+  void ChargePerfSample(ClientConnection &conn);
+  void RecordLoopPass(unsigned long startUs);
   void CloseConnection(int fd);
   void BuildPollFds(std::vector<struct pollfd> &pfds);
+  bool DriveTlsHandshake(ClientConnection &conn);  // true once established
 
   // CGI support
   bool MaybeStartCgi(ClientConnection &conn, const RouteConfig &route,
@@ -102,11 +241,82 @@ class Server {
   bool DriveCgiIO(ClientConnection &conn);  // returns false if should close
   void ReapCgi(ClientConnection &conn);
   bool HandleCgiEvent(int fd, short revents);
+  bool JoinCoalesced(ClientConnection &conn, const RouteConfig &route);
+  void FinishCoalesced();
+  ResponseCache &CacheFor(int serverIndex);
+  bool ServeFromCache(ClientConnection &conn, const RouteConfig &route,
+                      const std::string &filePath);
+  void StartCacheRefresh(const ClientConnection &conn,
+                         const RouteConfig &route,
+                         const std::string &filePath);
+  void StoreCachedResponse(
+      const ClientConnection &conn, int code,
+      const std::vector<std::pair<std::string, std::string> > &headers,
+      const std::string &head, const std::string &body);
+
+  void ServeEmbedded(ClientConnection &conn, const ServerConfig &sc,
+                     const RouteConfig &route, const std::string &rel);
+  void ServeStats(ClientConnection &conn);
+  bool ServeFromSharedCache(ClientConnection &conn, const ServerConfig &sc,
+                            const RouteConfig &route,
+                            const std::string &filePath);
+
+  // HTTP/2 cleartext (prior knowledge or Upgrade: h2c)
+  bool MaybeUpgradeHttp2(ClientConnection &conn);
+  void StartHttp2(ClientConnection &conn);
+  void DriveHttp2(ClientConnection &conn);
+  void DispatchHttp2Stream(ClientConnection &conn, uint32_t streamId,
+                           const HttpRequest &req);
+  void FlushHttp2(ClientConnection &conn);
+  void CollectHttp2Responses();
+
+  // WebSocket relay
+  void StartWebSocket(ClientConnection &conn, const ServerConfig &sc,
+                      const RouteConfig &route);
+  void DriveWebSocket(ClientConnection &conn);
+  void QueueWsFrame(ClientConnection &conn, const SharedBuffer &frame);
+  void FailWebSocket(ClientConnection &conn, int closeCode);
+  int ConnectWsBackend(const std::string &path);
+  void HandleWsBackendEvent(int fd, short revents);
+  void FlushWsBackend(int fd, WsBackend &backend);
+  void CloseWsBackend(int fd);
 
   // Member variables
   const Config &m_config;
   std::vector<FD> m_listenSockets;
+  std::map<int, TlsContext *> m_tlsContexts;  // listen fd -> TLS settings
   std::map<int, ClientConnection> m_clients;
   std::vector<struct pollfd> m_pfds;
   std::map<int, int> m_cgiFdToClient;  // map cgi pipe fd -> client fd
+  std::map<std::string, CoalescedRequest> m_inFlight;  // by coalescing key
+  std::map<int, ResponseCache> m_responseCaches;       // by server index
+  std::vector<RewriteEngine> m_rewrites;               // by server index
+  std::vector<IpAccessList> m_serverAccess;            // by server index
+  std::vector<std::vector<IpAccessList> > m_routeAccess;  // [server][route]
+  std::vector<std::vector<CachePolicy> > m_cachePolicies;  // [server][route]
+  DirListingCache m_dirCache;
+  // Static file caches in shared memory, owned here by segment file; server
+  // blocks naming the same file share one mapping
+  std::map<std::string, SharedFileCache *> m_sharedCaches;
+  std::vector<SharedFileCache *> m_staticCaches;  // by server index; 0 = none
+  Stats m_stats;
+  // Hardware counters, when a server block enables them: read before and
+  // after each connection's handlers, the difference charged to the request
+  PerfCounters m_perf;
+  uint64_t m_perfMark[kStatHardwareEventCount];
+  bool m_perfSampling;  // m_perfMark was read for the handlers now running
+  // Event-loop lag: start of the current window and its longest pass
+  unsigned long m_loopWindowUs;
+  unsigned long m_loopMaxUs;
+  std::vector<VhostQuota> m_quotas;  // by server index
+  // Request captures, owned here by file like the shared caches
+  std::map<std::string, TrafficCapture *> m_captureFiles;
+  std::vector<TrafficCapture *> m_captures;  // by server index; 0 = none
+  unsigned long m_nextCaptureId;
+  // Zero-copy sends of closed connections, with the close time: the kernel
+  // may still transmit from them, and no completion can be read any more
+  std::deque<std::pair<unsigned long, SharedBuffer> > m_zeroCopyOrphans;
+  int m_nextStreamKey;                 // next negative m_clients key
+  std::map<int, WsBackend> m_wsBackends;  // backend socket fd -> state
+  uint32_t m_nextWsId;
 };
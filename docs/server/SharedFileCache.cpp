@@ -0,0 +1,513 @@
+#include "server/SharedFileCache.hpp"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+namespace {
+
+const uint32_t kMagic = 0x53464331;  // "SFC1"
+const uint32_t kVersion = 1;
+const size_t kSlabBytes = 4 * 1024 * 1024;
+const size_t kMinChunk = 4096;
+const int kClasses = 11;  // 4 KiB .. 4 MiB
+const size_t kShards = 64;
+const size_t kKeyBytes = 192;
+const size_t kPage = 4096;
+const uint8_t kNoClass = 0xff;
+const size_t kNoSlot = (size_t)-1;
+
+size_t roundUp(size_t n, size_t to) { return (n + to - 1) / to * to; }
+
+size_t classBytes(int cls) { return kMinChunk << cls; }
+
+uint32_t nowSec() { return (uint32_t)std::time(0); }
+
+// FNV-1a 64; the prime and offset are built from halves to stay C++98
+uint64_t hashKey(const std::string &key) {
+  uint64_t h = ((uint64_t)0xcbf29ce4UL << 32) | 0x84222325UL;
+  const uint64_t prime = ((uint64_t)0x100UL << 32) | 0x000001b3UL;
+  for (size_t i = 0; i < key.size(); ++i) {
+    h ^= (unsigned char)key[i];
+    h *= prime;
+  }
+  return h ? h : 1;
+}
+
+void initMutex(pthread_mutex_t *m) {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(m, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+// The data a dead owner was guarding is only ever a slot or free-list
+// update away from consistent, so the lock is simply taken over
+void lockMutex(pthread_mutex_t *m) {
+  if (pthread_mutex_lock(m) == EOWNERDEAD) pthread_mutex_consistent(m);
+}
+
+struct Slot {
+  uint64_t hash;
+  uint64_t chunk;  // offset in the segment; 0 = empty
+};
+
+}  // namespace
+
+struct SharedFileCache::Header {
+  uint32_t magic;  // written last on creation
+  uint32_t version;
+  uint64_t layout;  // structure sizes, to reject a differently built server
+  uint64_t slotCount;
+  uint64_t slabCount;
+  uint64_t slotsOffset;
+  uint64_t classesOffset;  // one size class byte per slab
+  uint64_t slabsOffset;
+  uint64_t nextSlab;  // slabs carved so far (allocLock)
+  uint64_t freeHead[kClasses];  // free chunk lists (allocLock)
+  uint64_t classSlabs[kClasses];
+  uint64_t clockHand;
+  uint64_t entries;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  pthread_mutex_t allocLock;
+  pthread_mutex_t shardLocks[kShards];
+};
+
+struct SharedFileCache::Chunk {
+  uint64_t generation;  // bumped on free, so stale unpins are ignored
+  uint64_t nextFree;
+  uint32_t pins;
+  uint32_t lastPinSec;
+  uint32_t cls;
+  uint32_t referenced;  // hit since the clock last passed
+  uint32_t detached;    // out of the index while pinned: last unpin frees
+  uint32_t keyLen;
+  uint64_t hash;
+  uint64_t size;
+  uint64_t dev;
+  uint64_t ino;
+  int64_t mtimeSec;
+  int64_t mtimeNsec;
+  char key[kKeyBytes];
+};
+
+struct SharedFileCache::PinRef {
+  SharedFileCache *cache;
+  uint64_t chunk;
+  uint64_t generation;
+};
+
+namespace {
+
+const size_t kChunkHeaderBytes = 320;
+
+int64_t mtimeNsec(const struct stat &st) {
+#ifdef __linux__
+  return st.st_mtim.tv_nsec;
+#else
+  (void)st;
+  return 0;
+#endif
+}
+
+}  // namespace
+
+SharedFileCache::SharedFileCache()
+    : m_base(0), m_bytes(0), m_header(0), m_fd(-1) {}
+
+SharedFileCache::~SharedFileCache() {
+  if (m_base) ::munmap(m_base, m_bytes);
+  if (m_fd >= 0) ::close(m_fd);  // drops the flock
+}
+
+bool SharedFileCache::Open(const std::string &path, size_t bytes,
+                           std::string &error) {
+  size_t slabs = bytes / kSlabBytes;
+  if (slabs == 0) {
+    error = "shared cache smaller than one 4 MiB slab";
+    return false;
+  }
+  if (sizeof(Chunk) > kChunkHeaderBytes) {
+    error = "chunk header does not fit";
+    return false;
+  }
+  // Two slots per smallest chunk keeps the table at most half full
+  size_t slotCount = slabs * (kSlabBytes / kMinChunk) * 2;
+  size_t slotsOffset = roundUp(sizeof(Header), kPage);
+  size_t classesOffset = slotsOffset + slotCount * sizeof(Slot);
+  size_t slabsOffset = roundUp(classesOffset + slabs, kPage);
+  size_t total = slabsOffset + slabs * kSlabBytes;
+
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    error = path + ": " + std::strerror(errno);
+    return false;
+  }
+  // Every user holds a shared lock, so an exclusive one means nobody else
+  // has the segment mapped and it may be rebuilt
+  bool alone = ::flock(fd, LOCK_EX | LOCK_NB) == 0;
+  struct stat st;
+  if ((!alone && ::flock(fd, LOCK_SH) != 0) || ::fstat(fd, &st) != 0) {
+    error = path + ": " + std::strerror(errno);
+    ::close(fd);
+    return false;
+  }
+  bool sized = (size_t)st.st_size == total;
+  if (!sized && !alone) {
+    error = path + ": in use with a different size";
+    ::close(fd);
+    return false;
+  }
+  if (!sized && (::ftruncate(fd, 0) != 0 ||
+                 ::ftruncate(fd, (off_t)total) != 0)) {
+    error = path + ": " + std::strerror(errno);
+    ::close(fd);
+    return false;
+  }
+  void *map =
+      ::mmap(0, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    error = path + ": " + std::strerror(errno);
+    ::close(fd);
+    return false;
+  }
+  m_base = (char *)map;
+  m_bytes = total;
+  m_header = (Header *)map;
+  m_fd = fd;
+
+  uint64_t layout = sizeof(Header) | (uint64_t)sizeof(Chunk) << 32;
+  bool compatible = sized && m_header->magic == kMagic &&
+                    m_header->version == kVersion &&
+                    m_header->layout == layout &&
+                    m_header->slotCount == slotCount &&
+                    m_header->slabCount == slabs;
+  if (!compatible && !alone) {
+    error = path + ": in use by an incompatible server";
+    return false;
+  }
+  if (!compatible) {
+    std::memset(m_base, 0, slabsOffset);
+    m_header->version = kVersion;
+    m_header->layout = layout;
+    m_header->slotCount = slotCount;
+    m_header->slabCount = slabs;
+    m_header->slotsOffset = slotsOffset;
+    m_header->classesOffset = classesOffset;
+    m_header->slabsOffset = slabsOffset;
+    std::memset(m_base + classesOffset, kNoClass, slabs);
+    Initialize();
+    __sync_synchronize();
+    m_header->magic = kMagic;
+  } else if (alone) {
+    Recover();
+  }
+  if (alone) ::flock(fd, LOCK_SH);
+  return true;
+}
+
+void SharedFileCache::Initialize() {
+  initMutex(&m_header->allocLock);
+  for (size_t i = 0; i < kShards; ++i) initMutex(&m_header->shardLocks[i]);
+}
+
+// Run by the only process attached to an existing segment: whatever a
+// previous process was doing is over, so locks are reset, pins dropped and
+// chunks not reachable from the index returned to the free lists
+void SharedFileCache::Recover() {
+  Initialize();
+  Slot *slots = (Slot *)(m_base + m_header->slotsOffset);
+  std::vector<uint64_t> used;
+  for (size_t i = 0; i < m_header->slotCount; ++i)
+    if (slots[i].chunk) used.push_back(slots[i].chunk);
+  std::sort(used.begin(), used.end());
+  for (int c = 0; c < kClasses; ++c) m_header->freeHead[c] = 0;
+  const uint8_t *classes = (uint8_t *)(m_base + m_header->classesOffset);
+  for (size_t s = 0; s < m_header->nextSlab; ++s) {
+    int cls = classes[s];
+    uint64_t slab = m_header->slabsOffset + s * kSlabBytes;
+    for (size_t off = 0; off < kSlabBytes; off += classBytes(cls)) {
+      Chunk *c = At(slab + off);
+      c->pins = 0;
+      c->detached = 0;
+      if (std::binary_search(used.begin(), used.end(), slab + off)) continue;
+      ++c->generation;
+      c->nextFree = m_header->freeHead[cls];
+      m_header->freeHead[cls] = slab + off;
+    }
+  }
+  m_header->entries = used.size();
+}
+
+SharedFileCache::Chunk *SharedFileCache::At(uint64_t offset) const {
+  return (Chunk *)(m_base + offset);
+}
+
+size_t SharedFileCache::MaxBodySize() const {
+  return kSlabBytes - kChunkHeaderBytes;
+}
+
+// Probes the key's shard (locked by the caller). Found: index is its slot.
+// Not found: index is the first empty slot, or kNoSlot when the shard is full.
+bool SharedFileCache::FindSlot(uint64_t hash, const std::string &key,
+                               size_t &index) const {
+  Slot *slots = (Slot *)(m_base + m_header->slotsOffset);
+  size_t per = m_header->slotCount / kShards;
+  size_t base = (hash % kShards) * per;
+  size_t home = (hash / kShards) % per;
+  index = kNoSlot;
+  for (size_t i = 0; i < per; ++i) {
+    size_t at = base + (home + i) % per;
+    if (!slots[at].chunk) {
+      index = at;
+      return false;
+    }
+    if (slots[at].hash != hash) continue;
+    const Chunk *c = At(slots[at].chunk);
+    if (c->keyLen == key.size() &&
+        std::memcmp(c->key, key.data(), key.size()) == 0) {
+      index = at;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Empties a slot (shard locked) by shifting later entries of its probe run
+// back, so lookups never need tombstones; returns the chunk it held
+uint64_t SharedFileCache::RemoveSlot(size_t index) {
+  Slot *slots = (Slot *)(m_base + m_header->slotsOffset);
+  size_t per = m_header->slotCount / kShards;
+  size_t base = index / per * per;
+  uint64_t chunk = slots[index].chunk;
+  size_t hole = index - base;
+  for (size_t j = (hole + 1) % per; slots[base + j].chunk; j = (j + 1) % per) {
+    size_t home = (slots[base + j].hash / kShards) % per;
+    bool stays = hole <= j ? (hole < home && home <= j)
+                           : (hole < home || home <= j);
+    if (stays) continue;
+    slots[base + hole] = slots[base + j];
+    hole = j;
+  }
+  slots[base + hole].hash = 0;
+  slots[base + hole].chunk = 0;
+  __sync_fetch_and_sub(&m_header->entries, 1);
+  return chunk;
+}
+
+bool SharedFileCache::Lookup(const std::string &key, const struct stat &st,
+                             SharedBuffer &body) {
+  if (!m_header || key.size() > kKeyBytes) return false;
+  uint64_t hash = hashKey(key);
+  pthread_mutex_t *lock = &m_header->shardLocks[hash % kShards];
+  Chunk *found = 0;
+  uint64_t chunk = 0, generation = 0, stale = 0;
+  lockMutex(lock);
+  size_t index;
+  if (FindSlot(hash, key, index)) {
+    Chunk *c = At(((Slot *)(m_base + m_header->slotsOffset))[index].chunk);
+    if (c->dev == (uint64_t)st.st_dev && c->ino == (uint64_t)st.st_ino &&
+        c->size == (uint64_t)st.st_size && c->mtimeSec == st.st_mtime &&
+        c->mtimeNsec == mtimeNsec(st)) {
+      __sync_fetch_and_add(&c->pins, 1);
+      c->lastPinSec = nowSec();
+      c->referenced = 1;
+      found = c;
+      chunk = (uint64_t)((char *)c - m_base);
+      generation = c->generation;
+    } else {
+      stale = RemoveSlot(index);
+    }
+  }
+  pthread_mutex_unlock(lock);
+  if (stale) Discard(stale);
+  if (!found) {
+    __sync_fetch_and_add(&m_header->misses, 1);
+    return false;
+  }
+  __sync_fetch_and_add(&m_header->hits, 1);
+  PinRef *ref = new PinRef;
+  ref->cache = this;
+  ref->chunk = chunk;
+  ref->generation = generation;
+  body = SharedBuffer::Borrow((const char *)found + kChunkHeaderBytes,
+                              found->size, &SharedFileCache::Unpin, ref);
+  return true;
+}
+
+bool SharedFileCache::Insert(const std::string &key, const struct stat &st,
+                             const std::string &body) {
+  if (!m_header || key.empty() || key.size() > kKeyBytes ||
+      body.size() > MaxBodySize())
+    return false;
+  int cls = 0;
+  while (classBytes(cls) < kChunkHeaderBytes + body.size()) ++cls;
+  uint64_t chunk = Allocate(cls);
+  if (!chunk) return false;
+  uint64_t hash = hashKey(key);
+  Chunk *c = At(chunk);
+  c->pins = 0;
+  c->lastPinSec = 0;
+  c->cls = (uint32_t)cls;
+  c->referenced = 0;
+  c->detached = 0;
+  c->keyLen = (uint32_t)key.size();
+  std::memcpy(c->key, key.data(), key.size());
+  c->hash = hash;
+  c->size = body.size();
+  c->dev = (uint64_t)st.st_dev;
+  c->ino = (uint64_t)st.st_ino;
+  c->mtimeSec = st.st_mtime;
+  c->mtimeNsec = mtimeNsec(st);
+  std::memcpy((char *)c + kChunkHeaderBytes, body.data(), body.size());
+
+  Slot *slots = (Slot *)(m_base + m_header->slotsOffset);
+  pthread_mutex_t *lock = &m_header->shardLocks[hash % kShards];
+  uint64_t replaced = 0;
+  bool placed = true;
+  lockMutex(lock);
+  size_t index;
+  if (FindSlot(hash, key, index)) {
+    replaced = slots[index].chunk;
+    slots[index].chunk = chunk;
+  } else if (index != kNoSlot) {
+    slots[index].hash = hash;
+    slots[index].chunk = chunk;
+    __sync_fetch_and_add(&m_header->entries, 1);
+  } else {
+    placed = false;
+  }
+  pthread_mutex_unlock(lock);
+  if (replaced) Discard(replaced);
+  if (!placed) Free(chunk);
+  return placed;
+}
+
+// A free chunk of class cls: from its free list, else a fresh slab, else by
+// evicting an entry of the same class. Only cls slabs can satisfy it, so a
+// segment filled with other classes refuses it rather than thrashing.
+uint64_t SharedFileCache::Allocate(int cls) {
+  for (int attempt = 0; attempt < 8; ++attempt) {
+    lockMutex(&m_header->allocLock);
+    if (!m_header->freeHead[cls] &&
+        m_header->nextSlab < m_header->slabCount) {
+      uint64_t s = m_header->nextSlab++;
+      ((uint8_t *)(m_base + m_header->classesOffset))[s] = (uint8_t)cls;
+      ++m_header->classSlabs[cls];
+      uint64_t slab = m_header->slabsOffset + s * kSlabBytes;
+      for (size_t off = kSlabBytes; off > 0; off -= classBytes(cls)) {
+        Chunk *c = At(slab + off - classBytes(cls));
+        c->nextFree = m_header->freeHead[cls];
+        m_header->freeHead[cls] = slab + off - classBytes(cls);
+      }
+    }
+    uint64_t chunk = m_header->freeHead[cls];
+    if (chunk) m_header->freeHead[cls] = At(chunk)->nextFree;
+    bool evictable = m_header->classSlabs[cls] != 0;
+    pthread_mutex_unlock(&m_header->allocLock);
+    if (chunk) return chunk;
+    if (!evictable || !EvictOne(cls)) return 0;
+  }
+  return 0;
+}
+
+// Clock over the slots: an unpinned entry of class cls is evicted unless it
+// was hit since the last pass, in which case it gets a second chance
+bool SharedFileCache::EvictOne(int cls) {
+  Slot *slots = (Slot *)(m_base + m_header->slotsOffset);
+  size_t count = m_header->slotCount;
+  size_t per = count / kShards;
+  uint32_t now = nowSec();
+  for (size_t step = 0; step < 2 * count; ++step) {
+    size_t index = __sync_fetch_and_add(&m_header->clockHand, 1) % count;
+    pthread_mutex_t *lock = &m_header->shardLocks[index / per];
+    uint64_t victim = 0;
+    lockMutex(lock);
+    if (slots[index].chunk) {
+      Chunk *c = At(slots[index].chunk);
+      bool pinned = c->pins > 0 && now - c->lastPinSec < kPinLeaseSec;
+      if (c->cls == (uint32_t)cls && !pinned) {
+        if (c->referenced)
+          c->referenced = 0;
+        else
+          victim = RemoveSlot(index);
+      }
+    }
+    pthread_mutex_unlock(lock);
+    if (victim) {
+      Free(victim);
+      __sync_fetch_and_add(&m_header->evictions, 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+void SharedFileCache::Free(uint64_t offset) {
+  Chunk *c = At(offset);
+  lockMutex(&m_header->allocLock);
+  ++c->generation;
+  c->pins = 0;
+  c->detached = 0;
+  c->nextFree = m_header->freeHead[c->cls];
+  m_header->freeHead[c->cls] = offset;
+  pthread_mutex_unlock(&m_header->allocLock);
+}
+
+// A chunk just taken out of the index: freed now, or by its last unpin if
+// it is still being sent. Whichever side clears detached frees it.
+void SharedFileCache::Discard(uint64_t offset) {
+  Chunk *c = At(offset);
+  if (c->pins > 0 && nowSec() - c->lastPinSec < kPinLeaseSec) {
+    c->detached = 1;
+    __sync_synchronize();
+    if (c->pins > 0 || !__sync_bool_compare_and_swap(&c->detached, 1, 0))
+      return;
+  }
+  Free(offset);
+}
+
+void SharedFileCache::Unpin(void *context) {
+  PinRef *ref = (PinRef *)context;
+  Chunk *c = ref->cache->At(ref->chunk);
+  if (c->generation == ref->generation) {
+    // Never below zero: a lease may have expired and the count been reset
+    uint32_t pins;
+    do {
+      pins = c->pins;
+    } while (pins > 0 &&
+             !__sync_bool_compare_and_swap(&c->pins, pins, pins - 1));
+    if (pins == 1 && c->detached &&
+        __sync_bool_compare_and_swap(&c->detached, 1, 0))
+      ref->cache->Free(ref->chunk);
+  }
+  delete ref;
+}
+
+unsigned long SharedFileCache::Entries() const {
+  return m_header ? (unsigned long)m_header->entries : 0;
+}
+
+unsigned long SharedFileCache::Hits() const {
+  return m_header ? (unsigned long)m_header->hits : 0;
+}
+
+unsigned long SharedFileCache::Misses() const {
+  return m_header ? (unsigned long)m_header->misses : 0;
+}
+
+unsigned long SharedFileCache::Evictions() const {
+  return m_header ? (unsigned long)m_header->evictions : 0;
+}
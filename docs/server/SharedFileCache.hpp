@@ -0,0 +1,78 @@
+// Static file cache in a shared, file-backed memory segment.
+#pragma once
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <string>
+
+#include "util/SharedBuffer.hpp"
+
+// Every server process that opens the same segment file (typically under
+// /dev/shm) maps the same cache, so several processes hold one copy of each
+// file, and a restarted process finds the cache warm instead of cold.
+//
+// The index is an open-addressed table of (hash, chunk) slots split into
+// shards, each guarded by a process-shared robust mutex, so a process that
+// dies holding one does not wedge the rest. Bodies live in chunks of
+// power-of-two size classes carved from 4 MiB slabs, as in memcached, with
+// the file's identity (path, device, inode, size, mtime) in each chunk's
+// header. Hits are sent straight from the mapping: a hit pins its chunk
+// until the last SharedBuffer handle to it is released, and only unpinned
+// chunks are evicted (by a clock over the slots) or reused. A pin held by a
+// process that died is disregarded after kPinLeaseSec.
+class SharedFileCache {
+ public:
+  static const uint32_t kPinLeaseSec = 600;
+
+  SharedFileCache();
+  ~SharedFileCache();
+
+  // Maps the segment at path, sized to bytes (at least one 4 MiB slab). A
+  // compatible existing segment is reused; the first process to attach
+  // also reclaims chunks and pins a crashed process left behind. A
+  // missing or incompatible segment is (re)created unless other processes
+  // still have it mapped. False with error set on failure.
+  bool Open(const std::string &path, size_t bytes, std::string &error);
+  // Body cached for key if it still matches st (same inode, size and
+  // mtime); the handle pins it. A stale entry is dropped.
+  bool Lookup(const std::string &key, const struct stat &st,
+              SharedBuffer &body);
+  // Stores body as key's content for st, replacing an older entry; false
+  // when it cannot (too large, key too long, nothing evictable)
+  bool Insert(const std::string &key, const struct stat &st,
+              const std::string &body);
+  size_t MaxBodySize() const;
+
+  // Counters shared by every process using the segment
+  unsigned long Entries() const;
+  unsigned long Hits() const;
+  unsigned long Misses() const;
+  unsigned long Evictions() const;
+
+ private:
+  // Non-copyable
+  SharedFileCache(const SharedFileCache &);
+  SharedFileCache &operator=(const SharedFileCache &);
+
+  struct Header;
+  struct Chunk;
+  struct PinRef;
+
+  Chunk *At(uint64_t offset) const;
+  void Initialize();
+  void Recover();
+  bool FindSlot(uint64_t hash, const std::string &key, size_t &index) const;
+  uint64_t RemoveSlot(size_t index);
+  uint64_t Allocate(int cls);
+  bool EvictOne(int cls);
+  void Free(uint64_t offset);
+  void Discard(uint64_t offset);
+  static void Unpin(void *context);
+
+  char *m_base;
+  size_t m_bytes;
+  Header *m_header;
+  int m_fd;  // holds a shared flock while mapped
+};
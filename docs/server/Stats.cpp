@@ -0,0 +1,307 @@
+#include "server/Stats.hpp"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+namespace {
+
+const uint32_t kMagic = 0x53545331;  // "STS1"
+const size_t kSlots = 64;
+const size_t kLine = 64;  // slots never share a cache line
+
+const unsigned long kLatencyBoundsUs[kStatLatencyBuckets] = {
+    100,    250,    500,    1000,    2500,    5000,    10000,   25000,
+    50000,  100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000};
+
+const char *const kCounterNames[kStatCounterCount] = {
+    "selfserv_connections_accepted_total",
+    "selfserv_responses_total{class=\"1xx\"}",
+    "selfserv_responses_total{class=\"2xx\"}",
+    "selfserv_responses_total{class=\"3xx\"}",
+    "selfserv_responses_total{class=\"4xx\"}",
+    "selfserv_responses_total{class=\"5xx\"}",
+    "selfserv_received_bytes_total",
+    "selfserv_sent_bytes_total",
+    "selfserv_cgi_runs_total",
+    "selfserv_quota_rejections_total"};
+
+const char *const kClassNames[kStatClassCount] = {
+    "static_hit", "static_miss", "not_found", "upload",
+    "cgi",        "redirect",    "other"};
+
+// The first family counts the requests measured; the others are summed over
+// them, in StatHardwareEvent order
+const char *const kHardwareNames[1 + kStatHardwareEventCount] = {
+    "selfserv_request_sampled_total", "selfserv_request_cpu_cycles_total",
+    "selfserv_request_instructions_total",
+    "selfserv_request_cache_misses_total",
+    "selfserv_request_branch_misses_total"};
+
+struct Header {
+  uint32_t magic;  // written last on creation
+  uint32_t layout;
+};
+
+// Only the owner stores; others load, so no read-modify-write is needed
+template <typename T>
+void relaxedAdd(T *p, T n) {
+  __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + n,
+                   __ATOMIC_RELAXED);
+}
+
+template <typename T>
+T relaxedLoad(const T *p) {
+  return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+size_t roundUp(size_t n, size_t to) { return (n + to - 1) / to * to; }
+
+bool processAlive(pid_t pid) {
+  return pid > 0 && (::kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+void appendMetric(std::string &out, const char *name, double value) {
+  char line[160];
+  std::snprintf(line, sizeof(line), "%s %.15g\n", name, value);
+  out += line;
+}
+
+}  // namespace
+
+struct Stats::Slot {
+  int32_t pid;  // owner; 0 = never claimed
+  int32_t pad;
+  uint64_t counters[kStatCounterCount];
+  int64_t gauges[kStatGaugeCount];
+  uint64_t latency[kStatLatencyBuckets + 1];
+  uint64_t latencySumUs;
+  uint64_t hardware[kStatClassCount][1 + kStatHardwareEventCount];
+};
+
+unsigned long MonotonicMicros() {
+  struct timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long)ts.tv_sec * 1000000UL +
+         (unsigned long)ts.tv_nsec / 1000UL;
+}
+
+Stats::Stats() : m_base(0), m_bytes(0), m_slot(0), m_fd(-1) {}
+
+Stats::~Stats() {
+  if (m_base) ::munmap(m_base, m_bytes);
+  if (m_fd >= 0) ::close(m_fd);
+}
+
+bool Stats::Open(const std::string &path, std::string &error) {
+  size_t slotBytes = roundUp(sizeof(Slot), kLine);
+  size_t total = kLine + kSlots * slotBytes;
+  uint32_t layout = (uint32_t)(slotBytes << 16 | kStatCounterCount << 8 |
+                               kStatLatencyBuckets);
+  if (path.empty()) {
+    void *map = ::mmap(0, total, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+      error = std::strerror(errno);
+      return false;
+    }
+    m_base = (char *)map;
+    m_bytes = total;
+    m_slot = SlotAt(0);
+    m_slot->pid = (int32_t)::getpid();
+    return true;
+  }
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    error = path + ": " + std::strerror(errno);
+    return false;
+  }
+  // As for the shared cache: only a sole user may (re)initialize
+  bool alone = ::flock(fd, LOCK_EX | LOCK_NB) == 0;
+  struct stat st;
+  if ((!alone && ::flock(fd, LOCK_SH) != 0) || ::fstat(fd, &st) != 0) {
+    error = path + ": " + std::strerror(errno);
+    ::close(fd);
+    return false;
+  }
+  bool sized = (size_t)st.st_size == total;
+  if (!sized && (!alone || ::ftruncate(fd, 0) != 0 ||
+                 ::ftruncate(fd, (off_t)total) != 0)) {
+    error = path + ": " + (alone ? std::strerror(errno)
+                                 : "in use with a different layout");
+    ::close(fd);
+    return false;
+  }
+  void *map = ::mmap(0, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    error = path + ": " + std::strerror(errno);
+    ::close(fd);
+    return false;
+  }
+  m_base = (char *)map;
+  m_bytes = total;
+  m_fd = fd;
+  Header *header = (Header *)m_base;
+  if (header->magic != kMagic || header->layout != layout) {
+    if (!alone) {
+      error = path + ": in use with a different layout";
+      return false;
+    }
+    std::memset(m_base, 0, total);
+    header->layout = layout;
+    __sync_synchronize();
+    header->magic = kMagic;
+  }
+  if (alone) ::flock(fd, LOCK_SH);
+
+  // The first never-used slot, or one whose owner has exited
+  pid_t me = ::getpid();
+  for (size_t i = 0; i < kSlots && !m_slot; ++i) {
+    Slot *slot = SlotAt(i);
+    int32_t owner = slot->pid;
+    if ((owner == 0 || !processAlive(owner)) &&
+        __sync_bool_compare_and_swap(&slot->pid, owner, (int32_t)me))
+      m_slot = slot;
+  }
+  if (!m_slot) {
+    error = path + ": no free slot";
+    return false;
+  }
+  for (int g = 0; g < kStatGaugeCount; ++g)
+    __atomic_store_n(&m_slot->gauges[g], 0, __ATOMIC_RELAXED);
+  return true;
+}
+
+Stats::Slot *Stats::SlotAt(size_t index) const {
+  return (Slot *)(m_base + kLine + index * roundUp(sizeof(Slot), kLine));
+}
+
+void Stats::Add(StatCounter counter, uint64_t n) {
+  if (m_slot) relaxedAdd(&m_slot->counters[counter], n);
+}
+
+void Stats::Adjust(StatGauge gauge, int64_t delta) {
+  if (m_slot) relaxedAdd(&m_slot->gauges[gauge], delta);
+}
+
+void Stats::Set(StatGauge gauge, int64_t value) {
+  if (m_slot)
+    __atomic_store_n(&m_slot->gauges[gauge], value, __ATOMIC_RELAXED);
+}
+
+void Stats::RecordResponse(int status, unsigned long micros) {
+  if (!m_slot) return;
+  if (status >= 100 && status < 600)
+    relaxedAdd(&m_slot->counters[kStatResponses1xx + status / 100 - 1],
+               (uint64_t)1);
+  int bucket = 0;
+  while (bucket < kStatLatencyBuckets && micros > kLatencyBoundsUs[bucket])
+    ++bucket;
+  relaxedAdd(&m_slot->latency[bucket], (uint64_t)1);
+  relaxedAdd(&m_slot->latencySumUs, (uint64_t)micros);
+}
+
+void Stats::RecordHardware(StatRequestClass cls,
+                           const uint64_t counts[kStatHardwareEventCount]) {
+  if (!m_slot) return;
+  uint64_t *row = m_slot->hardware[cls];
+  relaxedAdd(&row[0], (uint64_t)1);
+  for (int e = 0; e < kStatHardwareEventCount; ++e)
+    relaxedAdd(&row[1 + e], counts[e]);
+}
+
+std::string Stats::Render() const {
+  uint64_t counters[kStatCounterCount] = {0};
+  int64_t gauges[kStatGaugeCount] = {0};
+  uint64_t latency[kStatLatencyBuckets + 1] = {0};
+  uint64_t latencySumUs = 0;
+  uint64_t hardware[kStatClassCount][1 + kStatHardwareEventCount] = {{0}};
+  int processes = 0;
+  size_t slots = m_fd >= 0 ? kSlots : (m_slot ? 1 : 0);
+  for (size_t i = 0; i < slots; ++i) {
+    const Slot *slot = SlotAt(i);
+    int32_t owner = relaxedLoad(&slot->pid);
+    if (owner == 0) continue;
+    for (int c = 0; c < kStatCounterCount; ++c)
+      counters[c] += relaxedLoad(&slot->counters[c]);
+    for (int b = 0; b <= kStatLatencyBuckets; ++b)
+      latency[b] += relaxedLoad(&slot->latency[b]);
+    latencySumUs += relaxedLoad(&slot->latencySumUs);
+    for (int k = 0; k < kStatClassCount; ++k)
+      for (int e = 0; e <= kStatHardwareEventCount; ++e)
+        hardware[k][e] += relaxedLoad(&slot->hardware[k][e]);
+    // A dead process's gauges describe connections that no longer exist
+    if (slot != m_slot && !processAlive(owner)) continue;
+    ++processes;
+    for (int g = 0; g < kStatGaugeCount; ++g) {
+      int64_t value = relaxedLoad(&slot->gauges[g]);
+      if (g != kStatLoopLagMicros)
+        gauges[g] += value;
+      else if (value > gauges[g])
+        gauges[g] = value;
+    }
+  }
+
+  std::string out;
+  std::string previous;
+  for (int c = 0; c < kStatCounterCount; ++c) {
+    std::string family(kCounterNames[c],
+                       std::strcspn(kCounterNames[c], "{"));
+    if (family != previous) out += "# TYPE " + family + " counter\n";
+    previous = family;
+    appendMetric(out, kCounterNames[c], (double)counters[c]);
+  }
+  out += "# TYPE selfserv_connections_active gauge\n";
+  appendMetric(out, "selfserv_connections_active",
+               (double)gauges[kStatActiveConnections]);
+  out += "# TYPE selfserv_buffered_bytes gauge\n";
+  appendMetric(out, "selfserv_buffered_bytes",
+               (double)gauges[kStatBufferedBytes]);
+  out += "# TYPE selfserv_resident_memory_bytes gauge\n";
+  appendMetric(out, "selfserv_resident_memory_bytes",
+               (double)gauges[kStatResidentBytes]);
+  out += "# TYPE selfserv_event_loop_lag_seconds gauge\n";
+  appendMetric(out, "selfserv_event_loop_lag_seconds",
+               gauges[kStatLoopLagMicros] / 1e6);
+  out += "# TYPE selfserv_processes gauge\n";
+  appendMetric(out, "selfserv_processes", (double)processes);
+  out += "# TYPE selfserv_request_duration_seconds histogram\n";
+  uint64_t cumulative = 0;
+  for (int b = 0; b <= kStatLatencyBuckets; ++b) {
+    cumulative += latency[b];
+    char name[96];
+    if (b < kStatLatencyBuckets)
+      std::snprintf(name, sizeof(name),
+                    "selfserv_request_duration_seconds_bucket{le=\"%g\"}",
+                    kLatencyBoundsUs[b] / 1e6);
+    else
+      std::snprintf(name, sizeof(name),
+                    "selfserv_request_duration_seconds_bucket{le=\"+Inf\"}");
+    appendMetric(out, name, (double)cumulative);
+  }
+  appendMetric(out, "selfserv_request_duration_seconds_sum",
+               latencySumUs / 1e6);
+  appendMetric(out, "selfserv_request_duration_seconds_count",
+               (double)cumulative);
+  // Only once some process samples hardware counters
+  uint64_t sampled = 0;
+  for (int k = 0; k < kStatClassCount; ++k) sampled += hardware[k][0];
+  for (int e = 0; sampled && e <= kStatHardwareEventCount; ++e) {
+    out += std::string("# TYPE ") + kHardwareNames[e] + " counter\n";
+    for (int k = 0; k < kStatClassCount; ++k) {
+      char name[96];
+      std::snprintf(name, sizeof(name), "%s{class=\"%s\"}", kHardwareNames[e],
+                    kClassNames[k]);
+      appendMetric(out, name, (double)hardware[k][e]);
+    }
+  }
+  return out;
+}
@@ -0,0 +1,98 @@
+// Server counters kept in per-process slots of a shared segment.
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+
+enum StatCounter {
+  kStatAccepted,  // connections
+  kStatResponses1xx,
+  kStatResponses2xx,
+  kStatResponses3xx,
+  kStatResponses4xx,
+  kStatResponses5xx,
+  kStatBytesIn,
+  kStatBytesOut,
+  kStatCgiRuns,
+  kStatQuotaRejections,  // 503/429 for a virtual host over its quota
+  kStatCounterCount
+};
+
+enum StatGauge {
+  kStatActiveConnections,
+  kStatBufferedBytes,  // request and response bytes held by connections
+  kStatResidentBytes,  // process RSS
+  kStatLoopLagMicros,  // longest event-loop pass of the last second
+  kStatGaugeCount
+};
+
+// Request classes that hardware counters are attributed to
+enum StatRequestClass {
+  kStatClassStaticHit,   // a static body already in memory
+  kStatClassStaticMiss,  // a static file read from disk
+  kStatClassNotFound,
+  kStatClassUpload,
+  kStatClassCgi,
+  kStatClassRedirect,
+  kStatClassOther,
+  kStatClassCount
+};
+
+enum StatHardwareEvent {
+  kStatCycles,
+  kStatInstructions,
+  kStatCacheMisses,
+  kStatBranchMisses,
+  kStatHardwareEventCount
+};
+
+// Upper bounds of the request latency histogram buckets, in microseconds;
+// one more bucket catches everything slower
+const int kStatLatencyBuckets = 16;
+
+// Monotonic clock in microseconds, for latencies
+unsigned long MonotonicMicros();
+
+// Each process owns one slot of a segment mapped from a file (several server
+// processes naming the same file share it) and is its only writer: updates
+// are relaxed atomic loads and stores, with no read-modify-write, lock or
+// system call on the request path. Render() sums every slot. A slot left by
+// a process that has exited is taken over by the next one to start, whose
+// counters continue from its values, so totals stay monotonic across
+// restarts; gauges start again from zero. Gauges are summed over processes,
+// except the loop lag, which is the worst of them.
+class Stats {
+ public:
+  Stats();
+  ~Stats();
+
+  // Maps the segment at path and claims a slot; an empty path keeps the
+  // counters private to this process. False with error set on failure.
+  bool Open(const std::string &path, std::string &error);
+  void Add(StatCounter counter, uint64_t n = 1);
+  void Adjust(StatGauge gauge, int64_t delta);
+  void Set(StatGauge gauge, int64_t value);
+  // A finished response: counts it by status class and its latency
+  void RecordResponse(int status, unsigned long micros);
+  // Hardware counter deltas measured while handling one request
+  void RecordHardware(StatRequestClass cls,
+                      const uint64_t counts[kStatHardwareEventCount]);
+  // Prometheus text exposition of the sums over all slots
+  std::string Render() const;
+
+ private:
+  // Non-copyable
+  Stats(const Stats &);
+  Stats &operator=(const Stats &);
+
+  struct Slot;
+
+  Slot *SlotAt(size_t index) const;
+
+  char *m_base;
+  size_t m_bytes;
+  Slot *m_slot;  // this process's; 0 until opened
+  int m_fd;      // holds a shared flock while mapped; -1 when private
+};
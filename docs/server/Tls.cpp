@@ -0,0 +1,204 @@
+#include "server/Tls.hpp"
+
+#include <iostream>
+
+#ifdef SELFSERV_WITH_TLS
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+namespace {
+
+// Server preference order, wire format (length-prefixed)
+const unsigned char kAlpnProtocols[] = "\x02h2\x08http/1.1";
+const unsigned char kSessionIdContext[] = "selfserv";
+const long kSessionTimeoutSec = 300;
+const long kSessionCacheSize = 16384;
+
+int selectAlpn(SSL *, const unsigned char **out, unsigned char *outLen,
+               const unsigned char *in, unsigned int inLen, void *) {
+  unsigned char *selected = 0;
+  if (SSL_select_next_proto(&selected, outLen, kAlpnProtocols,
+                            sizeof(kAlpnProtocols) - 1, in,
+                            inLen) != OPENSSL_NPN_NEGOTIATED)
+    return SSL_TLSEXT_ERR_NOACK;  // no overlap: carry on without ALPN
+  *out = selected;
+  return SSL_TLSEXT_ERR_OK;
+}
+
+TlsConnection::Status mapError(SSL *ssl, int ret) {
+  switch (SSL_get_error(ssl, ret)) {
+    case SSL_ERROR_WANT_READ:
+      return TlsConnection::kTlsWantRead;
+    case SSL_ERROR_WANT_WRITE:
+      return TlsConnection::kTlsWantWrite;
+    case SSL_ERROR_ZERO_RETURN:
+      return TlsConnection::kTlsClosed;
+    default:
+      ERR_clear_error();
+      return TlsConnection::kTlsError;
+  }
+}
+
+}  // namespace
+
+TlsContext::TlsContext() : m_ctx(0) {}
+
+TlsContext::~TlsContext() {
+  if (m_ctx) SSL_CTX_free(m_ctx);
+}
+
+bool TlsContext::Init(const ServerConfig &sc) {
+  m_ctx = SSL_CTX_new(TLS_server_method());
+  if (!m_ctx) {
+    ERR_print_errors_fp(stderr);
+    return false;
+  }
+  SSL_CTX_set_min_proto_version(m_ctx, TLS1_2_VERSION);
+  if (SSL_CTX_use_certificate_chain_file(m_ctx, sc.tlsCertificate.c_str()) !=
+          1 ||
+      SSL_CTX_use_PrivateKey_file(m_ctx, sc.tlsCertificateKey.c_str(),
+                                  SSL_FILETYPE_PEM) != 1 ||
+      SSL_CTX_check_private_key(m_ctx) != 1) {
+    std::cerr << "[tls] cannot load certificate/key for " << sc.host << ":"
+              << sc.port << "\n";
+    ERR_print_errors_fp(stderr);
+    return false;
+  }
+  // The write buffer is a std::string that may reallocate between retries,
+  // and partial writes let HandleWritable erase what was sent
+  SSL_CTX_set_mode(m_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                              SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                              SSL_MODE_RELEASE_BUFFERS);
+
+  // Resumption: stateful cache for session-id clients plus stateless tickets
+  // (enabled by default; keys are generated per context)
+  SSL_CTX_set_session_cache_mode(m_ctx, SSL_SESS_CACHE_SERVER);
+  SSL_CTX_set_session_id_context(m_ctx, kSessionIdContext,
+                                 sizeof(kSessionIdContext) - 1);
+  SSL_CTX_sess_set_cache_size(m_ctx, kSessionCacheSize);
+  SSL_CTX_set_timeout(m_ctx, kSessionTimeoutSec);
+  SSL_CTX_set_num_tickets(m_ctx, 1);
+
+  SSL_CTX_set_alpn_select_cb(m_ctx, selectAlpn, 0);
+
+#ifdef SSL_OP_ENABLE_KTLS
+  // Falls back to userspace records when the kernel lacks the tls ULP or
+  // the negotiated cipher is not offloadable
+  if (sc.tlsKtls) SSL_CTX_set_options(m_ctx, SSL_OP_ENABLE_KTLS);
+#endif
+  return true;
+}
+
+bool TlsConnection::Start(const TlsContext &ctx, int fd) {
+  m_ssl = SSL_new(ctx.Get());
+  if (!m_ssl) return false;
+  if (SSL_set_fd(m_ssl, fd) != 1) {
+    Free();
+    return false;
+  }
+  SSL_set_accept_state(m_ssl);
+  m_established = false;
+  return true;
+}
+
+void TlsConnection::Free() {
+  if (m_ssl) {
+    // Best effort close_notify; never block or wait for the peer's reply
+    if (m_established) SSL_shutdown(m_ssl);
+    SSL_free(m_ssl);
+    m_ssl = 0;
+  }
+  m_established = false;
+}
+
+TlsConnection::Status TlsConnection::Handshake() {
+  int ret = SSL_do_handshake(m_ssl);
+  if (ret == 1) {
+    m_established = true;
+    return kTlsDone;
+  }
+  Status st = mapError(m_ssl, ret);
+  return st == kTlsClosed ? kTlsError : st;
+}
+
+TlsConnection::Status TlsConnection::Read(char *buf, size_t len, size_t &n) {
+  n = 0;
+  int ret = SSL_read(m_ssl, buf, (int)len);
+  if (ret > 0) {
+    n = (size_t)ret;
+    return kTlsDone;
+  }
+  return mapError(m_ssl, ret);
+}
+
+TlsConnection::Status TlsConnection::Write(const char *buf, size_t len,
+                                           size_t &n) {
+  n = 0;
+  if (len > 0x7fffffffu) len = 0x7fffffffu;
+  int ret = SSL_write(m_ssl, buf, (int)len);
+  if (ret > 0) {
+    n = (size_t)ret;
+    return kTlsDone;
+  }
+  return mapError(m_ssl, ret);
+}
+
+bool TlsConnection::NegotiatedH2() const {
+  const unsigned char *proto = 0;
+  unsigned int len = 0;
+  SSL_get0_alpn_selected(m_ssl, &proto, &len);
+  return len == 2 && proto[0] == 'h' && proto[1] == '2';
+}
+
+bool TlsConnection::Resumed() const { return SSL_session_reused(m_ssl) == 1; }
+
+bool TlsConnection::KtlsSend() const {
+  return BIO_get_ktls_send(SSL_get_wbio(m_ssl)) != 0;
+}
+
+std::string TlsConnection::Describe() const {
+  std::string d = SSL_get_version(m_ssl);
+  d += ' ';
+  d += SSL_get_cipher_name(m_ssl);
+  return d;
+}
+
+#else  // !SELFSERV_WITH_TLS
+
+TlsContext::TlsContext() : m_ctx(0) {}
+
+TlsContext::~TlsContext() {}
+
+bool TlsContext::Init(const ServerConfig &sc) {
+  std::cerr << "[tls] " << sc.host << ":" << sc.port
+            << " has a certificate but TLS support was not compiled in"
+               " (rebuild with WITH_TLS=1)\n";
+  return false;
+}
+
+bool TlsConnection::Start(const TlsContext &, int) { return false; }
+
+void TlsConnection::Free() {}
+
+TlsConnection::Status TlsConnection::Handshake() { return kTlsError; }
+
+TlsConnection::Status TlsConnection::Read(char *, size_t, size_t &n) {
+  n = 0;
+  return kTlsError;
+}
+
+TlsConnection::Status TlsConnection::Write(const char *, size_t, size_t &n) {
+  n = 0;
+  return kTlsError;
+}
+
+bool TlsConnection::NegotiatedH2() const { return false; }
+
+bool TlsConnection::Resumed() const { return false; }
+
+bool TlsConnection::KtlsSend() const { return false; }
+
+std::string TlsConnection::Describe() const { return std::string(); }
+
+#endif  // SELFSERV_WITH_TLS
@@ -0,0 +1,62 @@
+// TLS termination for listening sockets (OpenSSL). Built only when
+// SELFSERV_WITH_TLS is defined (make server WITH_TLS=1); otherwise
+// configuring a certificate makes TlsContext::Init fail with a clear message.
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "config/Config.hpp"
+
+// Opaque OpenSSL handles, so this header does not pull in <openssl/ssl.h>
+struct ssl_ctx_st;
+struct ssl_st;
+
+// One SSL_CTX per TLS-enabled server block: certificate, server-side session
+// cache, stateless session tickets, ALPN (h2, http/1.1) and, if requested,
+// kernel TLS offload.
+class TlsContext {
+ public:
+  TlsContext();
+  ~TlsContext();
+
+  bool Init(const ServerConfig &sc);
+  struct ssl_ctx_st *Get() const { return m_ctx; }
+
+ private:
+  // Non-copyable
+  TlsContext(const TlsContext &);
+  TlsContext &operator=(const TlsContext &);
+
+  struct ssl_ctx_st *m_ctx;
+};
+
+// Per-connection TLS state. Copyable as a plain handle (ClientConnection is
+// stored by value); the owner calls Free() exactly once.
+class TlsConnection {
+ public:
+  // Outcome of a non-blocking handshake/read/write step
+  enum Status { kTlsDone, kTlsWantRead, kTlsWantWrite, kTlsClosed, kTlsError };
+
+  TlsConnection() : m_ssl(0), m_established(false) {}
+
+  bool Start(const TlsContext &ctx, int fd);
+  void Free();
+
+  bool Active() const { return m_ssl != 0; }
+  bool Established() const { return m_established; }
+
+  Status Handshake();
+  Status Read(char *buf, size_t len, size_t &n);
+  Status Write(const char *buf, size_t len, size_t &n);
+
+  // Valid once established
+  bool NegotiatedH2() const;
+  bool Resumed() const;
+  bool KtlsSend() const;
+  std::string Describe() const;  // protocol/cipher for logging
+
+ private:
+  struct ssl_st *m_ssl;
+  bool m_established;
+};
@@ -0,0 +1,125 @@
+#include "server/TrafficCapture.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+// Records are written out once this much is pending, or at the end of an
+// event-loop pass
+const size_t kFlushBytes = 64 * 1024;
+
+void appendBase64(std::string &out, const char *data, size_t len) {
+  static const char kAlphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  const unsigned char *p = (const unsigned char *)data;
+  for (size_t i = 0; i < len; i += 3) {
+    unsigned long v = (unsigned long)p[i] << 16;
+    if (i + 1 < len) v |= (unsigned long)p[i + 1] << 8;
+    if (i + 2 < len) v |= p[i + 2];
+    out += kAlphabet[(v >> 18) & 63];
+    out += kAlphabet[(v >> 12) & 63];
+    out += i + 1 < len ? kAlphabet[(v >> 6) & 63] : '=';
+    out += i + 2 < len ? kAlphabet[v & 63] : '=';
+  }
+}
+
+// Printable ASCII plus CR, LF and tab: what a request head normally is, and
+// what any JSON reader takes back unchanged
+bool isPlainText(const char *data, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char c = (unsigned char)data[i];
+    if ((c < 0x20 && c != '\r' && c != '\n' && c != '\t') || c > 0x7e)
+      return false;
+  }
+  return true;
+}
+
+void appendJsonText(std::string &out, const char *data, size_t len) {
+  out += '"';
+  for (size_t i = 0; i < len; ++i) {
+    char c = data[i];
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (c == '\r') {
+      out += "\\r";
+    } else if (c == '\n') {
+      out += "\\n";
+    } else if (c == '\t') {
+      out += "\\t";
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+void appendNumber(std::string &out, const char *key, unsigned long value) {
+  char buf[48];
+  std::snprintf(buf, sizeof(buf), "\"%s\":%lu", key, value);
+  out += buf;
+}
+
+}  // namespace
+
+TrafficCapture::TrafficCapture() : m_fd(-1), m_records(0) {}
+
+TrafficCapture::~TrafficCapture() {
+  Flush();
+  if (m_fd >= 0) ::close(m_fd);
+}
+
+bool TrafficCapture::Open(const std::string &path, std::string &error) {
+  m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  if (m_fd < 0) {
+    error = path + ": " + std::strerror(errno);
+    return false;
+  }
+  m_path = path;
+  return true;
+}
+
+void TrafficCapture::Record(const CapturedRequest &request) {
+  std::string &out = m_pending;
+  out += '{';
+  appendNumber(out, "t", request.arrivalUs);
+  out += ',';
+  appendNumber(out, "pid", (unsigned long)::getpid());
+  out += ',';
+  appendNumber(out, "conn", request.connection);
+  out += request.pipelined ? ",\"pipelined\":true," : ",\"pipelined\":false,";
+  if (isPlainText(request.head, request.headLength)) {
+    out += "\"head\":";
+    appendJsonText(out, request.head, request.headLength);
+  } else {
+    out += "\"head_b64\":\"";
+    appendBase64(out, request.head, request.headLength);
+    out += '"';
+  }
+  if (request.bodyLength) {
+    out += ",\"body_b64\":\"";
+    appendBase64(out, request.body, request.bodyLength);
+    out += '"';
+  }
+  out += ',';
+  appendNumber(out, "body_length", (unsigned long)request.bodyTotal);
+  out += "}\n";
+  ++m_records;
+  if (m_pending.size() >= kFlushBytes) Flush();
+}
+
+void TrafficCapture::Flush() {
+  if (m_pending.empty() || m_fd < 0) return;
+  ssize_t n = ::write(m_fd, m_pending.data(), m_pending.size());
+  if (n != (ssize_t)m_pending.size())
+    std::cerr << "[capture] " << m_path << ": "
+              << (n < 0 ? std::strerror(errno) : "short write")
+              << "; records dropped\n";
+  m_pending.clear();
+}
@@ -0,0 +1,49 @@
+// Request capture for load-test replay (tools/replay).
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// One request as it arrived on a connection. head and body point into the
+// connection's read buffer; only the first bodyLength bytes of the body are
+// kept.
+struct CapturedRequest {
+  unsigned long connection;  // numbers a process's connections from 1
+  unsigned long arrivalUs;   // monotonic; first byte of the request
+  bool pipelined;            // sent before the previous response had ended
+  const char *head;          // request line and headers, CRLFCRLF included
+  size_t headLength;
+  const char *body;  // as sent (chunked framing included)
+  size_t bodyLength;
+  size_t bodyTotal;  // body bytes on the wire
+};
+
+// Appends one JSON object per request to a file:
+//
+//   {"t":..,"pid":..,"conn":..,"pipelined":false,"head":"GET / ..",
+//    "body_b64":"..","body_length":..}
+//
+// A head that is not printable ASCII is written as "head_b64" instead;
+// "body_b64" is omitted for empty bodies. Lines are buffered and written with
+// one append per Flush(), so processes sharing the file do not interleave
+// within a line.
+class TrafficCapture {
+ public:
+  TrafficCapture();
+  ~TrafficCapture();  // flushes
+
+  bool Open(const std::string &path, std::string &error);
+  void Record(const CapturedRequest &request);
+  void Flush();
+  size_t Records() const { return m_records; }
+
+ private:
+  // Non-copyable
+  TrafficCapture(const TrafficCapture &);
+  TrafficCapture &operator=(const TrafficCapture &);
+
+  int m_fd;
+  std::string m_pending;
+  std::string m_path;
+  size_t m_records;
+};
@@ -0,0 +1,136 @@
+#include "server/UploadSession.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+
+namespace {
+
+const size_t kIdBytes = 8;  // 16 hex digits
+
+bool validId(const std::string &id) {
+  if (id.size() != kIdBytes * 2) return false;
+  for (size_t i = 0; i < id.size(); ++i) {
+    char c = id[i];
+    if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return false;
+  }
+  return true;
+}
+
+std::string newId() {
+  unsigned char raw[kIdBytes];
+  size_t got = 0;
+  int fd = ::open("/dev/urandom", O_RDONLY);
+  if (fd >= 0) {
+    ssize_t n = ::read(fd, raw, sizeof(raw));
+    if (n > 0) got = (size_t)n;
+    ::close(fd);
+  }
+  for (size_t i = got; i < sizeof(raw); ++i)  // no /dev/urandom: best effort
+    raw[i] = (unsigned char)(std::rand() ^ std::time(0) ^ ::getpid());
+  static const char kHex[] = "0123456789abcdef";
+  std::string id;
+  for (size_t i = 0; i < sizeof(raw); ++i) {
+    id += kHex[raw[i] >> 4];
+    id += kHex[raw[i] & 15];
+  }
+  return id;
+}
+
+// Part number from a finished part's file name; 0 for anything else
+int partNumber(const char *name) {
+  int n = 0;
+  for (const char *p = name; *p; ++p) {
+    if (*p < '0' || *p > '9' || n > kMaxUploadParts) return 0;
+    n = n * 10 + (*p - '0');
+  }
+  return n <= kMaxUploadParts ? n : 0;
+}
+
+}  // namespace
+
+std::string UploadSessionDir(const std::string &target,
+                             const std::string &id) {
+  size_t slash = target.rfind('/');
+  size_t name = slash == std::string::npos ? 0 : slash + 1;
+  return target.substr(0, name) + "." + target.substr(name) + "." + id +
+         ".parts";
+}
+
+int CreateUploadSession(const std::string &target, std::string &id) {
+  for (int attempt = 0; attempt < 4; ++attempt) {
+    id = newId();
+    if (::mkdir(UploadSessionDir(target, id).c_str(), 0755) == 0) return 0;
+    if (errno == ENOENT || errno == ENOTDIR) return 409;
+    if (errno != EEXIST) return 500;
+  }
+  return 500;
+}
+
+bool UploadSessionPart(const std::string &target, const std::string &id,
+                       int part, std::string &path) {
+  if (!validId(id) || part < 1 || part > kMaxUploadParts) return false;
+  std::string dir = UploadSessionDir(target, id);
+  struct stat st;
+  if (::stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return false;
+  char num[16];
+  std::sprintf(num, "/%d", part);
+  path = dir + num;
+  return true;
+}
+
+bool RemoveUploadSession(const std::string &target, const std::string &id) {
+  if (!validId(id)) return false;
+  std::string dir = UploadSessionDir(target, id);
+  DIR *d = ::opendir(dir.c_str());
+  if (!d) return false;
+  struct dirent *e;
+  while ((e = ::readdir(d)) != 0) {
+    std::string name = e->d_name;
+    if (name != "." && name != "..") ::unlink((dir + "/" + name).c_str());
+  }
+  ::closedir(d);
+  return ::rmdir(dir.c_str()) == 0;
+}
+
+int BeginSessionAssembly(const std::string &target, const std::string &id,
+                         FileAssembly &assembly) {
+  if (!validId(id)) return 404;
+  std::string dir = UploadSessionDir(target, id);
+  DIR *d = ::opendir(dir.c_str());
+  if (!d) return 404;
+  std::vector<int> numbers;
+  std::vector<std::string> entries;
+  struct dirent *e;
+  while ((e = ::readdir(d)) != 0) {
+    std::string name = e->d_name;
+    if (name == "." || name == "..") continue;
+    entries.push_back(dir + "/" + name);
+    int n = partNumber(e->d_name);
+    if (n > 0) numbers.push_back(n);
+  }
+  ::closedir(d);
+  std::sort(numbers.begin(), numbers.end());
+  if (numbers.empty()) return 409;
+  std::vector<std::string> parts;
+  for (size_t i = 0; i < numbers.size(); ++i) {
+    if (numbers[i] != (int)i + 1) return 409;  // a part is missing
+    char num[16];
+    std::sprintf(num, "/%d", numbers[i]);
+    parts.push_back(dir + num);
+  }
+  int status = assembly.Begin(parts, target, true);
+  if (status != 0) return status;
+  for (size_t i = 0; i < entries.size(); ++i)
+    assembly.RemoveOnSuccess(entries[i]);
+  assembly.RemoveOnSuccess(dir);
+  return 0;
+}
@@ -0,0 +1,31 @@
+// Multi-part upload sessions: the parts of one object are PUT separately
+// (in parallel, each resumable) and joined in the kernel on completion.
+#pragma once
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "server/FileCopy.hpp"
+
+const int kMaxUploadParts = 10000;
+
+// A session is a hidden directory next to the target,
+// "dir/.name.<id>.parts", holding one file per finished part ("1", "2",
+// ...); parts still being written are PutUpload part files inside it.
+std::string UploadSessionDir(const std::string &target, const std::string &id);
+// Creates a session under a fresh random id; 0, 409 (no parent directory)
+// or 500
+int CreateUploadSession(const std::string &target, std::string &id);
+// File for part n (1..kMaxUploadParts) of session id; false when the id is
+// malformed or no such session exists
+bool UploadSessionPart(const std::string &target, const std::string &id,
+                       int part, std::string &path);
+bool RemoveUploadSession(const std::string &target, const std::string &id);
+
+// Prepares joining parts 1..N of session id into target; the session is
+// removed once the result is in place. 0, or 404 (no session), 409 (no
+// parts or a gap in the numbering) or 500.
+int BeginSessionAssembly(const std::string &target, const std::string &id,
+                         FileAssembly &assembly);
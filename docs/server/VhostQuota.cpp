@@ -0,0 +1,74 @@
+#include "server/VhostQuota.hpp"
+
+namespace {
+
+const uint64_t kToken = 1000000;  // one request, in bucket units
+
+}  // namespace
+
+VhostQuota::VhostQuota()
+    : m_maxConnections(0),
+      m_connections(0),
+      m_maxBuffered(0),
+      m_buffered(0),
+      m_maxCgi(0),
+      m_cgi(0),
+      m_rate(0),
+      m_capacity(0),
+      m_tokens(0),
+      m_lastUs(0) {}
+
+void VhostQuota::Configure(size_t maxConnections, size_t maxBuffered,
+                           size_t maxCgi, unsigned long ratePerSec,
+                           unsigned long burst) {
+  m_maxConnections = maxConnections;
+  m_maxBuffered = maxBuffered;
+  m_maxCgi = maxCgi;
+  m_rate = ratePerSec;
+  m_capacity = (uint64_t)(burst ? burst : ratePerSec) * kToken;
+  m_tokens = m_capacity;
+  m_lastUs = 0;
+}
+
+int VhostQuota::Admit(bool newConnection, unsigned long nowUs,
+                      const char *&why) {
+  if (newConnection && m_maxConnections &&
+      m_connections >= m_maxConnections) {
+    why = "connections";
+    return 503;
+  }
+  if (m_maxBuffered && m_buffered >= m_maxBuffered) {
+    why = "buffered bytes";
+    return 503;
+  }
+  if (m_rate) {
+    // Refill for the time since the last request, up to the burst size
+    uint64_t elapsed = m_lastUs ? nowUs - m_lastUs : m_capacity;
+    m_lastUs = nowUs;
+    if (elapsed >= m_capacity / m_rate + 1)
+      m_tokens = m_capacity;
+    else if ((m_tokens += elapsed * m_rate) > m_capacity)
+      m_tokens = m_capacity;
+    if (m_tokens < kToken) {
+      why = "request rate";
+      return 429;
+    }
+    m_tokens -= kToken;
+  }
+  if (newConnection) ++m_connections;
+  return 0;
+}
+
+void VhostQuota::Detach() {
+  if (m_connections) --m_connections;
+}
+
+bool VhostQuota::CgiAvailable() const {
+  return !m_maxCgi || m_cgi < m_maxCgi;
+}
+
+void VhostQuota::StartCgi() { ++m_cgi; }
+
+void VhostQuota::EndCgi() {
+  if (m_cgi) --m_cgi;
+}
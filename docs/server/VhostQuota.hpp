@@ -0,0 +1,41 @@
+// Resource quotas of one virtual host (server block).
+#pragma once
+
+#include <stdint.h>
+
+#include <cstddef>
+
+// Keeps one tenant from starving the others: caps on the connections
+// attributed to the host, the bytes they hold buffered, its concurrent CGI
+// processes and its request rate (a token bucket). A limit of 0 is no
+// limit. Connections are attributed when a request's Host header selects
+// the server block; buffered bytes are totalled by the event loop's
+// per-iteration sweep, so checks cost a few comparisons.
+class VhostQuota {
+ public:
+  VhostQuota();
+
+  void Configure(size_t maxConnections, size_t maxBuffered, size_t maxCgi,
+                 unsigned long ratePerSec, unsigned long burst);
+  // Admits a request at nowUs (microseconds, monotonic), attaching its
+  // connection first when newConnection. 0 if admitted; otherwise 503 or
+  // 429, with why naming the exhausted resource.
+  int Admit(bool newConnection, unsigned long nowUs, const char *&why);
+  void Detach();  // an attached connection closed or moved to another host
+  bool CgiAvailable() const;
+  void StartCgi();
+  void EndCgi();
+  void SetBuffered(size_t bytes) { m_buffered = bytes; }
+
+ private:
+  size_t m_maxConnections;
+  size_t m_connections;
+  size_t m_maxBuffered;
+  size_t m_buffered;
+  size_t m_maxCgi;
+  size_t m_cgi;
+  uint64_t m_rate;      // tokens per microsecond, in millionths of a request
+  uint64_t m_capacity;  // burst, in millionths of a request
+  uint64_t m_tokens;
+  unsigned long m_lastUs;
+};
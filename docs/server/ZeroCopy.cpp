@@ -0,0 +1,91 @@
+#include "server/ZeroCopy.hpp"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/errqueue.h>
+#endif
+
+bool ZeroCopySender::Enable(int fd) {
+  if (m_state == kUntried) {
+    m_state = kOff;
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    int one = 1;
+    if (::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0)
+      m_state = kOn;
+#else
+    (void)fd;
+#endif
+  }
+  return m_state == kOn;
+}
+
+ssize_t ZeroCopySender::Send(int fd, const SharedBuffer &buf, size_t offset,
+                             size_t len) {
+#ifdef MSG_ZEROCOPY
+  if (m_state == kOn) {
+    ssize_t n = ::send(fd, buf.Data() + offset, len, MSG_ZEROCOPY);
+    if (n >= 0) {
+      // Only sends that queued data are numbered
+      // The handle is assigned in place rather than copied through a pair
+      m_inFlight.push_back(std::pair<uint32_t, SharedBuffer>());
+      m_inFlight.back().first = m_nextId++;
+      m_inFlight.back().second = buf;
+      return n;
+    }
+    if (errno != ENOBUFS) return -1;
+  }
+#endif
+  return ::send(fd, buf.Data() + offset, len, 0);
+}
+
+bool ZeroCopySender::Reap(int fd) {
+#if defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+  for (;;) {
+    char control[128];
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (::recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) break;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm;
+         cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+          !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+        continue;
+      struct sock_extended_err ee;
+      std::memcpy(&ee, CMSG_DATA(cm), sizeof(ee));
+      if (ee.ee_errno != 0 || ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+      // The kernel copied after all (loopback, a device without
+      // scatter-gather): pinning only adds cost on this socket
+      if (ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) m_state = kOff;
+      Complete(ee.ee_info, ee.ee_data);
+    }
+  }
+#endif
+  int err = 0;
+  socklen_t len = sizeof(err);
+  return ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0;
+}
+
+void ZeroCopySender::Complete(uint32_t first, uint32_t last) {
+  // Ranges normally arrive in order, so this pops from the front; ids wrap
+  std::deque<std::pair<uint32_t, SharedBuffer> >::iterator it =
+      m_inFlight.begin();
+  while (it != m_inFlight.end()) {
+    if ((uint32_t)(it->first - first) <= (uint32_t)(last - first))
+      it = m_inFlight.erase(it);
+    else
+      ++it;
+  }
+}
+
+void ZeroCopySender::TakePending(std::vector<SharedBuffer> &out) {
+  for (size_t i = 0; i < m_inFlight.size(); ++i)
+    out.push_back(m_inFlight[i].second);
+  m_inFlight.clear();
+}
@@ -0,0 +1,44 @@
+// MSG_ZEROCOPY sends of shared buffers.
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <deque>
+#include <utility>
+#include <vector>
+
+#include "util/SharedBuffer.hpp"
+
+// With MSG_ZEROCOPY the kernel transmits from the sender's pages instead of
+// copying them into socket memory, and later reports on the socket's error
+// queue (raising POLLERR) the range of sends it no longer needs. Each send
+// holds a handle to its buffer until then, so the bytes cannot be freed or
+// reused while the kernel may still read them. Pinning pages and fielding
+// notifications costs more than copying a few kilobytes, so callers use it
+// for large sends only.
+class ZeroCopySender {
+ public:
+  ZeroCopySender() : m_nextId(0), m_state(kUntried) {}
+
+  // Sets SO_ZEROCOPY on the socket the first time; false when the kernel
+  // lacks it or has turned out to copy anyway
+  bool Enable(int fd);
+  // Like send(2) of buf[offset, offset + len). Falls back to a copying send
+  // when the kernel refuses to pin more pages (ENOBUFS).
+  ssize_t Send(int fd, const SharedBuffer &buf, size_t offset, size_t len);
+  // Drains the error queue and releases the sends it reports complete.
+  // False when the socket also has a real error pending.
+  bool Reap(int fd);
+  size_t Pending() const { return m_inFlight.size(); }
+  // Hands over the buffers of unfinished sends, for a closing socket
+  void TakePending(std::vector<SharedBuffer> &out);
+
+ private:
+  enum State { kUntried, kOn, kOff };
+  void Complete(uint32_t first, uint32_t last);
+
+  std::deque<std::pair<uint32_t, SharedBuffer> > m_inFlight;  // by send id
+  uint32_t m_nextId;  // id the kernel assigns the next zero-copy send
+  State m_state;
+};
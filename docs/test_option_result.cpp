@@ -172,6 +172,37 @@ void test_complex_types() {
   std::cout << "  ✓ Complex types test passed\n";
 }
 
+void test_emplace_and_layout() {
+  std::cout << "Testing in-place construction and storage layout...\n";
+
+  Option<std::string> opt;
+  opt.Emplace(3, 'x');
+  assert(opt.Unwrap() == "xxx");
+  opt.Emplace("abc", 2);
+  assert(opt.Unwrap() == "ab");
+  opt.Reset();
+  assert(opt.IsNone());
+
+  Result<std::string, int> res = Result<std::string, int>::Err(7);
+  res.EmplaceOk(2, 'y');
+  assert(res.IsOk() && res.Unwrap() == "yy");
+  res.EmplaceErr(9);
+  assert(res.IsErr() && res.UnwrapErr() == 9);
+
+  // Exact alignment: no double aligner padding for small payloads
+  assert(sizeof(Option<int>) == 2 * sizeof(int));
+  assert(sizeof(Result<int, int>) == 2 * sizeof(int));
+  assert(sizeof(Option<char>) == 2);
+
+  // Trivially copyable payloads copy bitwise through implicit operations
+  Result<int, int> a = Result<int, int>::Ok(5);
+  Result<int, int> b = Result<int, int>::Err(6);
+  b = a;
+  assert(b.IsOk() && b.Unwrap() == 5);
+
+  std::cout << "  ✓ Emplace and layout test passed\n";
+}
+
 int main() {
   std::cout << "=== Running Option<T> and Result<T,E> Tests ===\n\n";
 
@@ -182,6 +213,7 @@ int main() {
   test_result_copy_semantics();
   test_result_exceptions();
   test_complex_types();
+  test_emplace_and_layout();
 
   std::cout << "\n=== All Tests Passed! ===\n";
   return 0;
@@ -0,0 +1,292 @@
+// Micro-benchmark of the Option/Result storage layout against the previous
+// one (a char buffer followed by a double aligner, with user-written copy
+// operations and destructor), kept here as LegacyOption/LegacyResult.
+//
+//   bench_option_result [iterations]
+//
+// Prints the sizes of a few instantiations, then the time per operation of
+//   return   a non-inlined call returning Result<int, int>, checked and summed
+//   scan     summing the Ok values of an array of Result<int, int>
+//   copy     copying that array (std::vector assignment)
+//   some     Option<std::string> assigned from Some(std::string(...))
+//   emplace  the same built in place by Emplace(...) (neither row has an old
+//            figure; the old layout had no Emplace)
+// Each figure is the best of five runs. C++98; build with
+//
+//   c++ -std=c++98 -O2 -Isrc -o bench_option_result
+//       docs/tools/bench_option_result.cpp
+#include <time.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "option/option.hpp"
+#include "result/result.hpp"
+
+using selfserv::Option;
+using selfserv::Result;
+
+namespace {
+
+template <typename T>
+class LegacyOption {
+ public:
+  LegacyOption() : m_hasValue(false) {}
+  explicit LegacyOption(const T &value) : m_hasValue(true) {
+    new (GetPtr()) T(value);
+  }
+  LegacyOption(const LegacyOption &other) : m_hasValue(other.m_hasValue) {
+    if (m_hasValue) new (GetPtr()) T(*other.GetPtr());
+  }
+  LegacyOption &operator=(const LegacyOption &other) {
+    if (this != &other) {
+      if (m_hasValue) GetPtr()->~T();
+      m_hasValue = other.m_hasValue;
+      if (m_hasValue) new (GetPtr()) T(*other.GetPtr());
+    }
+    return *this;
+  }
+  ~LegacyOption() {
+    if (m_hasValue) GetPtr()->~T();
+  }
+
+ private:
+  T *GetPtr() { return reinterpret_cast<T *>(&m_storage.aligned.data[0]); }
+  const T *GetPtr() const {
+    return reinterpret_cast<const T *>(&m_storage.aligned.data[0]);
+  }
+
+  union Storage {
+    char dummy;
+    struct {
+      char data[sizeof(T)];
+      double aligner;
+    } aligned;
+  } m_storage;
+  bool m_hasValue;
+};
+
+template <typename T, typename E>
+class LegacyResult {
+ public:
+  static LegacyResult Ok(const T &value) { return LegacyResult(value); }
+  static LegacyResult Err(const E &error) {
+    LegacyResult result;
+    result.m_isOk = false;
+    new (result.GetEPtr()) E(error);
+    return result;
+  }
+  LegacyResult(const LegacyResult &other) : m_isOk(other.m_isOk) {
+    if (m_isOk)
+      new (GetTPtr()) T(*other.GetTPtr());
+    else
+      new (GetEPtr()) E(*other.GetEPtr());
+  }
+  LegacyResult &operator=(const LegacyResult &other) {
+    if (this != &other) {
+      Destroy();
+      m_isOk = other.m_isOk;
+      if (m_isOk)
+        new (GetTPtr()) T(*other.GetTPtr());
+      else
+        new (GetEPtr()) E(*other.GetEPtr());
+    }
+    return *this;
+  }
+  ~LegacyResult() { Destroy(); }
+
+  bool IsOk() const { return m_isOk; }
+  const T &Unwrap() const { return *GetTPtr(); }
+
+ private:
+  LegacyResult() : m_isOk(true) {}
+  explicit LegacyResult(const T &value) : m_isOk(true) {
+    new (GetTPtr()) T(value);
+  }
+  void Destroy() {
+    if (m_isOk)
+      GetTPtr()->~T();
+    else
+      GetEPtr()->~E();
+  }
+  T *GetTPtr() { return reinterpret_cast<T *>(&m_storage.t.data[0]); }
+  const T *GetTPtr() const {
+    return reinterpret_cast<const T *>(&m_storage.t.data[0]);
+  }
+  E *GetEPtr() { return reinterpret_cast<E *>(&m_storage.e.data[0]); }
+  const E *GetEPtr() const {
+    return reinterpret_cast<const E *>(&m_storage.e.data[0]);
+  }
+
+  union Storage {
+    char dummy;
+    struct {
+      char data[sizeof(T)];
+      double aligner;
+    } t;
+    struct {
+      char data[sizeof(E)];
+      double aligner;
+    } e;
+  } m_storage;
+  bool m_isOk;
+};
+
+typedef Result<int, int> NewResult;
+typedef LegacyResult<int, int> OldResult;
+
+double nowSeconds() {
+  struct timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Odd inputs fail, the way a parser rejects some of its input
+NewResult checkNew(int x) {
+  if (x & 1) return NewResult::Err(x);
+  return NewResult::Ok(x >> 1);
+}
+
+OldResult checkOld(int x) {
+  if (x & 1) return OldResult::Err(x);
+  return OldResult::Ok(x >> 1);
+}
+
+// Called through volatile pointers so the return path is not inlined away
+NewResult (*volatile g_checkNew)(int) = checkNew;
+OldResult (*volatile g_checkOld)(int) = checkOld;
+volatile long g_sink;
+
+template <typename R>
+double timeReturn(R (*volatile *fn)(int), long iterations) {
+  double best = 1e9;
+  for (int run = 0; run < 5; ++run) {
+    R (*call)(int) = *fn;
+    long sum = 0;
+    double start = nowSeconds();
+    for (long i = 0; i < iterations; ++i) {
+      R r = call((int)i);
+      if (r.IsOk()) sum += r.Unwrap();
+    }
+    double elapsed = nowSeconds() - start;
+    g_sink = sum;
+    if (elapsed < best) best = elapsed;
+  }
+  return best / iterations;
+}
+
+template <typename R>
+void fill(std::vector<R> &values, size_t count) {
+  values.reserve(count);
+  for (size_t i = 0; i < count; ++i)
+    values.push_back(i & 1 ? R::Err((int)i) : R::Ok((int)i));
+}
+
+template <typename R>
+double timeScan(const std::vector<R> &values) {
+  double best = 1e9;
+  for (int run = 0; run < 5; ++run) {
+    long sum = 0;
+    double start = nowSeconds();
+    for (size_t i = 0; i < values.size(); ++i)
+      if (values[i].IsOk()) sum += values[i].Unwrap();
+    double elapsed = nowSeconds() - start;
+    g_sink = sum;
+    if (elapsed < best) best = elapsed;
+  }
+  return best / values.size();
+}
+
+template <typename R>
+double timeCopy(const std::vector<R> &values) {
+  double best = 1e9;
+  for (int run = 0; run < 5; ++run) {
+    std::vector<R> copy;
+    double start = nowSeconds();
+    copy = values;
+    double elapsed = nowSeconds() - start;
+    g_sink = (long)copy.size();
+    if (elapsed < best) best = elapsed;
+  }
+  return best / values.size();
+}
+
+double timeStringOption(long iterations, bool emplace) {
+  const char *text = "a value long enough to live on the heap";
+  double best = 1e9;
+  for (int run = 0; run < 5; ++run) {
+    long total = 0;
+    double start = nowSeconds();
+    for (long i = 0; i < iterations; ++i) {
+      Option<std::string> value;
+      if (emplace)
+        value.Emplace(text, (size_t)(i & 31) + 8);
+      else
+        value = Option<std::string>::Some(
+            std::string(text, (size_t)(i & 31) + 8));
+      total += (long)value.Unwrap().size();
+    }
+    double elapsed = nowSeconds() - start;
+    g_sink = total;
+    if (elapsed < best) best = elapsed;
+  }
+  return best / iterations;
+}
+
+void printRow(const char *name, double oldSec, double newSec) {
+  if (oldSec > 0)
+    std::printf("%-8s %9.2f ns %9.2f ns %7.2fx\n", name, oldSec * 1e9,
+                newSec * 1e9, oldSec / newSec);
+  else
+    std::printf("%-8s %12s %9.2f ns\n", name, "-", newSec * 1e9);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  long iterations = argc > 1 ? std::atol(argv[1]) : 50000000L;
+  if (iterations <= 0) {
+    std::fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+    return 2;
+  }
+  std::printf("%-26s %6s %6s\n", "sizeof", "old", "new");
+  std::printf("%-26s %6lu %6lu\n", "Option<int>",
+              (unsigned long)sizeof(LegacyOption<int>),
+              (unsigned long)sizeof(Option<int>));
+  std::printf("%-26s %6lu %6lu\n", "Option<char>",
+              (unsigned long)sizeof(LegacyOption<char>),
+              (unsigned long)sizeof(Option<char>));
+  std::printf("%-26s %6lu %6lu\n", "Result<int, int>",
+              (unsigned long)sizeof(OldResult),
+              (unsigned long)sizeof(NewResult));
+  std::printf("%-26s %6lu %6lu\n", "Result<std::string, int>",
+              (unsigned long)sizeof(LegacyResult<std::string, int>),
+              (unsigned long)sizeof(Result<std::string, int>));
+  std::printf("\n%-8s %12s %12s %8s\n", "per op", "old", "new", "speedup");
+
+  printRow("return", timeReturn(&g_checkOld, iterations),
+           timeReturn(&g_checkNew, iterations));
+
+  size_t count = (size_t)(iterations / 10);
+  double oldScan, oldCopy;
+  {
+    std::vector<OldResult> values;
+    fill(values, count);
+    oldScan = timeScan(values);
+    oldCopy = timeCopy(values);
+  }
+  std::vector<NewResult> values;
+  fill(values, count);
+  printRow("scan", oldScan, timeScan(values));
+  printRow("copy", oldCopy, timeCopy(values));
+
+  long strings = iterations / 10;
+  double some = timeStringOption(strings, false);
+  double emplace = timeStringOption(strings, true);
+  printRow("some", 0, some);
+  printRow("emplace", 0, emplace);
+  return 0;
+}
@@ -0,0 +1,222 @@
+// Build-time generator: compiles a directory tree into a C++ source holding a
+// sorted table of EmbeddedAsset records (see server/EmbeddedAssets.hpp).
+//
+//   embed_assets <www dir> <output.cpp>
+//
+// Every file becomes a read-only byte array plus its MIME type, a strong
+// ETag (FNV-1a 64 of the content) and, when gzip saves at least 10%, a
+// precompressed copy. C++98; links against zlib.
+#include <dirent.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Asset {
+  std::string path;  // URL path, starting with '/'
+  std::string data;
+  std::string gzip;  // empty when compression does not pay off
+  bool operator<(const Asset &other) const { return path < other.path; }
+};
+
+const char *mimeFor(const std::string &path) {
+  static const char *const kTypes[][2] = {
+      {".html", "text/html; charset=utf-8"},
+      {".htm", "text/html; charset=utf-8"},
+      {".css", "text/css; charset=utf-8"},
+      {".js", "application/javascript; charset=utf-8"},
+      {".mjs", "application/javascript; charset=utf-8"},
+      {".json", "application/json"},
+      {".svg", "image/svg+xml"},
+      {".png", "image/png"},
+      {".jpg", "image/jpeg"},
+      {".jpeg", "image/jpeg"},
+      {".gif", "image/gif"},
+      {".ico", "image/x-icon"},
+      {".webp", "image/webp"},
+      {".woff2", "font/woff2"},
+      {".wasm", "application/wasm"},
+      {".txt", "text/plain; charset=utf-8"}};
+  size_t dot = path.rfind('.');
+  if (dot == std::string::npos || path.find('/', dot) != std::string::npos)
+    return "application/octet-stream";
+  std::string ext = path.substr(dot);
+  for (size_t i = 0; i < ext.size(); ++i)
+    if (ext[i] >= 'A' && ext[i] <= 'Z') ext[i] = (char)(ext[i] - 'A' + 'a');
+  for (size_t i = 0; i < sizeof(kTypes) / sizeof(kTypes[0]); ++i)
+    if (ext == kTypes[i][0]) return kTypes[i][1];
+  return "application/octet-stream";
+}
+
+// Compressible types only; images and fonts are already compressed
+bool compressible(const char *mime) {
+  return std::strncmp(mime, "text/", 5) == 0 ||
+         std::strstr(mime, "javascript") || std::strstr(mime, "json") ||
+         std::strstr(mime, "svg") || std::strstr(mime, "wasm");
+}
+
+std::string etagFor(const std::string &data) {
+  unsigned long hi = 0xcbf29ce4UL, lo = 0x84222325UL;  // FNV-1a 64 offset
+  for (size_t i = 0; i < data.size(); ++i) {
+    lo ^= (unsigned char)data[i];
+    // 64-bit multiply by the FNV prime 0x100000001b3 on two 32-bit halves
+    unsigned long loProd = (lo & 0xffffffffUL) * 0x1b3UL;
+    unsigned long carry = loProd >> 32;
+    unsigned long newHi =
+        ((hi & 0xffffffffUL) * 0x1b3UL + (lo & 0xffffffffUL) * 0x100UL +
+         carry) &
+        0xffffffffUL;
+    lo = loProd & 0xffffffffUL;
+    hi = newHi;
+  }
+  char buf[24];
+  std::sprintf(buf, "\"%08lx%08lx\"", hi, lo);
+  return buf;
+}
+
+bool gzipData(const std::string &in, std::string &out) {
+  z_stream zs;
+  std::memset(&zs, 0, sizeof(zs));
+  // windowBits 15 + 16 selects the gzip wrapper
+  if (deflateInit2(&zs, 9, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) !=
+      Z_OK)
+    return false;
+  out.resize(deflateBound(&zs, (uLong)in.size()) + 32);
+  zs.next_in = (Bytef *)in.data();
+  zs.avail_in = (uInt)in.size();
+  zs.next_out = (Bytef *)&out[0];
+  zs.avail_out = (uInt)out.size();
+  int rc = deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return rc == Z_STREAM_END;
+}
+
+bool readFile(const std::string &path, std::string &out) {
+  std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+  if (!in) return false;
+  std::ostringstream ss;
+  ss << in.rdbuf();
+  out = ss.str();
+  return true;
+}
+
+bool collect(const std::string &dir, const std::string &urlPrefix,
+             std::vector<Asset> &out) {
+  DIR *d = ::opendir(dir.c_str());
+  if (!d) {
+    std::perror(dir.c_str());
+    return false;
+  }
+  bool ok = true;
+  struct dirent *ent;
+  while (ok && (ent = ::readdir(d))) {
+    std::string name = ent->d_name;
+    if (name == "." || name == ".." || name[0] == '.') continue;
+    std::string full = dir + "/" + name;
+    struct stat st;
+    if (::stat(full.c_str(), &st) != 0) continue;
+    if (S_ISDIR(st.st_mode)) {
+      ok = collect(full, urlPrefix + name + "/", out);
+    } else if (S_ISREG(st.st_mode)) {
+      Asset a;
+      a.path = urlPrefix + name;
+      if (!readFile(full, a.data)) {
+        std::perror(full.c_str());
+        ok = false;
+        break;
+      }
+      std::string gz;
+      if (compressible(mimeFor(a.path)) && gzipData(a.data, gz) &&
+          gz.size() * 10 < a.data.size() * 9)
+        a.gzip = gz;
+      out.push_back(a);
+    }
+  }
+  ::closedir(d);
+  return ok;
+}
+
+void writeBytes(std::ostream &os, const std::string &name,
+                const std::string &data) {
+  os << "static const unsigned char " << name << "[] = {";
+  if (data.empty()) os << "0";  // zero-length arrays are not C++
+  for (size_t i = 0; i < data.size(); ++i) {
+    if (i % 16 == 0) os << "\n   ";
+    char buf[8];
+    std::sprintf(buf, " 0x%02x,", (unsigned char)data[i]);
+    os << buf;
+  }
+  os << "\n};\n";
+}
+
+std::string cString(const std::string &s) {
+  std::string out = "\"";
+  for (size_t i = 0; i < s.size(); ++i) {
+    if (s[i] == '"' || s[i] == '\\') out += '\\';
+    out += s[i];
+  }
+  return out + "\"";
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    std::cerr << "usage: " << argv[0] << " <www dir> <output.cpp>\n";
+    return 2;
+  }
+  std::vector<Asset> assets;
+  if (!collect(argv[1], "/", assets)) return 1;
+  // The server looks paths up by binary search
+  std::sort(assets.begin(), assets.end());
+
+  std::ostringstream os;
+  os << "// Generated by embed_assets from " << argv[1]
+     << "; do not edit.\n"
+        "#include \"server/EmbeddedAssets.hpp\"\n\n";
+  size_t raw = 0, packed = 0;
+  for (size_t i = 0; i < assets.size(); ++i) {
+    char name[32];
+    std::sprintf(name, "kAsset%lu", (unsigned long)i);
+    writeBytes(os, name, assets[i].data);
+    if (!assets[i].gzip.empty())
+      writeBytes(os, std::string(name) + "Gzip", assets[i].gzip);
+    raw += assets[i].data.size();
+    packed += assets[i].gzip.size();
+  }
+  os << "\nconst EmbeddedAsset kEmbeddedAssets[] = {\n";
+  for (size_t i = 0; i < assets.size(); ++i) {
+    char name[32];
+    std::sprintf(name, "kAsset%lu", (unsigned long)i);
+    const Asset &a = assets[i];
+    os << "    {" << cString(a.path) << ", " << name << ", " << a.data.size()
+       << ", " << cString(mimeFor(a.path)) << ", "
+       << cString(etagFor(a.data)) << ", ";
+    if (a.gzip.empty())
+      os << "0, 0},\n";
+    else
+      os << name << "Gzip, " << a.gzip.size() << "},\n";
+  }
+  if (assets.empty()) os << "    {\"\", 0, 0, \"\", \"\", 0, 0},\n";
+  os << "};\n\nconst size_t kEmbeddedAssetCount = " << assets.size() << ";\n";
+
+  std::ofstream out(argv[2], std::ios::out | std::ios::binary);
+  out << os.str();
+  if (!out) {
+    std::perror(argv[2]);
+    return 1;
+  }
+  std::cerr << "embedded " << assets.size() << " files, " << raw
+            << " bytes (" << packed << " bytes precompressed)\n";
+  return 0;
+}
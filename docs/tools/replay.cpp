@@ -0,0 +1,609 @@
+// Load-test driver: re-issues a request capture (the server's `capture`
+// directive) against a server and reports the latency distribution.
+//
+//   replay [-s <speed>|max] [-c <connections>] <host> <port> <capture.jsonl>
+//
+// Each captured connection is replayed on its own connection, in order.
+// A request waits for the previous response unless it was pipelined behind
+// it. With a speed (default 1) requests also wait for their capture time,
+// scaled; with max they go as soon as the connection allows. -c caps the
+// connections open at once (default 256). Bodies captured only in part are
+// padded with zero bytes to their recorded length. HTTP/1.x over plain TCP.
+// C++98; build with the JSON parser from src/json:
+//
+//   c++ -std=c++98 -O2 -Isrc -o replay docs/tools/replay.cpp
+//       src/json/json_parser.cpp
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "json/json_parser.hpp"
+
+namespace {
+
+// Outstanding requests fail when nothing moves for this long
+const unsigned long kStallUs = 30UL * 1000000UL;
+
+struct Request {
+  unsigned long t;  // capture time, microseconds
+  bool pipelined;
+  bool headOnly;  // HEAD: the response has no body
+  std::string method;
+  std::string bytes;  // head and body as sent
+};
+
+struct Connection {
+  std::vector<Request> requests;
+  std::vector<unsigned long> sentUs;
+  size_t next;                 // first request not yet sent
+  std::deque<size_t> waiting;  // sent, response not complete
+  int fd;
+  bool connecting;
+  bool finished;
+  std::string out;
+  size_t outOffset;
+  std::string in;
+  Connection()
+      : next(0),
+        fd(-1),
+        connecting(false),
+        finished(false),
+        outOffset(0) {}
+};
+
+struct Totals {
+  size_t sent;
+  size_t answered;
+  size_t failed;
+  size_t reconnects;
+  size_t classes[6];  // by status / 100
+  std::map<std::string, std::vector<unsigned long> > latency;  // by method
+  Totals() : sent(0), answered(0), failed(0), reconnects(0) {
+    std::fill(classes, classes + 6, 0);
+  }
+};
+
+unsigned long nowUs() {
+  struct timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long)ts.tv_sec * 1000000UL +
+         (unsigned long)ts.tv_nsec / 1000UL;
+}
+
+bool decodeBase64(const std::string &in, std::string &out) {
+  unsigned long v = 0;
+  int bits = 0;
+  for (size_t i = 0; i < in.size() && in[i] != '='; ++i) {
+    char c = in[i];
+    int d;
+    if (c >= 'A' && c <= 'Z')
+      d = c - 'A';
+    else if (c >= 'a' && c <= 'z')
+      d = c - 'a' + 26;
+    else if (c >= '0' && c <= '9')
+      d = c - '0' + 52;
+    else if (c == '+')
+      d = 62;
+    else if (c == '/')
+      d = 63;
+    else
+      return false;
+    v = (v << 6) | (unsigned long)d;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      out += (char)((v >> bits) & 0xff);
+    }
+  }
+  return true;
+}
+
+const JsonValue *field(const JsonObject &obj, const char *key,
+                       JsonType type) {
+  const JsonValue *v = obj.GetValue(key);
+  return v && v->GetType() == type ? v : 0;
+}
+
+unsigned long number(const JsonObject &obj, const char *key) {
+  const JsonValue *v = field(obj, key, kJsonNumber);
+  return v ? (unsigned long)static_cast<const JsonNumber *>(v)->GetValue() : 0;
+}
+
+const std::string *text(const JsonObject &obj, const char *key) {
+  const JsonValue *v = field(obj, key, kJsonString);
+  return v ? &static_cast<const JsonString *>(v)->GetValue() : 0;
+}
+
+// One capture line into a request; false when it is not one
+bool parseRecord(const JsonObject &obj, Request &req, unsigned long &pid,
+                 unsigned long &conn) {
+  const std::string *head = text(obj, "head");
+  const std::string *head64 = text(obj, "head_b64");
+  if (head)
+    req.bytes = *head;
+  else if (!head64 || !decodeBase64(*head64, req.bytes))
+    return false;
+  if (req.bytes.find("\r\n\r\n") == std::string::npos) return false;
+  if (const std::string *body = text(obj, "body_b64"))
+    if (!decodeBase64(*body, req.bytes)) return false;
+  size_t headLength = req.bytes.find("\r\n\r\n") + 4;
+  size_t bodyTotal = number(obj, "body_length");
+  if (req.bytes.size() < headLength + bodyTotal)
+    req.bytes.resize(headLength + bodyTotal, '\0');
+  req.method = req.bytes.substr(0, req.bytes.find(' '));
+  req.headOnly = req.method == "HEAD";
+  req.t = number(obj, "t");
+  const JsonValue *pipelined = field(obj, "pipelined", kJsonBool);
+  req.pipelined =
+      pipelined && static_cast<const JsonBool *>(pipelined)->GetValue();
+  pid = number(obj, "pid");
+  conn = number(obj, "conn");
+  return true;
+}
+
+// Groups the capture's requests by connection, in capture order. Lines that
+// do not parse (such as one cut short by a failed write) are skipped.
+bool loadCapture(const char *path, std::vector<Connection> &conns,
+                 unsigned long &t0) {
+  std::ifstream file(path);
+  if (!file) {
+    std::cerr << "replay: " << path << ": " << std::strerror(errno) << "\n";
+    return false;
+  }
+  std::map<std::pair<unsigned long, unsigned long>, size_t> index;
+  std::string line;
+  size_t lineNo = 0, skipped = 0;
+  t0 = 0;
+  while (std::getline(file, line)) {
+    ++lineNo;
+    if (line.empty()) continue;
+    Request req;
+    unsigned long pid = 0, conn = 0;
+    bool ok = false;
+    try {
+      JsonParser parser;
+      JsonValuePtr root(parser.Parse(line));
+      ok = root.Get()->GetType() == kJsonObject &&
+           parseRecord(*static_cast<const JsonObject *>(root.Get()), req,
+                       pid, conn);
+    } catch (const std::exception &e) {
+      if (skipped == 0) std::cerr << "replay: line " << lineNo << ": "
+                                  << e.what() << "\n";
+    }
+    if (!ok) {
+      ++skipped;
+      continue;
+    }
+    std::pair<unsigned long, unsigned long> key(pid, conn);
+    std::map<std::pair<unsigned long, unsigned long>, size_t>::iterator it =
+        index.find(key);
+    if (it == index.end()) {
+      it = index.insert(std::make_pair(key, conns.size())).first;
+      conns.push_back(Connection());
+    }
+    conns[it->second].requests.push_back(req);
+    if (t0 == 0 || req.t < t0) t0 = req.t;
+  }
+  if (skipped) std::cerr << "replay: skipped " << skipped << " lines\n";
+  for (size_t i = 0; i < conns.size(); ++i)
+    conns[i].sentUs.assign(conns[i].requests.size(), 0);
+  return true;
+}
+
+// Length of the complete response at the start of buf, 0 while it is not
+// all there. A response delimited by the end of the connection is complete
+// only at eof.
+size_t responseLength(const std::string &buf, bool headOnly, bool eof,
+                      int &status) {
+  size_t headEnd = buf.find("\r\n\r\n");
+  if (headEnd == std::string::npos) return 0;
+  headEnd += 4;
+  status = 0;
+  if (buf.size() > 12 && buf.compare(0, 5, "HTTP/") == 0)
+    status = std::atoi(buf.c_str() + buf.find(' ') + 1);
+  if (status < 200 || status == 204 || status == 304 || headOnly)
+    return headEnd;
+  bool chunked = false;
+  long length = -1;
+  size_t pos = buf.find("\r\n") + 2;
+  while (pos < headEnd - 2) {
+    size_t eol = buf.find("\r\n", pos);
+    std::string name = buf.substr(pos, buf.find(':', pos) - pos);
+    for (size_t i = 0; i < name.size(); ++i)
+      name[i] = (char)std::tolower((unsigned char)name[i]);
+    const char *value = buf.c_str() + buf.find(':', pos) + 1;
+    if (name == "content-length")
+      length = std::atol(value);
+    else if (name == "transfer-encoding" && std::strstr(value, "chunked"))
+      chunked = true;
+    pos = eol + 2;
+  }
+  if (chunked) {
+    pos = headEnd;
+    for (;;) {
+      size_t eol = buf.find("\r\n", pos);
+      if (eol == std::string::npos) return 0;
+      unsigned long size = std::strtoul(buf.c_str() + pos, 0, 16);
+      pos = eol + 2;
+      if (size == 0) {
+        // Trailers, then an empty line
+        for (;;) {
+          eol = buf.find("\r\n", pos);
+          if (eol == std::string::npos) return 0;
+          if (eol == pos) return eol + 2;
+          pos = eol + 2;
+        }
+      }
+      if (buf.size() < pos + size + 2) return 0;
+      pos += size + 2;
+    }
+  }
+  if (length >= 0)
+    return buf.size() >= headEnd + (size_t)length ? headEnd + length : 0;
+  return eof ? buf.size() : 0;
+}
+
+class Replayer {
+ public:
+  Replayer(std::vector<Connection> &conns, const struct addrinfo *addr,
+           double speed, size_t maxOpen, unsigned long t0)
+      : m_conns(conns),
+        m_addr(addr),
+        m_speed(speed),
+        m_maxOpen(maxOpen),
+        m_t0(t0),
+        m_open(0),
+        m_startUs(0),
+        m_progressUs(0) {}
+
+  void Run();
+  const Totals &Result() const { return m_totals; }
+
+ private:
+  unsigned long DueUs(const Request &req) const {
+    if (m_speed <= 0) return m_startUs;
+    return m_startUs + (unsigned long)((double)(req.t - m_t0) / m_speed);
+  }
+  void Connect(Connection &c);
+  void Abandon(Connection &c);
+  void Close(Connection &c);
+  void FailWaiting(Connection &c);
+  void Queue(Connection &c, unsigned long now, unsigned long &wakeUs);
+  void Write(Connection &c);
+  void Read(Connection &c);
+  bool Complete(Connection &c, bool eof);
+
+  std::vector<Connection> &m_conns;
+  const struct addrinfo *m_addr;
+  double m_speed;  // 0 = max
+  size_t m_maxOpen;
+  unsigned long m_t0;
+  size_t m_open;
+  unsigned long m_startUs;
+  unsigned long m_progressUs;  // last byte moved
+  Totals m_totals;
+};
+
+void Replayer::Connect(Connection &c) {
+  if (c.next > 0) ++m_totals.reconnects;
+  c.fd = ::socket(m_addr->ai_family, SOCK_STREAM, 0);
+  if (c.fd >= 0) {
+    ::fcntl(c.fd, F_SETFL, ::fcntl(c.fd, F_GETFL, 0) | O_NONBLOCK);
+    int one = 1;
+    ::setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (::connect(c.fd, m_addr->ai_addr, m_addr->ai_addrlen) == 0 ||
+        errno == EINPROGRESS) {
+      c.connecting = true;
+      ++m_open;
+      return;
+    }
+    ::close(c.fd);
+    c.fd = -1;
+  }
+  Abandon(c);
+}
+
+// Nothing to talk to: the rest of this connection fails
+void Replayer::Abandon(Connection &c) {
+  std::cerr << "replay: connect: " << std::strerror(errno) << "\n";
+  m_totals.failed += c.requests.size() - c.next;
+  c.next = c.requests.size();
+  c.finished = true;
+}
+
+void Replayer::Close(Connection &c) {
+  ::close(c.fd);
+  c.fd = -1;
+  c.connecting = false;
+  c.out.clear();
+  c.outOffset = 0;
+  c.in.clear();
+  --m_open;
+  c.finished = c.next == c.requests.size();
+}
+
+void Replayer::FailWaiting(Connection &c) {
+  m_totals.failed += c.waiting.size();
+  c.waiting.clear();
+}
+
+// Hands the connection every request that may go now; wakeUs is lowered to
+// when the next one will be due
+void Replayer::Queue(Connection &c, unsigned long now, unsigned long &wakeUs) {
+  while (c.next < c.requests.size()) {
+    const Request &req = c.requests[c.next];
+    if (!c.waiting.empty() && !req.pipelined) return;
+    unsigned long due = DueUs(req);
+    if (due > now) {
+      if (due < wakeUs) wakeUs = due;
+      return;
+    }
+    c.out += req.bytes;
+    c.sentUs[c.next] = now;
+    c.waiting.push_back(c.next++);
+    ++m_totals.sent;
+  }
+}
+
+void Replayer::Write(Connection &c) {
+  while (c.outOffset < c.out.size()) {
+    ssize_t n = ::send(c.fd, c.out.data() + c.outOffset,
+                       c.out.size() - c.outOffset, MSG_NOSIGNAL);
+    if (n <= 0) return;  // EAGAIN; errors show up on the read side
+    c.outOffset += (size_t)n;
+    m_progressUs = nowUs();
+  }
+  c.out.clear();
+  c.outOffset = 0;
+}
+
+// Takes complete responses off the input; false once the connection cannot
+// carry more (an upgrade)
+bool Replayer::Complete(Connection &c, bool eof) {
+  while (!c.waiting.empty()) {
+    const Request &req = c.requests[c.waiting.front()];
+    int status = 0;
+    size_t len = responseLength(c.in, req.headOnly, eof, status);
+    if (len == 0) return true;
+    c.in.erase(0, len);
+    if (status >= 100 && status < 200 && status != 101) continue;
+    unsigned long latency = nowUs() - c.sentUs[c.waiting.front()];
+    m_totals.latency[req.method].push_back(latency);
+    ++m_totals.answered;
+    ++m_totals.classes[status / 100 < 6 ? status / 100 : 0];
+    c.waiting.pop_front();
+    if (status == 101) return false;
+  }
+  return true;
+}
+
+void Replayer::Read(Connection &c) {
+  char buf[16384];
+  for (;;) {
+    ssize_t n = ::recv(c.fd, buf, sizeof(buf), 0);
+    if (n > 0) {
+      c.in.append(buf, (size_t)n);
+      m_progressUs = nowUs();
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    // The server closed (or reset) the connection; what is unanswered
+    // failed, and unsent requests continue on a new connection
+    Complete(c, true);
+    FailWaiting(c);
+    Close(c);
+    return;
+  }
+  if (!Complete(c, false)) {
+    m_totals.failed += c.requests.size() - c.next;
+    c.next = c.requests.size();
+    FailWaiting(c);
+    Close(c);
+  }
+}
+
+void Replayer::Run() {
+  std::signal(SIGPIPE, SIG_IGN);
+  m_startUs = m_progressUs = nowUs();
+  std::vector<struct pollfd> pfds;
+  std::vector<size_t> owners;
+  for (;;) {
+    unsigned long now = nowUs();
+    unsigned long wakeUs = (unsigned long)-1;
+    for (size_t i = 0; i < m_conns.size(); ++i) {
+      Connection &c = m_conns[i];
+      if (c.finished) continue;
+      if (c.fd < 0) {
+        unsigned long due = DueUs(c.requests[c.next]);
+        if (due > now) {
+          if (due < wakeUs) wakeUs = due;
+          continue;
+        }
+        if (m_open >= m_maxOpen) continue;
+        Connect(c);
+        continue;
+      }
+      if (c.connecting) continue;
+      Queue(c, now, wakeUs);
+      if (c.next == c.requests.size() && c.waiting.empty()) {
+        Close(c);
+        continue;
+      }
+      Write(c);
+    }
+    bool busy = false;
+    for (size_t i = 0; i < m_conns.size() && !busy; ++i)
+      busy = !m_conns[i].finished;
+    if (!busy) return;
+    pfds.clear();
+    owners.clear();
+    for (size_t i = 0; i < m_conns.size(); ++i) {
+      const Connection &c = m_conns[i];
+      if (c.fd < 0) continue;
+      struct pollfd p;
+      p.fd = c.fd;
+      p.events = POLLIN;
+      if (c.connecting || c.outOffset < c.out.size()) p.events |= POLLOUT;
+      p.revents = 0;
+      pfds.push_back(p);
+      owners.push_back(i);
+    }
+    int timeoutMs = 1000;
+    if (wakeUs != (unsigned long)-1)
+      timeoutMs = wakeUs <= now ? 0 : (int)((wakeUs - now + 999) / 1000);
+    if (timeoutMs > 1000) timeoutMs = 1000;
+    if (::poll(pfds.empty() ? 0 : &pfds[0], pfds.size(), timeoutMs) < 0 &&
+        errno != EINTR)
+      return;
+    for (size_t k = 0; k < pfds.size(); ++k) {
+      Connection &c = m_conns[owners[k]];
+      short ev = pfds[k].revents;
+      if (!ev) continue;
+      if (c.connecting) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        ::getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err) {
+          Close(c);
+          errno = err;
+          Abandon(c);
+          continue;
+        }
+        c.connecting = false;
+        m_progressUs = nowUs();
+        continue;
+      }
+      if (ev & POLLOUT) Write(c);
+      if (ev & (POLLIN | POLLHUP | POLLERR)) Read(c);
+    }
+    if (nowUs() - m_progressUs > kStallUs) {
+      std::cerr << "replay: no progress for " << kStallUs / 1000000
+                << " s; giving up on open connections\n";
+      for (size_t i = 0; i < m_conns.size(); ++i) {
+        Connection &c = m_conns[i];
+        if (c.fd < 0) continue;
+        FailWaiting(c);
+        m_totals.failed += c.requests.size() - c.next;
+        c.next = c.requests.size();
+        Close(c);
+      }
+      m_progressUs = nowUs();
+    }
+  }
+}
+
+void printLatency(const char *label, std::vector<unsigned long> &v) {
+  if (v.empty()) return;
+  std::sort(v.begin(), v.end());
+  double sum = 0;
+  for (size_t i = 0; i < v.size(); ++i) sum += (double)v[i];
+  static const double kQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+  static const char *const kNames[] = {"p50", "p90", "p99", "p99.9"};
+  std::printf("%-10s %8lu  min %.3f", label, (unsigned long)v.size(),
+              v[0] / 1000.0);
+  for (size_t q = 0; q < 4; ++q) {
+    size_t i = (size_t)(kQuantiles[q] * (double)v.size());
+    if (i >= v.size()) i = v.size() - 1;
+    std::printf("  %s %.3f", kNames[q], v[i] / 1000.0);
+  }
+  std::printf("  max %.3f  mean %.3f\n", v.back() / 1000.0,
+              sum / (double)v.size() / 1000.0);
+}
+
+int usage() {
+  std::cerr << "usage: replay [-s <speed>|max] [-c <connections>] <host> "
+               "<port> <capture.jsonl>\n";
+  return 2;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  double speed = 1;
+  size_t maxOpen = 256;
+  int arg = 1;
+  for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+    std::string opt = argv[arg], value = argv[arg + 1];
+    if (opt == "-s")
+      speed = value == "max" ? 0 : std::atof(value.c_str());
+    else if (opt == "-c")
+      maxOpen = (size_t)std::atol(value.c_str());
+    else
+      return usage();
+  }
+  if (argc - arg != 3 || speed < 0 || maxOpen == 0) return usage();
+  struct addrinfo hints, *addr = 0;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_socktype = SOCK_STREAM;
+  int rc = ::getaddrinfo(argv[arg], argv[arg + 1], &hints, &addr);
+  if (rc != 0) {
+    std::cerr << "replay: " << argv[arg] << ": " << gai_strerror(rc) << "\n";
+    return 1;
+  }
+  std::vector<Connection> conns;
+  unsigned long t0 = 0;
+  if (!loadCapture(argv[arg + 2], conns, t0)) return 1;
+  size_t requests = 0;
+  for (size_t i = 0; i < conns.size(); ++i)
+    requests += conns[i].requests.size();
+  std::printf("replaying %lu requests on %lu connections",
+              (unsigned long)requests, (unsigned long)conns.size());
+  if (speed == 0)
+    std::printf(" at max speed\n");
+  else
+    std::printf(" at %gx\n", speed);
+
+  Replayer replayer(conns, addr, speed, maxOpen, t0);
+  unsigned long start = nowUs();
+  replayer.Run();
+  double seconds = (double)(nowUs() - start) / 1e6;
+  ::freeaddrinfo(addr);
+
+  const Totals &totals = replayer.Result();
+  std::printf("requests   %lu sent, %lu answered, %lu failed, %lu reconnects\n",
+              (unsigned long)totals.sent, (unsigned long)totals.answered,
+              (unsigned long)totals.failed, (unsigned long)totals.reconnects);
+  std::printf("status     1xx %lu  2xx %lu  3xx %lu  4xx %lu  5xx %lu\n",
+              (unsigned long)totals.classes[1],
+              (unsigned long)totals.classes[2],
+              (unsigned long)totals.classes[3],
+              (unsigned long)totals.classes[4],
+              (unsigned long)totals.classes[5]);
+  std::printf("duration   %.3f s, %.1f responses/s\n", seconds,
+              seconds > 0 ? totals.answered / seconds : 0.0);
+  std::printf("latency ms (from sending the request to the whole response)\n");
+  std::vector<unsigned long> all;
+  std::map<std::string, std::vector<unsigned long> > byMethod = totals.latency;
+  for (std::map<std::string, std::vector<unsigned long> >::iterator it =
+           byMethod.begin();
+       it != byMethod.end(); ++it)
+    all.insert(all.end(), it->second.begin(), it->second.end());
+  printLatency("all", all);
+  if (byMethod.size() > 1)
+    for (std::map<std::string, std::vector<unsigned long> >::iterator it =
+             byMethod.begin();
+         it != byMethod.end(); ++it)
+      printLatency(it->first.c_str(), it->second);
+  return totals.failed ? 1 : 0;
+}
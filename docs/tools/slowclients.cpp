@@ -0,0 +1,585 @@
+// Adversarial-client harness: keeps many connections open against a running
+// server while reading responses slowly, sending requests in small pieces
+// and resetting some of them mid-exchange, and samples the server's stats
+// route meanwhile to show how memory and the event loop hold up.
+//
+//   slowclients [options] <host> <port>
+//     -n <connections>  kept open; each finished one is replaced (100)
+//     -u <path>         requested (/)
+//     -b <bytes>        POST a body of this size instead of a GET (0)
+//     -r <bytes/s>      read rate per connection, 0 = unthrottled (1024)
+//     -q <bytes>        receive buffer per connection, 0 = system default (0)
+//     -w <bytes/s>      write rate per connection, 0 = unthrottled (0)
+//     -k <bytes>        largest piece per send() (1024)
+//     -x <percent>      of connections reset (RST) at a random point (0)
+//     -d <seconds>      run time (30)
+//     -i <seconds>      between samples of the stats route (1)
+//     -m <path>         the stats route (/metrics)
+//     -R <bytes>        fail if the server's resident memory exceeds this
+//     -B <bytes>        fail if the server's buffered bytes exceed this
+//     -L <ms>           fail if the event-loop lag exceeds this
+//
+// Requests ask for Connection: close, and a response is read to the end of
+// the connection. A reset happens once a random number of bytes, up to 64
+// KiB, has been exchanged, or at the end of a shorter exchange. Each sample
+// prints the server's resident memory, buffered bytes and loop lag (the
+// selfserv_* gauges) and how long the scrape itself took. The exit status is
+// 1 if a limit was exceeded. HTTP/1.1 over plain TCP. C++98; build with
+//
+//   c++ -std=c++98 -O2 -o slowclients docs/tools/slowclients.cpp
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Resets fall within this many bytes of the exchange
+const unsigned long kResetWindow = 64 * 1024;
+// Connections opened per loop pass, so the listen backlog is not overrun
+const size_t kConnectBurst = 256;
+
+struct Options {
+  size_t connections;
+  std::string path;
+  size_t bodyBytes;
+  double readRate;  // bytes/s; 0 = unthrottled
+  int receiveBuffer;
+  double writeRate;
+  size_t piece;
+  int resetPercent;
+  double seconds;
+  double interval;
+  std::string metricsPath;
+  double maxResident;  // 0 = no limit
+  double maxBuffered;
+  double maxLagMs;
+  Options()
+      : connections(100),
+        path("/"),
+        bodyBytes(0),
+        readRate(1024),
+        receiveBuffer(0),
+        writeRate(0),
+        piece(1024),
+        resetPercent(0),
+        seconds(30),
+        interval(1),
+        metricsPath("/metrics"),
+        maxResident(0),
+        maxBuffered(0),
+        maxLagMs(0) {}
+};
+
+struct Client {
+  int fd;
+  bool connecting;
+  size_t sent;
+  unsigned long nextWriteUs;
+  double tokens;  // bytes that may be read now
+  unsigned long refillUs;
+  unsigned long received;
+  unsigned long resetAt;  // bytes exchanged; 0 = never
+  char status[13];        // "HTTP/1.1 200"
+  Client()
+      : fd(-1),
+        connecting(false),
+        sent(0),
+        nextWriteUs(0),
+        tokens(0),
+        refillUs(0),
+        received(0),
+        resetAt(0) {
+    status[0] = '\0';
+  }
+};
+
+// One scrape of the stats route, on its own connection
+struct Scrape {
+  int fd;
+  unsigned long startUs;
+  size_t sent;
+  std::string request;
+  std::string response;
+  Scrape() : fd(-1), startUs(0), sent(0) {}
+};
+
+struct Sample {
+  double resident;  // -1 when the gauge was missing
+  double buffered;
+  double lagMs;
+  double scrapeMs;
+};
+
+struct Totals {
+  unsigned long opened;
+  unsigned long completed;  // server closed after a response
+  unsigned long empty;      // server closed without one
+  unsigned long resets;     // by us
+  unsigned long errors;     // connect failures and resets by the server
+  unsigned long classes[6];  // by status / 100
+  unsigned long bytesIn;
+  unsigned long bytesOut;
+  Totals()
+      : opened(0),
+        completed(0),
+        empty(0),
+        resets(0),
+        errors(0),
+        bytesIn(0),
+        bytesOut(0) {
+    std::fill(classes, classes + 6, 0);
+  }
+};
+
+unsigned long nowUs() {
+  struct timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long)ts.tv_sec * 1000000UL +
+         (unsigned long)ts.tv_nsec / 1000UL;
+}
+
+int openSocket(const struct addrinfo *addr, int receiveBuffer) {
+  int fd = ::socket(addr->ai_family, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  // Before connect(), so the window is advertised small from the start
+  if (receiveBuffer > 0)
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receiveBuffer,
+                 sizeof(receiveBuffer));
+  if (::connect(fd, addr->ai_addr, addr->ai_addrlen) == 0 ||
+      errno == EINPROGRESS)
+    return fd;
+  ::close(fd);
+  return -1;
+}
+
+// Value of an unlabelled metric in Prometheus text, -1 when absent
+double metric(const std::string &text, const char *name) {
+  std::string key = std::string("\n") + name + " ";
+  size_t pos = text.find(key);
+  if (pos == std::string::npos) return -1;
+  return std::atof(text.c_str() + pos + key.size());
+}
+
+// MiB, KiB, ms and ms, or "-" for a gauge the server did not report
+void formatSample(const Sample &s, char cells[4][32]) {
+  const double values[4] = {s.resident >= 0 ? s.resident / 1048576 : -1,
+                            s.buffered >= 0 ? s.buffered / 1024 : -1,
+                            s.lagMs, s.scrapeMs};
+  for (int i = 0; i < 4; ++i) {
+    if (values[i] < 0)
+      std::strcpy(cells[i], "-");
+    else
+      std::snprintf(cells[i], sizeof(cells[i]), "%.1f", values[i]);
+  }
+}
+
+class Harness {
+ public:
+  Harness(const Options &opt, const struct addrinfo *addr,
+          const std::string &host)
+      : m_opt(opt),
+        m_addr(addr),
+        m_clients(opt.connections),
+        m_peak(),
+        m_failed(false) {
+    std::ostringstream head;
+    head << (opt.bodyBytes ? "POST " : "GET ") << opt.path
+         << " HTTP/1.1\r\nHost: " << host << "\r\nConnection: close\r\n";
+    if (opt.bodyBytes)
+      head << "Content-Type: application/octet-stream\r\nContent-Length: "
+           << opt.bodyBytes << "\r\n";
+    head << "\r\n";
+    m_request = head.str() + std::string(opt.bodyBytes, 'x');
+    m_scrapeRequest = "GET " + opt.metricsPath + " HTTP/1.1\r\nHost: " +
+                      host + "\r\nConnection: close\r\n\r\n";
+    m_peak.resident = m_peak.buffered = m_peak.lagMs = m_peak.scrapeMs = -1;
+  }
+
+  void Run();
+  const Totals &Result() const { return m_totals; }
+  const Sample &Peak() const { return m_peak; }
+  bool Failed() const { return m_failed; }
+
+ private:
+  void Connect(Client &c, unsigned long now);
+  void Close(Client &c, bool reset);
+  void Write(Client &c, unsigned long now, unsigned long &wakeUs);
+  void Read(Client &c);
+  bool ReadAllowed(Client &c, unsigned long now, unsigned long &wakeUs);
+  void StartScrape(unsigned long now);
+  void ServeScrape(short revents);
+  void Report(const Sample &s, unsigned long now);
+  void Check(double value, double limit, const char *what);
+
+  const Options &m_opt;
+  const struct addrinfo *m_addr;
+  std::vector<Client> m_clients;
+  std::string m_request;
+  std::string m_scrapeRequest;
+  Scrape m_scrape;
+  Totals m_totals;
+  Sample m_peak;
+  unsigned long m_startUs;
+  size_t m_open;
+  bool m_failed;
+};
+
+void Harness::Connect(Client &c, unsigned long now) {
+  c = Client();
+  c.fd = openSocket(m_addr, m_opt.receiveBuffer);
+  if (c.fd < 0) {
+    ++m_totals.errors;
+    return;
+  }
+  c.connecting = true;
+  c.refillUs = now;
+  if (m_opt.resetPercent > 0 && std::rand() % 100 < m_opt.resetPercent)
+    c.resetAt = 1 + (unsigned long)std::rand() % kResetWindow;
+  ++m_totals.opened;
+  ++m_open;
+}
+
+// A reset drops whatever the server still had in flight for us
+void Harness::Close(Client &c, bool reset) {
+  if (reset) {
+    struct linger hard = {1, 0};
+    ::setsockopt(c.fd, SOL_SOCKET, SO_LINGER, &hard, sizeof(hard));
+    ++m_totals.resets;
+  }
+  ::close(c.fd);
+  c.fd = -1;
+  --m_open;
+}
+
+// One piece of the request when its time has come
+void Harness::Write(Client &c, unsigned long now, unsigned long &wakeUs) {
+  while (c.sent < m_request.size()) {
+    if (c.nextWriteUs > now) {
+      wakeUs = std::min(wakeUs, c.nextWriteUs);
+      return;
+    }
+    size_t n = std::min(m_opt.piece, m_request.size() - c.sent);
+    ssize_t w = ::send(c.fd, m_request.data() + c.sent, n, MSG_NOSIGNAL);
+    if (w <= 0) return;  // EAGAIN; errors show up on the read side
+    c.sent += (size_t)w;
+    m_totals.bytesOut += (unsigned long)w;
+    if (m_opt.writeRate > 0)
+      c.nextWriteUs = now + (unsigned long)((double)w * 1e6 / m_opt.writeRate);
+    if (c.resetAt && c.sent + c.received >= c.resetAt) {
+      Close(c, true);
+      return;
+    }
+  }
+}
+
+// Refills the read allowance; reads wait for a tenth of a second's worth so
+// a throttled connection is not woken for every byte
+bool Harness::ReadAllowed(Client &c, unsigned long now,
+                          unsigned long &wakeUs) {
+  if (m_opt.readRate <= 0) return true;
+  double burst = std::max(1.0, std::min(m_opt.readRate / 10, 16384.0));
+  c.tokens = std::min(burst, c.tokens + (double)(now - c.refillUs) *
+                                            m_opt.readRate / 1e6);
+  c.refillUs = now;
+  if (c.tokens >= burst) return true;
+  wakeUs = std::min(
+      wakeUs,
+      now + 1 + (unsigned long)((burst - c.tokens) * 1e6 / m_opt.readRate));
+  return false;
+}
+
+void Harness::Read(Client &c) {
+  unsigned long exchanged = c.sent + c.received;
+  if (c.resetAt && exchanged >= c.resetAt) {
+    Close(c, true);
+    return;
+  }
+  char buf[16384];
+  size_t want = sizeof(buf);
+  if (m_opt.readRate > 0) want = std::min(want, (size_t)c.tokens);
+  if (c.resetAt) want = std::min(want, (size_t)(c.resetAt - exchanged));
+  // POLLHUP and POLLERR arrive without read allowance; the recv only
+  // collects the error or end of file
+  if (want == 0) want = 1;
+  ssize_t n = ::recv(c.fd, buf, want, 0);
+  if (n > 0) {
+    size_t have = std::strlen(c.status);
+    if (have < sizeof(c.status) - 1) {
+      size_t take = std::min((size_t)n, sizeof(c.status) - 1 - have);
+      std::memcpy(c.status + have, buf, take);
+      c.status[have + take] = '\0';
+    }
+    c.received += (unsigned long)n;
+    c.tokens -= (double)n;
+    m_totals.bytesIn += (unsigned long)n;
+    if (c.resetAt && c.sent + c.received >= c.resetAt) Close(c, true);
+    return;
+  }
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+  if (n < 0) {
+    ++m_totals.errors;  // reset by the server
+  } else if (c.received == 0) {
+    ++m_totals.empty;
+  } else {
+    ++m_totals.completed;
+    int code = std::strlen(c.status) == 12 ? std::atoi(c.status + 9) : 0;
+    ++m_totals.classes[code >= 100 && code < 600 ? code / 100 : 0];
+  }
+  // A short exchange still ends in its reset
+  Close(c, c.resetAt != 0);
+}
+
+void Harness::StartScrape(unsigned long now) {
+  if (m_scrape.fd >= 0) return;  // the previous one is still running
+  m_scrape = Scrape();
+  m_scrape.fd = openSocket(m_addr, 0);
+  m_scrape.startUs = now;
+  m_scrape.request = m_scrapeRequest;
+  if (m_scrape.fd < 0) {
+    Sample s = {-1, -1, -1, -1};
+    Report(s, now);
+  }
+}
+
+void Harness::ServeScrape(short revents) {
+  if (revents & POLLOUT) {
+    ssize_t n = ::send(m_scrape.fd, m_scrape.request.data() + m_scrape.sent,
+                       m_scrape.request.size() - m_scrape.sent, MSG_NOSIGNAL);
+    if (n > 0) m_scrape.sent += (size_t)n;
+  }
+  if (!(revents & (POLLIN | POLLHUP | POLLERR))) return;
+  char buf[16384];
+  ssize_t n;
+  while ((n = ::recv(m_scrape.fd, buf, sizeof(buf), 0)) > 0)
+    m_scrape.response.append(buf, (size_t)n);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+  ::close(m_scrape.fd);
+  m_scrape.fd = -1;
+  unsigned long now = nowUs();
+  std::string text = "\n" + m_scrape.response;
+  Sample s;
+  s.resident = metric(text, "selfserv_resident_memory_bytes");
+  s.buffered = metric(text, "selfserv_buffered_bytes");
+  s.lagMs = metric(text, "selfserv_event_loop_lag_seconds");
+  if (s.lagMs >= 0) s.lagMs *= 1000;
+  s.scrapeMs = (double)(now - m_scrape.startUs) / 1000;
+  Report(s, now);
+}
+
+void Harness::Check(double value, double limit, const char *what) {
+  if (limit <= 0 || value <= limit) return;
+  if (!m_failed)
+    std::fprintf(stderr, "slowclients: %s %g over the limit %g\n", what,
+                 value, limit);
+  m_failed = true;
+}
+
+void Harness::Report(const Sample &s, unsigned long now) {
+  char cells[4][32];
+  formatSample(s, cells);
+  std::printf("%7.1f %6lu %8lu %7lu %6lu %9s %12s %8s %9s\n",
+              (double)(now - m_startUs) / 1e6, (unsigned long)m_open,
+              m_totals.completed, m_totals.resets, m_totals.errors, cells[0],
+              cells[1], cells[2], cells[3]);
+  std::fflush(stdout);
+  m_peak.resident = std::max(m_peak.resident, s.resident);
+  m_peak.buffered = std::max(m_peak.buffered, s.buffered);
+  m_peak.lagMs = std::max(m_peak.lagMs, s.lagMs);
+  m_peak.scrapeMs = std::max(m_peak.scrapeMs, s.scrapeMs);
+  Check(s.resident, m_opt.maxResident, "resident memory");
+  Check(s.buffered, m_opt.maxBuffered, "buffered bytes");
+  Check(s.lagMs, m_opt.maxLagMs, "loop lag (ms)");
+}
+
+void Harness::Run() {
+  std::signal(SIGPIPE, SIG_IGN);
+  m_startUs = nowUs();
+  m_open = 0;
+  unsigned long endUs = m_startUs + (unsigned long)(m_opt.seconds * 1e6);
+  unsigned long intervalUs = (unsigned long)(m_opt.interval * 1e6);
+  unsigned long nextSampleUs = m_startUs + intervalUs;
+  std::printf("%7s %6s %8s %7s %6s %9s %12s %8s %9s\n", "t(s)", "open",
+              "complete", "resets", "errors", "rss(MiB)", "buffered(KiB)",
+              "lag(ms)", "scrape(ms)");
+  std::vector<struct pollfd> pfds;
+  std::vector<size_t> owners;
+  for (;;) {
+    unsigned long now = nowUs();
+    if (now >= endUs) break;
+    if (now >= nextSampleUs) {
+      StartScrape(now);
+      nextSampleUs += intervalUs;
+    }
+    unsigned long wakeUs = std::min(endUs, nextSampleUs);
+    pfds.clear();
+    owners.clear();
+    size_t burst = 0;
+    for (size_t i = 0; i < m_clients.size(); ++i) {
+      Client &c = m_clients[i];
+      if (c.fd < 0) {
+        if (burst++ >= kConnectBurst) {
+          wakeUs = now;
+          continue;
+        }
+        Connect(c, now);
+        if (c.fd < 0) continue;
+      }
+      struct pollfd p;
+      p.fd = c.fd;
+      p.events = 0;
+      p.revents = 0;
+      if (c.connecting) {
+        p.events = POLLOUT;
+      } else {
+        Write(c, now, wakeUs);
+        if (c.fd < 0) continue;
+        if (c.sent < m_request.size() && c.nextWriteUs <= now)
+          p.events |= POLLOUT;
+        if (ReadAllowed(c, now, wakeUs)) p.events |= POLLIN;
+      }
+      pfds.push_back(p);
+      owners.push_back(i);
+    }
+    if (m_scrape.fd >= 0) {
+      struct pollfd p;
+      p.fd = m_scrape.fd;
+      p.events = POLLIN;
+      if (m_scrape.sent < m_scrape.request.size()) p.events |= POLLOUT;
+      p.revents = 0;
+      pfds.push_back(p);
+      owners.push_back(m_clients.size());
+    }
+    int timeoutMs = wakeUs <= now ? 0 : (int)((wakeUs - now + 999) / 1000);
+    if (::poll(pfds.empty() ? 0 : &pfds[0], pfds.size(), timeoutMs) < 0 &&
+        errno != EINTR)
+      break;
+    now = nowUs();
+    for (size_t k = 0; k < pfds.size(); ++k) {
+      short ev = pfds[k].revents;
+      if (!ev) continue;
+      if (owners[k] == m_clients.size()) {
+        ServeScrape(ev);
+        continue;
+      }
+      Client &c = m_clients[owners[k]];
+      if (c.connecting) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        ::getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err) {
+          ++m_totals.errors;
+          Close(c, false);
+          continue;
+        }
+        c.connecting = false;
+        c.refillUs = now;
+        continue;
+      }
+      if (ev & (POLLIN | POLLHUP | POLLERR)) Read(c);
+    }
+  }
+  for (size_t i = 0; i < m_clients.size(); ++i)
+    if (m_clients[i].fd >= 0) Close(m_clients[i], false);
+  if (m_scrape.fd >= 0) ::close(m_scrape.fd);
+}
+
+int usage() {
+  std::cerr << "usage: slowclients [-n <connections>] [-u <path>] "
+               "[-b <body bytes>] [-r <read bytes/s>] [-q <receive buffer>] "
+               "[-w <write bytes/s>] [-k <piece bytes>] [-x <reset %>] "
+               "[-d <seconds>] [-i <seconds>] [-m <stats path>] "
+               "[-R <max rss>] [-B <max buffered>] [-L <max lag ms>] "
+               "<host> <port>\n";
+  return 2;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options opt;
+  int arg = 1;
+  for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+    std::string o = argv[arg];
+    const char *value = argv[arg + 1];
+    if (o == "-n")
+      opt.connections = (size_t)std::atol(value);
+    else if (o == "-u")
+      opt.path = value;
+    else if (o == "-b")
+      opt.bodyBytes = (size_t)std::atol(value);
+    else if (o == "-r")
+      opt.readRate = std::atof(value);
+    else if (o == "-q")
+      opt.receiveBuffer = std::atoi(value);
+    else if (o == "-w")
+      opt.writeRate = std::atof(value);
+    else if (o == "-k")
+      opt.piece = (size_t)std::atol(value);
+    else if (o == "-x")
+      opt.resetPercent = std::atoi(value);
+    else if (o == "-d")
+      opt.seconds = std::atof(value);
+    else if (o == "-i")
+      opt.interval = std::atof(value);
+    else if (o == "-m")
+      opt.metricsPath = value;
+    else if (o == "-R")
+      opt.maxResident = std::atof(value);
+    else if (o == "-B")
+      opt.maxBuffered = std::atof(value);
+    else if (o == "-L")
+      opt.maxLagMs = std::atof(value);
+    else
+      return usage();
+  }
+  if (argc - arg != 2 || opt.connections == 0 || opt.piece == 0 ||
+      opt.seconds <= 0 || opt.interval <= 0)
+    return usage();
+  struct addrinfo hints, *addr = 0;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_socktype = SOCK_STREAM;
+  int rc = ::getaddrinfo(argv[arg], argv[arg + 1], &hints, &addr);
+  if (rc != 0) {
+    std::cerr << "slowclients: " << argv[arg] << ": " << gai_strerror(rc)
+              << "\n";
+    return 1;
+  }
+  std::srand((unsigned)::getpid());
+
+  Harness harness(opt, addr, argv[arg]);
+  harness.Run();
+  ::freeaddrinfo(addr);
+
+  const Totals &totals = harness.Result();
+  std::printf("connections %lu opened, %lu complete, %lu empty, %lu reset, "
+              "%lu errors\n",
+              totals.opened, totals.completed, totals.empty, totals.resets,
+              totals.errors);
+  std::printf("status      1xx %lu  2xx %lu  3xx %lu  4xx %lu  5xx %lu\n",
+              totals.classes[1], totals.classes[2], totals.classes[3],
+              totals.classes[4], totals.classes[5]);
+  std::printf("bytes       %lu sent, %lu received\n", totals.bytesOut,
+              totals.bytesIn);
+  char cells[4][32];
+  formatSample(harness.Peak(), cells);
+  std::printf("peak        rss %s MiB, buffered %s KiB, loop lag %s ms, "
+              "scrape %s ms\n",
+              cells[0], cells[1], cells[2], cells[3]);
+  return harness.Failed() ? 1 : 0;
+}
@@ -0,0 +1,97 @@
+#include <string>
+#include <iostream>
+
+#include "server/CachePolicy.hpp"
+
+#ifdef __has_include
+# if __has_include(<criterion/criterion.h>)
+#  define HAVE_CRITERION 1
+# endif
+#endif
+
+#ifdef HAVE_CRITERION
+#include <criterion/criterion.h>
+#endif
+
+static void cache_policy_fingerprint_impl() {
+  const char *yes[] = {"app.3f9a2c.js", "/www/static/main-1a2b3c4d.css",
+                       "chunk.vendor.0f1e2d3c4b.min.js", "logo.ABCDEF12.svg"};
+  const char *no[] = {"app.js",          "app.min.js",
+                      "jquery-3.6.0.js", "report-20240101.pdf",
+                      "deadbeef01.png",  "/a.3f9a2c/app.js",
+                      "app.3f9a2",       "app.facade.js",
+                      "app.3f9a2c"};
+  for (size_t i = 0; i < sizeof(yes) / sizeof(yes[0]); ++i) {
+    if (!IsFingerprinted(yes[i]))
+      std::cerr << "FAIL not fingerprinted " << yes[i] << std::endl;
+  }
+  for (size_t i = 0; i < sizeof(no) / sizeof(no[0]); ++i) {
+    if (IsFingerprinted(no[i]))
+      std::cerr << "FAIL fingerprinted " << no[i] << std::endl;
+  }
+  if (HttpDate(784111777) != "Sun, 06 Nov 1994 08:49:37 GMT")
+    std::cerr << "FAIL date " << HttpDate(784111777) << std::endl;
+}
+
+static void expectHeaders(const char *expires, const char *cacheControl,
+                          bool immutable, const char *path,
+                          const std::string &want) {
+  RouteConfig route;
+  route.path = "/";
+  route.expires = expires;
+  route.cacheControl = cacheControl;
+  route.immutableAssets = immutable;
+  CachePolicy policy;
+  std::string error;
+  if (!policy.Compile(route, error)) {
+    std::cerr << "FAIL compile " << expires << " " << error << std::endl;
+    return;
+  }
+  std::string got = policy.Headers(path, 1000);
+  if (got != want)
+    std::cerr << "FAIL " << expires << "/" << cacheControl << " " << path
+              << ": " << got << std::endl;
+}
+
+static void cache_policy_headers_impl() {
+  const std::string immutable =
+      "Cache-Control: public, max-age=31536000, immutable\r\n";
+  expectHeaders("", "", true, "index.html", "");
+  expectHeaders("", "", true, "app.3f9a2c.js", immutable);
+  expectHeaders("", "", false, "app.3f9a2c.js", "");
+  expectHeaders("1h", "public", true, "app.3f9a2c.js", immutable);
+  expectHeaders("1h", "public", true, "index.html",
+                "Cache-Control: public, max-age=3600\r\n"
+                "Expires: Thu, 01 Jan 1970 01:16:40 GMT\r\n");
+  expectHeaders("90", "", true, "a.css",
+                "Cache-Control: max-age=90\r\n"
+                "Expires: Thu, 01 Jan 1970 00:18:10 GMT\r\n");
+  expectHeaders("epoch", "", true, "a.css",
+                "Cache-Control: no-cache\r\n"
+                "Expires: Thu, 01 Jan 1970 00:00:01 GMT\r\n");
+  expectHeaders("off", "no-cache,,must-revalidate", true, "a.css",
+                "Cache-Control: no-cache, must-revalidate\r\n");
+
+  const char *bad[][2] = {{"1y", ""}, {"h", ""}, {"10hh", ""},
+                          {"99999999999", ""}, {"1d", "max-age=60"}};
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+    RouteConfig route;
+    route.expires = bad[i][0];
+    route.cacheControl = bad[i][1];
+    CachePolicy policy;
+    std::string error;
+    if (policy.Compile(route, error))
+      std::cerr << "FAIL accepted " << bad[i][0] << std::endl;
+  }
+}
+
+#ifdef HAVE_CRITERION
+Test(CachePolicy, fingerprint) { cache_policy_fingerprint_impl(); }
+Test(CachePolicy, headers) { cache_policy_headers_impl(); }
+#else
+int main() {
+  cache_policy_fingerprint_impl();
+  cache_policy_headers_impl();
+  return 0;
+}
+#endif
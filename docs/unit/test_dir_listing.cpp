@@ -0,0 +1,215 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <iostream>
+
+#include "server/DirListing.hpp"
+
+#ifdef __has_include
+# if __has_include(<criterion/criterion.h>)
+#  define HAVE_CRITERION 1
+# endif
+#endif
+
+#ifdef HAVE_CRITERION
+#include <criterion/criterion.h>
+#endif
+
+static std::string makeDir() {
+  char tmpl[] = "/tmp/test_dir_listing.XXXXXX";
+  return ::mkdtemp(tmpl) ? tmpl : "";
+}
+
+static void touch(const std::string &path, size_t size) {
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return;
+  std::string data(size, 'x');
+  if (size) ::write(fd, data.data(), size);
+  ::close(fd);
+}
+
+static void setMtime(const std::string &path, time_t sec) {
+  struct timespec times[2];
+  times[0].tv_sec = sec;
+  times[0].tv_nsec = 0;
+  times[1] = times[0];
+  ::utimensat(AT_FDCWD, path.c_str(), times, 0);
+}
+
+static void removeTree(const std::string &dir) {
+  std::string cmd = "rm -rf '" + dir + "'";
+  if (std::system(cmd.c_str()) != 0)
+    std::cerr << "FAIL cleanup " << dir << std::endl;
+}
+
+static std::string render(const DirSnapshot &snap,
+                          const DirListingOptions &opts) {
+  DirListingWriter writer(snap, opts, "/files/", false);
+  std::string out;
+  while (writer.Next(out, 1 << 20)) {
+  }
+  return out;
+}
+
+static void dir_snapshot_impl() {
+  std::string dir = makeDir();
+  touch(dir + "/a", 1);
+  touch(dir + "/b", 2);
+  setMtime(dir, 1000000000);
+  DirListingCache cache;
+  DirSnapshot first, again;
+  if (!cache.Get(dir, true, first) || first.Size() != 2 ||
+      !first.HasStat() || !cache.Get(dir, true, again) ||
+      &again.At(0) != &first.At(0))
+    std::cerr << "FAIL snapshot reuse" << std::endl;
+  // A snapshot with stat info also serves a request without
+  DirSnapshot bare;
+  if (!cache.Get(dir, false, bare) || &bare.At(0) != &first.At(0))
+    std::cerr << "FAIL snapshot reuse without stat" << std::endl;
+
+  // A new entry changes the mtime; the old snapshot stays usable
+  touch(dir + "/c", 3);
+  setMtime(dir, 1000000001);
+  DirSnapshot changed;
+  if (!cache.Get(dir, true, changed) || changed.Size() != 3 ||
+      first.Size() != 2 || first.At(0).name.empty())
+    std::cerr << "FAIL snapshot after new entry" << std::endl;
+  // Only the mtime is compared, so a touch alone also re-reads
+  setMtime(dir, 1000000002);
+  DirSnapshot touched;
+  if (!cache.Get(dir, true, touched) || &touched.At(0) == &changed.At(0))
+    std::cerr << "FAIL snapshot after mtime change" << std::endl;
+
+  // A stat-less snapshot is replaced when stat info is wanted
+  std::string other = makeDir();
+  touch(other + "/x", 10);
+  DirSnapshot plain, full;
+  if (!cache.Get(other, false, plain) || plain.HasStat() ||
+      !cache.Get(other, true, full) || !full.HasStat() ||
+      full.At(0).size != 10)
+    std::cerr << "FAIL stat upgrade" << std::endl;
+
+  // Least recently used directories go once the entry budget is spent
+  DirListingCache small(3);
+  DirSnapshot s1, s2, s3;
+  small.Get(dir, false, s1);
+  small.Get(other, false, s2);
+  small.Get(dir, false, s3);
+  if (&s3.At(0) == &s1.At(0))
+    std::cerr << "FAIL eviction" << std::endl;
+  if (cache.Get(dir + "/missing", false, s1))
+    std::cerr << "FAIL missing directory" << std::endl;
+  removeTree(dir);
+  removeTree(other);
+}
+
+static void dir_slices_impl() {
+  std::string dir = makeDir();
+  for (int i = 0; i < 300; ++i) {
+    char name[32];
+    std::sprintf(name, "/file-%03d.txt", i);
+    touch(dir + name, (size_t)i);
+  }
+  ::mkdir((dir + "/zdir").c_str(), 0755);
+  DirListingCache cache;
+  DirSnapshot snap;
+  cache.Get(dir, true, snap);
+  DirListingOptions opts;
+  std::string whole = render(snap, opts);
+  if (whole.find("zdir/") > whole.find("file-000.txt"))
+    std::cerr << "FAIL directories first" << std::endl;
+
+  // No slice grows past the budget by more than one row
+  const size_t kBudget = 512;
+  const size_t kMaxRow = 200;
+  DirListingWriter writer(snap, opts, "/files/", false);
+  std::string joined;
+  size_t slices = 0;
+  bool more = true;
+  while (more) {
+    std::string slice;
+    more = writer.Next(slice, kBudget);
+    if (slice.size() > kBudget + kMaxRow)
+      std::cerr << "FAIL slice of " << slice.size() << std::endl;
+    joined += slice;
+    ++slices;
+  }
+  if (joined != whole || slices < whole.size() / (kBudget + kMaxRow))
+    std::cerr << "FAIL slices " << slices << std::endl;
+
+  // Chunked output frames each slice and ends with the last chunk
+  DirListingWriter chunked(snap, opts, "/files/", true);
+  std::string framed;
+  while (chunked.Next(framed, kBudget)) {
+  }
+  std::string unframed;
+  size_t pos = 0;
+  for (;;) {
+    size_t len = std::strtoul(framed.c_str() + pos, 0, 16);
+    pos = framed.find("\r\n", pos) + 2;
+    if (!len) break;
+    unframed += framed.substr(pos, len);
+    pos += len + 2;
+  }
+  if (unframed != whole || framed.compare(framed.size() - 5, 5, "0\r\n\r\n"))
+    std::cerr << "FAIL chunked framing" << std::endl;
+
+  // Pages select a window of the sorted order; zdir opens the first one
+  ParseDirListingQuery("format=json&sort=size&order=desc&page=2&limit=10",
+                       opts);
+  std::string page = render(snap, opts);
+  if (page.find("\"total\":301,\"page\":2,\"limit\":10") ==
+          std::string::npos ||
+      page.find("[{\"name\":\"file-290.txt\"") == std::string::npos ||
+      page.find("file-291.txt") != std::string::npos ||
+      page.find("file-280.txt") != std::string::npos)
+    std::cerr << "FAIL page:\n" << page << std::endl;
+  opts.page = 1000;
+  if (render(snap, opts).find("\"entries\":[]}") == std::string::npos)
+    std::cerr << "FAIL page past the end" << std::endl;
+  removeTree(dir);
+}
+
+static void dir_escaping_impl() {
+  std::string dir = makeDir();
+  touch(dir + "/quote\"back\\slash", 0);
+  touch(dir + "/ctl\x01tab\t", 0);
+  touch(dir + "/<b>&amp; x.html", 0);
+  DirListingCache cache;
+  DirSnapshot snap;
+  cache.Get(dir, false, snap);
+  DirListingOptions opts;
+  opts.json = true;
+  opts.withStat = false;
+  std::string json = render(snap, opts);
+  if (json.find("\"name\":\"quote\\\"back\\\\slash\"") == std::string::npos ||
+      json.find("\"name\":\"ctl\\u0001tab\\u0009\"") == std::string::npos ||
+      json.find("\"name\":\"<b>&amp; x.html\"") == std::string::npos ||
+      json.find("\"size\"") != std::string::npos)
+    std::cerr << "FAIL json escaping:\n" << json << std::endl;
+  opts.json = false;
+  std::string html = render(snap, opts);
+  if (html.find("href=\"/files/%3Cb%3E%26amp%3B%20x.html\"") ==
+          std::string::npos ||
+      html.find(">&lt;b&gt;&amp;amp; x.html</a>") == std::string::npos ||
+      html.find("<b>") != std::string::npos)
+    std::cerr << "FAIL html escaping:\n" << html << std::endl;
+  removeTree(dir);
+}
+
+#ifdef HAVE_CRITERION
+Test(DirListing, snapshots) { dir_snapshot_impl(); }
+Test(DirListing, slices) { dir_slices_impl(); }
+Test(DirListing, escaping) { dir_escaping_impl(); }
+#else
+int main() {
+  dir_snapshot_impl();
+  dir_slices_impl();
+  dir_escaping_impl();
+  return 0;
+}
+#endif
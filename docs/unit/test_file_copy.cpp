@@ -0,0 +1,123 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "server/FileCopy.hpp"
+
+#ifdef __has_include
+# if __has_include(<criterion/criterion.h>)
+#  define HAVE_CRITERION 1
+# endif
+#endif
+
+#ifdef HAVE_CRITERION
+#include <criterion/criterion.h>
+#endif
+
+static void check(bool ok, const char *what) {
+  if (!ok) std::cerr << "FAIL " << what << std::endl;
+}
+
+static void writeFile(const std::string &path, const std::string &data) {
+  FILE *f = std::fopen(path.c_str(), "wb");
+  if (!f) return;
+  std::fwrite(data.data(), 1, data.size(), f);
+  std::fclose(f);
+}
+
+static std::string readAll(const std::string &path) {
+  std::string out;
+  FILE *f = std::fopen(path.c_str(), "rb");
+  if (!f) return out;
+  char buf[256];
+  size_t n;
+  while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0) out.append(buf, n);
+  std::fclose(f);
+  return out;
+}
+
+static void file_copy_range_impl() {
+  char dir[] = "/tmp/file_copy_XXXXXX";
+  if (!mkdtemp(dir)) return;
+  std::string a = std::string(dir) + "/a", b = std::string(dir) + "/b";
+  writeFile(a, "0123456789");
+  int in = open(a.c_str(), O_RDONLY);
+  int out = open(b.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  off_t from = 2, to = 0;
+  check(CopyFileBytes(in, from, out, to, 5) == 5 && from == 7 && to == 5,
+        "offsets advance");
+  close(in);
+  close(out);
+  check(readAll(b) == "23456", "copied range");
+  std::remove(a.c_str());
+  std::remove(b.c_str());
+  rmdir(dir);
+}
+
+static void file_copy_rename_impl() {
+  char dir[] = "/tmp/file_rename_XXXXXX";
+  if (!mkdtemp(dir)) return;
+  std::string a = std::string(dir) + "/a", b = std::string(dir) + "/b";
+  std::string c = std::string(dir) + "/c";
+  writeFile(a, "one");
+  writeFile(b, "two");
+  check(RenameFile(a, b, false) == 412 && readAll(b) == "two", "no replace");
+  check(RenameFile(a, c, false) == 201 && readAll(c) == "one", "created");
+  check(RenameFile(c, b, true) == 204 && readAll(b) == "one", "replaced");
+  check(RenameFile(b, std::string(dir) + "/x/y", true) == 409, "no dir");
+
+  std::vector<std::string> sources;
+  sources.push_back(b);
+  sources.push_back(b);
+  FileAssembly copy;
+  check(copy.Begin(sources, a, false) == 0, "begin");
+  while (copy.Step(1)) {
+  }
+  check(copy.Finish() == 201 && readAll(a) == "oneone", "assembled");
+  FileAssembly again;
+  again.Begin(sources, a, false);
+  while (again.Step(1 << 20)) {
+  }
+  check(again.Finish() == 412 && readAll(a) == "oneone", "kept target");
+  std::remove(a.c_str());
+  std::remove(b.c_str());
+  check(rmdir(dir) == 0, "temporaries removed");
+}
+
+static void file_copy_destination_impl() {
+  std::string authority, path;
+  check(ParseDestination("/up/a%20b/../c", authority, path) &&
+            authority.empty() && path == "/up/c",
+        "origin-form destination");
+  check(ParseDestination("http://example.com:8080/up/c?x", authority, path) &&
+            authority == "example.com:8080" && path == "/up/c",
+        "absolute destination");
+  check(ParseDestination("https://example.com/", authority, path) &&
+            authority == "example.com" && path == "/",
+        "https destination");
+  const char *bad[] = {"*", "", "up/c", "http://example.com",
+                       "https://", "http:///up/c", "http://host?x/up/c",
+                       "ftp://example.com/up/c", "/up/%zz", "/../c"};
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i)
+    if (ParseDestination(bad[i], authority, path))
+      std::cerr << "FAIL accepted destination " << bad[i] << std::endl;
+}
+
+#ifdef HAVE_CRITERION
+Test(FileCopy, range) { file_copy_range_impl(); }
+Test(FileCopy, rename) { file_copy_rename_impl(); }
+Test(FileCopy, destination) { file_copy_destination_impl(); }
+#else
+int main() {
+  file_copy_range_impl();
+  file_copy_rename_impl();
+  file_copy_destination_impl();
+  return 0;
+}
+#endif
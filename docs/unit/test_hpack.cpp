@@ -0,0 +1,278 @@
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "http/Hpack.hpp"
+
+#ifdef __has_include
+# if __has_include(<criterion/criterion.h>)
+#  define HAVE_CRITERION 1
+# endif
+#endif
+
+#ifdef HAVE_CRITERION
+#include <criterion/criterion.h>
+#endif
+
+static std::string fromHex(const char *hex) {
+  std::string out;
+  for (size_t i = 0; hex[i] && hex[i + 1]; i += 2) {
+    unsigned int byte = 0;
+    for (size_t j = 0; j < 2; ++j) {
+      char c = hex[i + j];
+      byte = byte * 16 + (c <= '9' ? c - '0' : c - 'a' + 10);
+    }
+    out += static_cast<char>(byte);
+  }
+  return out;
+}
+
+static std::string toHex(const std::string &bytes) {
+  static const char kDigits[] = "0123456789abcdef";
+  std::string out;
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    unsigned char c = static_cast<unsigned char>(bytes[i]);
+    out += kDigits[c >> 4];
+    out += kDigits[c & 15];
+  }
+  return out;
+}
+
+// Fields as "name: value" lines, the layout of RFC 7541 Appendix C
+static std::string render(const std::vector<HttpHeader> &fields) {
+  std::string out;
+  for (size_t i = 0; i < fields.size(); ++i)
+    out += fields[i].name + ": " + fields[i].value + "\n";
+  return out;
+}
+
+static std::vector<HttpHeader> parseFields(const char *lines) {
+  std::vector<HttpHeader> fields;
+  std::string text = lines;
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t eol = text.find('\n', pos);
+    // Pseudo-header names start with ':', so split after the first byte
+    size_t colon = text.find(": ", pos + 1);
+    HttpHeader h;
+    h.name = text.substr(pos, colon - pos);
+    h.value = text.substr(colon + 2, eol - colon - 2);
+    fields.push_back(h);
+    pos = eol + 1;
+  }
+  return fields;
+}
+
+struct Block {
+  const char *hex;
+  const char *fields;
+};
+
+static const char kRequest1[] =
+    ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n";
+static const char kRequest2[] =
+    ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n"
+    "cache-control: no-cache\n";
+static const char kRequest3[] =
+    ":method: GET\n:scheme: https\n:path: /index.html\n"
+    ":authority: www.example.com\ncustom-key: custom-value\n";
+static const char kResponse1[] =
+    ":status: 302\ncache-control: private\n"
+    "date: Mon, 21 Oct 2013 20:13:21 GMT\n"
+    "location: https://www.example.com\n";
+static const char kResponse2[] =
+    ":status: 307\ncache-control: private\n"
+    "date: Mon, 21 Oct 2013 20:13:21 GMT\n"
+    "location: https://www.example.com\n";
+static const char kResponse3[] =
+    ":status: 200\ncache-control: private\n"
+    "date: Mon, 21 Oct 2013 20:13:22 GMT\n"
+    "location: https://www.example.com\ncontent-encoding: gzip\n"
+    "set-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1\n";
+
+// RFC 7541 C.3 (requests, plain literals)
+static const Block kC3[] = {
+    {"828684410f7777772e6578616d706c652e636f6d", kRequest1},
+    {"828684be58086e6f2d6361636865", kRequest2},
+    {"828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565",
+     kRequest3},
+};
+
+// RFC 7541 C.4 (requests, Huffman)
+static const Block kC4[] = {
+    {"828684418cf1e3c2e5f23a6ba0ab90f4ff", kRequest1},
+    {"828684be5886a8eb10649cbf", kRequest2},
+    {"828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf", kRequest3},
+};
+
+// RFC 7541 C.5 (responses, plain literals, 256-byte table)
+static const Block kC5[] = {
+    {"4803333032580770726976617465611d4d6f6e2c203231204f63742032303133"
+     "2032303a31333a323120474d546e1768747470733a2f2f7777772e6578616d70"
+     "6c652e636f6d",
+     kResponse1},
+    {"4803333037c1c0bf", kResponse2},
+    {"88c1611d4d6f6e2c203231204f637420323031332032303a31333a323220474d"
+     "54c05a04677a69707738666f6f3d4153444a4b48514b425a584f5157454f5049"
+     "5541585157454f49553b206d61782d6167653d333630303b2076657273696f6e"
+     "3d31",
+     kResponse3},
+};
+
+// RFC 7541 C.6 (responses, Huffman, 256-byte table)
+static const Block kC6[] = {
+    {"488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e082a6"
+     "2d1bff6e919d29ad171863c78f0b97c8e9ae82ae43d3",
+     kResponse1},
+    {"4883640effc1c0bf", kResponse2},
+    {"88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839bd9ab"
+     "77ad94e7821dd7f2e6c7b335dfdfcd5b3960d5af27087f3672c1ab270fb5291f"
+     "9587316065c003ed4ee5b1063d5007",
+     kResponse3},
+};
+
+static void decodeSequence(const char *name, const Block *blocks,
+                           size_t count, size_t tableSize) {
+  HpackDecoder decoder;
+  decoder.SetMaxTableSize(tableSize);
+  for (size_t i = 0; i < count; ++i) {
+    std::vector<HttpHeader> fields;
+    if (!decoder.Decode(fromHex(blocks[i].hex), fields) ||
+        render(fields) != blocks[i].fields)
+      std::cerr << "FAIL " << name << "." << i + 1 << ":\n"
+                << render(fields) << std::endl;
+  }
+}
+
+static void hpack_decode_impl() {
+  // C.2: one representation of each kind
+  const Block single[] = {
+      {"400a637573746f6d2d6b65790d637573746f6d2d686561646572",
+       "custom-key: custom-header\n"},
+      {"040c2f73616d706c652f70617468", ":path: /sample/path\n"},
+      {"100870617373776f726406736563726574", "password: secret\n"},
+      {"82", ":method: GET\n"},
+  };
+  for (size_t i = 0; i < sizeof(single) / sizeof(single[0]); ++i) {
+    HpackDecoder decoder;
+    std::vector<HttpHeader> fields;
+    if (!decoder.Decode(fromHex(single[i].hex), fields) ||
+        render(fields) != single[i].fields)
+      std::cerr << "FAIL C.2." << i + 1 << std::endl;
+  }
+  // Later blocks index entries added (and, at 256 bytes, evicted) by earlier
+  // ones, so each sequence shares one decoder
+  decodeSequence("C.3", kC3, 3, 4096);
+  decodeSequence("C.4", kC4, 3, 4096);
+  decodeSequence("C.5", kC5, 3, 256);
+  decodeSequence("C.6", kC6, 3, 256);
+}
+
+static void hpack_encode_impl() {
+  // Huffman whenever shorter and incremental indexing reproduce C.4 exactly
+  HpackEncoder encoder;
+  for (size_t i = 0; i < 3; ++i) {
+    std::string block;
+    encoder.Encode(parseFields(kC4[i].fields), block);
+    if (toHex(block) != kC4[i].hex)
+      std::cerr << "FAIL encode C.4." << i + 1 << ": " << toHex(block)
+                << std::endl;
+  }
+  // Responses keep date and location out of the table, so only the round
+  // trip is fixed; a shrunken table is announced at the start of the block
+  HpackEncoder responses;
+  HpackDecoder decoder;
+  const char *sequence[] = {kResponse1, kResponse2, kResponse3, kResponse3};
+  for (size_t i = 0; i < 4; ++i) {
+    if (i == 2) responses.SetMaxTableSize(256);
+    std::string block;
+    responses.Encode(parseFields(sequence[i]), block);
+    if (i == 2 && block[0] != '\x3f')
+      std::cerr << "FAIL size update: " << toHex(block) << std::endl;
+    std::vector<HttpHeader> fields;
+    if (!decoder.Decode(block, fields) || render(fields) != sequence[i])
+      std::cerr << "FAIL response round trip " << i << std::endl;
+  }
+}
+
+static void hpack_huffman_impl() {
+  HpackDecoder decoder;
+  std::vector<HttpHeader> fields;
+  // 'a' is 00011; the final byte is padded with ones
+  if (!decoder.Decode(fromHex("04811f"), fields) ||
+      render(fields) != ":path: a\n")
+    std::cerr << "FAIL huffman single symbol" << std::endl;
+  const char *bad[] = {
+      "048118",      // padding that is not a prefix of EOS
+      "04821fff",    // more than seven bits of padding
+      "0484ffffffff",  // EOS inside the string
+      "0482ffff",    // incomplete code cut off by the end of the string
+  };
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+    HpackDecoder fresh;
+    if (fresh.Decode(fromHex(bad[i]), fields))
+      std::cerr << "FAIL huffman accepted " << bad[i] << std::endl;
+  }
+  // Every byte value, including those with 30-bit codes, survives both the
+  // Huffman and the plain forms
+  std::string all;
+  for (int c = 0; c < 256; ++c) all += static_cast<char>(c);
+  std::vector<HttpHeader> in(2);
+  in[0].name = "x-bytes";
+  in[0].value = all;
+  in[1].name = "x-text";
+  in[1].value = "www.example.com/some/longer/path?query=value";
+  HpackEncoder encoder;
+  HpackDecoder back;
+  std::string block;
+  encoder.Encode(in, block);
+  fields.clear();
+  if (!back.Decode(block, fields) || fields.size() != 2 ||
+      fields[0].value != all || fields[1].value != in[1].value)
+    std::cerr << "FAIL huffman round trip" << std::endl;
+}
+
+static void hpack_reject_impl() {
+  const char *bad[] = {
+      "be",              // dynamic index beyond an empty table
+      "80",              // index zero
+      "ffffffffffff7f",  // integer past the 2^28 cap
+      "3fe21f",          // size update above SETTINGS_HEADER_TABLE_SIZE
+      "8220",            // size update after a field
+      "400a6375",        // literal shorter than its length
+      "04",              // literal without its value
+  };
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+    HpackDecoder decoder;
+    std::vector<HttpHeader> fields;
+    if (decoder.Decode(fromHex(bad[i]), fields))
+      std::cerr << "FAIL accepted " << bad[i] << std::endl;
+  }
+  HpackDecoder decoder;
+  std::vector<HttpHeader> fields;
+  if (!decoder.Decode(fromHex("3fe11f"), fields))
+    std::cerr << "FAIL size update at the limit" << std::endl;
+  // An entry larger than the table empties it instead of being added
+  HpackTable table;
+  table.SetMaxSize(64);
+  table.Add("a", "b");
+  table.Add("long-name", std::string(40, 'v'));
+  std::string name, value;
+  if (table.Lookup(62, name, value))
+    std::cerr << "FAIL oversized entry kept " << name << std::endl;
+}
+
+#ifdef HAVE_CRITERION
+Test(Hpack, decode_appendix_c) { hpack_decode_impl(); }
+Test(Hpack, encode) { hpack_encode_impl(); }
+Test(Hpack, huffman) { hpack_huffman_impl(); }
+Test(Hpack, reject) { hpack_reject_impl(); }
+#else
+int main() {
+  hpack_decode_impl();
+  hpack_encode_impl();
+  hpack_huffman_impl();
+  hpack_reject_impl();
+  return 0;
+}
+#endif
@@ -0,0 +1,335 @@
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "http/Http2Session.hpp"
+
+#ifdef __has_include
+# if __has_include(<criterion/criterion.h>)
+#  define HAVE_CRITERION 1
+# endif
+#endif
+
+#ifdef HAVE_CRITERION
+#include <criterion/criterion.h>
+#endif
+
+static const char kPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+enum {
+  kData = 0x0,
+  kHeaders = 0x1,
+  kRstStream = 0x3,
+  kSettings = 0x4,
+  kPushPromise = 0x5,
+  kPing = 0x6,
+  kGoAway = 0x7,
+  kWindowUpdate = 0x8,
+  kContinuation = 0x9
+};
+
+struct Frame {
+  unsigned char type;
+  unsigned char flags;
+  uint32_t stream;
+  std::string payload;
+};
+
+static std::string u32(uint32_t v) {
+  std::string out;
+  out += static_cast<char>(v >> 24);
+  out += static_cast<char>((v >> 16) & 0xff);
+  out += static_cast<char>((v >> 8) & 0xff);
+  out += static_cast<char>(v & 0xff);
+  return out;
+}
+
+static uint32_t readU32(const std::string &s, size_t pos) {
+  return (static_cast<uint32_t>(static_cast<unsigned char>(s[pos])) << 24) |
+         (static_cast<uint32_t>(static_cast<unsigned char>(s[pos + 1]))
+          << 16) |
+         (static_cast<uint32_t>(static_cast<unsigned char>(s[pos + 2]))
+          << 8) |
+         static_cast<uint32_t>(static_cast<unsigned char>(s[pos + 3]));
+}
+
+static std::string frame(unsigned char type, unsigned char flags,
+                         uint32_t stream, const std::string &payload) {
+  std::string out;
+  size_t len = payload.size();
+  out += static_cast<char>((len >> 16) & 0xff);
+  out += static_cast<char>((len >> 8) & 0xff);
+  out += static_cast<char>(len & 0xff);
+  out += static_cast<char>(type);
+  out += static_cast<char>(flags);
+  out += u32(stream);
+  return out + payload;
+}
+
+static std::string setting(unsigned id, uint32_t value) {
+  std::string out;
+  out += static_cast<char>(id >> 8);
+  out += static_cast<char>(id & 0xff);
+  return out + u32(value);
+}
+
+static std::vector<Frame> parseFrames(const std::string &bytes) {
+  std::vector<Frame> frames;
+  size_t pos = 0;
+  while (bytes.size() - pos >= 9) {
+    size_t len = (static_cast<size_t>(static_cast<unsigned char>(bytes[pos]))
+                  << 16) |
+                 (static_cast<size_t>(static_cast<unsigned char>(
+                      bytes[pos + 1])) << 8) |
+                 static_cast<unsigned char>(bytes[pos + 2]);
+    Frame f;
+    f.type = static_cast<unsigned char>(bytes[pos + 3]);
+    f.flags = static_cast<unsigned char>(bytes[pos + 4]);
+    f.stream = readU32(bytes, pos + 5) & 0x7fffffffu;
+    f.payload = bytes.substr(pos + 9, len);
+    frames.push_back(f);
+    pos += 9 + len;
+  }
+  return frames;
+}
+
+static std::vector<Frame> flush(Http2Session &session) {
+  std::string out;
+  session.Flush(out, 1 << 20);
+  return parseFrames(out);
+}
+
+// Error code of the GOAWAY among frames, or -1 if there is none
+static long goAwayCode(const std::vector<Frame> &frames) {
+  for (size_t i = 0; i < frames.size(); ++i) {
+    if (frames[i].type == kGoAway) return readU32(frames[i].payload, 4);
+  }
+  return -1;
+}
+
+static std::string requestBlock(HpackEncoder &encoder, const char *path) {
+  const char *fields[][2] = {{":method", "GET"},
+                             {":scheme", "http"},
+                             {":path", path},
+                             {":authority", "example.com"}};
+  std::vector<HttpHeader> headers;
+  for (size_t i = 0; i < 4; ++i) {
+    HttpHeader h;
+    h.name = fields[i][0];
+    h.value = fields[i][1];
+    headers.push_back(h);
+  }
+  std::string block;
+  encoder.Encode(headers, block);
+  return block;
+}
+
+// A session past the preface and the client's SETTINGS, output drained
+static void open(Http2Session &session) {
+  std::string in = std::string(kPreface) + frame(kSettings, 0, 0, "");
+  session.Feed(in);
+  flush(session);
+}
+
+static void h2_preface_impl() {
+  std::string preface = kPreface;
+  if (Http2Session::MatchPreface(preface.substr(0, 10)) != 0 ||
+      Http2Session::MatchPreface(preface) != 1 ||
+      Http2Session::MatchPreface("GET / HTTP/1.1\r\n") != -1 ||
+      Http2Session::MatchPreface("PRI * HTTP/1.1") != -1)
+    std::cerr << "FAIL MatchPreface" << std::endl;
+
+  // Our SETTINGS goes first, then the ACK of theirs; a split preface is fine
+  Http2Session session(1024);
+  std::string in = preface.substr(0, 7);
+  if (!session.Feed(in) || in.size() != 7)
+    std::cerr << "FAIL partial preface" << std::endl;
+  in += preface.substr(7) + frame(kSettings, 0, 0, setting(0x4, 1000));
+  if (!session.Feed(in) || !in.empty())
+    std::cerr << "FAIL preface" << std::endl;
+  std::vector<Frame> frames = flush(session);
+  if (frames.size() != 2 || frames[0].type != kSettings ||
+      frames[0].flags != 0 || frames[0].payload != setting(0x3, 100) ||
+      frames[1].type != kSettings || frames[1].flags != 1 ||
+      !frames[1].payload.empty())
+    std::cerr << "FAIL settings exchange" << std::endl;
+
+  Http2Session wrong(1024);
+  std::string http1 = "GET / HTTP/1.1\r\nHost: x\r\n\r\n";
+  if (wrong.Feed(http1) || goAwayCode(flush(wrong)) != 1 ||
+      !wrong.WantsClose())
+    std::cerr << "FAIL bad preface" << std::endl;
+}
+
+static void h2_settings_impl() {
+  struct Case {
+    const char *what;
+    std::string frame;
+    long code;
+  };
+  const Case cases[] = {
+      {"length not a multiple of 6", frame(kSettings, 0, 0, "12345"), 6},
+      {"on a stream", frame(kSettings, 0, 1, ""), 1},
+      {"ACK with a payload", frame(kSettings, 1, 0, setting(0x4, 1)), 6},
+      {"window above 2^31-1", frame(kSettings, 0, 0, setting(0x4, 1u << 31)),
+       3},
+      {"frame size below 16384", frame(kSettings, 0, 0, setting(0x5, 100)),
+       1},
+      {"push above 1", frame(kSettings, 0, 0, setting(0x2, 2)), 1},
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+    Http2Session session(1024);
+    open(session);
+    std::string in = cases[i].frame;
+    if (session.Feed(in) || goAwayCode(flush(session)) != cases[i].code)
+      std::cerr << "FAIL settings " << cases[i].what << std::endl;
+  }
+  // Unknown identifiers are ignored
+  Http2Session session(1024);
+  open(session);
+  std::string in = frame(kSettings, 0, 0, setting(0x99, 7));
+  if (!session.Feed(in) || flush(session).size() != 1)
+    std::cerr << "FAIL unknown setting" << std::endl;
+}
+
+static void h2_flow_control_impl() {
+  Http2Session session(1024);
+  open(session);
+  HpackEncoder encoder;
+  std::string in = frame(kHeaders, 0x5, 1, requestBlock(encoder, "/a"));
+  uint32_t id;
+  HttpRequest req;
+  if (!session.Feed(in) || !session.PopRequest(id, req) || id != 1 ||
+      req.path != "/a" || req.method != "GET" || !req.complete)
+    std::cerr << "FAIL request" << std::endl;
+
+  const size_t kBody = 100000;
+  session.SubmitResponse(
+      1, "HTTP/1.1 200 OK\r\nConnection: keep-alive\r\n\r\n" +
+             std::string(kBody, 'x'),
+      false);
+  std::vector<Frame> frames = flush(session);
+  size_t sent = 0;
+  bool forbidden = false;
+  for (size_t i = 0; i < frames.size(); ++i) {
+    if (frames[i].type == kData) {
+      if (frames[i].payload.size() > 16384 || frames[i].flags)
+        std::cerr << "FAIL data frame" << std::endl;
+      sent += frames[i].payload.size();
+    }
+    if (frames[i].type == kHeaders &&
+        frames[i].payload.find("keep-alive") != std::string::npos)
+      forbidden = true;
+  }
+  // Both windows start at 65535
+  if (frames.empty() || frames[0].type != kHeaders || sent != 65535 ||
+      forbidden)
+    std::cerr << "FAIL initial window: " << sent << std::endl;
+
+  // Crediting only the connection leaves the stream window empty
+  in = frame(kWindowUpdate, 0, 0, u32(kBody));
+  session.Feed(in);
+  if (!flush(session).empty())
+    std::cerr << "FAIL stream window ignored" << std::endl;
+  in = frame(kWindowUpdate, 0, 1, u32(1000));
+  session.Feed(in);
+  frames = flush(session);
+  if (frames.size() != 1 || frames[0].payload.size() != 1000)
+    std::cerr << "FAIL partial credit" << std::endl;
+  in = frame(kWindowUpdate, 0, 1, u32(kBody));
+  session.Feed(in);
+  frames = flush(session);
+  sent = 0;
+  for (size_t i = 0; i < frames.size(); ++i) sent += frames[i].payload.size();
+  if (sent != kBody - 65535 - 1000 || frames.empty() ||
+      frames.back().flags != 1 || session.ActiveStreams() != 0)
+    std::cerr << "FAIL rest of body: " << sent << std::endl;
+
+  // Request bodies are credited back as they arrive
+  in = frame(kHeaders, 0x4, 3, requestBlock(encoder, "/up")) +
+       frame(kData, 0, 3, std::string(500, 'y'));
+  session.Feed(in);
+  frames = flush(session);
+  if (frames.size() != 2 || frames[0].type != kWindowUpdate ||
+      frames[1].type != kWindowUpdate ||
+      readU32(frames[0].payload, 0) != 500)
+    std::cerr << "FAIL receive credit" << std::endl;
+
+  // Overflowing the connection window is a connection error
+  in = frame(kWindowUpdate, 0, 0, u32(0x7fffffffu));
+  if (session.Feed(in) || goAwayCode(flush(session)) != 3)
+    std::cerr << "FAIL window overflow" << std::endl;
+}
+
+static void h2_invalid_frames_impl() {
+  HpackEncoder encoder;
+  std::string block = requestBlock(encoder, "/");
+  struct Case {
+    const char *what;
+    std::string frames;
+    long code;
+  };
+  const Case cases[] = {
+      {"oversized frame", frame(kData, 0, 1, std::string(16385, 'x')), 6},
+      {"HEADERS on stream 0", frame(kHeaders, 0x5, 0, block), 1},
+      {"even stream id", frame(kHeaders, 0x5, 2, block), 1},
+      {"decreasing stream id",
+       frame(kHeaders, 0x5, 5, block) + frame(kHeaders, 0x5, 3, block), 1},
+      {"interleaved CONTINUATION",
+       frame(kHeaders, 0x1, 1, block) + frame(kPing, 0, 0, "12345678"), 1},
+      {"CONTINUATION without HEADERS", frame(kContinuation, 0x4, 1, block),
+       1},
+      {"PUSH_PROMISE", frame(kPushPromise, 0x4, 1, u32(2)), 1},
+      {"short PING", frame(kPing, 0, 0, "1234567"), 6},
+      {"PING on a stream", frame(kPing, 0, 1, "12345678"), 1},
+      {"zero connection WINDOW_UPDATE", frame(kWindowUpdate, 0, 0, u32(0)),
+       1},
+      {"short WINDOW_UPDATE", frame(kWindowUpdate, 0, 0, "123"), 6},
+      {"bad HPACK", frame(kHeaders, 0x5, 1, "\xbe"), 9},
+      {"DATA on an idle stream", frame(kData, 0, 7, "x"), 1},
+      {"bad padding", frame(kData, 0x8, 1, "\x05x"), 1},
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+    Http2Session session(1024);
+    open(session);
+    std::string in = cases[i].frames;
+    if (session.Feed(in) || goAwayCode(flush(session)) != cases[i].code ||
+        !session.WantsClose())
+      std::cerr << "FAIL " << cases[i].what << std::endl;
+  }
+
+  // Stream errors reset the stream and keep the connection
+  Http2Session session(1024);
+  open(session);
+  HpackEncoder streamEncoder;
+  std::string in = frame(kHeaders, 0x4, 1, requestBlock(streamEncoder, "/")) +
+                   frame(kWindowUpdate, 0, 1, u32(0));
+  std::vector<Frame> frames;
+  if (session.Feed(in)) frames = flush(session);
+  if (frames.size() != 1 || frames[0].type != kRstStream ||
+      readU32(frames[0].payload, 0) != 1 || session.ActiveStreams() != 0)
+    std::cerr << "FAIL stream WINDOW_UPDATE of 0" << std::endl;
+  in = frame(kPing, 0, 0, "abcdefgh") + frame(0xfa, 0, 0, "unknown");
+  frames.clear();
+  if (session.Feed(in)) frames = flush(session);
+  if (frames.size() != 1 || frames[0].type != kPing || frames[0].flags != 1 ||
+      frames[0].payload != "abcdefgh")
+    std::cerr << "FAIL PING ACK" << std::endl;
+}
+
+#ifdef HAVE_CRITERION
+Test(Http2Session, preface) { h2_preface_impl(); }
+Test(Http2Session, settings) { h2_settings_impl(); }
+Test(Http2Session, flow_control) { h2_flow_control_impl(); }
+Test(Http2Session, invalid_frames) { h2_invalid_frames_impl(); }
+#else
+int main() {
+  h2_preface_impl();
+  h2_settings_impl();
+  h2_flow_control_impl();
+  h2_invalid_frames_impl();
+  return 0;
+}
+#endif
@@ -0,0 +1,87 @@
+#include <string>
+#include <iostream>
+
+#include "server/IpAccess.hpp"
+
+#ifdef __has_include
+# if __has_include(<criterion/criterion.h>)
+#  define HAVE_CRITERION 1
+# endif
+#endif
+
+#ifdef HAVE_CRITERION
+#include <criterion/criterion.h>
+#endif
+
+static void rule(std::vector<AccessRule> &rules, bool allow,
+                 const char *source) {
+  AccessRule r;
+  r.allow = allow;
+  r.fromFile = false;
+  r.source = source;
+  rules.push_back(r);
+}
+
+static void expect(const IpAccessList &list, const char *addr, bool allowed) {
+  IpAddress a;
+  int len;
+  if (!ParseCidr(addr, a, len) || list.Allows(a) != allowed)
+    std::cerr << "FAIL " << addr << " expected "
+              << (allowed ? "allow" : "deny") << std::endl;
+}
+
+static void ip_access_match_impl() {
+  std::vector<AccessRule> rules;
+  rule(rules, false, "10.0.0.0/8");
+  rule(rules, true, "10.1.0.0/16");
+  rule(rules, false, "10.1.2.3");
+  rule(rules, false, "10.128.0.0/9");  // splits the 10/8 subtree
+  rule(rules, false, "2001:db8::/32");
+  rule(rules, true, "2001:db8:1::/48");
+  IpAccessList list;
+  std::string error;
+  if (!list.Build(rules, error) || list.PrefixCount() != 6)
+    std::cerr << "FAIL build " << error << std::endl;
+  expect(list, "10.9.9.9", false);
+  expect(list, "10.1.9.9", true);
+  expect(list, "10.1.2.3", false);
+  expect(list, "10.1.2.4", true);
+  expect(list, "10.200.0.1", false);
+  expect(list, "11.0.0.1", true);
+  expect(list, "2001:db8:2::1", false);
+  expect(list, "2001:db8:1::1", true);
+  expect(list, "::1", true);
+
+  std::vector<AccessRule> all;
+  rule(all, false, "all");
+  rule(all, true, "192.0.2.0/24");
+  IpAccessList strict;
+  if (!strict.Build(all, error)) std::cerr << "FAIL build all" << std::endl;
+  expect(strict, "192.0.2.77", true);
+  expect(strict, "192.0.3.1", false);
+  expect(strict, "::1", false);
+}
+
+static void ip_access_parse_impl() {
+  IpAddress a;
+  int len;
+  const char *bad[] = {"10.0.0.0/33", "10.0.0.1/", "1.2.3", "::1/129",
+                       "host", ""};
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+    if (ParseCidr(bad[i], a, len))
+      std::cerr << "FAIL accepted " << bad[i] << std::endl;
+  }
+  if (!ParseCidr("192.0.2.77/24", a, len) || len != 120 ||
+      FormatIpAddress(a) != "192.0.2.0")
+    std::cerr << "FAIL mask " << FormatIpAddress(a) << std::endl;
+  if (!ParseCidr("2001:db8::1", a, len) || len != 128 ||
+      FormatIpAddress(a) != "2001:db8::1")
+    std::cerr << "FAIL v6 " << FormatIpAddress(a) << std::endl;
+}
+
+#ifdef HAVE_CRITERION
+Test(IpAccess, match) { ip_access_match_impl(); }
+Test(IpAccess, parse) { ip_access_parse_impl(); }
+#else
+int main() { ip_access_match_impl(); ip_access_parse_impl(); return 0; }
+#endif
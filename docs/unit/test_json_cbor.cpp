@@ -0,0 +1,283 @@
+#include <stdexcept>
+#include <string>
+#include <iostream>
+
+#include "json/json_cbor.hpp"
+
+#ifdef __has_include
+# if __has_include(<criterion/criterion.h>)
+#  define HAVE_CRITERION 1
+# endif
+#endif
+
+#ifdef HAVE_CRITERION
+#include <criterion/criterion.h>
+#endif
+
+// Built from docs/ with -I../src (see the src/json sources)
+
+static std::string fromHex(const char *hex) {
+  std::string out;
+  for (size_t i = 0; hex[i] && hex[i + 1]; i += 2) {
+    unsigned int byte = 0;
+    for (size_t j = 0; j < 2; ++j) {
+      char c = hex[i + j];
+      byte = byte * 16 + (c <= '9' ? c - '0' : c - 'a' + 10);
+    }
+    out += static_cast<char>(byte);
+  }
+  return out;
+}
+
+static std::string toHex(const std::string &bytes) {
+  static const char kDigits[] = "0123456789abcdef";
+  std::string out;
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    unsigned char c = static_cast<unsigned char>(bytes[i]);
+    out += kDigits[c >> 4];
+    out += kDigits[c & 15];
+  }
+  return out;
+}
+
+static std::string jsonText(const std::string &json) {
+  JsonParser parser;
+  JsonValuePtr value(parser.Parse(json));
+  return value.Get()->ToString();
+}
+
+// Decodes and returns an empty string on rejection
+static std::string decodeText(const std::string &bytes) {
+  try {
+    CborDecoder decoder;
+    JsonValuePtr value(decoder.Decode(bytes));
+    return value.Get()->ToString();
+  } catch (const std::exception &) {
+    return "";
+  }
+}
+
+static bool rejected(const std::string &bytes) {
+  try {
+    CborDecoder decoder;
+    JsonValuePtr value(decoder.Decode(bytes));
+  } catch (const std::exception &) {
+    return true;
+  }
+  return false;
+}
+
+struct Vector {
+  const char *hex;
+  const char *json;
+  bool encodes;  // the encoder picks this exact form for the value
+};
+
+// RFC 8949 Appendix A, minus the items JSON cannot hold (byte strings,
+// undefined, NaN, infinities, non-string map keys)
+static const Vector kVectors[] = {
+    {"00", "0", true},
+    {"01", "1", true},
+    {"0a", "10", true},
+    {"17", "23", true},
+    {"1818", "24", true},
+    {"1819", "25", true},
+    {"1864", "100", true},
+    {"1903e8", "1000", true},
+    {"1a000f4240", "1000000", true},
+    {"1b000000e8d4a51000", "1000000000000", true},
+    {"1bffffffffffffffff", "18446744073709551615", false},
+    {"3bffffffffffffffff", "-18446744073709551616", false},
+    {"20", "-1", true},
+    {"29", "-10", true},
+    {"3863", "-100", true},
+    {"3903e7", "-1000", true},
+    {"f90000", "0.0", false},
+    {"f93c00", "1.0", false},
+    {"fb3ff199999999999a", "1.1", true},
+    {"f93e00", "1.5", true},
+    {"f97bff", "65504.0", false},
+    {"fa47c35000", "100000.0", false},
+    {"fa7f7fffff", "3.4028234663852886e+38", true},
+    {"fb7e37e43c8800759c", "1.0e+300", true},
+    {"f90001", "5.960464477539063e-8", true},
+    {"f90400", "0.00006103515625", true},
+    {"f9c400", "-4.0", false},
+    {"fbc010666666666666", "-4.1", true},
+    {"f4", "false", true},
+    {"f5", "true", true},
+    {"f6", "null", true},
+    {"c074323031332d30332d32315432303a30343a30305a",
+     "\"2013-03-21T20:04:00Z\"", false},
+    {"c11a514b67b0", "1363896240", false},
+    {"c1fb41d452d9ec200000", "1363896240.5", false},
+    {"d82076687474703a2f2f7777772e6578616d706c652e636f6d",
+     "\"http://www.example.com\"", false},
+    {"60", "\"\"", true},
+    {"6161", "\"a\"", true},
+    {"6449455446", "\"IETF\"", true},
+    {"62225c", "\"\\\"\\\\\"", true},
+    {"62c3bc", "\"\xc3\xbc\"", true},
+    {"63e6b0b4", "\"\xe6\xb0\xb4\"", true},
+    {"64f0908591", "\"\xf0\x90\x85\x91\"", true},
+    {"80", "[]", true},
+    {"83010203", "[1, 2, 3]", true},
+    {"8301820203820405", "[1, [2, 3], [4, 5]]", true},
+    {"98190102030405060708090a0b0c0d0e0f101112131415161718181819",
+     "[1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19,"
+     " 20, 21, 22, 23, 24, 25]",
+     true},
+    {"a0", "{}", true},
+    {"a26161016162820203", "{\"a\": 1, \"b\": [2, 3]}", true},
+    {"826161a161626163", "[\"a\", {\"b\": \"c\"}]", true},
+    {"a56161614161626142616361436164614461656145",
+     "{\"a\": \"A\", \"b\": \"B\", \"c\": \"C\", \"d\": \"D\", \"e\": \"E\"}",
+     true},
+    {"9fff", "[]", false},
+    {"9f018202039f0405ffff", "[1, [2, 3], [4, 5]]", false},
+    {"9f01820203820405ff", "[1, [2, 3], [4, 5]]", false},
+    {"83018202039f0405ff", "[1, [2, 3], [4, 5]]", false},
+    {"83019f0203ff820405", "[1, [2, 3], [4, 5]]", false},
+    {"9f0102030405060708090a0b0c0d0e0f101112131415161718181819ff",
+     "[1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19,"
+     " 20, 21, 22, 23, 24, 25]",
+     false},
+    {"bf61610161629f0203ffff", "{\"a\": 1, \"b\": [2, 3]}", false},
+    {"826161bf61626163ff", "[\"a\", {\"b\": \"c\"}]", false},
+    {"bf6346756ef563416d7421ff", "{\"Fun\": true, \"Amt\": -2}", false},
+};
+
+static const size_t kVectorCount = sizeof(kVectors) / sizeof(kVectors[0]);
+
+static void cbor_vectors_impl() {
+  for (size_t i = 0; i < kVectorCount; ++i) {
+    const Vector &v = kVectors[i];
+    std::string bytes = fromHex(v.hex);
+    std::string want = jsonText(v.json);
+    std::string got = decodeText(bytes);
+    if (got != want)
+      std::cerr << "FAIL decode " << v.hex << ": " << got << std::endl;
+    CborReader reader(bytes.data(), bytes.size());
+    reader.SkipValue();
+    if (!reader.AtEnd() || reader.GetOffset() != bytes.size())
+      std::cerr << "FAIL skip " << v.hex << std::endl;
+    if (!v.encodes) continue;
+    JsonParser parser;
+    JsonValuePtr value(parser.Parse(v.json));
+    CborEncoder encoder;
+    std::string encoded = toHex(encoder.Encode(*value.Get()));
+    if (encoded != v.hex)
+      std::cerr << "FAIL encode " << v.json << ": " << encoded << std::endl;
+  }
+}
+
+static void cbor_round_trip_impl() {
+  const char *docs[] = {
+      "{\"a\": [1, -1, 2.5, 1e300, -9223372036854775808, true, false, null,"
+      " \"h\"], \"b\": {\"x\": \"yz\"}, \"\": 0, \"big\": 4294967296,"
+      " \"m\": 70000, \"esc\": \"tab\\there \xc3\xa9\"}",
+      "[]", "{}", "\"s\"", "3.14159", "-0.5", "[[[[[]]]]]"};
+  for (size_t i = 0; i < sizeof(docs) / sizeof(docs[0]); ++i) {
+    JsonParser parser;
+    JsonValuePtr value(parser.Parse(docs[i]));
+    CborEncoder encoder;
+    std::string bytes = encoder.Encode(*value.Get());
+    if (decodeText(bytes) != value.Get()->ToString())
+      std::cerr << "FAIL round trip " << docs[i] << std::endl;
+    // Encoding appends, so documents can be streamed back to back
+    std::string twice;
+    encoder.Encode(*value.Get(), twice);
+    encoder.Encode(*value.Get(), twice);
+    CborReader reader(twice.data(), twice.size());
+    reader.SkipValue();
+    if (reader.GetOffset() != bytes.size())
+      std::cerr << "FAIL sequence offset " << docs[i] << std::endl;
+    reader.SkipValue();
+    if (!reader.AtEnd()) std::cerr << "FAIL sequence " << docs[i] << std::endl;
+  }
+}
+
+static void cbor_reader_views_impl() {
+  // Strings are views into the input, not copies
+  std::string bytes = fromHex("826449455446a161626163");
+  CborReader reader(bytes.data(), bytes.size());
+  CborItem item;
+  reader.Read(item);
+  if (item.type != kJsonArray || item.size != 2)
+    std::cerr << "FAIL array header" << std::endl;
+  reader.Read(item);
+  if (item.type != kJsonString || item.size != 4 ||
+      item.data != bytes.data() + 2)
+    std::cerr << "FAIL string view" << std::endl;
+  reader.Read(item);
+  if (item.type != kJsonObject || item.size != 1)
+    std::cerr << "FAIL map header" << std::endl;
+  bytes = fromHex("9f01ff");
+  CborReader indefinite(bytes.data(), bytes.size());
+  indefinite.Read(item);
+  if (item.size != CborItem::kIndefinite || indefinite.ReadBreak())
+    std::cerr << "FAIL indefinite header" << std::endl;
+  indefinite.Read(item);
+  if (!indefinite.ReadBreak() || !indefinite.AtEnd())
+    std::cerr << "FAIL break" << std::endl;
+}
+
+static void cbor_reject_impl() {
+  // CBOR is prefix-free: every strict prefix of a valid item is truncated
+  for (size_t i = 0; i < kVectorCount; ++i) {
+    std::string bytes = fromHex(kVectors[i].hex);
+    for (size_t len = 0; len < bytes.size(); ++len) {
+      if (!rejected(bytes.substr(0, len)))
+        std::cerr << "FAIL truncated " << kVectors[i].hex << " at " << len
+                  << std::endl;
+    }
+  }
+  // Lengths larger than what is left of the input, up to 2^64 - 1
+  const char *overlong[] = {
+      "9bffffffffffffffff", "bbffffffffffffffff", "7bffffffffffffffff",
+      "5bffffffffffffffff", "7a7fffffff61",      "98ff01",
+      "a2616101",           "7818616263"};
+  for (size_t i = 0; i < sizeof(overlong) / sizeof(overlong[0]); ++i) {
+    if (!rejected(fromHex(overlong[i])))
+      std::cerr << "FAIL over-long " << overlong[i] << std::endl;
+  }
+  // Nesting is bounded instead of recursing until the stack runs out
+  std::string shallow(100, static_cast<char>(0x81));
+  shallow += static_cast<char>(0xf6);
+  if (rejected(shallow)) std::cerr << "FAIL shallow nesting" << std::endl;
+  std::string deep(100000, static_cast<char>(0x81));
+  deep += static_cast<char>(0xf6);
+  if (!rejected(deep)) std::cerr << "FAIL deep nesting" << std::endl;
+  std::string deepMaps;
+  for (size_t i = 0; i < 100000; ++i) deepMaps += fromHex("bf6161");
+  if (!rejected(deepMaps)) std::cerr << "FAIL deep maps" << std::endl;
+  // Malformed items that are complete
+  const char *malformed[] = {
+      "0000",                 // trailing bytes
+      "ff",                   // break outside a container
+      "1c",                   // reserved additional information
+      "5f42010243030405ff",   // indefinite byte string
+      "7f657374726561646d696e67ff",  // indefinite text string
+      "f0",                   // unassigned simple value
+      "a10102",               // non-string map key
+  };
+  for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i) {
+    if (!rejected(fromHex(malformed[i])))
+      std::cerr << "FAIL malformed " << malformed[i] << std::endl;
+  }
+}
+
+#ifdef HAVE_CRITERION
+Test(JsonCbor, appendix_a) { cbor_vectors_impl(); }
+Test(JsonCbor, round_trip) { cbor_round_trip_impl(); }
+Test(JsonCbor, reader_views) { cbor_reader_views_impl(); }
+Test(JsonCbor, reject) { cbor_reject_impl(); }
+#else
+int main() {
+  cbor_vectors_impl();
+  cbor_round_trip_impl();
+  cbor_reader_views_impl();
+  cbor_reject_impl();
+  return 0;
+}
+#endif
@@ -0,0 +1,124 @@
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "server/PutUpload.hpp"
+
+#ifdef __has_include
+# if __has_include(<criterion/criterion.h>)
+#  define HAVE_CRITERION 1
+# endif
+#endif
+
+#ifdef HAVE_CRITERION
+#include <criterion/criterion.h>
+#endif
+
+static void check(bool ok, const char *what) {
+  if (!ok) std::cerr << "FAIL " << what << std::endl;
+}
+
+static void put_upload_range_impl() {
+  ContentRange r;
+  check(ParseContentRange("bytes 0-1023/4096", r) && r.first == 0 &&
+            r.last == 1023 && r.total == 4096,
+        "full range");
+  check(ParseContentRange("bytes 5-9/*", r) && r.total == -1, "star total");
+  check(!ParseContentRange("bytes 9-5/10", r), "reversed");
+  check(!ParseContentRange("bytes 0-10/10", r), "past total");
+  check(!ParseContentRange("bytes=0-1/2", r), "range syntax");
+  check(!ParseContentRange("bytes 0-1/2x", r), "trailing junk");
+  check(!ParseContentRange("bytes 99999999999999999999-1/2", r), "overflow");
+  check(UploadPartPath("/srv/up/a.bin") == "/srv/up/.a.bin.part", "part");
+}
+
+static void put_upload_resume_impl() {
+  char dir[] = "/tmp/put_upload_XXXXXX";
+  if (!mkdtemp(dir)) return;
+  std::string target = std::string(dir) + "/f.txt";
+  PutUpload up;
+  off_t n = 0;
+  check(up.Begin(target, "bytes 0-4/10", 5, 0) == 0, "begin first");
+  check(up.Write("hel", 3), "write");
+  up.Abort();  // connection lost after three bytes
+  check(UploadPersisted(target, n) && n == 3, "persisted after abort");
+  check(up.Begin(target, "bytes 5-9/10", 5, 0) == 409, "gap rejected");
+  check(up.Begin(target, "bytes 3-8/10", 6, 0) == 0, "resume");
+  check(up.Write("lo wor", 6) && up.Remaining() == 0, "write rest");
+  check(up.Finish() == 202, "incomplete: one byte short of the total");
+  check(up.Begin(target, "bytes 9-9/10", 1, 0) == 0, "last byte");
+  check(up.Write("l", 1) && up.Finish() == 201, "created");
+  check(!UploadPersisted(target, n), "part renamed");
+  check(up.Begin(target, "", 2, 1) == 413, "size cap");
+  check(up.Begin(target, "", 2, 0) == 0 && up.Write("ok", 2) &&
+            up.Finish() == 204,
+        "replaced");
+  struct stat st;
+  check(stat(target.c_str(), &st) == 0 && st.st_size == 2, "final size");
+  std::remove(target.c_str());
+  rmdir(dir);
+}
+
+// Body written in odd-sized pieces, interrupted at an unaligned offset and
+// resumed, under the O_DIRECT (direct) or write-behind policy
+static void uploadInPieces(bool direct) {
+  char dir[] = "/tmp/put_upload_XXXXXX";
+  if (!mkdtemp(dir)) return;
+  std::string target = std::string(dir) + "/big.bin";
+  std::string body(3 * 1024 * 1024 + 123, 'x');
+  for (size_t i = 0; i < body.size(); ++i) body[i] = (char)(i * 7 + i / 4096);
+  const off_t size = (off_t)body.size();
+  const off_t cut = 1500001;
+  PutUpload up;
+  up.SetCachePolicy(direct ? 0 : 1, direct ? 1 : 0);
+  char range[64];
+  std::sprintf(range, "bytes 0-%ld/%ld", (long)cut - 1, (long)size);
+  check(up.Begin(target, range, cut, 0) == 0, "begin pieces");
+  if (direct && !up.Direct()) std::cerr << "SKIP no O_DIRECT in /tmp\n";
+  for (off_t at = 0; at < cut; at += 7777) {
+    size_t len = (size_t)(cut - at < 7777 ? cut - at : 7777);
+    check(up.Write(body.data() + at, len), "write piece");
+  }
+  up.Abort();  // staged bytes are written before the file is closed
+  off_t n = 0;
+  check(UploadPersisted(target, n) && n == cut, "persisted at the cut");
+  std::sprintf(range, "bytes %ld-%ld/%ld", (long)cut, (long)size - 1,
+               (long)size);
+  check(up.Begin(target, range, size - cut, 0) == 0, "resume pieces");
+  for (off_t at = cut; at < size; at += 65536) {
+    size_t len = (size_t)(size - at < 65536 ? size - at : 65536);
+    check(up.Write(body.data() + at, len), "write rest");
+  }
+  check(up.Finish() == 201, "pieces complete");
+  FILE *f = std::fopen(target.c_str(), "rb");
+  std::string got;
+  char buf[65536];
+  size_t r;
+  while (f && (r = std::fread(buf, 1, sizeof(buf), f)) > 0) got.append(buf, r);
+  if (f) std::fclose(f);
+  check(got == body, direct ? "direct content" : "write-behind content");
+  std::remove(target.c_str());
+  rmdir(dir);
+}
+
+static void put_upload_cache_policy_impl() {
+  uploadInPieces(true);
+  uploadInPieces(false);
+}
+
+#ifdef HAVE_CRITERION
+Test(PutUpload, range) { put_upload_range_impl(); }
+Test(PutUpload, resume) { put_upload_resume_impl(); }
+Test(PutUpload, cache_policy) { put_upload_cache_policy_impl(); }
+#else
+int main() {
+  put_upload_range_impl();
+  put_upload_resume_impl();
+  put_upload_cache_policy_impl();
+  return 0;
+}
+#endif
@@ -0,0 +1,53 @@
+#include <string>
+#include <iostream>
+
+#include "server/ResponseCache.hpp"
+
+#ifdef __has_include
+# if __has_include(<criterion/criterion.h>)
+#  define HAVE_CRITERION 1
+# endif
+#endif
+
+#ifdef HAVE_CRITERION
+#include <criterion/criterion.h>
+#endif
+
+static void cache_freshness_impl() {
+  ResponseCache cache(1 << 20);
+  ResponseCache::Hit hit;
+  if (cache.Lookup("k", 0, hit)) std::cerr << "FAIL empty hit" << std::endl;
+  cache.Store("k", "HTTP/1.1 200 OK\r\n", "body", 1000, 2000, 3000);
+  if (!cache.Lookup("k", 2000, hit) || hit.stale || hit.ageSec != 1 ||
+      std::string(hit.body.Data(), hit.body.Size()) != "body")
+    std::cerr << "FAIL fresh hit" << std::endl;
+  // Stale window: served, and only the first caller refreshes
+  if (!cache.Lookup("k", 3500, hit) || !hit.stale || !hit.refresh)
+    std::cerr << "FAIL stale hit" << std::endl;
+  if (!cache.Lookup("k", 3600, hit) || hit.refresh)
+    std::cerr << "FAIL single refresh" << std::endl;
+  if (cache.Lookup("k", 6000, hit)) std::cerr << "FAIL expired" << std::endl;
+  if (cache.Bytes() != 0) std::cerr << "FAIL bytes after expiry" << std::endl;
+}
+
+static void cache_lru_impl() {
+  std::string body(100, 'x');
+  ResponseCache cache(300);
+  cache.Store("a", "", body, 0, 1000, 0);
+  cache.Store("b", "", body, 0, 1000, 0);
+  ResponseCache::Hit hit;
+  cache.Lookup("a", 1, hit);  // b is now least recently used
+  cache.Store("c", "", body, 0, 1000, 0);
+  if (!cache.Lookup("a", 2, hit)) std::cerr << "FAIL lru kept a" << std::endl;
+  if (cache.Lookup("b", 2, hit)) std::cerr << "FAIL lru evicted b" << std::endl;
+  if (!cache.Lookup("c", 2, hit)) std::cerr << "FAIL lru kept c" << std::endl;
+  cache.Store("big", "", std::string(200, 'y'), 0, 1000, 0);
+  if (cache.Lookup("big", 2, hit)) std::cerr << "FAIL oversized" << std::endl;
+}
+
+#ifdef HAVE_CRITERION
+Test(ResponseCache, freshness) { cache_freshness_impl(); }
+Test(ResponseCache, lru) { cache_lru_impl(); }
+#else
+int main() { cache_freshness_impl(); cache_lru_impl(); return 0; }
+#endif
@@ -0,0 +1,105 @@
+#include <string>
+#include <iostream>
+#include <vector>
+
+#include "server/Rewrite.hpp"
+
+#ifdef __has_include
+# if __has_include(<criterion/criterion.h>)
+#  define HAVE_CRITERION 1
+# endif
+#endif
+
+#ifdef HAVE_CRITERION
+#include <criterion/criterion.h>
+#endif
+
+static RewriteRule rule(const char *pattern, const char *target, int code) {
+  RewriteRule r;
+  r.pattern = pattern;
+  r.target = target;
+  r.code = code;
+  return r;
+}
+
+static void expect(const RewriteEngine &engine, const char *path,
+                   const char *query, const char *target) {
+  RewriteResult res;
+  bool matched = engine.Match(path, query, res);
+  if (!target) {
+    if (matched) std::cerr << "FAIL unexpected match " << path << std::endl;
+  } else if (!matched || res.target != target) {
+    std::cerr << "FAIL " << path << " -> " << res.target << " (want "
+              << target << ")" << std::endl;
+  }
+}
+
+static void rewrite_match_impl() {
+  std::vector<RewriteRule> rules;
+  rules.push_back(rule("=/exact", "/e", 0));
+  rules.push_back(rule("/static/", "/assets/$1", 0));
+  rules.push_back(rule("^/u/([a-z]+)/(.*)$", "/user.cgi?name=$1&p=$2", 0));
+  rules.push_back(rule("^/(img|css)/[^/]+\\.(png|css)$", "/$1-$2", 0));
+  rules.push_back(rule("^/a+b?c*$", "/abc", 0));
+  rules.push_back(rule("/", "/fallback", 0));  // everything else
+  RewriteEngine engine;
+  std::string error;
+  if (!engine.Compile(rules, error)) std::cerr << "FAIL " << error << std::endl;
+  expect(engine, "/exact", "", "/e");
+  expect(engine, "/exact/more", "", "/fallback");
+  expect(engine, "/static/js/app.js", "v=2", "/assets/js/app.js?v=2");
+  expect(engine, "/u/bob/a b", "x=1", "/user.cgi?name=bob&p=a%20b&x=1");
+  expect(engine, "/u/Bob/x", "", "/fallback");
+  expect(engine, "/img/logo.png", "", "/img-png");
+  expect(engine, "/css/site.css", "", "/css-css");
+  expect(engine, "/css/a/site.css", "", "/fallback");
+  expect(engine, "/aaac", "", "/abc");
+  expect(engine, "/bc", "", "/fallback");
+
+  std::vector<RewriteRule> none;
+  RewriteEngine empty;
+  empty.Compile(none, error);
+  expect(empty, "/x", "", 0);
+}
+
+static void rewrite_respond_impl() {
+  std::vector<RewriteRule> rules;
+  rules.push_back(rule("^/old/(.*)", "/new/$1", 301));
+  rules.push_back(rule("=/drop", "/kept?", 302));
+  rules.push_back(rule("=/gone", "bye", 410));
+  RewriteEngine engine;
+  std::string error;
+  engine.Compile(rules, error);
+  RewriteResult res;
+  if (!engine.Match("/old/x", "q=1", res) ||
+      res.action != RewriteResult::kRewriteRespond || res.code != 301 ||
+      res.head.find("Location: /new/x?q=1\r\n") == std::string::npos)
+    std::cerr << "FAIL permanent redirect" << std::endl;
+  expect(engine, "/drop", "q=1", "/kept");
+  if (!engine.Match("/gone", "", res) || res.code != 410 || res.body != "bye")
+    std::cerr << "FAIL return" << std::endl;
+}
+
+static void rewrite_errors_impl() {
+  const char *bad[] = {"relative", "^/(a", "^/a)", "^/[a-", "^*a", "^/a$b"};
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+    std::vector<RewriteRule> rules(1, rule(bad[i], "/", 0));
+    RewriteEngine engine;
+    std::string error;
+    if (engine.Compile(rules, error))
+      std::cerr << "FAIL accepted " << bad[i] << std::endl;
+  }
+}
+
+#ifdef HAVE_CRITERION
+Test(Rewrite, match) { rewrite_match_impl(); }
+Test(Rewrite, respond) { rewrite_respond_impl(); }
+Test(Rewrite, errors) { rewrite_errors_impl(); }
+#else
+int main() {
+  rewrite_match_impl();
+  rewrite_respond_impl();
+  rewrite_errors_impl();
+  return 0;
+}
+#endif
@@ -0,0 +1,144 @@
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "server/SharedFileCache.hpp"
+
+#ifdef __has_include
+# if __has_include(<criterion/criterion.h>)
+#  define HAVE_CRITERION 1
+# endif
+#endif
+
+#ifdef HAVE_CRITERION
+#include <criterion/criterion.h>
+#endif
+
+static const size_t kSegment = 8 * 1024 * 1024;  // two slabs
+
+static std::string segmentPath() {
+  char path[64];
+  std::snprintf(path, sizeof(path), "/tmp/test_shared_cache.%d",
+                (int)::getpid());
+  return path;
+}
+
+// Identity of a cached file, as stat would report it
+static struct stat fileStat(long ino, long mtime, size_t size) {
+  struct stat st;
+  std::memset(&st, 0, sizeof(st));
+  st.st_dev = 1;
+  st.st_ino = ino;
+  st.st_mtime = mtime;
+  st.st_size = size;
+  return st;
+}
+
+static void shared_cache_lookup_impl() {
+  std::string path = segmentPath();
+  std::string error;
+  std::string body(10000, 'a');
+  struct stat st = fileStat(7, 100, body.size());
+  {
+    SharedFileCache cache;
+    if (!cache.Open(path, kSegment, error)) {
+      std::cerr << "FAIL open: " << error << std::endl;
+      return;
+    }
+    SharedBuffer got;
+    if (cache.Lookup("/www/a", st, got)) std::cerr << "FAIL hit empty";
+    if (!cache.Insert("/www/a", st, body)) std::cerr << "FAIL insert";
+    if (!cache.Lookup("/www/a", st, got) ||
+        std::string(got.Data(), got.Size()) != body)
+      std::cerr << "FAIL lookup" << std::endl;
+    // A changed file is a miss, and its stale entry is dropped
+    struct stat touched = fileStat(7, 101, body.size());
+    SharedBuffer stale;
+    if (cache.Lookup("/www/a", touched, stale))
+      std::cerr << "FAIL stale hit" << std::endl;
+    if (cache.Entries() != 0) std::cerr << "FAIL stale entry kept";
+    // The pinned body stays readable after its entry is gone
+    if (std::string(got.Data(), got.Size()) != body)
+      std::cerr << "FAIL pinned body overwritten" << std::endl;
+    cache.Insert("/www/a", st, body);
+  }
+  // A restarted process finds the entry
+  {
+    SharedFileCache cache;
+    SharedBuffer got;
+    if (!cache.Open(path, kSegment, error) ||
+        !cache.Lookup("/www/a", st, got) || got.Size() != body.size())
+      std::cerr << "FAIL entry lost across reopen" << std::endl;
+  }
+  // So does another process attached at the same time
+  {
+    SharedFileCache cache;
+    cache.Open(path, kSegment, error);
+    pid_t pid = ::fork();
+    if (pid == 0) {
+      SharedFileCache child;
+      SharedBuffer got;
+      bool ok = child.Open(path, kSegment, error) &&
+                child.Lookup("/www/a", st, got) && got.Size() == body.size();
+      ::_exit(ok ? 0 : 1);
+    }
+    int status = 1;
+    ::waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      std::cerr << "FAIL child missed the entry" << std::endl;
+    if (cache.Hits() < 1) std::cerr << "FAIL hits not shared" << std::endl;
+    // A segment in use is not resized under its users
+    SharedFileCache other;
+    if (other.Open(path, 2 * kSegment, error))
+      std::cerr << "FAIL resized a segment in use" << std::endl;
+  }
+  ::unlink(path.c_str());
+}
+
+static void shared_cache_evict_impl() {
+  std::string path = segmentPath();
+  std::string error;
+  SharedFileCache cache;
+  if (!cache.Open(path, kSegment, error)) {
+    std::cerr << "FAIL open: " << error << std::endl;
+    return;
+  }
+  // 1 MiB bodies take 2 MiB chunks: two slabs hold four
+  std::string body(1024 * 1024, 'b');
+  SharedBuffer pinned;
+  for (long i = 0; i < 12; ++i) {
+    char key[32];
+    std::snprintf(key, sizeof(key), "/big/%ld", i);
+    if (!cache.Insert(key, fileStat(i, 1, body.size()), body))
+      std::cerr << "FAIL insert " << i << std::endl;
+    if (i == 0) cache.Lookup(key, fileStat(0, 1, body.size()), pinned);
+  }
+  if (cache.Entries() != 4) std::cerr << "FAIL entries " << cache.Entries();
+  if (cache.Evictions() != 8)
+    std::cerr << "FAIL evictions " << cache.Evictions() << std::endl;
+  SharedBuffer got;
+  if (!cache.Lookup("/big/0", fileStat(0, 1, body.size()), got))
+    std::cerr << "FAIL pinned entry evicted" << std::endl;
+  if (!cache.Lookup("/big/11", fileStat(11, 1, body.size()), got))
+    std::cerr << "FAIL newest entry evicted" << std::endl;
+  // Nothing fits a body larger than a slab
+  if (cache.Insert("/huge", fileStat(99, 1, 0), std::string(5 << 20, 'c')))
+    std::cerr << "FAIL oversized insert" << std::endl;
+  ::unlink(path.c_str());
+}
+
+#ifdef HAVE_CRITERION
+Test(SharedFileCache, lookup) { shared_cache_lookup_impl(); }
+Test(SharedFileCache, evict) { shared_cache_evict_impl(); }
+#else
+int main() {
+  shared_cache_lookup_impl();
+  shared_cache_evict_impl();
+  return 0;
+}
+#endif
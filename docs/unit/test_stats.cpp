@@ -0,0 +1,137 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#include "server/Stats.hpp"
+
+#ifdef __has_include
+# if __has_include(<criterion/criterion.h>)
+#  define HAVE_CRITERION 1
+# endif
+#endif
+
+#ifdef HAVE_CRITERION
+#include <criterion/criterion.h>
+#endif
+
+static bool hasLine(const std::string &text, const std::string &line) {
+  return text.find(line + "\n") != std::string::npos;
+}
+
+static void stats_private_impl() {
+  Stats stats;
+  std::string error;
+  if (!stats.Open("", error)) {
+    std::cerr << "FAIL open: " << error << std::endl;
+    return;
+  }
+  stats.Add(kStatAccepted);
+  stats.Adjust(kStatActiveConnections, 1);
+  stats.RecordResponse(200, 50);
+  stats.RecordResponse(404, 3000);
+  std::string text = stats.Render();
+  if (!hasLine(text, "selfserv_connections_accepted_total 1") ||
+      !hasLine(text, "selfserv_responses_total{class=\"2xx\"} 1") ||
+      !hasLine(text, "selfserv_responses_total{class=\"4xx\"} 1") ||
+      !hasLine(text, "selfserv_connections_active 1"))
+    std::cerr << "FAIL counters:\n" << text << std::endl;
+  // Buckets are cumulative
+  if (!hasLine(text,
+               "selfserv_request_duration_seconds_bucket{le=\"0.0001\"} 1") ||
+      !hasLine(text,
+               "selfserv_request_duration_seconds_bucket{le=\"0.005\"} 2") ||
+      !hasLine(text, "selfserv_request_duration_seconds_count 2"))
+    std::cerr << "FAIL histogram:\n" << text << std::endl;
+  // Hardware counters appear once a request has been sampled
+  if (text.find("selfserv_request_sampled_total") != std::string::npos)
+    std::cerr << "FAIL hardware before sampling:\n" << text << std::endl;
+  const uint64_t counts[kStatHardwareEventCount] = {1000, 800, 7, 3};
+  stats.RecordHardware(kStatClassCgi, counts);
+  stats.RecordHardware(kStatClassCgi, counts);
+  text = stats.Render();
+  if (!hasLine(text, "selfserv_request_sampled_total{class=\"cgi\"} 2") ||
+      !hasLine(text,
+               "selfserv_request_sampled_total{class=\"static_hit\"} 0") ||
+      !hasLine(text,
+               "selfserv_request_cpu_cycles_total{class=\"cgi\"} 2000") ||
+      !hasLine(text,
+               "selfserv_request_branch_misses_total{class=\"cgi\"} 6"))
+    std::cerr << "FAIL hardware:\n" << text << std::endl;
+}
+
+static void stats_shared_impl() {
+  char path[64];
+  std::snprintf(path, sizeof(path), "/tmp/test_stats.%d", (int)::getpid());
+  std::string error;
+  Stats parent;
+  if (!parent.Open(path, error)) {
+    std::cerr << "FAIL open: " << error << std::endl;
+    return;
+  }
+  parent.Add(kStatBytesOut, 100);
+  parent.Adjust(kStatActiveConnections, 1);
+  parent.Set(kStatLoopLagMicros, 5000);
+  int ready[2], done[2];
+  if (::pipe(ready) != 0 || ::pipe(done) != 0) return;
+  pid_t pid = ::fork();
+  if (pid == 0) {
+    Stats child;
+    if (child.Open(path, error)) {
+      child.Add(kStatBytesOut, 23);
+      child.Adjust(kStatActiveConnections, 2);
+      child.Set(kStatBufferedBytes, 4096);
+      child.Set(kStatLoopLagMicros, 2000);
+    }
+    char c = 1;
+    ::write(ready[1], &c, 1);
+    ::read(done[0], &c, 1);
+    ::_exit(0);
+  }
+  char c;
+  ::read(ready[0], &c, 1);
+  // Counters are summed across processes while both are running
+  std::string text = parent.Render();
+  if (!hasLine(text, "selfserv_sent_bytes_total 123") ||
+      !hasLine(text, "selfserv_connections_active 3") ||
+      !hasLine(text, "selfserv_processes 2"))
+    std::cerr << "FAIL live sums:\n" << text << std::endl;
+  // Gauges add up, except the loop lag: the worst process counts
+  if (!hasLine(text, "selfserv_buffered_bytes 4096") ||
+      !hasLine(text, "selfserv_event_loop_lag_seconds 0.005"))
+    std::cerr << "FAIL gauges:\n" << text << std::endl;
+  ::write(done[1], &c, 1);
+  int status;
+  ::waitpid(pid, &status, 0);
+  // An exited process keeps its counters but not its gauges
+  text = parent.Render();
+  if (!hasLine(text, "selfserv_sent_bytes_total 123") ||
+      !hasLine(text, "selfserv_connections_active 1") ||
+      !hasLine(text, "selfserv_processes 1"))
+    std::cerr << "FAIL after exit:\n" << text << std::endl;
+  // Its slot is taken over, and the total does not go backwards
+  Stats restarted;
+  restarted.Open(path, error);
+  restarted.Add(kStatBytesOut, 1);
+  text = parent.Render();
+  if (!hasLine(text, "selfserv_sent_bytes_total 124"))
+    std::cerr << "FAIL after restart:\n" << text << std::endl;
+  ::close(ready[0]);
+  ::close(ready[1]);
+  ::close(done[0]);
+  ::close(done[1]);
+  ::unlink(path);
+}
+
+#ifdef HAVE_CRITERION
+Test(Stats, private_counters) { stats_private_impl(); }
+Test(Stats, shared) { stats_shared_impl(); }
+#else
+int main() {
+  stats_private_impl();
+  stats_shared_impl();
+  return 0;
+}
+#endif
@@ -0,0 +1,79 @@
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "server/TrafficCapture.hpp"
+
+#ifdef __has_include
+# if __has_include(<criterion/criterion.h>)
+#  define HAVE_CRITERION 1
+# endif
+#endif
+
+#ifdef HAVE_CRITERION
+#include <criterion/criterion.h>
+#endif
+
+static CapturedRequest makeRequest(const std::string &head,
+                                   const std::string &body, size_t total) {
+  CapturedRequest rec;
+  rec.connection = 7;
+  rec.arrivalUs = 1234567;
+  rec.pipelined = false;
+  rec.head = head.data();
+  rec.headLength = head.size();
+  rec.body = body.data();
+  rec.bodyLength = body.size();
+  rec.bodyTotal = total;
+  return rec;
+}
+
+static void traffic_capture_impl() {
+  char path[64];
+  std::snprintf(path, sizeof(path), "/tmp/test_capture.%d", (int)::getpid());
+  ::unlink(path);
+  std::string error;
+  {
+    TrafficCapture capture;
+    if (!capture.Open(path, error)) {
+      std::cerr << "FAIL open: " << error << std::endl;
+      return;
+    }
+    std::string get = "GET /a?b=\"c\" HTTP/1.1\r\nHost: x\r\n\r\n";
+    capture.Record(makeRequest(get, "", 0));
+    // A head that is not plain text, and a body cut at the limit
+    std::string post = "POST / HTTP/1.1\r\nX: \xc3\xa9\r\n\r\n";
+    CapturedRequest rec = makeRequest(post, std::string("ab\0", 3), 10);
+    rec.pipelined = true;
+    capture.Record(rec);
+    if (capture.Records() != 2) std::cerr << "FAIL record count" << std::endl;
+  }  // flushed when destroyed
+  std::ifstream in(path);
+  std::stringstream text;
+  text << in.rdbuf();
+  std::ostringstream expected;
+  expected << "{\"t\":1234567,\"pid\":" << ::getpid()
+           << ",\"conn\":7,\"pipelined\":false,\"head\":\"GET /a?b=\\\"c\\\" "
+              "HTTP/1.1\\r\\nHost: x\\r\\n\\r\\n\",\"body_length\":0}\n"
+           << "{\"t\":1234567,\"pid\":" << ::getpid()
+           << ",\"conn\":7,\"pipelined\":true,\"head_b64\":"
+              "\"UE9TVCAvIEhUVFAvMS4xDQpYOiDDqQ0KDQo=\",\"body_b64\":\"YWIA\","
+              "\"body_length\":10}\n";
+  if (text.str() != expected.str())
+    std::cerr << "FAIL lines:\n" << text.str() << "expected:\n"
+              << expected.str() << std::endl;
+  ::unlink(path);
+}
+
+#ifdef HAVE_CRITERION
+Test(TrafficCapture, lines) { traffic_capture_impl(); }
+#else
+int main() {
+  traffic_capture_impl();
+  return 0;
+}
+#endif
@@ -0,0 +1,78 @@
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "server/UploadSession.hpp"
+
+#ifdef __has_include
+# if __has_include(<criterion/criterion.h>)
+#  define HAVE_CRITERION 1
+# endif
+#endif
+
+#ifdef HAVE_CRITERION
+#include <criterion/criterion.h>
+#endif
+
+static void check(bool ok, const char *what) {
+  if (!ok) std::cerr << "FAIL " << what << std::endl;
+}
+
+static void writeFile(const std::string &path, const std::string &data) {
+  FILE *f = std::fopen(path.c_str(), "wb");
+  if (!f) return;
+  std::fwrite(data.data(), 1, data.size(), f);
+  std::fclose(f);
+}
+
+static std::string readAll(const std::string &path) {
+  std::string out;
+  FILE *f = std::fopen(path.c_str(), "rb");
+  if (!f) return out;
+  char buf[256];
+  size_t n;
+  while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0) out.append(buf, n);
+  std::fclose(f);
+  return out;
+}
+
+static void upload_session_assemble_impl() {
+  char dir[] = "/tmp/upload_session_XXXXXX";
+  if (!mkdtemp(dir)) return;
+  std::string target = std::string(dir) + "/obj";
+  std::string id, part;
+  check(CreateUploadSession(target, id) == 0 && id.size() == 16, "create");
+  check(!UploadSessionPart(target, "../../etc/passw", 1, part), "bad id");
+  check(!UploadSessionPart(target, id, 0, part), "part 0");
+  check(UploadSessionPart(target, id, 3, part), "part 3");
+  writeFile(part, "world");
+  FileAssembly gap;
+  check(BeginSessionAssembly(target, id, gap) == 409, "gap");
+  UploadSessionPart(target, id, 1, part);
+  writeFile(part, "hello");
+  UploadSessionPart(target, id, 2, part);
+  writeFile(part, ", ");
+  FileAssembly join;
+  check(BeginSessionAssembly(target, id, join) == 0 &&
+            join.SourceCount() == 3,
+        "begin");
+  int steps = 0;
+  while (join.Step(2)) ++steps;  // two bytes per slice
+  check(steps >= 5, "sliced");
+  check(join.Finish() == 201 && join.Size() == 12, "finish");
+  check(readAll(target) == "hello, world", "content");
+  struct stat st;
+  check(stat(UploadSessionDir(target, id).c_str(), &st) != 0, "cleaned up");
+  std::remove(target.c_str());
+  rmdir(dir);
+}
+
+#ifdef HAVE_CRITERION
+Test(UploadSession, assemble) { upload_session_assemble_impl(); }
+#else
+int main() { upload_session_assemble_impl(); return 0; }
+#endif
@@ -0,0 +1,62 @@
+#include <string>
+#include <iostream>
+
+#include "http/Uri.hpp"
+
+#ifdef __has_include
+# if __has_include(<criterion/criterion.h>)
+#  define HAVE_CRITERION 1
+# endif
+#endif
+
+#ifdef HAVE_CRITERION
+#include <criterion/criterion.h>
+#endif
+
+static void expect(const char *target, const char *path, const char *query) {
+  std::string p, q;
+  if (!NormalizeRequestTarget(target, p, q) || p != path || q != query)
+    std::cerr << "FAIL " << target << " -> " << p << " ? " << q << std::endl;
+}
+
+static void reject(const char *target) {
+  std::string p, q;
+  if (NormalizeRequestTarget(target, p, q))
+    std::cerr << "FAIL accepted " << target << std::endl;
+}
+
+static void uri_normalize_impl() {
+  expect("/", "/", "");
+  expect("/a//b///c", "/a/b/c", "");
+  expect("/a/./b/.", "/a/b/", "");
+  expect("/a/b/../c/..", "/a/", "");
+  expect("/%7euser/%41%62", "/~user/Ab", "");
+  expect("/a/%2e%2E/b", "/b", "");
+  expect("/a%2Fb", "/a/b", "");
+  expect("/.well-known/..x", "/.well-known/..x", "");
+  expect("/p?x=%20&y=/..#frag", "/p", "x=%20&y=/..");
+  expect("/p#frag?no", "/p", "");
+  expect("http://example.com:8080/a/./b?q", "/a/b", "q");
+  expect("http://example.com", "/", "");
+  expect("*", "*", "");
+}
+
+static void uri_reject_impl() {
+  reject("");
+  reject("relative/path");
+  reject("/..");
+  reject("/a/../..");
+  reject("/%2e%2e/etc/passwd");
+  reject("/a%2");
+  reject("/a%g0");
+  reject("/a%00b");
+  reject("/a b");
+  reject("/a\tb");
+}
+
+#ifdef HAVE_CRITERION
+Test(Uri, normalize) { uri_normalize_impl(); }
+Test(Uri, reject) { uri_reject_impl(); }
+#else
+int main() { uri_normalize_impl(); uri_reject_impl(); return 0; }
+#endif
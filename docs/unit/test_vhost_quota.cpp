@@ -0,0 +1,72 @@
+#include <iostream>
+
+#include "server/VhostQuota.hpp"
+
+#ifdef __has_include
+# if __has_include(<criterion/criterion.h>)
+#  define HAVE_CRITERION 1
+# endif
+#endif
+
+#ifdef HAVE_CRITERION
+#include <criterion/criterion.h>
+#endif
+
+static void vhost_quota_rate_impl() {
+  VhostQuota quota;
+  quota.Configure(0, 0, 0, 10, 3);  // 10/s, bursts of 3
+  const char *why = "";
+  unsigned long now = 1000000;
+  for (int i = 0; i < 3; ++i)
+    if (quota.Admit(false, now, why) != 0)
+      std::cerr << "FAIL burst request " << i << std::endl;
+  if (quota.Admit(false, now, why) != 429)
+    std::cerr << "FAIL beyond burst admitted" << std::endl;
+  // One token every 100 ms
+  if (quota.Admit(false, now + 50000, why) != 429)
+    std::cerr << "FAIL admitted before refill" << std::endl;
+  if (quota.Admit(false, now + 100000, why) != 0)
+    std::cerr << "FAIL refill not admitted" << std::endl;
+  // A long pause refills only up to the burst
+  now += 60 * 1000000UL;
+  int admitted = 0;
+  for (int i = 0; i < 10; ++i) admitted += quota.Admit(false, now, why) == 0;
+  if (admitted != 3)
+    std::cerr << "FAIL burst after pause " << admitted << std::endl;
+}
+
+static void vhost_quota_limits_impl() {
+  VhostQuota quota;
+  quota.Configure(2, 1000, 1, 0, 0);
+  const char *why = "";
+  if (quota.Admit(true, 1, why) != 0 || quota.Admit(true, 1, why) != 0)
+    std::cerr << "FAIL connections under the limit" << std::endl;
+  if (quota.Admit(true, 1, why) != 503)
+    std::cerr << "FAIL third connection admitted" << std::endl;
+  // Attached connections keep sending requests
+  if (quota.Admit(false, 1, why) != 0)
+    std::cerr << "FAIL request on an attached connection" << std::endl;
+  quota.Detach();
+  if (quota.Admit(true, 1, why) != 0)
+    std::cerr << "FAIL connection after a detach" << std::endl;
+  quota.SetBuffered(1000);
+  if (quota.Admit(false, 1, why) != 503)
+    std::cerr << "FAIL admitted over the buffer limit" << std::endl;
+  quota.SetBuffered(0);
+  quota.StartCgi();
+  if (quota.CgiAvailable())
+    std::cerr << "FAIL second CGI available" << std::endl;
+  quota.EndCgi();
+  if (!quota.CgiAvailable()) std::cerr << "FAIL CGI not released" << std::endl;
+}
+
+#ifdef HAVE_CRITERION
+Test(VhostQuota, rate) { vhost_quota_rate_impl(); }
+Test(VhostQuota, limits) { vhost_quota_limits_impl(); }
+#else
+int main() {
+  vhost_quota_rate_impl();
+  vhost_quota_limits_impl();
+  return 0;
+}
+#endif
@@ -0,0 +1,209 @@
+#include <stdint.h>
+
+#include <string>
+#include <iostream>
+
+#include "http/WebSocket.hpp"
+
+#ifdef __has_include
+# if __has_include(<criterion/criterion.h>)
+#  define HAVE_CRITERION 1
+# endif
+#endif
+
+#ifdef HAVE_CRITERION
+#include <criterion/criterion.h>
+#endif
+
+static const unsigned char kMask[4] = {0x37, 0xfa, 0x21, 0x3d};
+
+static std::string bytes(const unsigned char *data, size_t len) {
+  return std::string(reinterpret_cast<const char *>(data), len);
+}
+
+// Client frame header with the given payload length, masked with kMask
+static std::string clientFrame(unsigned char b0, const std::string &payload) {
+  std::string out;
+  out += static_cast<char>(b0);
+  size_t len = payload.size();
+  if (len < 126) {
+    out += static_cast<char>(0x80 | len);
+  } else if (len < 65536) {
+    out += static_cast<char>(0x80 | 126);
+    out += static_cast<char>(len >> 8);
+    out += static_cast<char>(len & 0xff);
+  } else {
+    out += static_cast<char>(0x80 | 127);
+    for (int shift = 56; shift >= 0; shift -= 8)
+      out += static_cast<char>((static_cast<uint64_t>(len) >> shift) & 0xff);
+  }
+  out += bytes(kMask, 4);
+  for (size_t i = 0; i < len; ++i)
+    out += static_cast<char>(payload[i] ^ kMask[i & 3]);
+  return out;
+}
+
+static void ws_accept_key_impl() {
+  // RFC 6455 section 1.3
+  std::string accept = WebSocketAcceptKey("dGhlIHNhbXBsZSBub25jZQ==");
+  if (accept != "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=")
+    std::cerr << "FAIL accept key " << accept << std::endl;
+}
+
+static void ws_parse_impl() {
+  // RFC 6455 section 5.7: a masked "Hello"
+  const unsigned char hello[] = {0x81, 0x85, 0x37, 0xfa, 0x21, 0x3d,
+                                 0x7f, 0x9f, 0x4d, 0x51, 0x58};
+  std::string whole = bytes(hello, sizeof(hello)) + "\x81";
+  // Every prefix of the frame, headers included, waits for more
+  for (size_t len = 0; len < sizeof(hello); ++len) {
+    WebSocketParser parser;
+    WsFrame frame;
+    std::string in = whole.substr(0, len);
+    if (parser.Parse(in, frame) != WebSocketParser::kWsNeedMore ||
+        in.size() != len)
+      std::cerr << "FAIL need more at " << len << std::endl;
+  }
+  WebSocketParser parser;
+  WsFrame frame;
+  if (parser.Parse(whole, frame) != WebSocketParser::kWsFrame ||
+      frame.payload != "Hello" || !frame.fin ||
+      frame.opcode != kWsOpText || whole != "\x81")
+    std::cerr << "FAIL hello" << std::endl;
+
+  // Extended lengths, split inside the 16- and 64-bit length fields
+  const size_t sizes[] = {125, 126, 65535, 65536};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    std::string payload(sizes[i], 'p');
+    std::string in = clientFrame(0x82, payload);
+    std::string head = in.substr(0, 3);
+    WebSocketParser big(1 << 20);
+    if (big.Parse(head, frame) != WebSocketParser::kWsNeedMore)
+      std::cerr << "FAIL split length " << sizes[i] << std::endl;
+    if (big.Parse(in, frame) != WebSocketParser::kWsFrame ||
+        frame.payload != payload || !in.empty())
+      std::cerr << "FAIL length " << sizes[i] << std::endl;
+  }
+
+  struct Case {
+    const char *what;
+    std::string frame;
+    int code;
+  };
+  std::string unmasked = clientFrame(0x81, "Hello");
+  unmasked[1] = static_cast<char>(unmasked[1] & 0x7f);
+  const Case cases[] = {
+      {"unmasked", unmasked, kWsCloseProtocolError},
+      {"RSV bit", clientFrame(0xc1, "x"), kWsCloseProtocolError},
+      {"reserved opcode", clientFrame(0x83, "x"), kWsCloseProtocolError},
+      {"control frame over 125 bytes",
+       clientFrame(0x89, std::string(126, 'p')), kWsCloseProtocolError},
+      {"fragmented control frame", clientFrame(0x09, "p"),
+       kWsCloseProtocolError},
+      {"oversized", clientFrame(0x82, std::string(1025, 'x')),
+       kWsCloseTooBig},
+      {"64-bit length", std::string("\x82\xff\x00\x00\x00\x01\x00\x00\x00\x00",
+                                    10),
+       kWsCloseTooBig},
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+    WebSocketParser limited(1024);
+    // The header alone is enough to reject
+    std::string in = cases[i].frame.substr(0, 14);
+    if (limited.Parse(in, frame) != WebSocketParser::kWsError ||
+        limited.CloseCode() != cases[i].code)
+      std::cerr << "FAIL " << cases[i].what << std::endl;
+  }
+}
+
+static void ws_unmask_impl() {
+  // Lengths around the 16-byte SIMD and 8-byte word strides, at every key
+  // phase and from an unaligned start
+  char buf[80];
+  char want[80];
+  for (size_t len = 0; len <= 70; ++len) {
+    for (size_t offset = 0; offset < 4; ++offset) {
+      for (size_t i = 0; i < len; ++i) {
+        buf[1 + i] = static_cast<char>(i * 7 + 1);
+        want[i] = static_cast<char>(buf[1 + i] ^ kMask[(offset + i) & 3]);
+      }
+      buf[1 + len] = 'z';
+      WebSocketUnmask(buf + 1, len, kMask, offset);
+      if (std::string(buf + 1, len) != std::string(want, len) ||
+          buf[1 + len] != 'z')
+        std::cerr << "FAIL unmask len " << len << " offset " << offset
+                  << std::endl;
+    }
+  }
+  // Unmasking in pieces carries the key phase across calls
+  std::string payload = "a payload unmasked across three separate calls";
+  std::string masked = clientFrame(0x81, payload).substr(6);
+  WebSocketUnmask(&masked[0], 5, kMask, 0);
+  WebSocketUnmask(&masked[5], 19, kMask, 5);
+  WebSocketUnmask(&masked[24], masked.size() - 24, kMask, 24 & 3);
+  if (masked != payload) std::cerr << "FAIL unmask in pieces" << std::endl;
+}
+
+static void ws_encode_impl() {
+  // RFC 6455 section 5.7: unmasked "Hello" from the server
+  const unsigned char hello[] = {0x81, 0x05, 0x48, 0x65, 0x6c, 0x6c, 0x6f};
+  if (WebSocketEncodeFrame(kWsOpText, "Hello") != bytes(hello, 7))
+    std::cerr << "FAIL encode hello" << std::endl;
+  std::string frame = WebSocketEncodeFrame(kWsOpBinary, std::string(256, 'x'));
+  if (frame.substr(0, 4) != std::string("\x82\x7e\x01\x00", 4) ||
+      frame.size() != 260)
+    std::cerr << "FAIL encode 16-bit length" << std::endl;
+  frame = WebSocketEncodeFrame(kWsOpBinary, std::string(65536, 'x'));
+  if (frame.substr(0, 10) !=
+          std::string("\x82\x7f\x00\x00\x00\x00\x00\x01\x00\x00", 10) ||
+      frame.size() != 65546)
+    std::cerr << "FAIL encode 64-bit length" << std::endl;
+  if (WebSocketCloseFrame(kWsCloseTooBig) != std::string("\x88\x02\x03\xf1"))
+    std::cerr << "FAIL close frame" << std::endl;
+}
+
+static void ws_record_impl() {
+  std::string stream;
+  AppendWsRecord(stream, kWsRecordText, 0x01020304, "hi");
+  AppendWsRecord(stream, kWsRecordClose, 7, "");
+  if (stream.size() != 2 * kWsRecordHeaderLen + 2 ||
+      stream.substr(0, kWsRecordHeaderLen) !=
+          std::string("T\x01\x02\x03\x04\x00\x00\x00\x02", 9))
+    std::cerr << "FAIL record layout" << std::endl;
+  char type;
+  uint32_t id;
+  std::string payload;
+  // A partial record, header or payload, leaves pos where it was
+  for (size_t len = 0; len < kWsRecordHeaderLen + 2; ++len) {
+    size_t pos = 0;
+    if (ParseWsRecord(stream.substr(0, len), pos, type, id, payload) ||
+        pos != 0)
+      std::cerr << "FAIL partial record at " << len << std::endl;
+  }
+  size_t pos = 0;
+  if (!ParseWsRecord(stream, pos, type, id, payload) || type != 'T' ||
+      id != 0x01020304 || payload != "hi" || pos != kWsRecordHeaderLen + 2)
+    std::cerr << "FAIL first record" << std::endl;
+  if (!ParseWsRecord(stream, pos, type, id, payload) || type != 'C' ||
+      id != 7 || !payload.empty() || pos != stream.size())
+    std::cerr << "FAIL second record" << std::endl;
+  if (ParseWsRecord(stream, pos, type, id, payload))
+    std::cerr << "FAIL record past the end" << std::endl;
+}
+
+#ifdef HAVE_CRITERION
+Test(WebSocket, accept_key) { ws_accept_key_impl(); }
+Test(WebSocket, parse) { ws_parse_impl(); }
+Test(WebSocket, unmask) { ws_unmask_impl(); }
+Test(WebSocket, encode) { ws_encode_impl(); }
+Test(WebSocket, records) { ws_record_impl(); }
+#else
+int main() {
+  ws_accept_key_impl();
+  ws_parse_impl();
+  ws_unmask_impl();
+  ws_encode_impl();
+  ws_record_impl();
+  return 0;
+}
+#endif
@@ -0,0 +1,83 @@
+// Immutable, reference-counted byte buffer (C++98, header-only).
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Content shared by several connections -- a broadcast WebSocket frame, a
+// coalesced or cached response body -- is stored once and each connection
+// queues a handle, so fan-out costs a pointer copy instead of a payload copy.
+// Single-threaded: the count is a plain integer.
+class SharedBuffer {
+ public:
+  SharedBuffer() : m_rep(0) {}
+  explicit SharedBuffer(const std::string &data) : m_rep(new Rep) {
+    m_rep->data = data;
+    m_rep->borrowed = 0;
+    m_rep->borrowedSize = 0;
+    m_rep->release = 0;
+    m_rep->context = 0;
+    m_rep->refs = 1;
+  }
+  // Refers to bytes that outlive every handle (static data such as embedded
+  // assets) without copying them
+  static SharedBuffer Borrow(const char *data, size_t size) {
+    return Borrow(data, size, 0, 0);
+  }
+  // Refers to bytes that stay valid until release(context) runs, which
+  // happens when the last handle goes away (a pinned cache entry)
+  static SharedBuffer Borrow(const char *data, size_t size,
+                             void (*release)(void *), void *context) {
+    SharedBuffer buf;
+    buf.m_rep = new Rep;
+    buf.m_rep->borrowed = data;
+    buf.m_rep->borrowedSize = size;
+    buf.m_rep->release = release;
+    buf.m_rep->context = context;
+    buf.m_rep->refs = 1;
+    return buf;
+  }
+  SharedBuffer(const SharedBuffer &other) : m_rep(other.m_rep) {
+    if (m_rep) ++m_rep->refs;
+  }
+  SharedBuffer &operator=(const SharedBuffer &other) {
+    if (m_rep != other.m_rep) {
+      Release();
+      m_rep = other.m_rep;
+      if (m_rep) ++m_rep->refs;
+    }
+    return *this;
+  }
+  ~SharedBuffer() { Release(); }
+
+  const char *Data() const {
+    if (!m_rep) return 0;
+    return m_rep->borrowed ? m_rep->borrowed : m_rep->data.data();
+  }
+  size_t Size() const {
+    if (!m_rep) return 0;
+    return m_rep->borrowed ? m_rep->borrowedSize : m_rep->data.size();
+  }
+
+ private:
+  struct Rep {
+    std::string data;
+    const char *borrowed;  // not owned; used instead of data when set
+    size_t borrowedSize;
+    void (*release)(void *);  // called once the last handle is gone
+    void *context;
+    size_t refs;
+  };
+  // Detaches before the count drops, so nothing of this handle is touched
+  // once the representation may be gone
+  void Release() {
+    Rep *rep = m_rep;
+    m_rep = 0;
+    if (rep && --rep->refs == 0) {
+      if (rep->release) rep->release(rep->context);
+      delete rep;
+    }
+  }
+
+  Rep *m_rep;
+};
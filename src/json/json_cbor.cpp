@@ -0,0 +1,498 @@
+#include "json_cbor.hpp"
+
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// CBOR major types (RFC 8949 section 3.1)
+const unsigned char kMajorUnsigned = 0;
+const unsigned char kMajorNegative = 1;
+const unsigned char kMajorBytes = 2;
+const unsigned char kMajorText = 3;
+const unsigned char kMajorArray = 4;
+const unsigned char kMajorMap = 5;
+const unsigned char kMajorTag = 6;
+const unsigned char kMajorSimple = 7;
+
+const unsigned char kInfoIndefinite = 31;
+const unsigned char kBreakByte = 0xff;
+
+const unsigned char kSimpleFalse = 0xf4;
+const unsigned char kSimpleTrue = 0xf5;
+const unsigned char kSimpleNull = 0xf6;
+const unsigned char kFloat16 = 0xf9;
+const unsigned char kFloat32 = 0xfa;
+const unsigned char kFloat64 = 0xfb;
+
+// Nesting limit so hostile input cannot exhaust the stack while decoding
+const size_t kMaxDepth = 512;
+
+// 2^63: integral doubles below this magnitude round-trip through int64
+const double kTwo63 = 9223372036854775808.0;
+
+double DecodeHalf(unsigned int half) {
+  int exponent = (half >> 10) & 0x1f;
+  int mantissa = half & 0x3ff;
+  double value;
+  if (exponent == 0) {
+    value = std::ldexp(static_cast<double>(mantissa), -24);
+  } else if (exponent != 31) {
+    value = std::ldexp(static_cast<double>(mantissa + 1024), exponent - 25);
+  } else {
+    value = mantissa == 0 ? std::numeric_limits<double>::infinity()
+                          : std::numeric_limits<double>::quiet_NaN();
+  }
+  return (half & 0x8000) ? -value : value;
+}
+
+// Inverse of DecodeHalf for finite values: false unless the half-precision
+// form holds the value exactly
+bool EncodeHalf(double value, unsigned int& half) {
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  half = (bits >> 63) != 0 ? 0x8000 : 0;
+  double magnitude = std::fabs(value);
+  if (magnitude == 0) return true;
+  int exponent;
+  std::frexp(magnitude, &exponent);
+  double mantissa;
+  if (exponent > 16 || exponent < -23) return false;
+  if (exponent >= -13) {
+    mantissa = std::ldexp(magnitude, 11 - exponent);
+    if (mantissa != std::floor(mantissa)) return false;
+    half |= (exponent + 14) << 10;
+    half |= static_cast<unsigned int>(mantissa) - 1024;
+  } else {
+    mantissa = std::ldexp(magnitude, 24);
+    if (mantissa != std::floor(mantissa)) return false;
+    half |= static_cast<unsigned int>(mantissa);
+  }
+  return true;
+}
+
+void ThrowDecodeError(const std::string& message) {
+  throw std::runtime_error("CBOR Decode Error: " + message);
+}
+
+}  // namespace
+
+// CborReader implementation
+CborReader::CborReader(const char* data, size_t size)
+    : m_start(data), m_current(data), m_end(data + size) {}
+
+CborReader::~CborReader() {}
+
+void CborReader::Read(CborItem& item) {
+  unsigned char initial = NextByte();
+  unsigned char major = initial >> 5;
+  unsigned char info = initial & 0x1f;
+
+  // Tags carry semantics JSON cannot express; decode the tagged item as-is
+  while (major == kMajorTag) {
+    if (info == kInfoIndefinite) {
+      ThrowError("Invalid tag encoding");
+    }
+    ReadArgument(info);
+    initial = NextByte();
+    major = initial >> 5;
+    info = initial & 0x1f;
+  }
+
+  item = CborItem();
+  switch (major) {
+    case kMajorUnsigned:
+      item.type = kJsonNumber;
+      item.numberValue = static_cast<double>(ReadArgument(info));
+      return;
+    case kMajorNegative:
+      item.type = kJsonNumber;
+      item.numberValue = -1.0 - static_cast<double>(ReadArgument(info));
+      return;
+    case kMajorBytes:
+    case kMajorText: {
+      if (info == kInfoIndefinite) {
+        ThrowError("Indefinite-length strings are not supported");
+      }
+      uint64_t length = ReadArgument(info);
+      if (length > static_cast<uint64_t>(m_end - m_current)) {
+        ThrowError("String length exceeds remaining input");
+      }
+      item.type = kJsonString;
+      item.size = static_cast<size_t>(length);
+      item.data = Take(item.size);
+      return;
+    }
+    case kMajorArray:
+    case kMajorMap: {
+      item.type = major == kMajorArray ? kJsonArray : kJsonObject;
+      if (info == kInfoIndefinite) {
+        item.size = CborItem::kIndefinite;
+        return;
+      }
+      // Every member takes at least one byte, which bounds honest counts
+      uint64_t count = ReadArgument(info);
+      uint64_t members = major == kMajorArray ? count : count * 2;
+      if (count > static_cast<uint64_t>(m_end - m_current) ||
+          members > static_cast<uint64_t>(m_end - m_current)) {
+        ThrowError("Container length exceeds remaining input");
+      }
+      item.size = static_cast<size_t>(count);
+      return;
+    }
+    default:
+      break;
+  }
+
+  // Major type 7: simple values and floats
+  switch (initial) {
+    case kSimpleFalse:
+    case kSimpleTrue:
+      item.type = kJsonBool;
+      item.boolValue = initial == kSimpleTrue;
+      return;
+    case kSimpleNull:
+    case 0xf7:  // undefined
+      item.type = kJsonNull;
+      return;
+    case kFloat16:
+      item.type = kJsonNumber;
+      item.numberValue =
+          DecodeHalf(static_cast<unsigned int>(ReadArgument(info)));
+      return;
+    case kFloat32: {
+      uint32_t bits = static_cast<uint32_t>(ReadArgument(info));
+      float value;
+      std::memcpy(&value, &bits, sizeof(value));
+      item.type = kJsonNumber;
+      item.numberValue = value;
+      return;
+    }
+    case kFloat64: {
+      uint64_t bits = ReadArgument(info);
+      std::memcpy(&item.numberValue, &bits, sizeof(item.numberValue));
+      item.type = kJsonNumber;
+      return;
+    }
+    case kBreakByte:
+      ThrowError("Unexpected break");
+      return;  // Never reached
+    default:
+      ThrowError("Unsupported simple value");
+  }
+}
+
+bool CborReader::ReadBreak() {
+  if (m_current >= m_end) {
+    ThrowError("Unexpected end of CBOR");
+  }
+  if (static_cast<unsigned char>(*m_current) != kBreakByte) {
+    return false;
+  }
+  ++m_current;
+  return true;
+}
+
+void CborReader::SkipValue() {
+  // Explicit stack of outstanding member counts keeps skipping iterative
+  std::vector<size_t> pending(1, 1);
+  while (!pending.empty()) {
+    size_t& top = pending.back();
+    if (top == CborItem::kIndefinite) {
+      if (ReadBreak()) {
+        pending.pop_back();
+        continue;
+      }
+    } else if (top == 0) {
+      pending.pop_back();
+      continue;
+    } else {
+      --top;
+    }
+
+    CborItem item;
+    Read(item);
+    if (item.type == kJsonArray) {
+      pending.push_back(item.size);
+    } else if (item.type == kJsonObject) {
+      pending.push_back(item.size == CborItem::kIndefinite ? item.size
+                                                           : item.size * 2);
+    }
+  }
+}
+
+bool CborReader::AtEnd() const { return m_current >= m_end; }
+
+size_t CborReader::GetOffset() const { return m_current - m_start; }
+
+uint64_t CborReader::ReadArgument(unsigned char info) {
+  if (info < 24) {
+    return info;
+  }
+  size_t width;
+  switch (info) {
+    case 24:
+      width = 1;
+      break;
+    case 25:
+      width = 2;
+      break;
+    case 26:
+      width = 4;
+      break;
+    case 27:
+      width = 8;
+      break;
+    default:
+      ThrowError("Invalid additional information");
+      return 0;  // Never reached
+  }
+  const unsigned char* bytes =
+      reinterpret_cast<const unsigned char*>(Take(width));
+  uint64_t value = 0;
+  for (size_t i = 0; i < width; ++i) {
+    value = (value << 8) | bytes[i];
+  }
+  return value;
+}
+
+unsigned char CborReader::NextByte() {
+  return static_cast<unsigned char>(*Take(1));
+}
+
+const char* CborReader::Take(size_t count) {
+  if (static_cast<size_t>(m_end - m_current) < count) {
+    ThrowError("Unexpected end of CBOR");
+  }
+  const char* at = m_current;
+  m_current += count;
+  return at;
+}
+
+void CborReader::ThrowError(const std::string& message) const {
+  std::ostringstream oss;
+  oss << message << " at offset " << (m_current - m_start);
+  ThrowDecodeError(oss.str());
+}
+
+// CborEncoder implementation
+CborEncoder::CborEncoder() {}
+
+CborEncoder::~CborEncoder() {}
+
+std::string CborEncoder::Encode(const JsonValue& value) {
+  std::string out;
+  EncodeValue(value, out);
+  return out;
+}
+
+void CborEncoder::Encode(const JsonValue& value, std::string& out) {
+  EncodeValue(value, out);
+}
+
+void CborEncoder::EncodeValue(const JsonValue& value, std::string& out) {
+  switch (value.GetType()) {
+    case kJsonNull:
+      out += static_cast<char>(kSimpleNull);
+      break;
+    case kJsonBool:
+      out += static_cast<char>(
+          static_cast<const JsonBool&>(value).GetValue() ? kSimpleTrue
+                                                         : kSimpleFalse);
+      break;
+    case kJsonNumber:
+      EncodeNumber(static_cast<const JsonNumber&>(value).GetValue(), out);
+      break;
+    case kJsonString:
+      WriteString(static_cast<const JsonString&>(value).GetValue(), out);
+      break;
+    case kJsonArray: {
+      const JsonArray& array = static_cast<const JsonArray&>(value);
+      WriteHead(kMajorArray, array.GetSize(), out);
+      for (size_t i = 0; i < array.GetSize(); ++i) {
+        EncodeValue(*array.GetValue(i), out);
+      }
+      break;
+    }
+    case kJsonObject: {
+      const JsonObject& object = static_cast<const JsonObject&>(value);
+      WriteHead(kMajorMap, object.GetSize(), out);
+      for (JsonObject::ConstIterator it = object.Begin(); it != object.End();
+           ++it) {
+        WriteString(it->first, out);
+        EncodeValue(*it->second, out);
+      }
+      break;
+    }
+  }
+}
+
+void CborEncoder::EncodeNumber(double value, std::string& out) {
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  bool negativeZero = value == 0 && (bits >> 63) != 0;
+
+  if (!negativeZero && value == std::floor(value) && value >= -kTwo63 &&
+      value < kTwo63) {
+    if (value >= 0) {
+      WriteHead(kMajorUnsigned, static_cast<uint64_t>(value), out);
+    } else {
+      WriteHead(kMajorNegative, static_cast<uint64_t>(-value) - 1, out);
+    }
+    return;
+  }
+
+  // Prefer the 2- or 4-byte form when it round-trips exactly
+  unsigned int half;
+  if (std::fabs(value) <= FLT_MAX && EncodeHalf(value, half)) {
+    out += static_cast<char>(kFloat16);
+    out += static_cast<char>(half >> 8);
+    out += static_cast<char>(half & 0xff);
+    return;
+  }
+  if (std::fabs(value) <= FLT_MAX) {
+    float narrow = static_cast<float>(value);
+    if (static_cast<double>(narrow) == value) {
+      uint32_t narrowBits;
+      std::memcpy(&narrowBits, &narrow, sizeof(narrowBits));
+      out += static_cast<char>(kFloat32);
+      for (int shift = 24; shift >= 0; shift -= 8) {
+        out += static_cast<char>((narrowBits >> shift) & 0xff);
+      }
+      return;
+    }
+  }
+
+  out += static_cast<char>(kFloat64);
+  for (int shift = 56; shift >= 0; shift -= 8) {
+    out += static_cast<char>((bits >> shift) & 0xff);
+  }
+}
+
+void CborEncoder::WriteHead(unsigned char major, uint64_t argument,
+                            std::string& out) {
+  unsigned char initial = static_cast<unsigned char>(major << 5);
+  int width;
+  if (argument < 24) {
+    out += static_cast<char>(initial | argument);
+    return;
+  } else if (argument <= 0xff) {
+    out += static_cast<char>(initial | 24);
+    width = 1;
+  } else if (argument <= 0xffff) {
+    out += static_cast<char>(initial | 25);
+    width = 2;
+  } else if (argument <= 0xffffffffUL) {
+    out += static_cast<char>(initial | 26);
+    width = 4;
+  } else {
+    out += static_cast<char>(initial | 27);
+    width = 8;
+  }
+  for (int shift = (width - 1) * 8; shift >= 0; shift -= 8) {
+    out += static_cast<char>((argument >> shift) & 0xff);
+  }
+}
+
+void CborEncoder::WriteString(const std::string& value, std::string& out) {
+  WriteHead(kMajorText, value.size(), out);
+  out += value;
+}
+
+// CborDecoder implementation
+CborDecoder::CborDecoder() {}
+
+CborDecoder::~CborDecoder() {}
+
+JsonValue* CborDecoder::Decode(const std::string& data) {
+  return Decode(data.data(), data.size());
+}
+
+JsonValue* CborDecoder::Decode(const char* data, size_t size) {
+  CborReader reader(data, size);
+  if (reader.AtEnd()) {
+    ThrowDecodeError("Empty CBOR buffer");
+  }
+
+  JsonValue* result = DecodeValue(reader, 0);
+
+  if (!reader.AtEnd()) {
+    delete result;
+    ThrowDecodeError("Unexpected bytes after CBOR value");
+  }
+
+  return result;
+}
+
+JsonValue* CborDecoder::DecodeValue(CborReader& reader, size_t depth) {
+  if (depth > kMaxDepth) {
+    ThrowDecodeError("Nesting too deep");
+  }
+
+  CborItem item;
+  reader.Read(item);
+  switch (item.type) {
+    case kJsonNull:
+      return new JsonNull();
+    case kJsonBool:
+      return new JsonBool(item.boolValue);
+    case kJsonNumber:
+      return new JsonNumber(item.numberValue);
+    case kJsonString:
+      return new JsonString(std::string(item.data, item.size));
+    case kJsonArray:
+      return DecodeArray(reader, item, depth);
+    case kJsonObject:
+      return DecodeObject(reader, item, depth);
+  }
+  return NULL;  // Never reached
+}
+
+JsonArray* CborDecoder::DecodeArray(CborReader& reader, const CborItem& item,
+                                    size_t depth) {
+  JsonArray* array = new JsonArray();
+
+  try {
+    if (item.size == CborItem::kIndefinite) {
+      while (!reader.ReadBreak()) {
+        array->AddValue(DecodeValue(reader, depth + 1));
+      }
+    } else {
+      for (size_t i = 0; i < item.size; ++i) {
+        array->AddValue(DecodeValue(reader, depth + 1));
+      }
+    }
+    return array;
+  } catch (...) {
+    delete array;
+    throw;
+  }
+}
+
+JsonObject* CborDecoder::DecodeObject(CborReader& reader, const CborItem& item,
+                                      size_t depth) {
+  JsonObject* object = new JsonObject();
+
+  try {
+    size_t remaining = item.size;
+    while (item.size == CborItem::kIndefinite ? !reader.ReadBreak()
+                                              : remaining-- > 0) {
+      CborItem key;
+      reader.Read(key);
+      if (key.type != kJsonString) {
+        ThrowDecodeError("Expected string key in map");
+      }
+      JsonValue* value = DecodeValue(reader, depth + 1);
+      object->SetValue(std::string(key.data, key.size), value);
+    }
+    return object;
+  } catch (...) {
+    delete object;
+    throw;
+  }
+}
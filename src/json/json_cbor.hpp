@@ -0,0 +1,191 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+#include "json_parser.hpp"
+
+/**
+ * @brief One data item produced by CborReader
+ *
+ * Strings are returned as views into the caller's input buffer, so reading a
+ * document never copies string payloads. Containers report their element
+ * count (pairs for objects) in `size`, or CborItem::kIndefinite when the
+ * encoder used an indefinite-length array/map terminated by a break byte.
+ */
+struct CborItem {
+  static const size_t kIndefinite = static_cast<size_t>(-1);
+
+  JsonType type;
+  bool boolValue;
+  double numberValue;
+  const char* data;  // string bytes inside the input (not NUL-terminated)
+  size_t size;       // string length, or element/pair count for containers
+
+  CborItem()
+      : type(kJsonNull), boolValue(false), numberValue(0), data(NULL), size(0) {}
+};
+
+/**
+ * @brief Zero-copy pull reader over a CBOR (RFC 8949) buffer
+ *
+ * The reader maps CBOR major types onto the JsonType model: integers and
+ * floats become numbers, byte and text strings become strings, arrays and
+ * maps become arrays and objects. Tags are skipped transparently.
+ * Indefinite-length strings are rejected since they cannot be viewed in place.
+ * The input buffer must outlive every CborItem read from it.
+ */
+class CborReader {
+ public:
+  /**
+   * @brief Constructor
+   * @param data Start of the encoded buffer (not copied)
+   * @param size Number of bytes in the buffer
+   */
+  CborReader(const char* data, size_t size);
+
+  /**
+   * @brief Destructor
+   */
+  ~CborReader();
+
+  /**
+   * @brief Read the header of the next data item
+   * @param item Receives the item; container members follow in the stream
+   * @throws std::runtime_error on truncated or malformed input
+   */
+  void Read(CborItem& item);
+
+  /**
+   * @brief Consume a break byte closing an indefinite-length container
+   * @return true if a break was consumed, false if another item follows
+   * @throws std::runtime_error at end of input
+   */
+  bool ReadBreak();
+
+  /**
+   * @brief Skip the next data item including all nested members
+   * @throws std::runtime_error on truncated or malformed input
+   */
+  void SkipValue();
+
+  /**
+   * @brief Check whether the whole buffer has been consumed
+   * @return true if no bytes remain
+   */
+  bool AtEnd() const;
+
+  /**
+   * @brief Current read offset, useful for sequences of documents
+   * @return Number of bytes consumed so far
+   */
+  size_t GetOffset() const;
+
+ private:
+  uint64_t ReadArgument(unsigned char info);
+  unsigned char NextByte();
+  const char* Take(size_t count);
+  void ThrowError(const std::string& message) const;
+
+  // Disable copy constructor and assignment operator
+  CborReader(const CborReader&);
+  CborReader& operator=(const CborReader&);
+
+  // Data members
+  const char* m_start;
+  const char* m_current;
+  const char* m_end;
+};
+
+/**
+ * @brief Serializes a JsonValue tree to CBOR
+ *
+ * Integral numbers that fit in 64 bits are written as CBOR integers, all
+ * other numbers as the narrowest IEEE 754 float that holds them exactly.
+ * Lengths always use the definite form, so the output is canonical for a
+ * given tree (object keys are in map order).
+ */
+class CborEncoder {
+ public:
+  /**
+   * @brief Constructor
+   */
+  CborEncoder();
+
+  /**
+   * @brief Destructor
+   */
+  ~CborEncoder();
+
+  /**
+   * @brief Encode a value into a new buffer
+   * @param value Root of the tree to encode
+   * @return The encoded bytes
+   */
+  std::string Encode(const JsonValue& value);
+
+  /**
+   * @brief Append the encoding of a value to an existing buffer
+   * @param value Root of the tree to encode
+   * @param out Buffer that receives the bytes
+   */
+  void Encode(const JsonValue& value, std::string& out);
+
+ private:
+  void EncodeValue(const JsonValue& value, std::string& out);
+  void EncodeNumber(double value, std::string& out);
+  void WriteHead(unsigned char major, uint64_t argument, std::string& out);
+  void WriteString(const std::string& value, std::string& out);
+
+  // Disable copy constructor and assignment operator
+  CborEncoder(const CborEncoder&);
+  CborEncoder& operator=(const CborEncoder&);
+};
+
+/**
+ * @brief Builds a JsonValue tree from CBOR
+ *
+ * Produces the same DOM as JsonParser, so callers can switch between the text
+ * and binary representations without touching consumers of the tree.
+ */
+class CborDecoder {
+ public:
+  /**
+   * @brief Constructor
+   */
+  CborDecoder();
+
+  /**
+   * @brief Destructor
+   */
+  ~CborDecoder();
+
+  /**
+   * @brief Decode a single CBOR document
+   * @param data The encoded bytes
+   * @return Pointer to the root JsonValue (caller owns the memory)
+   * @throws std::runtime_error on malformed input or trailing bytes
+   */
+  JsonValue* Decode(const std::string& data);
+
+  /**
+   * @brief Decode a single CBOR document from a raw buffer
+   * @param data Start of the encoded bytes
+   * @param size Number of bytes
+   * @return Pointer to the root JsonValue (caller owns the memory)
+   * @throws std::runtime_error on malformed input or trailing bytes
+   */
+  JsonValue* Decode(const char* data, size_t size);
+
+ private:
+  JsonValue* DecodeValue(CborReader& reader, size_t depth);
+  JsonArray* DecodeArray(CborReader& reader, const CborItem& item,
+                         size_t depth);
+  JsonObject* DecodeObject(CborReader& reader, const CborItem& item,
+                           size_t depth);
+
+  // Disable copy constructor and assignment operator
+  CborDecoder(const CborDecoder&);
+  CborDecoder& operator=(const CborDecoder&);
+};
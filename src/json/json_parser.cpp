@@ -190,6 +190,12 @@ std::vector<std::string> JsonObject::GetKeys() const {
   return keys;
 }
 
+size_t JsonObject::GetSize() const { return m_values.size(); }
+
+JsonObject::ConstIterator JsonObject::Begin() const { return m_values.begin(); }
+
+JsonObject::ConstIterator JsonObject::End() const { return m_values.end(); }
+
 // JsonParser implementation
 JsonParser::JsonParser() : m_start(NULL), m_current(NULL), m_end(NULL) {}
 
@@ -436,7 +442,7 @@ std::string JsonParser::ParseStringLiteral() {
         default:
           ThrowError("Invalid escape sequence");
       }
-    } else if (c < 32) {
+    } else if (static_cast<unsigned char>(c) < 32) {
       ThrowError("Control character in string");
     } else {
       result += c;
@@ -161,6 +161,8 @@ class JsonArray : public JsonValue {
  */
 class JsonObject : public JsonValue {
  public:
+  typedef std::map<std::string, JsonValue*>::const_iterator ConstIterator;
+
   JsonObject();
   virtual ~JsonObject();
   virtual JsonValue* Clone() const;
@@ -193,6 +195,24 @@ class JsonObject : public JsonValue {
    */
   std::vector<std::string> GetKeys() const;
 
+  /**
+   * @brief Get the number of key-value pairs in the object
+   * @return Number of members in the object
+   */
+  size_t GetSize() const;
+
+  /**
+   * @brief Iterate members in key order without copying the keys
+   * @return Iterator to the first member (JsonObject retains ownership)
+   */
+  ConstIterator Begin() const;
+
+  /**
+   * @brief End iterator matching Begin()
+   * @return Past-the-end member iterator
+   */
+  ConstIterator End() const;
+
  private:
   std::map<std::string, JsonValue*> m_values;
 };
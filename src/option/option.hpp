@@ -4,6 +4,8 @@
 #include <new>
 #include <stdexcept>
 
+#include "type_traits/type_traits.hpp"
+
 namespace selfserv {
 
 /**
@@ -14,6 +16,87 @@ class BadOptionAccess : public std::runtime_error {
   explicit BadOptionAccess(const char* msg) : std::runtime_error(msg) {}
 };
 
+namespace detail {
+
+/**
+ * OptionStorage - owns the bytes and the engaged flag behind Option<T>.
+ *
+ * The general version manages T's lifetime by hand (Rule of Three). The
+ * trivially copyable specialization below declares no copy operations or
+ * destructor at all, so Option<int> is itself trivially copyable and the ABI
+ * can return it in registers like a plain value plus flag.
+ */
+template <typename T, bool Trivial = IsTriviallyCopyable<T>::kValue != 0>
+class OptionStorage {
+ public:
+  OptionStorage() : m_hasValue(false) {}
+
+  OptionStorage(const OptionStorage& other) : m_hasValue(false) {
+    if (other.m_hasValue) {
+      Construct(*other.Ptr());
+    }
+  }
+
+  OptionStorage& operator=(const OptionStorage& other) {
+    if (this != &other) {  // Self-assignment guard
+      Destroy();
+      if (other.m_hasValue) {
+        Construct(*other.Ptr());
+      }
+    }
+    return *this;
+  }
+
+  ~OptionStorage() { Destroy(); }
+
+  bool HasValue() const { return m_hasValue; }
+  T* Ptr() { return reinterpret_cast<T*>(m_bytes.data); }
+  const T* Ptr() const { return reinterpret_cast<const T*>(m_bytes.data); }
+
+  void Construct(const T& value) {
+    new (Ptr()) T(value);  // Placement new with copy constructor
+    m_hasValue = true;
+  }
+
+  // Marks the slot engaged after the caller placement-new'd into Ptr()
+  void SetEngaged() { m_hasValue = true; }
+
+  void Destroy() {
+    if (m_hasValue) {
+      m_hasValue = false;
+      Ptr()->~T();  // Explicit destructor call
+    }
+  }
+
+ private:
+  AlignedStorage<sizeof(T), AlignmentOf<T>::kValue> m_bytes;
+  bool m_hasValue;
+};
+
+template <typename T>
+class OptionStorage<T, true> {
+ public:
+  OptionStorage() : m_hasValue(false) {}
+
+  bool HasValue() const { return m_hasValue; }
+  T* Ptr() { return reinterpret_cast<T*>(m_bytes.data); }
+  const T* Ptr() const { return reinterpret_cast<const T*>(m_bytes.data); }
+
+  void Construct(const T& value) {
+    *Ptr() = value;
+    m_hasValue = true;
+  }
+
+  void SetEngaged() { m_hasValue = true; }
+  void Destroy() { m_hasValue = false; }
+
+ private:
+  AlignedStorage<sizeof(T), AlignmentOf<T>::kValue> m_bytes;
+  bool m_hasValue;
+};
+
+}  // namespace detail
+
 /**
  * Option<T> - A C++98 implementation of the Maybe monad.
  *
@@ -34,118 +117,108 @@ class BadOptionAccess : public std::runtime_error {
  *    Our approach only throws during T's constructor, which is more
  * predictable.
  *
+ * STORAGE:
+ * - The buffer is sized and aligned for T exactly (see detail::AlignmentOf),
+ *   so Option<int> is 8 bytes rather than the 24 a double aligner produced.
+ * - Trivially copyable payloads (detail::IsTriviallyCopyable) skip
+ *   placement new and destructor dispatch entirely; copies are bitwise.
+ * - Emplace() builds T in place from up to three constructor arguments,
+ *   avoiding the temporary that Some(T(...)) would copy from.
+ *
  * TRADE-OFFS:
  * - COMPLEXITY: Requires manual destructor calls and placement new expertise.
- * - SIZE: Option<T> is always sizeof(T) + alignment + bool, even when empty.
- * - ALIGNMENT: Must ensure proper alignment for any type T.
- *
- * For a mission-critical 2005 application, these trade-offs favor reliability
- * and performance over memory compactness.
+ * - SIZE: Option<T> is always sizeof(T) + bool + padding, even when empty.
  */
 template <typename T>
 class Option {
  private:
-  // Aligned storage for T - ensures proper alignment for any type
-  union Storage {
-    char dummy;  // Ensures Storage is at least 1 byte
-    // Use char array with proper alignment. In C++98, we approximate
-    // alignment requirements. For most types, double alignment suffices.
-    // For more precise alignment, we'd need compiler-specific attributes.
-    struct {
-      char data[sizeof(T)];
-      double aligner;  // Forces alignment suitable for most types
-    } aligned;
-  } m_storage;
-
-  bool m_hasValue;
+  detail::OptionStorage<T> m_storage;
 
   // Helper to get typed pointer to storage
-  T* GetPtr() { return reinterpret_cast<T*>(&m_storage.aligned.data[0]); }
-  const T* GetPtr() const {
-    return reinterpret_cast<const T*>(&m_storage.aligned.data[0]);
-  }
+  T* GetPtr() { return m_storage.Ptr(); }
+  const T* GetPtr() const { return m_storage.Ptr(); }
 
  public:
   /**
    * Default constructor - creates an empty Option (None state).
    */
-  Option() : m_hasValue(false) {
-    // No need to initialize storage for empty Option
-  }
+  Option() {}
 
   /**
    * Value constructor - creates an Option containing the given value (Some
    * state). Uses copy constructor of T.
    */
-  explicit Option(const T& value) : m_hasValue(true) {
-    new (GetPtr()) T(value);  // Placement new with copy constructor
-  }
+  explicit Option(const T& value) { m_storage.Construct(value); }
+
+  // Copy constructor, assignment and destructor come from OptionStorage,
+  // which is trivial whenever T is trivially copyable.
 
   /**
-   * Copy constructor - implements Rule of Three.
-   * Performs deep copy of the contained value if present.
+   * Static factory method for creating empty Option.
    */
-  Option(const Option& other) : m_hasValue(other.m_hasValue) {
-    if (m_hasValue) {
-      new (GetPtr()) T(*other.GetPtr());  // Copy construct T
-    }
-  }
+  static Option None() { return Option(); }
 
   /**
-   * Assignment operator - implements Rule of Three.
-   * Handles self-assignment and properly destroys/constructs values.
+   * Static factory method for creating Option with value.
    */
-  Option& operator=(const Option& other) {
-    if (this != &other) {  // Self-assignment guard
-      if (m_hasValue) {
-        GetPtr()->~T();  // Destroy current value
-        m_hasValue = false;
-      }
-
-      if (other.m_hasValue) {
-        new (GetPtr()) T(*other.GetPtr());  // Copy construct new value
-        m_hasValue = true;
-      }
-    }
-    return *this;
-  }
+  static Option Some(const T& value) { return Option(value); }
 
   /**
-   * Destructor - implements Rule of Three.
-   * Properly destroys contained value if present.
+   * Destroy any current value and construct a new one in place from the
+   * given arguments. Leaves the Option empty if T's constructor throws.
    */
-  ~Option() {
-    if (m_hasValue) {
-      GetPtr()->~T();  // Explicit destructor call
-    }
+  T& Emplace() {
+    m_storage.Destroy();
+    new (GetPtr()) T();
+    m_storage.SetEngaged();
+    return *GetPtr();
   }
 
-  /**
-   * Static factory method for creating empty Option.
-   */
-  static Option None() { return Option(); }
+  template <typename A1>
+  T& Emplace(const A1& a1) {
+    m_storage.Destroy();
+    new (GetPtr()) T(a1);
+    m_storage.SetEngaged();
+    return *GetPtr();
+  }
+
+  template <typename A1, typename A2>
+  T& Emplace(const A1& a1, const A2& a2) {
+    m_storage.Destroy();
+    new (GetPtr()) T(a1, a2);
+    m_storage.SetEngaged();
+    return *GetPtr();
+  }
+
+  template <typename A1, typename A2, typename A3>
+  T& Emplace(const A1& a1, const A2& a2, const A3& a3) {
+    m_storage.Destroy();
+    new (GetPtr()) T(a1, a2, a3);
+    m_storage.SetEngaged();
+    return *GetPtr();
+  }
 
   /**
-   * Static factory method for creating Option with value.
+   * Destroy the contained value, if any, leaving the Option empty.
    */
-  static Option Some(const T& value) { return Option(value); }
+  void Reset() { m_storage.Destroy(); }
 
   /**
    * Check if Option contains a value.
    */
-  bool IsSome() const { return m_hasValue; }
+  bool IsSome() const { return m_storage.HasValue(); }
 
   /**
    * Check if Option is empty.
    */
-  bool IsNone() const { return !m_hasValue; }
+  bool IsNone() const { return !m_storage.HasValue(); }
 
   /**
    * Extract the contained value.
    * @throws BadOptionAccess if Option is empty
    */
   T& Unwrap() {
-    if (!m_hasValue) {
+    if (!m_storage.HasValue()) {
       throw BadOptionAccess("Called unwrap() on empty Option");
     }
     return *GetPtr();
@@ -156,7 +229,7 @@ class Option {
    * @throws BadOptionAccess if Option is empty
    */
   const T& Unwrap() const {
-    if (!m_hasValue) {
+    if (!m_storage.HasValue()) {
       throw BadOptionAccess("Called unwrap() on empty Option");
     }
     return *GetPtr();
@@ -166,18 +239,18 @@ class Option {
    * Get pointer to contained value, or NULL if empty.
    * Safer alternative to unwrap() when you want to check for presence.
    */
-  T* Get() { return m_hasValue ? GetPtr() : NULL; }
+  T* Get() { return m_storage.HasValue() ? GetPtr() : NULL; }
 
   /**
    * Get pointer to contained value, or NULL if empty (const version).
    */
-  const T* Get() const { return m_hasValue ? GetPtr() : NULL; }
+  const T* Get() const { return m_storage.HasValue() ? GetPtr() : NULL; }
 
   /**
    * Extract value or return default if empty.
    */
   T UnwrapOr(const T& defaultValue) const {
-    return m_hasValue ? *GetPtr() : defaultValue;
+    return m_storage.HasValue() ? *GetPtr() : defaultValue;
   }
 };
 
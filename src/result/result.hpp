@@ -4,6 +4,8 @@
 #include <new>
 #include <stdexcept>
 
+#include "type_traits/type_traits.hpp"
+
 namespace selfserv {
 
 /**
@@ -15,6 +17,116 @@ class BadResultAccess : public std::runtime_error {
   explicit BadResultAccess(const char* msg) : std::runtime_error(msg) {}
 };
 
+namespace detail {
+
+/**
+ * ResultStorage - owns the shared buffer and discriminator behind Result.
+ *
+ * The state byte is kStateEmpty only after an Emplace*() whose constructor
+ * threw; every other path keeps exactly one of T or E alive. When both T and
+ * E are trivially copyable the specialization below leaves copy operations
+ * and the destructor implicit, so the whole Result is trivially copyable.
+ */
+enum ResultState { kStateEmpty, kStateOk, kStateErr };
+
+template <typename T, typename E,
+          bool Trivial = IsTriviallyCopyable<T>::kValue != 0 &&
+                         IsTriviallyCopyable<E>::kValue != 0>
+class ResultStorage {
+ public:
+  ResultStorage() : m_state(kStateEmpty) {}
+
+  ResultStorage(const ResultStorage& other) : m_state(kStateEmpty) {
+    CopyFrom(other);
+  }
+
+  ResultStorage& operator=(const ResultStorage& other) {
+    if (this != &other) {  // Self-assignment guard
+      Destroy();
+      CopyFrom(other);
+    }
+    return *this;
+  }
+
+  ~ResultStorage() { Destroy(); }
+
+  ResultState State() const { return static_cast<ResultState>(m_state); }
+  void SetState(ResultState state) { m_state = static_cast<char>(state); }
+
+  T* OkPtr() { return reinterpret_cast<T*>(m_bytes.data); }
+  const T* OkPtr() const { return reinterpret_cast<const T*>(m_bytes.data); }
+  E* ErrPtr() { return reinterpret_cast<E*>(m_bytes.data); }
+  const E* ErrPtr() const { return reinterpret_cast<const E*>(m_bytes.data); }
+
+  void ConstructOk(const T& value) {
+    new (OkPtr()) T(value);
+    m_state = kStateOk;
+  }
+
+  void ConstructErr(const E& error) {
+    new (ErrPtr()) E(error);
+    m_state = kStateErr;
+  }
+
+  void Destroy() {
+    char state = m_state;
+    m_state = kStateEmpty;
+    if (state == kStateOk) {
+      OkPtr()->~T();
+    } else if (state == kStateErr) {
+      ErrPtr()->~E();
+    }
+  }
+
+ private:
+  void CopyFrom(const ResultStorage& other) {
+    if (other.m_state == kStateOk) {
+      ConstructOk(*other.OkPtr());
+    } else if (other.m_state == kStateErr) {
+      ConstructErr(*other.ErrPtr());
+    }
+  }
+
+  AlignedStorage<Max<sizeof(T), sizeof(E)>::kValue,
+                 Max<AlignmentOf<T>::kValue, AlignmentOf<E>::kValue>::kValue>
+      m_bytes;
+  char m_state;
+};
+
+template <typename T, typename E>
+class ResultStorage<T, E, true> {
+ public:
+  ResultStorage() : m_state(kStateEmpty) {}
+
+  ResultState State() const { return static_cast<ResultState>(m_state); }
+  void SetState(ResultState state) { m_state = static_cast<char>(state); }
+
+  T* OkPtr() { return reinterpret_cast<T*>(m_bytes.data); }
+  const T* OkPtr() const { return reinterpret_cast<const T*>(m_bytes.data); }
+  E* ErrPtr() { return reinterpret_cast<E*>(m_bytes.data); }
+  const E* ErrPtr() const { return reinterpret_cast<const E*>(m_bytes.data); }
+
+  void ConstructOk(const T& value) {
+    *OkPtr() = value;
+    m_state = kStateOk;
+  }
+
+  void ConstructErr(const E& error) {
+    *ErrPtr() = error;
+    m_state = kStateErr;
+  }
+
+  void Destroy() { m_state = kStateEmpty; }
+
+ private:
+  AlignedStorage<Max<sizeof(T), sizeof(E)>::kValue,
+                 Max<AlignmentOf<T>::kValue, AlignmentOf<E>::kValue>::kValue>
+      m_bytes;
+  char m_state;
+};
+
+}  // namespace detail
+
 /**
  * Result<T, E> - A C++98 implementation of the Either monad.
  *
@@ -26,133 +138,142 @@ class BadResultAccess : public std::runtime_error {
  *
  * APPROACH:
  * 1. Union storage sized for max(sizeof(T), sizeof(E))
- * 2. Boolean discriminator to track which type is active
- * 3. Placement new/explicit destructor for active type management
+ * 2. One-byte discriminator to track which type is active
+ * 3. Placement new/explicit destructor for active type management, skipped
+ *    entirely when both T and E are trivially copyable
  *
  * ALIGNMENT CONSIDERATIONS:
- * The union must be aligned for both T and E. We use a double aligner
- * as a reasonable approximation for C++98 (no alignof/alignas).
+ * The buffer takes the stricter of T's and E's alignment as computed by
+ * detail::AlignmentOf, instead of a blanket double aligner. Result<int, int>
+ * is therefore 8 bytes and, being trivially copyable, is returned in a
+ * register just like an int plus a flag.
  *
  * MEMORY LAYOUT:
- * | Union Storage (max(T,E) + alignment) | bool isOk | padding |
+ * | Storage (max(T,E), aligned for both) | char state | padding |
  *
  * This ensures type safety while maintaining C++98 compatibility.
  */
 template <typename T, typename E>
 class Result {
  private:
-  // Discriminated union for either T or E
-  union Storage {
-    char dummy;  // Ensures union is at least 1 byte
-    struct {
-      char tData[sizeof(T)];
-      double tAligner;
-    } tStorage;
-    struct {
-      char eData[sizeof(E)];
-      double eAligner;
-    } eStorage;
-  } m_storage;
-
-  bool m_isOk;  // true = contains T, false = contains E
+  detail::ResultStorage<T, E> m_storage;
 
   // Helper methods for type-safe access
-  T* GetTPtr() { return reinterpret_cast<T*>(&m_storage.tStorage.tData[0]); }
-  const T* GetTPtr() const {
-    return reinterpret_cast<const T*>(&m_storage.tStorage.tData[0]);
-  }
+  T* GetTPtr() { return m_storage.OkPtr(); }
+  const T* GetTPtr() const { return m_storage.OkPtr(); }
 
-  E* GetEPtr() { return reinterpret_cast<E*>(&m_storage.eStorage.eData[0]); }
-  const E* GetEPtr() const {
-    return reinterpret_cast<const E*>(&m_storage.eStorage.eData[0]);
-  }
+  E* GetEPtr() { return m_storage.ErrPtr(); }
+  const E* GetEPtr() const { return m_storage.ErrPtr(); }
 
  public:
   /**
    * Constructor for Ok state - contains a success value of type T.
    */
-  explicit Result(const T& value) : m_isOk(true) { new (GetTPtr()) T(value); }
+  explicit Result(const T& value) { m_storage.ConstructOk(value); }
+
+  // Copy constructor, assignment and destructor come from ResultStorage,
+  // which is trivial whenever T and E are trivially copyable.
 
   /**
-   * Copy constructor - implements Rule of Three.
-   * Copies whichever variant is active in the source Result.
+   * Static factory method for creating Ok result.
    */
-  Result(const Result& other) : m_isOk(other.m_isOk) {
-    if (m_isOk) {
-      new (GetTPtr()) T(*other.GetTPtr());
-    } else {
-      new (GetEPtr()) E(*other.GetEPtr());
-    }
-  }
+  static Result Ok(const T& value) { return Result(value); }
 
   /**
-   * Assignment operator - implements Rule of Three.
-   * Handles destruction of current state and construction of new state.
+   * Static factory method for creating Err result.
    */
-  Result& operator=(const Result& other) {
-    if (this != &other) {  // Self-assignment guard
-      // Destroy current active object
-      if (m_isOk) {
-        GetTPtr()->~T();
-      } else {
-        GetEPtr()->~E();
-      }
-
-      // Copy construct new active object
-      m_isOk = other.m_isOk;
-      if (m_isOk) {
-        new (GetTPtr()) T(*other.GetTPtr());
-      } else {
-        new (GetEPtr()) E(*other.GetEPtr());
-      }
-    }
-    return *this;
+  static Result Err(const E& error) {
+    Result result;
+    result.m_storage.ConstructErr(error);
+    return result;
   }
 
   /**
-   * Destructor - implements Rule of Three.
-   * Destroys whichever variant is currently active.
+   * Replace the current contents with a T constructed in place from the
+   * given arguments.
    */
-  ~Result() {
-    if (m_isOk) {
-      GetTPtr()->~T();
-    } else {
-      GetEPtr()->~E();
-    }
+  T& EmplaceOk() {
+    m_storage.Destroy();
+    new (GetTPtr()) T();
+    m_storage.SetState(detail::kStateOk);
+    return *GetTPtr();
   }
 
-  /**
-   * Static factory method for creating Ok result.
-   */
-  static Result Ok(const T& value) { return Result(value); }
+  template <typename A1>
+  T& EmplaceOk(const A1& a1) {
+    m_storage.Destroy();
+    new (GetTPtr()) T(a1);
+    m_storage.SetState(detail::kStateOk);
+    return *GetTPtr();
+  }
+
+  template <typename A1, typename A2>
+  T& EmplaceOk(const A1& a1, const A2& a2) {
+    m_storage.Destroy();
+    new (GetTPtr()) T(a1, a2);
+    m_storage.SetState(detail::kStateOk);
+    return *GetTPtr();
+  }
+
+  template <typename A1, typename A2, typename A3>
+  T& EmplaceOk(const A1& a1, const A2& a2, const A3& a3) {
+    m_storage.Destroy();
+    new (GetTPtr()) T(a1, a2, a3);
+    m_storage.SetState(detail::kStateOk);
+    return *GetTPtr();
+  }
 
   /**
-   * Static factory method for creating Err result.
-   * We need a separate private constructor for this.
+   * Replace the current contents with an E constructed in place from the
+   * given arguments.
    */
-  static Result Err(const E& error) {
-    Result result;
-    result.m_isOk = false;
-    new (result.GetEPtr()) E(error);
-    return result;
+  E& EmplaceErr() {
+    m_storage.Destroy();
+    new (GetEPtr()) E();
+    m_storage.SetState(detail::kStateErr);
+    return *GetEPtr();
+  }
+
+  template <typename A1>
+  E& EmplaceErr(const A1& a1) {
+    m_storage.Destroy();
+    new (GetEPtr()) E(a1);
+    m_storage.SetState(detail::kStateErr);
+    return *GetEPtr();
+  }
+
+  template <typename A1, typename A2>
+  E& EmplaceErr(const A1& a1, const A2& a2) {
+    m_storage.Destroy();
+    new (GetEPtr()) E(a1, a2);
+    m_storage.SetState(detail::kStateErr);
+    return *GetEPtr();
+  }
+
+  template <typename A1, typename A2, typename A3>
+  E& EmplaceErr(const A1& a1, const A2& a2, const A3& a3) {
+    m_storage.Destroy();
+    new (GetEPtr()) E(a1, a2, a3);
+    m_storage.SetState(detail::kStateErr);
+    return *GetEPtr();
   }
 
   /**
    * Check if Result contains a success value.
    */
-  bool IsOk() const { return m_isOk; }
+  bool IsOk() const { return m_storage.State() == detail::kStateOk; }
 
   /**
    * Check if Result contains an error value.
    */
-  bool IsErr() const { return !m_isOk; }
+  bool IsErr() const { return m_storage.State() == detail::kStateErr; }
 
   /**
    * Extract the success value.
    * @throws BadResultAccess if Result contains an error
    */
   T& Unwrap() {
-    if (!m_isOk) {
+    if (!IsOk()) {
       throw BadResultAccess("Called unwrap() on Err Result");
     }
     return *GetTPtr();
@@ -163,7 +284,7 @@ class Result {
    * @throws BadResultAccess if Result contains an error
    */
   const T& Unwrap() const {
-    if (!m_isOk) {
+    if (!IsOk()) {
       throw BadResultAccess("Called unwrap() on Err Result");
     }
     return *GetTPtr();
@@ -174,7 +295,7 @@ class Result {
    * @throws BadResultAccess if Result contains a success value
    */
   E& UnwrapErr() {
-    if (m_isOk) {
+    if (!IsErr()) {
       throw BadResultAccess("Called unwrapErr() on Ok Result");
     }
     return *GetEPtr();
@@ -185,7 +306,7 @@ class Result {
    * @throws BadResultAccess if Result contains a success value
    */
   const E& UnwrapErr() const {
-    if (m_isOk) {
+    if (!IsErr()) {
       throw BadResultAccess("Called unwrapErr() on Ok Result");
     }
     return *GetEPtr();
@@ -194,35 +315,35 @@ class Result {
   /**
    * Get pointer to success value, or NULL if error.
    */
-  T* Get() { return m_isOk ? GetTPtr() : NULL; }
+  T* Get() { return IsOk() ? GetTPtr() : NULL; }
 
   /**
    * Get pointer to success value, or NULL if error (const version).
    */
-  const T* Get() const { return m_isOk ? GetTPtr() : NULL; }
+  const T* Get() const { return IsOk() ? GetTPtr() : NULL; }
 
   /**
    * Get pointer to error value, or NULL if success.
    */
-  E* GetErr() { return m_isOk ? NULL : GetEPtr(); }
+  E* GetErr() { return IsErr() ? GetEPtr() : NULL; }
 
   /**
    * Get pointer to error value, or NULL if success (const version).
    */
-  const E* GetErr() const { return m_isOk ? NULL : GetEPtr(); }
+  const E* GetErr() const { return IsErr() ? GetEPtr() : NULL; }
 
   /**
    * Extract success value or return default if error.
    */
   T UnwrapOr(const T& defaultValue) const {
-    return m_isOk ? *GetTPtr() : defaultValue;
+    return IsOk() ? *GetTPtr() : defaultValue;
   }
 
  private:
   /**
    * Private default constructor for internal use by Err factory.
    */
-  Result() : m_isOk(true) {
+  Result() {
     // Don't construct anything yet - factory methods will handle it
   }
 };
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+
+namespace selfserv {
+
+/**
+ * Compile-time helpers shared by Option<T> and Result<T, E>.
+ *
+ * C++98 has neither alignof/alignas nor <type_traits>, so the pieces those
+ * templates need are spelled out here with the classic struct-offset and
+ * specialization tricks.
+ */
+namespace detail {
+
+/**
+ * AlignmentOf<T>::kValue - required alignment of T in bytes.
+ *
+ * Placing T after a single char forces the compiler to insert exactly
+ * alignof(T) - 1 bytes of padding, which the size difference exposes.
+ */
+template <typename T>
+struct AlignmentOf {
+ private:
+  struct Probe {
+    char head;
+    T value;
+  };
+
+ public:
+  enum { kValue = sizeof(Probe) - sizeof(T) };
+};
+
+/**
+ * Max<A, B>::kValue - the larger of two compile-time sizes.
+ */
+template <std::size_t A, std::size_t B>
+struct Max {
+  enum { kValue = A > B ? A : B };
+};
+
+/**
+ * AlignedScalar<N>::Type - a fundamental type whose alignment is N.
+ *
+ * Falls back to long double, the most strictly aligned fundamental type
+ * available without extensions.
+ */
+template <std::size_t Align>
+struct AlignedScalar {
+  typedef long double Type;
+};
+
+template <>
+struct AlignedScalar<1> {
+  typedef char Type;
+};
+
+template <>
+struct AlignedScalar<2> {
+  typedef short Type;
+};
+
+template <>
+struct AlignedScalar<4> {
+  typedef int Type;
+};
+
+template <>
+struct AlignedScalar<8> {
+  typedef double Type;
+};
+
+/**
+ * AlignedStorage<Size, Align> - raw bytes of exactly the requested size and
+ * alignment, without the over-alignment a blanket double member imposes.
+ */
+template <std::size_t Size, std::size_t Align>
+union AlignedStorage {
+  char data[Size];
+  typename AlignedScalar<Align>::Type aligner;
+};
+
+/**
+ * IsTriviallyCopyable<T>::kValue - nonzero when T can be copied bit-for-bit
+ * and needs no destructor call.
+ *
+ * Covers fundamental types and pointers. POD structs can opt in by
+ * specializing this template next to their definition.
+ */
+template <typename T>
+struct IsTriviallyCopyable {
+  enum { kValue = 0 };
+};
+
+template <typename T>
+struct IsTriviallyCopyable<T*> {
+  enum { kValue = 1 };
+};
+
+#define SELFSERV_TRIVIALLY_COPYABLE(Type) \
+  template <>                             \
+  struct IsTriviallyCopyable<Type> {      \
+    enum { kValue = 1 };                  \
+  }
+
+SELFSERV_TRIVIALLY_COPYABLE(bool);
+SELFSERV_TRIVIALLY_COPYABLE(char);
+SELFSERV_TRIVIALLY_COPYABLE(signed char);
+SELFSERV_TRIVIALLY_COPYABLE(unsigned char);
+SELFSERV_TRIVIALLY_COPYABLE(wchar_t);
+SELFSERV_TRIVIALLY_COPYABLE(short);
+SELFSERV_TRIVIALLY_COPYABLE(unsigned short);
+SELFSERV_TRIVIALLY_COPYABLE(int);
+SELFSERV_TRIVIALLY_COPYABLE(unsigned int);
+SELFSERV_TRIVIALLY_COPYABLE(long);
+SELFSERV_TRIVIALLY_COPYABLE(unsigned long);
+SELFSERV_TRIVIALLY_COPYABLE(float);
+SELFSERV_TRIVIALLY_COPYABLE(double);
+SELFSERV_TRIVIALLY_COPYABLE(long double);
+
+#undef SELFSERV_TRIVIALLY_COPYABLE
+
+}  // namespace detail
+
+}  // namespace selfserv